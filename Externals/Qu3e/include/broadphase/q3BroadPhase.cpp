@@ -27,29 +27,115 @@
 #include "q3BroadPhase.h"
 #include "../collision/q3Box.h"
 #include "../common/q3Geometry.h"
+#include "../dynamics/q3Contact.h"
 #include "../dynamics/q3ContactManager.h"
 
 //--------------------------------------------------------------------------------------------------
 // q3BroadPhase
+//--------------------------------------------------------------------------------------------------
+// Grows buffer to hold at least count keys, the contents are dropped
+inline void q3ReserveKeys( u64** buffer, i32* capacity, i32 count )
+{
+	if ( count <= *capacity )
+		return;
+
+	q3Free( *buffer );
+	*capacity = q3Max( count, *capacity * 2 );
+	*buffer = (u64*)q3Alloc( *capacity * sizeof( u64 ) );
+}
+
+//--------------------------------------------------------------------------------------------------
+// LSD radix sort over the 8 bytes of the keys. Bytes that are the same in
+// every key are skipped, with proxy ids below 65536 only 4 passes remain.
+// temp needs room for count keys.
+static void q3RadixSort( u64* keys, u64* temp, i32 count )
+{
+	if ( count < 2 )
+		return;
+
+	i32 histograms[ 8 ][ 256 ];
+	memset( histograms, 0, sizeof( histograms ) );
+
+	for ( i32 i = 0; i < count; ++i )
+	{
+		u64 key = keys[ i ];
+
+		for ( i32 digit = 0; digit < 8; ++digit )
+			++histograms[ digit ][ (key >> (digit * 8)) & 0xFF ];
+	}
+
+	u64* src = keys;
+	u64* dst = temp;
+
+	for ( i32 digit = 0; digit < 8; ++digit )
+	{
+		i32* histogram = histograms[ digit ];
+		i32 shift = digit * 8;
+
+		if ( histogram[ (src[ 0 ] >> shift) & 0xFF ] == count )
+			continue;
+
+		i32 offset = 0;
+		for ( i32 i = 0; i < 256; ++i )
+		{
+			i32 bucketCount = histogram[ i ];
+			histogram[ i ] = offset;
+			offset += bucketCount;
+		}
+
+		for ( i32 i = 0; i < count; ++i )
+		{
+			u64 key = src[ i ];
+			dst[ histogram[ (key >> shift) & 0xFF ]++ ] = key;
+		}
+
+		u64* swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if ( src != keys )
+		memcpy( keys, src, count * sizeof( u64 ) );
+}
+
 //--------------------------------------------------------------------------------------------------
 q3BroadPhase::q3BroadPhase( q3ContactManager *manager )
 {
 	m_manager = manager;
 
-	m_pairCount = 0;
+	for ( i32 i = 0; i < q3k_maxThreads; ++i )
+	{
+		q3PairQuery* query = m_queries + i;
+		query->pairCount = 0;
+		query->pairCapacity = 64;
+		query->pairs = (u64*)q3Alloc( query->pairCapacity * sizeof( u64 ) );
+		query->currentIndex = -1;
+	}
+
 	m_pairCapacity = 64;
-	m_pairBuffer = (q3ContactPair*)q3Alloc( m_pairCapacity * sizeof( q3ContactPair ) );
+	m_pairBuffer = (u64*)q3Alloc( m_pairCapacity * sizeof( u64 ) );
+	m_contactCapacity = 64;
+	m_contactBuffer = (u64*)q3Alloc( m_contactCapacity * sizeof( u64 ) );
+	m_sortCapacity = 64;
+	m_sortBuffer = (u64*)q3Alloc( m_sortCapacity * sizeof( u64 ) );
 
 	m_moveCount = 0;
 	m_moveCapacity = 64;
 	m_moveBuffer = (i32*)q3Alloc( m_moveCapacity * sizeof( i32 ) );
+
+	memset( &m_stats, 0, sizeof( m_stats ) );
 }
 
 //--------------------------------------------------------------------------------------------------
 q3BroadPhase::~q3BroadPhase( )
 {
 	q3Free( m_moveBuffer );
+	q3Free( m_sortBuffer );
+	q3Free( m_contactBuffer );
 	q3Free( m_pairBuffer );
+
+	for ( i32 i = 0; i < q3k_maxThreads; ++i )
+		q3Free( m_queries[ i ].pairs );
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -67,65 +153,98 @@ void q3BroadPhase::RemoveBox( const q3Box *box )
 }
 
 //--------------------------------------------------------------------------------------------------
-inline bool ContactPairSort( const q3ContactPair& lhs, const q3ContactPair& rhs )
+void q3BroadPhase::QueryJob( void* param, i32 index, i32 worker )
 {
-	if ( lhs.A < rhs.A )
-		return true;
+	q3BroadPhase* broadPhase = (q3BroadPhase*)param;
+	q3PairQuery* query = broadPhase->m_queries + worker;
 
-	if ( lhs.A == rhs.A )
-		return lhs.B < rhs.B;
+	query->currentIndex = broadPhase->m_moveBuffer[ index ];
+	q3AABB aabb = broadPhase->m_tree.GetFatAABB( query->currentIndex );
 
-	return false;
+	// @TODO: Use a static and non-static tree and query one against the other.
+	//        This will potentially prevent (gotta think about this more) time
+	//        wasted with queries of static bodies against static bodies, and
+	//        kinematic to kinematic.
+	broadPhase->m_tree.Query( query, aabb );
 }
 
 //--------------------------------------------------------------------------------------------------
 void q3BroadPhase::UpdatePairs( )
 {
-	m_pairCount = 0;
+	q3ThreadPool* threadPool = m_manager->m_threadPool;
+	i32 threadCount = threadPool->GetThreadCount( );
 
-	// Query the tree with all moving boxs
-	for ( i32 i = 0; i < m_moveCount; ++i)
-	{
-		m_currentIndex = m_moveBuffer[ i ];
-		q3AABB aabb = m_tree.GetFatAABB( m_currentIndex );
-
-		// @TODO: Use a static and non-static tree and query one against the other.
-		//        This will potentially prevent (gotta think about this more) time
-		//        wasted with queries of static bodies against static bodies, and
-		//        kinematic to kinematic.
-		m_tree.Query( this, aabb );
-	}
+	for ( i32 i = 0; i < threadCount; ++i )
+		m_queries[ i ].pairCount = 0;
+
+	// Query the tree with all moving boxes, the tree is only read
+	threadPool->ParallelFor( m_moveCount, 64, QueryJob, this );
+	m_stats.moveCount = m_moveCount;
 
 	// Reset the move buffer
 	m_moveCount = 0;
 
-	// Sort pairs to expose duplicates
-	std::sort( m_pairBuffer, m_pairBuffer + m_pairCount, ContactPairSort );
+	// Merge the per-thread pairs
+	i32 pairCount = 0;
+	for ( i32 i = 0; i < threadCount; ++i )
+		pairCount += m_queries[ i ].pairCount;
+
+	q3ReserveKeys( &m_pairBuffer, &m_pairCapacity, pairCount );
+	q3ReserveKeys( &m_sortBuffer, &m_sortCapacity, pairCount );
 
-	// Queue manifolds for solving
+	pairCount = 0;
+	for ( i32 i = 0; i < threadCount; ++i )
 	{
-		i32 i = 0;
-		while ( i < m_pairCount )
-		{
-			// Add contact to manager
-			q3ContactPair* pair = m_pairBuffer + i;
-			q3Box *A = (q3Box*)m_tree.GetUserData( pair->A );
-			q3Box *B = (q3Box*)m_tree.GetUserData( pair->B );
-			m_manager->AddContact( A, B );
+		q3PairQuery* query = m_queries + i;
+		memcpy( m_pairBuffer + pairCount, query->pairs, query->pairCount * sizeof( u64 ) );
+		pairCount += query->pairCount;
+	}
+
+	m_stats.queryPairCount = pairCount;
+
+	// Sort pairs to expose duplicates. Keys are whole pairs, so the result
+	// does not depend on which thread found which pair.
+	q3RadixSort( m_pairBuffer, m_sortBuffer, pairCount );
 
-			++i;
+	i32 uniqueCount = 0;
+	for ( i32 i = 0; i < pairCount; ++i )
+	{
+		if ( uniqueCount == 0 || m_pairBuffer[ i ] != m_pairBuffer[ uniqueCount - 1 ] )
+			m_pairBuffer[ uniqueCount++ ] = m_pairBuffer[ i ];
+	}
 
-			// Skip duplicate pairs by iterating i until we find a unique pair
-			while ( i < m_pairCount )
-			{
-				q3ContactPair* potentialDup = m_pairBuffer + i;
+	m_stats.pairCount = uniqueCount;
 
-				if ( pair->A != potentialDup->A || pair->B != potentialDup->B )
-					break;
+	// Keys of the current contacts
+	i32 contactCount = m_manager->m_contactCount;
+	q3ReserveKeys( &m_contactBuffer, &m_contactCapacity, contactCount );
+	q3ReserveKeys( &m_sortBuffer, &m_sortCapacity, contactCount );
 
-				++i;
-			}
-		}
+	i32 contactIndex = 0;
+	for ( q3ContactConstraint* c = m_manager->m_contactList; c; c = c->next )
+		m_contactBuffer[ contactIndex++ ] = q3PairKey( c->A->broadPhaseIndex, c->B->broadPhaseIndex );
+
+	assert( contactIndex == contactCount );
+	q3RadixSort( m_contactBuffer, m_sortBuffer, contactCount );
+
+	// Queue manifolds for solving, only for pairs without a contact
+	m_stats.newPairCount = 0;
+	contactIndex = 0;
+	for ( i32 i = 0; i < uniqueCount; ++i )
+	{
+		u64 key = m_pairBuffer[ i ];
+
+		while ( contactIndex < contactCount && m_contactBuffer[ contactIndex ] < key )
+			++contactIndex;
+
+		if ( contactIndex < contactCount && m_contactBuffer[ contactIndex ] == key )
+			continue;
+
+		// Add contact to manager
+		q3Box *A = (q3Box*)m_tree.GetUserData( i32( key >> 32 ) );
+		q3Box *B = (q3Box*)m_tree.GetUserData( i32( key & 0xFFFFFFFF ) );
+		m_manager->AddContact( A, B );
+		++m_stats.newPairCount;
 	}
 
 	m_tree.Validate( );
@@ -144,6 +263,12 @@ bool q3BroadPhase::TestOverlap( i32 A, i32 B ) const
 	return q3AABBtoAABB( m_tree.GetFatAABB( A ), m_tree.GetFatAABB( B ) );
 }
 
+//--------------------------------------------------------------------------------------------------
+const q3BroadPhaseStats& q3BroadPhase::GetStats( ) const
+{
+	return m_stats;
+}
+
 //--------------------------------------------------------------------------------------------------
 void q3BroadPhase::BufferMove( i32 id )
 {
@@ -30,6 +30,7 @@
 #include "../common/q3Types.h"
 #include "q3DynamicAABBTree.h"
 #include "../common/q3Memory.h"
+#include "../common/q3ThreadPool.h"
 
 //--------------------------------------------------------------------------------------------------
 // q3BroadPhase
@@ -39,10 +40,32 @@ struct q3Box;
 struct q3Transform;
 struct q3AABB;
 
-struct q3ContactPair
+// A pair of proxies packed as lower id << 32 | higher id, so sorting the keys
+// orders pairs by A and then by B
+inline u64 q3PairKey( i32 A, i32 B )
 {
-	i32 A;
-	i32 B;
+	return (u64( u32( q3Min( A, B ) ) ) << 32) | u64( u32( q3Max( A, B ) ) );
+}
+
+// Tree queries of one thread, collects the overlaps of the moved proxies it
+// was handed
+struct q3PairQuery
+{
+	u64* pairs;
+	i32 pairCount;
+	i32 pairCapacity;
+	i32 currentIndex;
+
+	bool TreeCallBack( i32 index );
+};
+
+// Counters of the last UpdatePairs( )
+struct q3BroadPhaseStats
+{
+	i32 moveCount;			// Proxies queried, moved or inserted since the last update
+	i32 queryPairCount;		// Overlaps reported by the queries, duplicates included
+	i32 pairCount;			// Unique overlapping pairs
+	i32 newPairCount;		// Pairs without a contact, handed to the contact manager
 };
 
 class q3BroadPhase
@@ -54,56 +77,63 @@ public:
 	void InsertBox( q3Box *shape, const q3AABB& aabb );
 	void RemoveBox( const q3Box *shape );
 
-	// Generates the contact list. All previous contacts are returned to the allocator
-	// before generation occurs.
+	// Queries the moved proxies on the contact manager's threads, then sorts
+	// and deduplicates the pairs and hands the ones without a contact to the
+	// contact manager, in pair order. Contacts whose proxies stopped
+	// overlapping are removed by q3ContactManager::TestCollisions.
 	void UpdatePairs( void );
 
 	void Update( i32 id, const q3AABB& aabb );
 
 	bool TestOverlap( i32 A, i32 B ) const;
 
+	const q3BroadPhaseStats& GetStats( ) const;
+
 private:
 	q3ContactManager *m_manager;
 
-	q3ContactPair* m_pairBuffer;
-	i32 m_pairCount;
+	q3PairQuery m_queries[ q3k_maxThreads ];
+
+	// Merged pairs, keys of the current contacts and scratch for sorting
+	u64* m_pairBuffer;
 	i32 m_pairCapacity;
+	u64* m_contactBuffer;
+	i32 m_contactCapacity;
+	u64* m_sortBuffer;
+	i32 m_sortCapacity;
 
 	i32* m_moveBuffer;
 	i32 m_moveCount;
 	i32 m_moveCapacity;
 
 	q3DynamicAABBTree m_tree;
-	i32 m_currentIndex;
+
+	q3BroadPhaseStats m_stats;
 
 	void BufferMove( i32 id );
-	bool TreeCallBack( i32 index );
 
-	friend class q3DynamicAABBTree;
+	// Job over the move buffer, param is the broadphase
+	static void QueryJob( void* param, i32 index, i32 worker );
+
 	friend class q3Scene;
 };
 
-inline bool q3BroadPhase::TreeCallBack( i32 index )
+inline bool q3PairQuery::TreeCallBack( i32 index )
 {
 	// Cannot collide with self
-	if ( index == m_currentIndex )
+	if ( index == currentIndex )
 		return true;
 
-	if ( m_pairCount == m_pairCapacity )
+	if ( pairCount == pairCapacity )
 	{
-		q3ContactPair* oldBuffer = m_pairBuffer;
-		m_pairCapacity *= 2;
-		m_pairBuffer = (q3ContactPair*)q3Alloc( m_pairCapacity * sizeof( q3ContactPair ) );
-		memcpy( m_pairBuffer, oldBuffer, m_pairCount * sizeof( q3ContactPair ) );
+		u64* oldBuffer = pairs;
+		pairCapacity *= 2;
+		pairs = (u64*)q3Alloc( pairCapacity * sizeof( u64 ) );
+		memcpy( pairs, oldBuffer, pairCount * sizeof( u64 ) );
 		q3Free( oldBuffer );
 	}
 
-	i32 iA = q3Min( index, m_currentIndex );
-	i32 iB = q3Max( index, m_currentIndex );
-
-	m_pairBuffer[ m_pairCount ].A = iA;
-	m_pairBuffer[ m_pairCount ].B = iB;
-	++m_pairCount;
+	pairs[ pairCount++ ] = q3PairKey( index, currentIndex );
 
 	return true;
 }
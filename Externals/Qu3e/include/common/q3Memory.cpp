@@ -30,14 +30,30 @@
 #include "q3Memory.h"
 #include "../math/q3Math.h"
 
+//--------------------------------------------------------------------------------------------------
+// q3AllocatorStats
+//--------------------------------------------------------------------------------------------------
+r32 q3AllocatorStats::Fragmentation( ) const
+{
+	if ( reservedBytes == 0 )
+		return r32( 0.0 );
+
+	return r32( 1.0 ) - r32( liveBytes ) / r32( reservedBytes );
+}
+
 //--------------------------------------------------------------------------------------------------
 // q3Stack
 //--------------------------------------------------------------------------------------------------
 q3Stack::q3Stack( )
-	: m_entries( (q3StackEntry*)q3Alloc( sizeof( q3StackEntry ) * 64 ) )
+	: m_memory( (u8*)q3Alloc( q3k_stackInitialSize ) )
+	, m_capacity( q3k_stackInitialSize )
+	, m_entries( (q3StackEntry*)q3Alloc( sizeof( q3StackEntry ) * 64 ) )
 	, m_index( 0 )
 	, m_allocation( 0 )
+	, m_peakAllocation( 0 )
+	, m_allocBytes( 0 )
 	, m_entryCount( 0 )
+	, m_peakEntryCount( 0 )
 	, m_entryCapacity( 64 )
 {
 }
@@ -47,6 +63,9 @@ q3Stack::~q3Stack( )
 {
 	assert( m_index == 0 );
 	assert( m_entryCount == 0 );
+
+	q3Free( m_memory );
+	q3Free( m_entries );
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -64,14 +83,24 @@ void *q3Stack::Allocate( i32 size )
 	q3StackEntry* entry = m_entries + m_entryCount;
 	entry->size = size;
 
-	// Make sure enough memory is available for this allocation
-	assert( m_index + size <= q3k_stackSize );
+	if ( m_index + size > m_capacity )
+	{
+		entry->data = (u8*)q3Alloc( size );
+		entry->usedAlloc = true;
+		m_allocBytes += size;
+	}
 
-	entry->data = m_memory + m_index;
-	m_index += size;
+	else
+	{
+		entry->data = m_memory + m_index;
+		entry->usedAlloc = false;
+		m_index += size;
+	}
 
 	m_allocation += size;
+	m_peakAllocation = q3Max( m_peakAllocation, m_allocation );
 	++m_entryCount;
+	m_peakEntryCount = q3Max( m_peakEntryCount, m_entryCount );
 
 	return entry->data;
 }
@@ -88,170 +117,35 @@ void q3Stack::Free( void *data )
 	// Must be in reverse order of allocation.
 	assert( data == entry->data );
 
-	m_index -= entry->size;
+	if ( entry->usedAlloc )
+	{
+		q3Free( data );
+		m_allocBytes -= entry->size;
+	}
+
+	else
+		m_index -= entry->size;
 
 	m_allocation -= entry->size;
 	--m_entryCount;
-}
-
-//--------------------------------------------------------------------------------------------------
-// q3Heap
-//--------------------------------------------------------------------------------------------------
-q3Heap::q3Heap( )
-{
-	m_memory = (q3Header*)q3Alloc( q3k_heapSize );
-	m_memory->next = NULL;
-	m_memory->prev = NULL;
-	m_memory->size = q3k_heapSize;
-
-	m_freeBlocks = (q3FreeBlock*)q3Alloc( sizeof( q3FreeBlock ) * q3k_heapInitialCapacity );
-	m_freeBlockCount = 1;
-	m_freeBlockCapacity = q3k_heapInitialCapacity;
-
-	m_freeBlocks->header = m_memory;
-	m_freeBlocks->size = q3k_heapSize;
-}
-
-//--------------------------------------------------------------------------------------------------
-q3Heap::~q3Heap( )
-{
-	q3Free( m_memory );
-	q3Free( m_freeBlocks );
-}
-
-//--------------------------------------------------------------------------------------------------
-void *q3Heap::Allocate( i32 size )
-{
-	i32 sizeNeeded = size + sizeof( q3Header );
-	q3FreeBlock* firstFit = NULL;
 
-	for ( i32 i = 0; i < m_freeBlockCount; ++i )
+	// Nothing points into the arena anymore, grow it to fit everything
+	if ( m_entryCount == 0 && m_peakAllocation > m_capacity )
 	{
-		q3FreeBlock* block = m_freeBlocks + i;
-
-		if ( block->size >= sizeNeeded )
-		{
-			firstFit = block;
-			break;
-		}
+		q3Free( m_memory );
+		m_capacity = q3Max( m_peakAllocation, m_capacity * 2 );
+		m_memory = (u8*)q3Alloc( m_capacity );
 	}
-
-	if ( !firstFit )
-		return NULL;
-
-	q3Header* node = firstFit->header;
-	q3Header* newNode = Q3_PTR_ADD( node, sizeNeeded );
-	node->size = sizeNeeded;
-
-	firstFit->size -= sizeNeeded;
-	firstFit->header = newNode;
-
-	newNode->next = node->next;
-	if ( node->next )
-		node->next->prev = newNode;
-	node->next = newNode;
-	newNode->prev = node;
-
-	return Q3_PTR_ADD( node, sizeof( q3Header ) );
 }
 
 //--------------------------------------------------------------------------------------------------
-void q3Heap::Free( void *memory )
+void q3Stack::GetStats( q3AllocatorStats* stats ) const
 {
-	assert( memory );
-	q3Header* node = (q3Header*)Q3_PTR_ADD( memory, -i32( sizeof( q3Header ) ) );
-
-	q3Header* next = node->next;
-	q3Header* prev = node->prev;
-	q3FreeBlock* nextBlock = NULL;
-	i32 prevBlockIndex = ~0;
-	q3FreeBlock* prevBlock = NULL;
-	i32 freeBlockCount = m_freeBlockCount;
-
-	for ( i32 i = 0; i < freeBlockCount; ++i )
-	{
-		q3FreeBlock* block = m_freeBlocks + i;
-		q3Header* header = block->header;
-
-		if ( header == next )
-			nextBlock = block;
-
-		else if ( header == prev )
-		{
-			prevBlock = block;
-			prevBlockIndex = i;
-		}
-	}
-
-	bool merged = false;
-
-	if ( prevBlock )
-	{
-		merged = true;
-
-		prev->next = next;
-		if ( next )
-			next->prev = prev;
-
-		prevBlock->size += node->size;
-		prev->size = prevBlock->size;
-
-		if ( nextBlock )
-		{
-			nextBlock->header = prev;
-			nextBlock->size += prev->size;
-			prev->size = nextBlock->size;
-
-			q3Header* nextnext = next->next;
-			prev->next = nextnext;
-
-			if ( nextnext )
-				nextnext->prev = prev;
-
-			// Remove the nextBlock from the freeBlocks array
-			assert( m_freeBlockCount );
-			assert( prevBlockIndex != ~0 );
-			--m_freeBlockCount;
-			m_freeBlocks[ prevBlockIndex ] = m_freeBlocks[ m_freeBlockCount ];
-		}
-	}
-
-	else if ( nextBlock )
-	{
-		merged = true;
-
-		nextBlock->header = node;
-		nextBlock->size += node->size;
-		node->size = nextBlock->size;
-
-		q3Header* nextnext = next->next;
-
-		if ( nextnext )
-			nextnext->prev = node;
-
-		node->next = nextnext;
-	}
-
-	if ( !merged )
-	{
-		q3FreeBlock block;
-		block.header = node;
-		block.size = node->size;
-
-		if ( m_freeBlockCount == m_freeBlockCapacity )
-		{
-			q3FreeBlock* oldBlocks = m_freeBlocks;
-			i32 oldCapacity = m_freeBlockCapacity;
-
-			m_freeBlockCapacity *= 2;
-			m_freeBlocks = (q3FreeBlock*)q3Alloc( sizeof( q3FreeBlock ) * m_freeBlockCapacity );
-
-			memcpy( m_freeBlocks, oldBlocks, sizeof( q3FreeBlock ) * oldCapacity );
-			q3Free( oldBlocks );
-		}
-
-		m_freeBlocks[ m_freeBlockCount++ ] = block;
-	}
+	stats->liveBytes = m_allocation;
+	stats->peakBytes = m_peakAllocation;
+	stats->reservedBytes = m_capacity + m_allocBytes;
+	stats->liveCount = m_entryCount;
+	stats->peakCount = m_peakEntryCount;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -266,6 +160,9 @@ q3PagedAllocator::q3PagedAllocator( i32 elementSize, i32 elementsPerPage )
 	m_pageCount = 0;
 
 	m_freeList = NULL;
+
+	m_liveCount = 0;
+	m_peakCount = 0;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -277,6 +174,9 @@ q3PagedAllocator::~q3PagedAllocator( )
 //--------------------------------------------------------------------------------------------------
 void* q3PagedAllocator::Allocate( )
 {
+	++m_liveCount;
+	m_peakCount = q3Max( m_peakCount, m_liveCount );
+
 	if ( m_freeList )
 	{
 		q3Block* data = m_freeList;
@@ -332,6 +232,7 @@ void q3PagedAllocator::Free( void* data )
 
 	((q3Block*)data)->next = m_freeList;
 	m_freeList = ((q3Block*)data);
+	--m_liveCount;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -346,6 +247,124 @@ void q3PagedAllocator::Clear( )
 		page = next;
 	}
 
+	m_pages = NULL;
 	m_freeList = NULL;
 	m_pageCount = 0;
+	m_liveCount = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3PagedAllocator::GetStats( q3AllocatorStats* stats ) const
+{
+	stats->liveBytes = m_liveCount * m_blockSize;
+	stats->peakBytes = m_peakCount * m_blockSize;
+	stats->reservedBytes = m_pageCount * m_blocksPerPage * m_blockSize;
+	stats->liveCount = m_liveCount;
+	stats->peakCount = m_peakCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+// q3Heap
+//--------------------------------------------------------------------------------------------------
+// Multiples of 16, blocks are as aligned as their page
+static const i32 q3k_heapClassSizes[ q3k_heapClassCount ] = {
+	16, 32, 48, 64, 96, 128, 160, 192, 224, 256, 320, 384, 448, 512, 768, 1024
+};
+
+//--------------------------------------------------------------------------------------------------
+q3Heap::q3Heap( )
+	: m_liveBytes( 0 )
+	, m_peakBytes( 0 )
+	, m_liveCount( 0 )
+	, m_peakCount( 0 )
+	, m_largeBytes( 0 )
+{
+	assert( q3k_heapClassSizes[ q3k_heapClassCount - 1 ] == q3k_heapMaxClassSize );
+
+	i32 sizeClass = 0;
+	for ( i32 i = 0; i < q3k_heapClassCount; ++i )
+	{
+		i32 size = q3k_heapClassSizes[ i ];
+		m_classes[ i ] = new q3PagedAllocator( size, q3k_heapPageSize / size );
+
+		for ( ; sizeClass <= size; ++sizeClass )
+			m_classOfSize[ sizeClass ] = u8( i );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------
+q3Heap::~q3Heap( )
+{
+	for ( i32 i = 0; i < q3k_heapClassCount; ++i )
+		delete m_classes[ i ];
+}
+
+//--------------------------------------------------------------------------------------------------
+void *q3Heap::Allocate( i32 size )
+{
+	assert( size > 0 );
+
+	void* memory;
+	i32 bytes;
+
+	if ( size > q3k_heapMaxClassSize )
+	{
+		memory = q3Alloc( size );
+		bytes = size;
+		m_largeBytes += size;
+	}
+
+	else
+	{
+		i32 sizeClass = m_classOfSize[ size ];
+		memory = m_classes[ sizeClass ]->Allocate( );
+		bytes = q3k_heapClassSizes[ sizeClass ];
+	}
+
+	m_liveBytes += bytes;
+	m_peakBytes = q3Max( m_peakBytes, m_liveBytes );
+	++m_liveCount;
+	m_peakCount = q3Max( m_peakCount, m_liveCount );
+
+	return memory;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3Heap::Free( void *memory, i32 size )
+{
+	assert( memory );
+	assert( size > 0 );
+
+	if ( size > q3k_heapMaxClassSize )
+	{
+		q3Free( memory );
+		m_liveBytes -= size;
+		m_largeBytes -= size;
+	}
+
+	else
+	{
+		i32 sizeClass = m_classOfSize[ size ];
+		m_classes[ sizeClass ]->Free( memory );
+		m_liveBytes -= q3k_heapClassSizes[ sizeClass ];
+	}
+
+	--m_liveCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3Heap::GetStats( q3AllocatorStats* stats ) const
+{
+	stats->liveBytes = m_liveBytes;
+	stats->peakBytes = m_peakBytes;
+	stats->reservedBytes = m_largeBytes;
+	stats->liveCount = m_liveCount;
+	stats->peakCount = m_peakCount;
+
+	for ( i32 i = 0; i < q3k_heapClassCount; ++i )
+	{
+		q3AllocatorStats classStats;
+		m_classes[ i ]->GetStats( &classStats );
+		stats->reservedBytes += classStats.reservedBytes;
+	}
 }
@@ -47,12 +47,30 @@ inline void q3Free( void* memory )
 #define Q3_PTR_ADD( P, BYTES ) \
 	((decltype( P ))(((u8 *)P) + (BYTES)))
 
+//--------------------------------------------------------------------------------------------------
+// q3AllocatorStats
+//--------------------------------------------------------------------------------------------------
+struct q3AllocatorStats
+{
+	i32 liveBytes;			// Handed out and not freed yet
+	i32 peakBytes;			// Highest liveBytes so far
+	i32 reservedBytes;		// Taken from the system
+	i32 liveCount;			// Allocations not freed yet
+	i32 peakCount;			// Highest liveCount so far
+
+	// Share of the reserved bytes not handed out
+	r32 Fragmentation( ) const;
+};
+
 //--------------------------------------------------------------------------------------------------
 // q3Stack
 //--------------------------------------------------------------------------------------------------
-// 20MB stack size, change as necessary
-const i32 q3k_stackSize = 1024 * 1024 * 20;
+// Initial arena size, the arena grows to fit the largest use seen
+const i32 q3k_stackInitialSize = 1024 * 1024;
 
+// Allocations that do not fit in the arena fall back to q3Alloc. Once the
+// stack is empty again the arena is reallocated large enough for the peak,
+// so the fallback only happens while the stack is still growing.
 class q3Stack
 {
 private:
@@ -60,6 +78,7 @@ private:
 	{
 		u8 *data;
 		i32 size;
+		bool usedAlloc;
 	};
 
 public:
@@ -69,56 +88,23 @@ public:
 	void *Allocate( i32 size );
 	void Free( void *data );
 
+	void GetStats( q3AllocatorStats* stats ) const;
+
 private:
-	u8 m_memory[ q3k_stackSize ];
+	u8* m_memory;
+	i32 m_capacity;
 	q3StackEntry* m_entries;
 
 	i32 m_index;
 
 	i32 m_allocation;
+	i32 m_peakAllocation;
+	i32 m_allocBytes;
 	i32 m_entryCount;
+	i32 m_peakEntryCount;
 	i32 m_entryCapacity;
 };
 
-//--------------------------------------------------------------------------------------------------
-// q3Heap
-//--------------------------------------------------------------------------------------------------
-// 20 MB heap size, change as necessary
-const i32 q3k_heapSize = 1024 * 1024 * 20;
-const i32 q3k_heapInitialCapacity = 1024;
-
-// Operates on first fit basis in attempt to improve cache coherency
-class q3Heap
-{
-private:
-	struct q3Header
-	{
-		q3Header* next;
-		q3Header* prev;
-		i32 size;
-	};
-
-	struct q3FreeBlock
-	{
-		q3Header* header;
-		i32 size;
-	};
-
-public:
-	q3Heap( );
-	~q3Heap( );
-
-	void *Allocate( i32 size );
-	void Free( void *memory );
-
-private:
-	q3Header* m_memory;
-
-	q3FreeBlock* m_freeBlocks;
-	i32 m_freeBlockCount;
-	i32 m_freeBlockCapacity;
-};
-
 //--------------------------------------------------------------------------------------------------
 // q3PagedAllocator
 //--------------------------------------------------------------------------------------------------
@@ -144,6 +130,8 @@ public:
 
 	void Clear( );
 
+	void GetStats( q3AllocatorStats* stats ) const;
+
 private:
 	i32 m_blockSize;
 	i32 m_blocksPerPage;
@@ -152,6 +140,42 @@ private:
 	i32 m_pageCount;
 
 	q3Block *m_freeList;
+
+	i32 m_liveCount;
+	i32 m_peakCount;
+};
+
+//--------------------------------------------------------------------------------------------------
+// q3Heap
+//--------------------------------------------------------------------------------------------------
+const i32 q3k_heapClassCount = 16;
+const i32 q3k_heapMaxClassSize = 1024;
+const i32 q3k_heapPageSize = 1024 * 16;
+
+// Size classes from 16 to q3k_heapMaxClassSize bytes, each one a
+// q3PagedAllocator, so allocating and freeing is a free list push or pop.
+// Larger allocations go straight to q3Alloc. Free needs the size that was
+// allocated to find the class again.
+class q3Heap
+{
+public:
+	q3Heap( );
+	~q3Heap( );
+
+	void *Allocate( i32 size );
+	void Free( void *memory, i32 size );
+
+	void GetStats( q3AllocatorStats* stats ) const;
+
+private:
+	q3PagedAllocator* m_classes[ q3k_heapClassCount ];
+	u8 m_classOfSize[ q3k_heapMaxClassSize + 1 ];
+
+	i32 m_liveBytes;
+	i32 m_peakBytes;
+	i32 m_liveCount;
+	i32 m_peakCount;
+	i32 m_largeBytes;
 };
 
 #endif // Q3MEMORY_H
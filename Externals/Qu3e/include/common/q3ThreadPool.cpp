@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------------------
+/**
+@file	q3ThreadPool.cpp
+
+	Copyright (c) 2014 Randy Gaul http://www.randygaul.net
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+	  1. The origin of this software must not be misrepresented; you must not
+	     claim that you wrote the original software. If you use this software
+	     in a product, an acknowledgment in the product documentation would be
+	     appreciated but is not required.
+	  2. Altered source versions must be plainly marked as such, and must not
+	     be misrepresented as being the original software.
+	  3. This notice may not be removed or altered from any source distribution.
+*/
+//--------------------------------------------------------------------------------------------------
+
+#include <cassert>
+
+#include "q3ThreadPool.h"
+#include "../math/q3Math.h"
+
+//--------------------------------------------------------------------------------------------------
+// q3ThreadPool
+//--------------------------------------------------------------------------------------------------
+q3ThreadPool::q3ThreadPool( )
+	: m_threadCount( 1 )
+	, m_generation( 0 )
+	, m_busyWorkers( 0 )
+	, m_quit( false )
+	, m_fn( NULL )
+	, m_param( NULL )
+	, m_count( 0 )
+	, m_batchSize( 1 )
+	, m_next( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------------------
+q3ThreadPool::~q3ThreadPool( )
+{
+	StopThreads( );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::SetThreadCount( i32 count )
+{
+	count = q3Max( 1, q3Min( count, q3k_maxThreads ) );
+
+	if ( count == m_threadCount )
+		return;
+
+	StopThreads( );
+	StartThreads( count );
+}
+
+//--------------------------------------------------------------------------------------------------
+i32 q3ThreadPool::GetThreadCount( ) const
+{
+	return m_threadCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::ParallelFor( i32 count, i32 batchSize, q3JobFunction fn, void* param )
+{
+	assert( batchSize > 0 );
+
+	if ( count <= 0 )
+		return;
+
+	// Not worth waking anyone up
+	if ( m_threadCount == 1 || count <= batchSize )
+	{
+		for ( i32 i = 0; i < count; ++i )
+			fn( param, i, 0 );
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_fn = fn;
+		m_param = param;
+		m_count = count;
+		m_batchSize = batchSize;
+		m_next = 0;
+		m_busyWorkers = m_threadCount - 1;
+		++m_generation;
+	}
+
+	m_wake.notify_all( );
+
+	RunJob( 0 );
+
+	std::unique_lock<std::mutex> lock( m_mutex );
+	while ( m_busyWorkers > 0 )
+		m_done.wait( lock );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::StartThreads( i32 count )
+{
+	m_quit = false;
+	m_threadCount = count;
+
+	for ( i32 i = 1; i < m_threadCount; ++i )
+		m_threads[ i ] = std::thread( WorkerMain, this, i );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::StopThreads( )
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_quit = true;
+	}
+
+	m_wake.notify_all( );
+
+	for ( i32 i = 1; i < m_threadCount; ++i )
+		m_threads[ i ].join( );
+
+	m_threadCount = 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::RunJob( i32 worker )
+{
+	while ( true )
+	{
+		i32 begin = m_next.fetch_add( m_batchSize );
+
+		if ( begin >= m_count )
+			break;
+
+		i32 end = q3Min( begin + m_batchSize, m_count );
+
+		for ( i32 i = begin; i < end; ++i )
+			m_fn( m_param, i, worker );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ThreadPool::WorkerMain( q3ThreadPool* pool, i32 worker )
+{
+	u32 generation = 0;
+
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( pool->m_mutex );
+
+			while ( !pool->m_quit && pool->m_generation == generation )
+				pool->m_wake.wait( lock );
+
+			if ( pool->m_quit )
+				return;
+
+			generation = pool->m_generation;
+		}
+
+		pool->RunJob( worker );
+
+		std::lock_guard<std::mutex> lock( pool->m_mutex );
+
+		if ( --pool->m_busyWorkers == 0 )
+			pool->m_done.notify_one( );
+	}
+}
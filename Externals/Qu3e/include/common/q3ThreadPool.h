@@ -0,0 +1,86 @@
+//--------------------------------------------------------------------------------------------------
+/**
+@file	q3ThreadPool.h
+
+	Copyright (c) 2014 Randy Gaul http://www.randygaul.net
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+	  1. The origin of this software must not be misrepresented; you must not
+	     claim that you wrote the original software. If you use this software
+	     in a product, an acknowledgment in the product documentation would be
+	     appreciated but is not required.
+	  2. Altered source versions must be plainly marked as such, and must not
+	     be misrepresented as being the original software.
+	  3. This notice may not be removed or altered from any source distribution.
+*/
+//--------------------------------------------------------------------------------------------------
+
+#ifndef Q3THREADPOOL_H
+#define Q3THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "q3Types.h"
+
+//--------------------------------------------------------------------------------------------------
+// q3ThreadPool
+//--------------------------------------------------------------------------------------------------
+const i32 q3k_maxThreads = 32;
+
+// Persistent worker threads for the parallel parts of q3Scene::Step. The
+// calling thread always takes part as worker 0, so a pool of one thread runs
+// every job inline and never touches a lock.
+class q3ThreadPool
+{
+public:
+	// Called once for every index of a job. worker is in [0, GetThreadCount( ))
+	// and can be used to pick per-thread scratch memory.
+	typedef void (*q3JobFunction)( void* param, i32 index, i32 worker );
+
+	q3ThreadPool( );
+	~q3ThreadPool( );
+
+	// Total number of threads including the caller, clamped to
+	// [1, q3k_maxThreads]. Must not be called from inside a job.
+	void SetThreadCount( i32 count );
+	i32 GetThreadCount( ) const;
+
+	// Runs fn for every index in [0, count) and returns once all of them are
+	// done. Threads grab batchSize consecutive indices at a time from a shared
+	// counter in increasing order, so jobs sorted by decreasing cost balance
+	// well. Results must not depend on which thread ran an index.
+	void ParallelFor( i32 count, i32 batchSize, q3JobFunction fn, void* param );
+
+private:
+	void StartThreads( i32 count );
+	void StopThreads( );
+	void RunJob( i32 worker );
+	static void WorkerMain( q3ThreadPool* pool, i32 worker );
+
+	std::thread m_threads[ q3k_maxThreads ];
+	i32 m_threadCount;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	u32 m_generation;
+	i32 m_busyWorkers;
+	bool m_quit;
+
+	q3JobFunction m_fn;
+	void* m_param;
+	i32 m_count;
+	i32 m_batchSize;
+	std::atomic<i32> m_next;
+};
+
+#endif // Q3THREADPOOL_H
@@ -37,6 +37,7 @@ typedef signed int i32;
 typedef unsigned char u8;
 typedef unsigned short u16;
 typedef unsigned int u32;
+typedef unsigned long long u64;
 
 #define Q3_UNUSED( A ) \
 	(void)A
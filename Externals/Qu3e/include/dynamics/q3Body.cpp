@@ -166,7 +166,7 @@ void q3Body::RemoveBox( const q3Box* box )
 
 	CalculateMassData( );
 
-	m_scene->m_heap.Free( (void*)box );
+	m_scene->m_heap.Free( (void*)box, sizeof( q3Box ) );
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -177,7 +177,7 @@ void q3Body::RemoveAllBoxes( )
 		q3Box* next = m_boxes->next;
 
 		m_scene->m_contactManager.m_broadphase.RemoveBox( m_boxes );
-		m_scene->m_heap.Free( (void*)m_boxes );
+		m_scene->m_heap.Free( (void*)m_boxes, sizeof( q3Box ) );
 
 		m_boxes = next;
 	}
@@ -30,12 +30,14 @@
 #include "q3Contact.h"
 #include "../scene/q3Scene.h"
 #include "../debug/q3Render.h"
+#include "../common/q3ThreadPool.h"
 
 //--------------------------------------------------------------------------------------------------
 // q3ContactManager
 //--------------------------------------------------------------------------------------------------
-q3ContactManager::q3ContactManager( q3Stack* stack )
+q3ContactManager::q3ContactManager( q3Stack* stack, q3ThreadPool* threadPool )
 	: m_stack( stack )
+	, m_threadPool( threadPool )
 	, m_broadphase( this )
 	, m_allocator( sizeof( q3ContactConstraint ), 256 )
 {
@@ -196,6 +198,10 @@ void q3ContactManager::RemoveFromBroadphase( q3Body *body )
 //--------------------------------------------------------------------------------------------------
 void q3ContactManager::TestCollisions( void )
 {
+	// Contact removal wakes bodies, which decides whether later constraints
+	// are tested, so culling stays serial and in list order
+	q3ContactConstraint** constraints = (q3ContactConstraint**)m_stack->Allocate( sizeof( q3ContactConstraint* ) * m_contactCount );
+	i32 constraintCount = 0;
 	q3ContactConstraint* constraint = m_contactList;
 
 	while( constraint )
@@ -227,58 +233,76 @@ void q3ContactManager::TestCollisions( void )
 			constraint = next;
 			continue;
 		}
-		
-		q3Manifold* manifold = &constraint->manifold;
-		q3Manifold oldManifold = constraint->manifold;
-		q3Vec3 ot0 = oldManifold.tangentVectors[ 0 ];
-		q3Vec3 ot1 = oldManifold.tangentVectors[ 1 ];
-		constraint->SolveCollision( );
-		q3ComputeBasis( manifold->normal, manifold->tangentVectors, manifold->tangentVectors + 1 );
-
-		for ( i32 i = 0; i < manifold->contactCount; ++i )
+
+		constraints[ constraintCount++ ] = constraint;
+		constraint = constraint->next;
+	}
+
+	// Every surviving pair only writes its own manifold and flags
+	m_threadPool->ParallelFor( constraintCount, 32, SolveCollision, constraints );
+
+	if ( m_contactListener )
+	{
+		for ( i32 i = 0; i < constraintCount; ++i )
 		{
-			q3Contact *c = manifold->contacts + i;
-			c->tangentImpulse[ 0 ] = c->tangentImpulse[ 1 ] = c->normalImpulse = r32( 0.0 );
-			u8 oldWarmStart = c->warmStarted;
-			c->warmStarted = u8( 0 );
+			constraint = constraints[ i ];
 
-			for ( i32 j = 0; j < oldManifold.contactCount; ++j )
+			if (
+				constraint->m_flags & q3ContactConstraint::eColliding &&
+				!(constraint->m_flags & q3ContactConstraint::eWasColliding)
+				)
 			{
-				q3Contact *oc = oldManifold.contacts + j;
-				if ( c->fp.key == oc->fp.key )
-				{
-					c->normalImpulse = oc->normalImpulse;
-
-					// Attempt to re-project old friction solutions
-					q3Vec3 friction = ot0 * oc->tangentImpulse[ 0 ] + ot1 * oc->tangentImpulse[ 1 ];
-					c->tangentImpulse[ 0 ] = q3Dot( friction, manifold->tangentVectors[ 0 ] );
-					c->tangentImpulse[ 1 ] = q3Dot( friction, manifold->tangentVectors[ 1 ] );
-					c->warmStarted = q3Max( oldWarmStart, u8( oldWarmStart + 1 ) );
-					break;
-				}
+				m_contactListener->BeginContact( constraint );
+			}
+
+			else if (
+				!(constraint->m_flags & q3ContactConstraint::eColliding) &&
+				constraint->m_flags & q3ContactConstraint::eWasColliding
+				)
+			{
+				m_contactListener->EndContact( constraint );
 			}
 		}
+	}
+
+	m_stack->Free( constraints );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3ContactManager::SolveCollision( void* param, i32 index, i32 worker )
+{
+	Q3_UNUSED( worker );
+
+	q3ContactConstraint* constraint = ((q3ContactConstraint**)param)[ index ];
+	q3Manifold* manifold = &constraint->manifold;
+	q3Manifold oldManifold = constraint->manifold;
+	q3Vec3 ot0 = oldManifold.tangentVectors[ 0 ];
+	q3Vec3 ot1 = oldManifold.tangentVectors[ 1 ];
+	constraint->SolveCollision( );
+	q3ComputeBasis( manifold->normal, manifold->tangentVectors, manifold->tangentVectors + 1 );
 
-		if ( m_contactListener )
+	for ( i32 i = 0; i < manifold->contactCount; ++i )
+	{
+		q3Contact *c = manifold->contacts + i;
+		c->tangentImpulse[ 0 ] = c->tangentImpulse[ 1 ] = c->normalImpulse = r32( 0.0 );
+		u8 oldWarmStart = c->warmStarted;
+		c->warmStarted = u8( 0 );
+
+		for ( i32 j = 0; j < oldManifold.contactCount; ++j )
 		{
-            if (
-                constraint->m_flags & q3ContactConstraint::eColliding &&
-                !(constraint->m_flags & q3ContactConstraint::eWasColliding)
-                )
-            {
-                m_contactListener->BeginContact( constraint );
-            }
-
-            else if (
-                !(constraint->m_flags & q3ContactConstraint::eColliding) &&
-                constraint->m_flags & q3ContactConstraint::eWasColliding
-                )
-            {
-                m_contactListener->EndContact( constraint );
-            }
+			q3Contact *oc = oldManifold.contacts + j;
+			if ( c->fp.key == oc->fp.key )
+			{
+				c->normalImpulse = oc->normalImpulse;
+
+				// Attempt to re-project old friction solutions
+				q3Vec3 friction = ot0 * oc->tangentImpulse[ 0 ] + ot1 * oc->tangentImpulse[ 1 ];
+				c->tangentImpulse[ 0 ] = q3Dot( friction, manifold->tangentVectors[ 0 ] );
+				c->tangentImpulse[ 1 ] = q3Dot( friction, manifold->tangentVectors[ 1 ] );
+				c->warmStarted = q3Max( oldWarmStart, u8( oldWarmStart + 1 ) );
+				break;
+			}
 		}
-
-		constraint = constraint->next;
 	}
 }
 
@@ -40,11 +40,12 @@ struct q3Box;
 class q3Body;
 class q3Render;
 class q3Stack;
+class q3ThreadPool;
 
 class q3ContactManager
 {
 public:
-	q3ContactManager( q3Stack* stack );
+	q3ContactManager( q3Stack* stack, q3ThreadPool* threadPool );
 
 	// Add a new contact constraint for a pair of objects
 	// unless the contact constraint already exists
@@ -64,7 +65,10 @@ public:
 	// Remove contacts without broadphase overlap
 	// Solves contact manifolds
 	void TestCollisions( void );
-	static void SolveCollision( void* param );
+
+	// Narrow phase job, param is the array of constraints gathered by
+	// TestCollisions. Only touches the constraint at index.
+	static void SolveCollision( void* param, i32 index, i32 worker );
 
 	void RenderContacts( q3Render* debugDrawer ) const;
 
@@ -72,6 +76,7 @@ private:
 	q3ContactConstraint* m_contactList;
 	i32 m_contactCount;
 	q3Stack* m_stack;
+	q3ThreadPool* m_threadPool;
 	q3PagedAllocator m_allocator;
 	q3BroadPhase m_broadphase;
 	q3ContactListener *m_contactListener;
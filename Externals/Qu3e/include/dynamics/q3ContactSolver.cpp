@@ -134,63 +134,41 @@ void q3ContactSolver::PreSolve( r32 dt )
 void q3ContactSolver::Solve( )
 {
 	for ( i32 i = 0; i < m_contactCount; ++i )
-	{
-		q3ContactConstraintState *cs = m_contacts + i;
-
-		q3Vec3 vA = m_velocities[ cs->indexA ].v;
-		q3Vec3 wA = m_velocities[ cs->indexA ].w;
-		q3Vec3 vB = m_velocities[ cs->indexB ].v;
-		q3Vec3 wB = m_velocities[ cs->indexB ].w;
+		SolveConstraint( m_contacts + i );
+}
 
-		for ( i32 j = 0; j < cs->contactCount; ++j )
-		{
-			q3ContactState *c = cs->contacts + j;
+//--------------------------------------------------------------------------------------------------
+void q3ContactSolver::SolveConstraint( q3ContactConstraintState *cs )
+{
+	q3Vec3 vA = m_velocities[ cs->indexA ].v;
+	q3Vec3 wA = m_velocities[ cs->indexA ].w;
+	q3Vec3 vB = m_velocities[ cs->indexB ].v;
+	q3Vec3 wB = m_velocities[ cs->indexB ].w;
 
-			// relative velocity at contact
-			q3Vec3 dv = vB + q3Cross( wB, c->rb ) - vA - q3Cross( wA, c->ra );
+	for ( i32 j = 0; j < cs->contactCount; ++j )
+	{
+		q3ContactState *c = cs->contacts + j;
 
-			// Friction
-			if ( m_enableFriction )
-			{
-				for ( i32 i = 0; i < 2; ++i )
-				{
-					r32 lambda = -q3Dot( dv, cs->tangentVectors[ i ] ) * c->tangentMass[ i ];
-
-					// Calculate frictional impulse
-					r32 maxLambda = cs->friction * c->normalImpulse;
-
-					// Clamp frictional impulse
-					r32 oldPT = c->tangentImpulse[ i ];
-					c->tangentImpulse[ i ] = q3Clamp( -maxLambda, maxLambda, oldPT + lambda );
-					lambda = c->tangentImpulse[ i ] - oldPT;
-
-					// Apply friction impulse
-					q3Vec3 impulse = cs->tangentVectors[ i ] * lambda;
-					vA -= impulse * cs->mA;
-					wA -= cs->iA * q3Cross( c->ra, impulse );
-
-					vB += impulse * cs->mB;
-					wB += cs->iB * q3Cross( c->rb, impulse );
-				}
-			}
+		// relative velocity at contact
+		q3Vec3 dv = vB + q3Cross( wB, c->rb ) - vA - q3Cross( wA, c->ra );
 
-			// Normal
+		// Friction
+		if ( m_enableFriction )
+		{
+			for ( i32 i = 0; i < 2; ++i )
 			{
-				dv = vB + q3Cross( wB, c->rb ) - vA - q3Cross( wA, c->ra );
-
-				// Normal impulse
-				r32 vn = q3Dot( dv, cs->normal );
+				r32 lambda = -q3Dot( dv, cs->tangentVectors[ i ] ) * c->tangentMass[ i ];
 
-				// Factor in positional bias to calculate impulse scalar j
-				r32 lambda = c->normalMass * (-vn + c->bias);
+				// Calculate frictional impulse
+				r32 maxLambda = cs->friction * c->normalImpulse;
 
-				// Clamp impulse
-				r32 tempPN = c->normalImpulse;
-				c->normalImpulse = q3Max( tempPN + lambda, r32( 0.0 ) );
-				lambda = c->normalImpulse - tempPN;
+				// Clamp frictional impulse
+				r32 oldPT = c->tangentImpulse[ i ];
+				c->tangentImpulse[ i ] = q3Clamp( -maxLambda, maxLambda, oldPT + lambda );
+				lambda = c->tangentImpulse[ i ] - oldPT;
 
-				// Apply impulse
-				q3Vec3 impulse = cs->normal * lambda;
+				// Apply friction impulse
+				q3Vec3 impulse = cs->tangentVectors[ i ] * lambda;
 				vA -= impulse * cs->mA;
 				wA -= cs->iA * q3Cross( c->ra, impulse );
 
@@ -199,9 +177,33 @@ void q3ContactSolver::Solve( )
 			}
 		}
 
-		m_velocities[ cs->indexA ].v = vA;
-		m_velocities[ cs->indexA ].w = wA;
-		m_velocities[ cs->indexB ].v = vB;
-		m_velocities[ cs->indexB ].w = wB;
+		// Normal
+		{
+			dv = vB + q3Cross( wB, c->rb ) - vA - q3Cross( wA, c->ra );
+
+			// Normal impulse
+			r32 vn = q3Dot( dv, cs->normal );
+
+			// Factor in positional bias to calculate impulse scalar j
+			r32 lambda = c->normalMass * (-vn + c->bias);
+
+			// Clamp impulse
+			r32 tempPN = c->normalImpulse;
+			c->normalImpulse = q3Max( tempPN + lambda, r32( 0.0 ) );
+			lambda = c->normalImpulse - tempPN;
+
+			// Apply impulse
+			q3Vec3 impulse = cs->normal * lambda;
+			vA -= impulse * cs->mA;
+			wA -= cs->iA * q3Cross( c->ra, impulse );
+
+			vB += impulse * cs->mB;
+			wB += cs->iB * q3Cross( c->rb, impulse );
+		}
 	}
+
+	m_velocities[ cs->indexA ].v = vA;
+	m_velocities[ cs->indexA ].w = wA;
+	m_velocities[ cs->indexB ].v = vB;
+	m_velocities[ cs->indexB ].w = wB;
 }
@@ -73,6 +73,7 @@ struct q3ContactSolver
 
 	void PreSolve( r32 dt );
 	void Solve( void );
+	void SolveConstraint( q3ContactConstraintState *cs );
 
 	q3Island *m_island;
 	q3ContactConstraintState *m_contacts;
@@ -28,6 +28,7 @@
 #include "q3Body.h"
 #include "../common/q3Memory.h"
 #include "q3ContactSolver.h"
+#include "q3SimdContactSolver.h"
 #include "../common/q3Settings.h"
 #include "../broadphase/q3BroadPhase.h"
 #include "q3Contact.h"
@@ -79,8 +80,22 @@ void q3Island::Solve( )
 	contactSolver.PreSolve( m_dt );
 
 	// Solve contacts
-	for ( i32 i = 0; i < m_iterations; ++i )
-		contactSolver.Solve( );
+	if ( m_simdScratch )
+	{
+		q3SimdContactSolver simdSolver;
+		simdSolver.Initialize( &contactSolver, m_simdScratch );
+
+		for ( i32 i = 0; i < m_iterations; ++i )
+			simdSolver.Solve( );
+
+		simdSolver.ShutDown( );
+	}
+
+	else
+	{
+		for ( i32 i = 0; i < m_iterations; ++i )
+			contactSolver.Solve( );
+	}
 
 	contactSolver.ShutDown( );
 
@@ -104,6 +119,8 @@ void q3Island::Solve( )
 		body->m_tx.rotation = body->m_q.ToMat3( );
 	}
 
+	m_asleep = false;
+
 	if ( m_allowSleep )
 	{
 		// Find minimum sleep time of the entire island
@@ -139,8 +156,13 @@ void q3Island::Solve( )
 		// and sleep test will be tried again.
 		if ( minSleepTime > Q3_SLEEP_TIME )
 		{
+			m_asleep = true;
+
 			for ( i32 i = 0; i < m_bodyCount; ++i )
-				m_bodies[ i ]->SetToSleep( );
+			{
+				if ( !(m_bodies[ i ]->m_flags & q3Body::eStatic) )
+					m_bodies[ i ]->SetToSleep( );
+			}
 		}
 	}
 }
@@ -68,6 +68,15 @@ struct q3Island
 
 	bool m_allowSleep;
 	bool m_enableFriction;
+
+	// Set by Solve( ) when the island went to sleep. Only non-static bodies
+	// are put to sleep there, static bodies can be shared with islands being
+	// solved at the same time and are left to the caller.
+	bool m_asleep;
+
+	// Scratch memory for q3SimdContactSolver, NULL solves the contacts with
+	// the scalar q3ContactSolver
+	void* m_simdScratch;
 };
 
 #endif // Q3ISLAND_H
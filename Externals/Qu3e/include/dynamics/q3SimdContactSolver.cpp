@@ -0,0 +1,383 @@
+//--------------------------------------------------------------------------------------------------
+/**
+@file	q3SimdContactSolver.cpp
+
+	Copyright (c) 2014 Randy Gaul http://www.randygaul.net
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+	  1. The origin of this software must not be misrepresented; you must not
+	     claim that you wrote the original software. If you use this software
+	     in a product, an acknowledgment in the product documentation would be
+	     appreciated but is not required.
+	  2. Altered source versions must be plainly marked as such, and must not
+	     be misrepresented as being the original software.
+	  3. This notice may not be removed or altered from any source distribution.
+*/
+//--------------------------------------------------------------------------------------------------
+
+#include <cstring>
+
+#include "q3SimdContactSolver.h"
+#include "q3ContactSolver.h"
+#include "q3Island.h"
+
+//--------------------------------------------------------------------------------------------------
+// q3SimdContactSolver
+//--------------------------------------------------------------------------------------------------
+// Same operation order as q3Dot, q3Cross and q3Mat3 * q3Vec3, so every lane
+// computes what the scalar solver would for its constraint
+inline __m128 q3SimdDot( const __m128* a, const __m128* b )
+{
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( a[ 0 ], b[ 0 ] ), _mm_mul_ps( a[ 1 ], b[ 1 ] ) ), _mm_mul_ps( a[ 2 ], b[ 2 ] ) );
+}
+
+inline void q3SimdCross( const __m128* a, const __m128* b, __m128* out )
+{
+	out[ 0 ] = _mm_sub_ps( _mm_mul_ps( a[ 1 ], b[ 2 ] ), _mm_mul_ps( b[ 1 ], a[ 2 ] ) );
+	out[ 1 ] = _mm_sub_ps( _mm_mul_ps( b[ 0 ], a[ 2 ] ), _mm_mul_ps( a[ 0 ], b[ 2 ] ) );
+	out[ 2 ] = _mm_sub_ps( _mm_mul_ps( a[ 0 ], b[ 1 ] ), _mm_mul_ps( b[ 0 ], a[ 1 ] ) );
+}
+
+inline void q3SimdMul( const __m128* m, const __m128* v, __m128* out )
+{
+	for ( i32 i = 0; i < 3; ++i )
+		out[ i ] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( m[ i ], v[ 0 ] ), _mm_mul_ps( m[ 3 + i ], v[ 1 ] ) ), _mm_mul_ps( m[ 6 + i ], v[ 2 ] ) );
+}
+
+inline __m128 q3SimdNegate( __m128 a )
+{
+	return _mm_xor_ps( a, _mm_set1_ps( -0.0f ) );
+}
+
+// Selects like q3Clamp, not min/max, to keep the sign of zeros
+inline __m128 q3SimdClamp( __m128 min, __m128 max, __m128 a )
+{
+	__m128 above = _mm_cmpgt_ps( a, max );
+	__m128 below = _mm_cmplt_ps( a, min );
+	a = _mm_or_ps( _mm_and_ps( above, max ), _mm_andnot_ps( above, a ) );
+	return _mm_or_ps( _mm_and_ps( below, min ), _mm_andnot_ps( below, a ) );
+}
+
+// dv = vB + wB x rb - vA - wA x ra
+inline void q3SimdRelativeVelocity( const __m128* vA, const __m128* wA, const __m128* vB, const __m128* wB, const q3SimdContactPoint* c, __m128* dv )
+{
+	__m128 wBxrb[ 3 ];
+	__m128 wAxra[ 3 ];
+	q3SimdCross( wB, c->rb, wBxrb );
+	q3SimdCross( wA, c->ra, wAxra );
+
+	for ( i32 i = 0; i < 3; ++i )
+		dv[ i ] = _mm_sub_ps( _mm_sub_ps( _mm_add_ps( vB[ i ], wBxrb[ i ] ), vA[ i ] ), wAxra[ i ] );
+}
+
+inline void q3SimdApplyImpulse( const q3SimdContactBatch* b, const q3SimdContactPoint* c, const __m128* impulse, __m128* vA, __m128* wA, __m128* vB, __m128* wB )
+{
+	__m128 r[ 3 ];
+	__m128 dw[ 3 ];
+
+	q3SimdCross( c->ra, impulse, r );
+	q3SimdMul( b->iA, r, dw );
+	for ( i32 i = 0; i < 3; ++i )
+	{
+		vA[ i ] = _mm_sub_ps( vA[ i ], _mm_mul_ps( impulse[ i ], b->mA ) );
+		wA[ i ] = _mm_sub_ps( wA[ i ], dw[ i ] );
+	}
+
+	q3SimdCross( c->rb, impulse, r );
+	q3SimdMul( b->iB, r, dw );
+	for ( i32 i = 0; i < 3; ++i )
+	{
+		vB[ i ] = _mm_add_ps( vB[ i ], _mm_mul_ps( impulse[ i ], b->mB ) );
+		wB[ i ] = _mm_add_ps( wB[ i ], dw[ i ] );
+	}
+}
+
+inline r32* q3SimdLane( __m128& v, i32 lane )
+{
+	return (r32*)&v + lane;
+}
+
+inline void q3SimdSetLane( __m128* v, i32 lane, const q3Vec3& value )
+{
+	*q3SimdLane( v[ 0 ], lane ) = value.x;
+	*q3SimdLane( v[ 1 ], lane ) = value.y;
+	*q3SimdLane( v[ 2 ], lane ) = value.z;
+}
+
+inline void q3SimdSetLane( __m128* m, i32 lane, const q3Mat3& value )
+{
+	q3SimdSetLane( m, lane, value.ex );
+	q3SimdSetLane( m + 3, lane, value.ey );
+	q3SimdSetLane( m + 6, lane, value.ez );
+}
+
+inline i32 q3SimdAlign( i32 size )
+{
+	return (size + 15) & ~15;
+}
+
+//--------------------------------------------------------------------------------------------------
+i32 q3SimdContactSolver::GetScratchSize( i32 contactCount, i32 bodyCount )
+{
+	i32 maxBatches = contactCount / q3k_simdWidth + q3k_simdColorCount;
+	i32 bitsetWords = (bodyCount + 31) / 32;
+
+	return 15
+		+ q3SimdAlign( sizeof( q3SimdContactBatch ) * maxBatches )
+		+ q3SimdAlign( sizeof( u32 ) * bitsetWords * q3k_simdColorCount )
+		+ q3SimdAlign( sizeof( i32 ) * contactCount ) * 2;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3SimdContactSolver::Initialize( q3ContactSolver* solver, void* scratch )
+{
+	i32 contactCount = solver->m_contactCount;
+	i32 bodyCount = solver->m_island->m_bodyCount;
+	i32 maxBatches = contactCount / q3k_simdWidth + q3k_simdColorCount;
+	i32 bitsetWords = (bodyCount + 31) / 32;
+
+	u8* memory = (u8*)(((size_t)scratch + 15) & ~(size_t)15);
+	m_solver = solver;
+	m_batches = (q3SimdContactBatch*)memory;
+	memory += q3SimdAlign( sizeof( q3SimdContactBatch ) * maxBatches );
+	u32* bitsets = (u32*)memory;
+	memory += q3SimdAlign( sizeof( u32 ) * bitsetWords * q3k_simdColorCount );
+	i32* colors = (i32*)memory;
+	memory += q3SimdAlign( sizeof( i32 ) * contactCount );
+	m_overflow = (i32*)memory;
+	m_overflowCount = 0;
+
+	// Greedy coloring in constraint order, bodies without mass are ignored
+	i32 colorCounts[ q3k_simdColorCount ] = { 0 };
+	memset( bitsets, 0, sizeof( u32 ) * bitsetWords * q3k_simdColorCount );
+
+	for ( i32 i = 0; i < contactCount; ++i )
+	{
+		const q3ContactConstraintState* cs = solver->m_contacts + i;
+		bool dynamicA = cs->mA != r32( 0.0 );
+		bool dynamicB = cs->mB != r32( 0.0 );
+		u32 bitA = 1u << (cs->indexA & 31);
+		u32 bitB = 1u << (cs->indexB & 31);
+		colors[ i ] = -1;
+
+		for ( i32 color = 0; color < q3k_simdColorCount; ++color )
+		{
+			u32* bits = bitsets + color * bitsetWords;
+
+			if ( dynamicA && (bits[ cs->indexA >> 5 ] & bitA) )
+				continue;
+
+			if ( dynamicB && (bits[ cs->indexB >> 5 ] & bitB) )
+				continue;
+
+			if ( dynamicA )
+				bits[ cs->indexA >> 5 ] |= bitA;
+
+			if ( dynamicB )
+				bits[ cs->indexB >> 5 ] |= bitB;
+
+			colors[ i ] = color;
+			++colorCounts[ color ];
+			break;
+		}
+
+		if ( colors[ i ] < 0 )
+			m_overflow[ m_overflowCount++ ] = i;
+	}
+
+	// Batches of a color are consecutive, colors in order
+	i32 cursors[ q3k_simdColorCount ];
+	m_batchCount = 0;
+	for ( i32 color = 0; color < q3k_simdColorCount; ++color )
+	{
+		cursors[ color ] = m_batchCount;
+		m_batchCount += (colorCounts[ color ] + q3k_simdWidth - 1) / q3k_simdWidth;
+	}
+
+	assert( m_batchCount <= maxBatches );
+	memset( m_batches, 0, sizeof( q3SimdContactBatch ) * m_batchCount );
+
+	for ( i32 i = 0; i < contactCount; ++i )
+	{
+		if ( colors[ i ] < 0 )
+			continue;
+
+		const q3ContactConstraintState* cs = solver->m_contacts + i;
+		q3SimdContactBatch* b = m_batches + cursors[ colors[ i ] ];
+		i32 lane = b->laneCount++;
+
+		if ( b->laneCount == q3k_simdWidth )
+			++cursors[ colors[ i ] ];
+
+		b->constraints[ lane ] = i;
+		b->indexA[ lane ] = cs->indexA;
+		b->indexB[ lane ] = cs->indexB;
+		b->pointCount = q3Max( b->pointCount, cs->contactCount );
+		q3SimdSetLane( b->normal, lane, cs->normal );
+		q3SimdSetLane( b->tangentVectors[ 0 ], lane, cs->tangentVectors[ 0 ] );
+		q3SimdSetLane( b->tangentVectors[ 1 ], lane, cs->tangentVectors[ 1 ] );
+		q3SimdSetLane( b->iA, lane, cs->iA );
+		q3SimdSetLane( b->iB, lane, cs->iB );
+		*q3SimdLane( b->mA, lane ) = cs->mA;
+		*q3SimdLane( b->mB, lane ) = cs->mB;
+		*q3SimdLane( b->friction, lane ) = cs->friction;
+
+		for ( i32 j = 0; j < cs->contactCount; ++j )
+		{
+			const q3ContactState* c = cs->contacts + j;
+			q3SimdContactPoint* p = b->points + j;
+			q3SimdSetLane( p->ra, lane, c->ra );
+			q3SimdSetLane( p->rb, lane, c->rb );
+			*q3SimdLane( p->normalMass, lane ) = c->normalMass;
+			*q3SimdLane( p->tangentMass[ 0 ], lane ) = c->tangentMass[ 0 ];
+			*q3SimdLane( p->tangentMass[ 1 ], lane ) = c->tangentMass[ 1 ];
+			*q3SimdLane( p->bias, lane ) = c->bias;
+			*q3SimdLane( p->normalImpulse, lane ) = c->normalImpulse;
+			*q3SimdLane( p->tangentImpulse[ 0 ], lane ) = c->tangentImpulse[ 0 ];
+			*q3SimdLane( p->tangentImpulse[ 1 ], lane ) = c->tangentImpulse[ 1 ];
+		}
+	}
+
+	// Unused lanes read the bodies of lane 0 and are never written back
+	for ( i32 i = 0; i < m_batchCount; ++i )
+	{
+		q3SimdContactBatch* b = m_batches + i;
+
+		for ( i32 lane = b->laneCount; lane < q3k_simdWidth; ++lane )
+		{
+			b->indexA[ lane ] = b->indexA[ 0 ];
+			b->indexB[ lane ] = b->indexB[ 0 ];
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3SimdContactSolver::Solve( void )
+{
+	q3VelocityState* velocities = m_solver->m_velocities;
+	bool enableFriction = m_solver->m_enableFriction;
+	const __m128 zero = _mm_setzero_ps( );
+
+	for ( i32 i = 0; i < m_batchCount; ++i )
+	{
+		q3SimdContactBatch* b = m_batches + i;
+		const q3VelocityState* a0 = velocities + b->indexA[ 0 ];
+		const q3VelocityState* a1 = velocities + b->indexA[ 1 ];
+		const q3VelocityState* a2 = velocities + b->indexA[ 2 ];
+		const q3VelocityState* a3 = velocities + b->indexA[ 3 ];
+		const q3VelocityState* b0 = velocities + b->indexB[ 0 ];
+		const q3VelocityState* b1 = velocities + b->indexB[ 1 ];
+		const q3VelocityState* b2 = velocities + b->indexB[ 2 ];
+		const q3VelocityState* b3 = velocities + b->indexB[ 3 ];
+
+		__m128 vA[ 3 ], wA[ 3 ], vB[ 3 ], wB[ 3 ];
+		vA[ 0 ] = _mm_setr_ps( a0->v.x, a1->v.x, a2->v.x, a3->v.x );
+		vA[ 1 ] = _mm_setr_ps( a0->v.y, a1->v.y, a2->v.y, a3->v.y );
+		vA[ 2 ] = _mm_setr_ps( a0->v.z, a1->v.z, a2->v.z, a3->v.z );
+		wA[ 0 ] = _mm_setr_ps( a0->w.x, a1->w.x, a2->w.x, a3->w.x );
+		wA[ 1 ] = _mm_setr_ps( a0->w.y, a1->w.y, a2->w.y, a3->w.y );
+		wA[ 2 ] = _mm_setr_ps( a0->w.z, a1->w.z, a2->w.z, a3->w.z );
+		vB[ 0 ] = _mm_setr_ps( b0->v.x, b1->v.x, b2->v.x, b3->v.x );
+		vB[ 1 ] = _mm_setr_ps( b0->v.y, b1->v.y, b2->v.y, b3->v.y );
+		vB[ 2 ] = _mm_setr_ps( b0->v.z, b1->v.z, b2->v.z, b3->v.z );
+		wB[ 0 ] = _mm_setr_ps( b0->w.x, b1->w.x, b2->w.x, b3->w.x );
+		wB[ 1 ] = _mm_setr_ps( b0->w.y, b1->w.y, b2->w.y, b3->w.y );
+		wB[ 2 ] = _mm_setr_ps( b0->w.z, b1->w.z, b2->w.z, b3->w.z );
+
+		for ( i32 j = 0; j < b->pointCount; ++j )
+		{
+			q3SimdContactPoint* c = b->points + j;
+			__m128 dv[ 3 ];
+			__m128 impulse[ 3 ];
+
+			// relative velocity at contact
+			q3SimdRelativeVelocity( vA, wA, vB, wB, c, dv );
+
+			// Friction
+			if ( enableFriction )
+			{
+				for ( i32 k = 0; k < 2; ++k )
+				{
+					__m128 lambda = _mm_mul_ps( q3SimdNegate( q3SimdDot( dv, b->tangentVectors[ k ] ) ), c->tangentMass[ k ] );
+
+					// Clamp frictional impulse
+					__m128 maxLambda = _mm_mul_ps( b->friction, c->normalImpulse );
+					__m128 oldPT = c->tangentImpulse[ k ];
+					c->tangentImpulse[ k ] = q3SimdClamp( q3SimdNegate( maxLambda ), maxLambda, _mm_add_ps( oldPT, lambda ) );
+					lambda = _mm_sub_ps( c->tangentImpulse[ k ], oldPT );
+
+					// Apply friction impulse
+					for ( i32 l = 0; l < 3; ++l )
+						impulse[ l ] = _mm_mul_ps( b->tangentVectors[ k ][ l ], lambda );
+
+					q3SimdApplyImpulse( b, c, impulse, vA, wA, vB, wB );
+				}
+			}
+
+			// Normal
+			{
+				q3SimdRelativeVelocity( vA, wA, vB, wB, c, dv );
+
+				// Factor in positional bias to calculate impulse scalar j
+				__m128 vn = q3SimdDot( dv, b->normal );
+				__m128 lambda = _mm_mul_ps( c->normalMass, _mm_add_ps( q3SimdNegate( vn ), c->bias ) );
+
+				// Clamp impulse
+				__m128 tempPN = c->normalImpulse;
+				c->normalImpulse = _mm_max_ps( _mm_add_ps( tempPN, lambda ), zero );
+				lambda = _mm_sub_ps( c->normalImpulse, tempPN );
+
+				for ( i32 l = 0; l < 3; ++l )
+					impulse[ l ] = _mm_mul_ps( b->normal[ l ], lambda );
+
+				q3SimdApplyImpulse( b, c, impulse, vA, wA, vB, wB );
+			}
+		}
+
+		// Lanes of a batch never share a body with mass, bodies without
+		// mass get their own velocity back
+		for ( i32 lane = 0; lane < b->laneCount; ++lane )
+		{
+			q3VelocityState* a = velocities + b->indexA[ lane ];
+			a->v.Set( *q3SimdLane( vA[ 0 ], lane ), *q3SimdLane( vA[ 1 ], lane ), *q3SimdLane( vA[ 2 ], lane ) );
+			a->w.Set( *q3SimdLane( wA[ 0 ], lane ), *q3SimdLane( wA[ 1 ], lane ), *q3SimdLane( wA[ 2 ], lane ) );
+
+			q3VelocityState* s = velocities + b->indexB[ lane ];
+			s->v.Set( *q3SimdLane( vB[ 0 ], lane ), *q3SimdLane( vB[ 1 ], lane ), *q3SimdLane( vB[ 2 ], lane ) );
+			s->w.Set( *q3SimdLane( wB[ 0 ], lane ), *q3SimdLane( wB[ 1 ], lane ), *q3SimdLane( wB[ 2 ], lane ) );
+		}
+	}
+
+	// Constraints that did not fit in any color
+	for ( i32 i = 0; i < m_overflowCount; ++i )
+		m_solver->SolveConstraint( m_solver->m_contacts + m_overflow[ i ] );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3SimdContactSolver::ShutDown( void )
+{
+	for ( i32 i = 0; i < m_batchCount; ++i )
+	{
+		q3SimdContactBatch* b = m_batches + i;
+
+		for ( i32 lane = 0; lane < b->laneCount; ++lane )
+		{
+			q3ContactConstraintState* cs = m_solver->m_contacts + b->constraints[ lane ];
+
+			for ( i32 j = 0; j < cs->contactCount; ++j )
+			{
+				q3SimdContactPoint* p = b->points + j;
+				q3ContactState* c = cs->contacts + j;
+				c->normalImpulse = *q3SimdLane( p->normalImpulse, lane );
+				c->tangentImpulse[ 0 ] = *q3SimdLane( p->tangentImpulse[ 0 ], lane );
+				c->tangentImpulse[ 1 ] = *q3SimdLane( p->tangentImpulse[ 1 ], lane );
+			}
+		}
+	}
+}
@@ -0,0 +1,99 @@
+//--------------------------------------------------------------------------------------------------
+/**
+@file	q3SimdContactSolver.h
+
+	Copyright (c) 2014 Randy Gaul http://www.randygaul.net
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+	  1. The origin of this software must not be misrepresented; you must not
+	     claim that you wrote the original software. If you use this software
+	     in a product, an acknowledgment in the product documentation would be
+	     appreciated but is not required.
+	  2. Altered source versions must be plainly marked as such, and must not
+	     be misrepresented as being the original software.
+	  3. This notice may not be removed or altered from any source distribution.
+*/
+//--------------------------------------------------------------------------------------------------
+
+#ifndef Q3SIMDCONTACTSOLVER_H
+#define Q3SIMDCONTACTSOLVER_H
+
+#include <xmmintrin.h>
+
+#include "../math/q3Math.h"
+
+//--------------------------------------------------------------------------------------------------
+// q3SimdContactSolver
+//--------------------------------------------------------------------------------------------------
+struct q3ContactSolver;
+
+const i32 q3k_simdWidth = 4;
+const i32 q3k_simdColorCount = 16;
+
+// One contact point of q3k_simdWidth constraints, lane i belongs to
+// constraint i of the batch
+struct q3SimdContactPoint
+{
+	__m128 ra[ 3 ];
+	__m128 rb[ 3 ];
+	__m128 normalMass;
+	__m128 tangentMass[ 2 ];
+	__m128 bias;
+	__m128 normalImpulse;
+	__m128 tangentImpulse[ 2 ];
+};
+
+// Lanes past laneCount and points past a lane's contact count are zero,
+// which makes every impulse they compute zero
+struct q3SimdContactBatch
+{
+	q3SimdContactPoint points[ 8 ];
+	__m128 normal[ 3 ];
+	__m128 tangentVectors[ 2 ][ 3 ];
+	__m128 iA[ 9 ];	// Columns, like q3Mat3
+	__m128 iB[ 9 ];
+	__m128 mA;
+	__m128 mB;
+	__m128 friction;
+	i32 constraints[ q3k_simdWidth ];	// Index into the solver's constraint states
+	i32 indexA[ q3k_simdWidth ];
+	i32 indexB[ q3k_simdWidth ];
+	i32 laneCount;
+	i32 pointCount;						// Highest contact count of all lanes
+};
+
+// Alternative to the q3ContactSolver::Solve( ) iterations that solves four
+// contact constraints at once with SSE. The constraints are greedily colored
+// so no two constraints of a color share a body that has mass, then every
+// color is cut into batches of q3k_simdWidth lanes. Static and kinematic
+// bodies never conflict, contacts add zero to their velocities. Constraints
+// that fit no color are solved one at a time after the batches.
+// PreSolve and ShutDown stay with q3ContactSolver.
+struct q3SimdContactSolver
+{
+	// Bytes of scratch memory Initialize needs, alignment included
+	static i32 GetScratchSize( i32 contactCount, i32 bodyCount );
+
+	// Colors and packs the constraints of a solver that already ran PreSolve
+	void Initialize( q3ContactSolver* solver, void* scratch );
+
+	// One iteration over all constraints, color by color
+	void Solve( void );
+
+	// Writes the accumulated impulses back to the solver's constraint states
+	void ShutDown( void );
+
+	q3ContactSolver* m_solver;
+	q3SimdContactBatch* m_batches;
+	i32 m_batchCount;
+	i32* m_overflow;
+	i32 m_overflowCount;
+};
+
+#endif // Q3SIMDCONTACTSOLVER_H
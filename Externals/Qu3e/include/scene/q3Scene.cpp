@@ -25,6 +25,7 @@
 //--------------------------------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <algorithm>
 
 #include "q3Scene.h"
 #include "../dynamics/q3Body.h"
@@ -32,22 +33,59 @@
 #include "../dynamics/q3Contact.h"
 #include "../dynamics/q3Island.h"
 #include "../dynamics/q3ContactSolver.h"
+#include "../dynamics/q3SimdContactSolver.h"
 #include "../collision/q3Box.h"
 
+//--------------------------------------------------------------------------------------------------
+// Island solving jobs
+//--------------------------------------------------------------------------------------------------
+struct q3IslandCostGreater
+{
+	bool operator()( i32 a, i32 b ) const
+	{
+		i32 costA = islands[ a ].m_contactCount * 8 + islands[ a ].m_bodyCount;
+		i32 costB = islands[ b ].m_contactCount * 8 + islands[ b ].m_bodyCount;
+
+		if ( costA != costB )
+			return costA > costB;
+
+		return a < b;
+	}
+
+	const q3Island* islands;
+};
+
+struct q3IslandSolveJob
+{
+	static void Solve( void* param, i32 index, i32 worker )
+	{
+		Q3_UNUSED( worker );
+
+		q3IslandSolveJob* job = (q3IslandSolveJob*)param;
+		job->islands[ job->order[ index ] ].Solve( );
+	}
+
+	q3Island* islands;
+	const i32* order;
+};
+
 //--------------------------------------------------------------------------------------------------
 // q3Scene
 //--------------------------------------------------------------------------------------------------
 q3Scene::q3Scene( r32 dt, const q3Vec3& gravity, i32 iterations )
-	: m_contactManager( &m_stack )
+	: m_contactManager( &m_stack, &m_threadPool )
 	, m_boxAllocator( sizeof( q3Box ), 256 )
 	, m_bodyCount( 0 )
 	, m_bodyList( NULL )
+	, m_simdScratch( NULL )
+	, m_simdScratchCapacity( 0 )
 	, m_gravity( gravity )
 	, m_dt( dt )
 	, m_iterations( iterations )
 	, m_newBox( false )
 	, m_allowSleep( true )
 	, m_enableFriction( true )
+	, m_enableSimdSolver( false )
 {
 }
 
@@ -55,6 +93,7 @@ q3Scene::q3Scene( r32 dt, const q3Vec3& gravity, i32 iterations )
 q3Scene::~q3Scene( )
 {
 	Shutdown( );
+	q3Free( m_simdScratch );
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -74,23 +113,24 @@ void q3Scene::Step( )
 	for ( q3ContactConstraint* c = m_contactManager.m_contactList; c; c = c->next )
 		c->m_flags &= ~q3ContactConstraint::eIsland;
 
-	// Size the stack island, pick worst case size
-	q3Island island;
-	island.m_bodyCapacity = m_bodyCount;
-	island.m_contactCapacity = m_contactManager.m_contactCount;
-	island.m_bodies = (q3Body**)m_stack.Allocate( sizeof( q3Body* ) * m_bodyCount );
-	island.m_velocities = (q3VelocityState *)m_stack.Allocate( sizeof( q3VelocityState ) * m_bodyCount );
-	island.m_contacts = (q3ContactConstraint **)m_stack.Allocate( sizeof( q3ContactConstraint* ) * island.m_contactCapacity );
-	island.m_contactStates = (q3ContactConstraintState *)m_stack.Allocate( sizeof( q3ContactConstraintState ) * island.m_contactCapacity );
-	island.m_allowSleep = m_allowSleep;
-	island.m_enableFriction = m_enableFriction;
-	island.m_bodyCount = 0;
-	island.m_contactCount = 0;
-	island.m_dt = m_dt;
-	island.m_gravity = m_gravity;
-	island.m_iterations = m_iterations;
-
-	// Build each active island and then solve each built island
+	// All islands are built first and then solved concurrently. Building only
+	// reads flags that solving never changes, so the islands are the same as
+	// when each one was solved right after being built. Islands share these
+	// arrays, each one owns a consecutive range. A static body can be part of
+	// several islands, and every appearance comes with a contact, which bounds
+	// the body entries.
+	i32 bodyCapacity = m_bodyCount + m_contactManager.m_contactCount;
+	i32 contactCapacity = m_contactManager.m_contactCount;
+	q3Island* islands = (q3Island*)m_stack.Allocate( sizeof( q3Island ) * m_bodyCount );
+	q3Body** islandBodies = (q3Body**)m_stack.Allocate( sizeof( q3Body* ) * bodyCapacity );
+	q3VelocityState* islandVelocities = (q3VelocityState *)m_stack.Allocate( sizeof( q3VelocityState ) * bodyCapacity );
+	q3ContactConstraint** islandContacts = (q3ContactConstraint **)m_stack.Allocate( sizeof( q3ContactConstraint* ) * contactCapacity );
+	q3ContactConstraintState* islandContactStates = (q3ContactConstraintState *)m_stack.Allocate( sizeof( q3ContactConstraintState ) * contactCapacity );
+	i32 islandCount = 0;
+	i32 bodyCount = 0;
+	i32 contactCount = 0;
+
+	// Build each active island
 	i32 stackSize = m_bodyCount;
 	q3Body** stack = (q3Body**)m_stack.Allocate( sizeof( q3Body* ) * stackSize );
 	for ( q3Body* seed = m_bodyList; seed; seed = seed->m_next )
@@ -108,10 +148,25 @@ void q3Scene::Step( )
 		if ( seed->m_flags & q3Body::eStatic )
 			continue;
 
+		q3Island* island = islands + islandCount++;
+		island->m_bodies = islandBodies + bodyCount;
+		island->m_velocities = islandVelocities + bodyCount;
+		island->m_bodyCapacity = bodyCapacity - bodyCount;
+		island->m_contacts = islandContacts + contactCount;
+		island->m_contactStates = islandContactStates + contactCount;
+		island->m_contactCapacity = contactCapacity - contactCount;
+		island->m_allowSleep = m_allowSleep;
+		island->m_enableFriction = m_enableFriction;
+		island->m_simdScratch = NULL;
+		island->m_bodyCount = 0;
+		island->m_contactCount = 0;
+		island->m_dt = m_dt;
+		island->m_gravity = m_gravity;
+		island->m_iterations = m_iterations;
+		island->m_asleep = false;
+
 		i32 stackCount = 0;
 		stack[ stackCount++ ] = seed;
-		island.m_bodyCount = 0;
-		island.m_contactCount = 0;
 
 		// Mark seed as apart of island
 		seed->m_flags |= q3Body::eIsland;
@@ -121,7 +176,7 @@ void q3Scene::Step( )
 		{
 			// Decrement stack to implement iterative backtracking
 			q3Body *body = stack[ --stackCount ];
-			island.Add( body );
+			island->Add( body );
 
 			// Awaken all bodies connected to the island
 			body->SetToAwake( );
@@ -153,7 +208,7 @@ void q3Scene::Step( )
 
 				// Mark island flag and add to island
 				contact->m_flags |= q3ContactConstraint::eIsland;
-				island.Add( contact );
+				island->Add( contact );
 
 				// Attempt to add the other body in the contact to the island
 				// to simulate contact awakening propogation
@@ -168,27 +223,96 @@ void q3Scene::Step( )
 			}
 		}
 
-		assert( island.m_bodyCount != 0 );
+		assert( island->m_bodyCount != 0 );
 
-		island.Initialize( );
-		island.Solve( );
+		// Static bodies are only indexed correctly within the island that
+		// was built last, so the contact states are set up right away
+		island->Initialize( );
+		island->m_bodyCapacity = island->m_bodyCount;
+		island->m_contactCapacity = island->m_contactCount;
+		bodyCount += island->m_bodyCount;
+		contactCount += island->m_contactCount;
 
 		// Reset all static island flags
 		// This allows static bodies to participate in other island formations
-		for ( i32 i = 0; i < island.m_bodyCount; i++ )
+		for ( i32 i = 0; i < island->m_bodyCount; i++ )
 		{
-			q3Body *body = island.m_bodies[ i ];
+			q3Body *body = island->m_bodies[ i ];
 
 			if ( body->m_flags & q3Body::eStatic )
 				body->m_flags &= ~q3Body::eIsland;
 		}
 	}
 
+	// Every island gets its own part of one scratch block, islands without
+	// contacts have nothing to solve. The block is kept across steps rather
+	// than taken from m_stack, it outgrows everything else Step( ) needs.
+	if ( m_enableSimdSolver )
+	{
+		i32 scratchSize = 0;
+		for ( i32 i = 0; i < islandCount; ++i )
+		{
+			if ( islands[ i ].m_contactCount )
+				scratchSize += q3SimdContactSolver::GetScratchSize( islands[ i ].m_contactCount, islands[ i ].m_bodyCount );
+		}
+
+		if ( scratchSize > m_simdScratchCapacity )
+		{
+			q3Free( m_simdScratch );
+			m_simdScratchCapacity = q3Max( scratchSize, m_simdScratchCapacity * 2 );
+			m_simdScratch = q3Alloc( m_simdScratchCapacity );
+		}
+
+		u8* scratch = (u8*)m_simdScratch;
+		for ( i32 i = 0; i < islandCount; ++i )
+		{
+			if ( islands[ i ].m_contactCount )
+			{
+				islands[ i ].m_simdScratch = scratch;
+				scratch += q3SimdContactSolver::GetScratchSize( islands[ i ].m_contactCount, islands[ i ].m_bodyCount );
+			}
+		}
+	}
+
+	// Solve the most expensive islands first so one big pile does not end up
+	// being started last
+	i32* order = (i32*)m_stack.Allocate( sizeof( i32 ) * islandCount );
+	for ( i32 i = 0; i < islandCount; ++i )
+		order[ i ] = i;
+
+	q3IslandCostGreater costGreater = { islands };
+	std::sort( order, order + islandCount, costGreater );
+
+	q3IslandSolveJob job = { islands, order };
+	m_threadPool.ParallelFor( islandCount, 1, q3IslandSolveJob::Solve, &job );
+
+	// Replay the static body wake ups and sleeps in build order, this leaves
+	// them in the state the last island touching them decided
+	for ( i32 i = 0; i < islandCount; ++i )
+	{
+		q3Island* island = islands + i;
+
+		for ( i32 j = 0; j < island->m_bodyCount; ++j )
+		{
+			q3Body *body = island->m_bodies[ j ];
+
+			if ( !(body->m_flags & q3Body::eStatic) )
+				continue;
+
+			body->SetToAwake( );
+
+			if ( island->m_asleep )
+				body->SetToSleep( );
+		}
+	}
+
+	m_stack.Free( order );
 	m_stack.Free( stack );
-	m_stack.Free( island.m_contactStates );
-	m_stack.Free( island.m_contacts );
-	m_stack.Free( island.m_velocities );
-	m_stack.Free( island.m_bodies );
+	m_stack.Free( islandContactStates );
+	m_stack.Free( islandContacts );
+	m_stack.Free( islandVelocities );
+	m_stack.Free( islandBodies );
+	m_stack.Free( islands );
 
 	// Update the broadphase AABBs
 	for ( q3Body* body = m_bodyList; body; body = body->m_next )
@@ -250,7 +374,7 @@ void q3Scene::RemoveBody( q3Body* body )
 
 	--m_bodyCount;
 
-	m_heap.Free( body );
+	m_heap.Free( body, sizeof( q3Body ) );
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -264,7 +388,7 @@ void q3Scene::RemoveAllBodies( )
 
 		body->RemoveAllBoxes( );
 
-		m_heap.Free( body );
+		m_heap.Free( body, sizeof( q3Body ) );
 
 		body = next;
 	}
@@ -296,6 +420,38 @@ void q3Scene::SetEnableFriction( bool enabled )
 	m_enableFriction = enabled;
 }
 
+//--------------------------------------------------------------------------------------------------
+void q3Scene::SetThreadCount( i32 count )
+{
+	m_threadPool.SetThreadCount( count );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3Scene::SetEnableSimdSolver( bool enabled )
+{
+	m_enableSimdSolver = enabled;
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3Scene::GetMemoryStats( q3AllocatorStats* heap, q3AllocatorStats* contacts, q3AllocatorStats* stack ) const
+{
+	m_heap.GetStats( heap );
+	m_contactManager.m_allocator.GetStats( contacts );
+	m_stack.GetStats( stack );
+}
+
+//--------------------------------------------------------------------------------------------------
+void q3Scene::GetBroadPhaseStats( q3BroadPhaseStats* stats ) const
+{
+	*stats = m_contactManager.m_broadphase.GetStats( );
+}
+
+//--------------------------------------------------------------------------------------------------
+i32 q3Scene::GetThreadCount( ) const
+{
+	return m_threadPool.GetThreadCount( );
+}
+
 //--------------------------------------------------------------------------------------------------
 void q3Scene::Render( q3Render* render ) const
 {
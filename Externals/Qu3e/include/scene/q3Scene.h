@@ -29,6 +29,7 @@
 
 #include "../common/q3Settings.h"
 #include "../common/q3Memory.h"
+#include "../common/q3ThreadPool.h"
 #include "../dynamics/q3ContactManager.h"
 
 //--------------------------------------------------------------------------------------------------
@@ -44,6 +45,13 @@ struct q3Island;
 // can be used for game logic and sounds. Physics objects created in these
 // callbacks will not be reported until the following frame. These callbacks
 // can be called frequently, so make them efficient.
+//
+// BeginContact and EndContact fire on the thread that called q3Scene::Step,
+// in contact list order, the same sequence as the serial narrow phase gave.
+// Since the narrow phase can run on several threads, they fire once every
+// contact of the step has been culled and updated rather than interleaved
+// with that pass. A callback therefore sees the new manifolds of all
+// contacts, including those later in the list.
 class q3ContactListener
 {
 public:
@@ -106,6 +114,25 @@ public:
 	// another. The friction force resists this sliding motion.
 	void SetEnableFriction( bool enabled );
 
+	// Number of threads Step( ) may use, including the calling thread. The
+	// default of one keeps everything on the caller. Results are identical
+	// for any thread count. The narrow phase and island solving run in
+	// parallel.
+	void SetThreadCount( i32 count );
+	i32 GetThreadCount( ) const;
+
+	// Solves contacts four at a time with SSE, see q3SimdContactSolver.
+	// Constraints are visited in a different order than the scalar solver,
+	// so results differ slightly between the two. Off by default.
+	void SetEnableSimdSolver( bool enabled );
+
+	// Allocator statistics. The heap holds bodies and boxes, contacts have
+	// their own pool and the stack holds the temporary memory of Step( ).
+	void GetMemoryStats( q3AllocatorStats* heap, q3AllocatorStats* contacts, q3AllocatorStats* stack ) const;
+
+	// Pair counters of the last broadphase update, at the end of Step( )
+	void GetBroadPhaseStats( q3BroadPhaseStats* stats ) const;
+
 	// Render the scene with an interpolated time between the last frame and
 	// the current simulation step.
 	void Render( q3Render* render ) const;
@@ -147,6 +174,7 @@ public:
 	void Dump( FILE* file ) const;
 
 private:
+	q3ThreadPool m_threadPool;
 	q3ContactManager m_contactManager;
 	q3PagedAllocator m_boxAllocator;
 
@@ -156,6 +184,9 @@ private:
 	q3Stack m_stack;
 	q3Heap m_heap;
 
+	void* m_simdScratch;
+	i32 m_simdScratchCapacity;
+
 	q3Vec3 m_gravity;
 	r32 m_dt;
 	i32 m_iterations;
@@ -163,6 +194,7 @@ private:
 	bool m_newBox;
 	bool m_allowSleep;
 	bool m_enableFriction;
+	bool m_enableSimdSolver;
 
 	friend class q3Body;
 };
@@ -230,4 +230,63 @@ uint64 File::Size() const
     return fileSize.QuadPart;
 }
 
+// == MappedFile ==================================================================================
+
+MappedFile::MappedFile() : fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr), data(nullptr), size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const wchar* filePath)
+{
+    Close();
+
+    fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if(GetFileSizeEx(fileHandle, &fileSize) == false || fileSize.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mappingHandle == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    data = reinterpret_cast<const uint8*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if(data == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    size = fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data != nullptr)
+        Win32Call(UnmapViewOfFile(data));
+    if(mappingHandle != nullptr)
+        Win32Call(CloseHandle(mappingHandle));
+    if(fileHandle != INVALID_HANDLE_VALUE)
+        Win32Call(CloseHandle(fileHandle));
+
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = nullptr;
+    data = nullptr;
+    size = 0;
+}
+
 }
\ No newline at end of file
@@ -68,6 +68,37 @@ public:
     uint64 Size() const;
 };
 
+// Read-only view of a whole file mapped into memory. Data() stays valid until Close(), so
+// callers can hand pointers into the file straight to the device without an intermediate copy.
+class MappedFile
+{
+
+private:
+
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+    const uint8* data;
+    uint64 size;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+
+    // Lifetime
+    MappedFile();
+    ~MappedFile();
+
+    // Returns false if the file doesn't exist or can't be mapped
+    bool Open(const wchar* filePath);
+    void Close();
+
+    // Accessors
+    const uint8* Data() const { return data; }
+    uint64 Size() const { return size; }
+    bool IsOpen() const { return data != nullptr; }
+};
+
 // == File ========================================================================================
 
 template<typename T> void File::Read(T& data) const
@@ -409,7 +409,7 @@ StructuredBuffer::StructuredBuffer() : Size(0), Stride(0), NumElements(0)
 }
 
 void StructuredBuffer::Initialize(ID3D11Device* device, uint32 stride, uint32 numElements, bool32 dynamic, bool32 useAsUAV,
-                                    bool32 appendConsume, bool32 hiddenCounter, const void* initData)
+                                    bool32 appendConsume, bool32 hiddenCounter, const void* initData, bool32 updatable)
 {
     Size = stride * numElements;
     Stride = stride;
@@ -422,10 +422,11 @@ void StructuredBuffer::Initialize(ID3D11Device* device, uint32 stride, uint32 nu
 
     D3D11_BUFFER_DESC bufferDesc;
     bufferDesc.ByteWidth = stride * numElements;
-    bufferDesc.Usage = useAsUAV ? D3D11_USAGE_DEFAULT : dynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_IMMUTABLE;
+    const bool32 defaultUsage = useAsUAV || updatable;
+    bufferDesc.Usage = defaultUsage ? D3D11_USAGE_DEFAULT : dynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_IMMUTABLE;
     bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
     bufferDesc.BindFlags |= useAsUAV ? D3D11_BIND_UNORDERED_ACCESS : 0;
-    bufferDesc.CPUAccessFlags = useAsUAV ? 0 : dynamic ? D3D11_CPU_ACCESS_WRITE : 0;
+    bufferDesc.CPUAccessFlags = defaultUsage ? 0 : dynamic ? D3D11_CPU_ACCESS_WRITE : 0;
     bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
     bufferDesc.StructureByteStride = stride;
 
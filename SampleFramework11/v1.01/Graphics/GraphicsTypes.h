@@ -146,8 +146,10 @@ struct StructuredBuffer
 
     StructuredBuffer();
 
+    // updatable creates a DEFAULT usage buffer without a UAV, for contents written with UpdateSubresource
     void Initialize(ID3D11Device* device, uint32 stride, uint32 numElements, bool32 dynamic = false, bool32 useAsUAV = false,
-                    bool32 appendConsume = false, bool32 hiddenCounter = false, const void* initData = nullptr);
+                    bool32 appendConsume = false, bool32 hiddenCounter = false, const void* initData = nullptr,
+                    bool32 updatable = false);
 
     void WriteToFile(const wchar* path, ID3D11Device* device, ID3D11DeviceContext* context);
     void ReadFromFile(const wchar* path, ID3D11Device* device);
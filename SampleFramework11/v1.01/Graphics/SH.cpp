@@ -12,6 +12,11 @@
 #include "..\\Utility.h"
 #include "ShaderCompilation.h"
 #include "Textures.h"
+#include "..\\Timer.h"
+
+#include <ppl.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 namespace SampleFramework11
 {
@@ -115,10 +120,9 @@ H4 ConvertToH4(const SH9& sh)
 }
 
 
-SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cubeMap)
+// Straight per texel loop, kept as the reference for SHCubemapProjector::RunBenchmark
+static SH9Color ProjectCubemapToSHScalar(const TextureData<Float4>& textureData)
 {
-    TextureData<Float4> textureData;
-    GetTextureData(device, cubeMap, textureData);
     Assert_(textureData.NumSlices == 6);
     const uint32 width = textureData.Width;
     const uint32 height = textureData.Height;
@@ -154,4 +158,857 @@ SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cube
     return result;
 }
 
-}
\ No newline at end of file
+SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cubeMap)
+{
+    SHCubemapProjector projector;
+    return ProjectCubemapToSH(device, cubeMap, projector);
+}
+
+SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cubeMap, SHCubemapProjector& projector)
+{
+    TextureData<Float4> textureData;
+    GetTextureData(device, cubeMap, textureData);
+    return projector.Project(textureData);
+}
+
+// ------------------------------------------------------------------------------------------------
+// SHCubemapProjector
+// ------------------------------------------------------------------------------------------------
+
+static const uint32 SHBlockSize = 8;
+static const uint32 SHRowsPerTask = 8;
+static const uint32 SHNumSums = 9 * 3;
+
+static bool CPUSupportsAVX()
+{
+    int info[4];
+    __cpuid(info, 1);
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if(!avx || !osxsave)
+        return false;
+
+    // The OS also has to save the upper halves of the YMM registers
+    return (_xgetbv(0) & 6) == 6;
+}
+
+static const bool UseAVX = CPUSupportsAVX();
+
+// Texel rows go through SoA scratch arrays padded to whole blocks
+struct SHRowScratch
+{
+    std::vector<float> R;
+    std::vector<float> G;
+    std::vector<float> B;
+    std::vector<float> Unpacked;
+
+    void Init(uint32 numBlocks)
+    {
+        R.assign(numBlocks * SHBlockSize, 0.0f);
+        G.assign(numBlocks * SHBlockSize, 0.0f);
+        B.assign(numBlocks * SHBlockSize, 0.0f);
+    }
+};
+
+static void LoadRow(const Float4* texels, uint32 width, SHRowScratch& scratch)
+{
+    for(uint32 x = 0; x < width; ++x)
+    {
+        scratch.R[x] = texels[x].x;
+        scratch.G[x] = texels[x].y;
+        scratch.B[x] = texels[x].z;
+    }
+}
+
+static void LoadRow(const Half4* texels, uint32 width, SHRowScratch& scratch)
+{
+    scratch.Unpacked.resize(width * 4);
+    XMConvertHalfToFloatStream(scratch.Unpacked.data(), sizeof(float), reinterpret_cast<const HALF*>(texels),
+                               sizeof(HALF), width * 4);
+
+    const float* rgba = scratch.Unpacked.data();
+    for(uint32 x = 0; x < width; ++x)
+    {
+        scratch.R[x] = rgba[x * 4 + 0];
+        scratch.G[x] = rgba[x * 4 + 1];
+        scratch.B[x] = rgba[x * 4 + 2];
+    }
+}
+
+static void AccumulateRowAVX(const float* basis, const SHRowScratch& row, uint32 numBlocks, double* sums)
+{
+    __m256 accR[9];
+    __m256 accG[9];
+    __m256 accB[9];
+    for(uint32 i = 0; i < 9; ++i)
+    {
+        accR[i] = _mm256_setzero_ps();
+        accG[i] = _mm256_setzero_ps();
+        accB[i] = _mm256_setzero_ps();
+    }
+
+    for(uint32 block = 0; block < numBlocks; ++block)
+    {
+        const __m256 r = _mm256_loadu_ps(&row.R[block * SHBlockSize]);
+        const __m256 g = _mm256_loadu_ps(&row.G[block * SHBlockSize]);
+        const __m256 b = _mm256_loadu_ps(&row.B[block * SHBlockSize]);
+        const float* blockBasis = basis + block * 9 * SHBlockSize;
+
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            const __m256 sh = _mm256_loadu_ps(blockBasis + i * SHBlockSize);
+            accR[i] = _mm256_add_ps(accR[i], _mm256_mul_ps(sh, r));
+            accG[i] = _mm256_add_ps(accG[i], _mm256_mul_ps(sh, g));
+            accB[i] = _mm256_add_ps(accB[i], _mm256_mul_ps(sh, b));
+        }
+    }
+
+    __declspec(align(32)) float lanes[3][SHBlockSize];
+    for(uint32 i = 0; i < 9; ++i)
+    {
+        _mm256_store_ps(lanes[0], accR[i]);
+        _mm256_store_ps(lanes[1], accG[i]);
+        _mm256_store_ps(lanes[2], accB[i]);
+        for(uint32 c = 0; c < 3; ++c)
+            for(uint32 lane = 0; lane < SHBlockSize; ++lane)
+                sums[i * 3 + c] += lanes[c][lane];
+    }
+}
+
+static void AccumulateRowScalar(const float* basis, const SHRowScratch& row, uint32 numBlocks, double* sums)
+{
+    float acc[SHNumSums] = { 0.0f };
+
+    for(uint32 block = 0; block < numBlocks; ++block)
+    {
+        const float* blockBasis = basis + block * 9 * SHBlockSize;
+        const uint32 first = block * SHBlockSize;
+
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            for(uint32 lane = 0; lane < SHBlockSize; ++lane)
+            {
+                const float sh = blockBasis[i * SHBlockSize + lane];
+                acc[i * 3 + 0] += sh * row.R[first + lane];
+                acc[i * 3 + 1] += sh * row.G[first + lane];
+                acc[i * 3 + 2] += sh * row.B[first + lane];
+            }
+        }
+    }
+
+    for(uint32 i = 0; i < SHNumSums; ++i)
+        sums[i] += acc[i];
+}
+
+void SHCubemapProjector::ClearCache()
+{
+    tables.clear();
+}
+
+const SHCubemapProjector::BasisTable& SHCubemapProjector::GetTable(uint32 width, uint32 height)
+{
+    for(uint64 i = 0; i < tables.size(); ++i)
+        if(tables[i]->Width == width && tables[i]->Height == height)
+            return *tables[i];
+
+    std::unique_ptr<BasisTable> table(new BasisTable());
+    table->Width = width;
+    table->Height = height;
+    table->NumBlocks = (width + SHBlockSize - 1) / SHBlockSize;
+
+    const uint32 numRows = 6 * height;
+    const uint32 rowSize = table->NumBlocks * 9 * SHBlockSize;
+    table->Basis.assign(uint64(numRows) * rowSize, 0.0f);
+
+    std::vector<double> rowWeights(numRows, 0.0);
+    BasisTable& t = *table;
+    concurrency::parallel_for(uint32(0), numRows, [&](uint32 row)
+    {
+        const uint32 face = row / height;
+        const uint32 y = row % height;
+        float* rowBasis = &t.Basis[uint64(row) * rowSize];
+
+        for(uint32 x = 0; x < width; ++x)
+        {
+            // Same weight and direction as the per texel loop
+            const float u = ((x + 0.5f) / width) * 2.0f - 1.0f;
+            const float v = ((y + 0.5f) / height) * 2.0f - 1.0f;
+            const float temp = 1.0f + u * u + v * v;
+            const float weight = 4.0f / (sqrt(temp) * temp);
+
+            SH9 sh = ProjectOntoSH9(MapXYSToDirection(x, y, face, width, height));
+            float* blockBasis = rowBasis + (x / SHBlockSize) * 9 * SHBlockSize;
+            for(uint32 i = 0; i < 9; ++i)
+                blockBasis[i * SHBlockSize + x % SHBlockSize] = sh.Coefficients[i] * weight;
+
+            rowWeights[row] += weight;
+        }
+    });
+
+    double weightSum = 0.0;
+    for(uint32 row = 0; row < numRows; ++row)
+        weightSum += rowWeights[row];
+    table->Normalization = float((4.0 * 3.14159) / weightSum);
+
+    tables.push_back(std::move(table));
+    return *tables.back();
+}
+
+template<typename T> SH9Color SHCubemapProjector::ProjectTexels(const TextureData<T>& cubeMap)
+{
+    Assert_(cubeMap.NumSlices == 6);
+    const uint32 width = cubeMap.Width;
+    const uint32 height = cubeMap.Height;
+    const BasisTable& table = GetTable(width, height);
+
+    const uint32 numRows = 6 * height;
+    const uint32 rowSize = table.NumBlocks * 9 * SHBlockSize;
+    const uint32 numTasks = (numRows + SHRowsPerTask - 1) / SHRowsPerTask;
+    taskSums.assign(numTasks * SHNumSums, 0.0);
+
+    concurrency::parallel_for(uint32(0), numTasks, [&](uint32 task)
+    {
+        SHRowScratch scratch;
+        scratch.Init(table.NumBlocks);
+        double* sums = &taskSums[task * SHNumSums];
+
+        const uint32 lastRow = std::min(numRows, (task + 1) * SHRowsPerTask);
+        for(uint32 row = task * SHRowsPerTask; row < lastRow; ++row)
+        {
+            LoadRow(&cubeMap.Texels[uint64(row) * width], width, scratch);
+            const float* rowBasis = &table.Basis[uint64(row) * rowSize];
+            if(UseAVX)
+                AccumulateRowAVX(rowBasis, scratch, table.NumBlocks, sums);
+            else
+                AccumulateRowScalar(rowBasis, scratch, table.NumBlocks, sums);
+        }
+    });
+
+    // Fixed summation order, the result doesn't depend on how tasks were scheduled
+    double total[SHNumSums] = { 0.0 };
+    for(uint32 task = 0; task < numTasks; ++task)
+        for(uint32 i = 0; i < SHNumSums; ++i)
+            total[i] += taskSums[task * SHNumSums + i];
+
+    SH9Color result;
+    for(uint32 i = 0; i < 9; ++i)
+        result.Coefficients[i] = Float3(float(total[i * 3 + 0]), float(total[i * 3 + 1]), float(total[i * 3 + 2]));
+
+    result *= table.Normalization;
+    return result;
+}
+
+SH9Color SHCubemapProjector::Project(const TextureData<Float4>& cubeMap)
+{
+    return ProjectTexels(cubeMap);
+}
+
+SH9Color SHCubemapProjector::Project(const TextureData<Half4>& cubeMap)
+{
+    return ProjectTexels(cubeMap);
+}
+
+static float MaxSHDifference(const SH9Color& a, const SH9Color& b)
+{
+    float maxDiff = 0.0f;
+    for(uint32 i = 0; i < 9; ++i)
+    {
+        Float3 diff = a.Coefficients[i] - b.Coefficients[i];
+        maxDiff = std::max(maxDiff, std::max(std::abs(diff.x), std::max(std::abs(diff.y), std::abs(diff.z))));
+    }
+    return maxDiff;
+}
+
+void SHCubemapProjector::RunBenchmark()
+{
+    static const uint32 NumIterations = 8;
+
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> colorDist(0.0f, 4.0f);
+
+    DebugPrint(std::wstring(L"SH projection benchmark (") + (UseAVX ? L"AVX" : L"scalar") + L" path)\n");
+
+    for(uint32 size = 16; size <= 1024; size *= 2)
+    {
+        TextureData<Float4> cubeMap;
+        cubeMap.Init(size, size, 6);
+        for(uint64 i = 0; i < cubeMap.Texels.size(); ++i)
+            cubeMap.Texels[i] = Float4(colorDist(rng), colorDist(rng), colorDist(rng), 1.0f);
+
+        TextureData<Half4> cubeMapHalf;
+        cubeMapHalf.Init(size, size, 6);
+        for(uint64 i = 0; i < cubeMap.Texels.size(); ++i)
+            cubeMapHalf.Texels[i] = Half4(cubeMap.Texels[i]);
+
+        SHCubemapProjector projector;
+        Timer timer;
+
+        timer.Update();
+        SH9Color reference = ProjectCubemapToSHScalar(cubeMap);
+        timer.Update();
+        const double scalarMs = timer.DeltaMillisecondsD();
+
+        // First call pays for the basis table
+        timer.Update();
+        projector.Project(cubeMap);
+        timer.Update();
+        const double firstMs = timer.DeltaMillisecondsD();
+
+        SH9Color result;
+        timer.Update();
+        for(uint32 iter = 0; iter < NumIterations; ++iter)
+            result = projector.Project(cubeMap);
+        timer.Update();
+        const double cachedMs = timer.DeltaMillisecondsD() / NumIterations;
+
+        SH9Color resultHalf;
+        timer.Update();
+        for(uint32 iter = 0; iter < NumIterations; ++iter)
+            resultHalf = projector.Project(cubeMapHalf);
+        timer.Update();
+        const double halfMs = timer.DeltaMillisecondsD() / NumIterations;
+
+        DebugPrint(ToString(size) + L"^2 per face: scalar " + ToString(scalarMs) + L"ms, first projection "
+                   + ToString(firstMs) + L"ms, cached Float4 " + ToString(cachedMs) + L"ms, cached Half4 "
+                   + ToString(halfMs) + L"ms, max difference " + ToString(MaxSHDifference(reference, result))
+                   + L" (Half4 " + ToString(MaxSHDifference(reference, resultHalf)) + L")\n");
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Batch evaluation, rotation and products
+// ------------------------------------------------------------------------------------------------
+
+static const uint32 SHMaxBatchWidth = 8;
+
+static const float SH9CosineKernel[9] =
+{
+    CosineA0, CosineA1, CosineA1, CosineA1, CosineA2, CosineA2, CosineA2, CosineA2, CosineA2
+};
+
+// Basis of 4 directions at once, same constants as ProjectOntoSH9
+static inline void SH9BasisSSE(__m128 x, __m128 y, __m128 z, __m128* basis)
+{
+    basis[0] = _mm_set1_ps(0.282095f);
+    basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), y);
+    basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), z);
+    basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), x);
+    basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, y));
+    basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(y, z));
+    basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)),
+                                                              _mm_set1_ps(1.0f)));
+    basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, z));
+    basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+}
+
+// Same for 8 directions
+static inline void SH9BasisAVX(__m256 x, __m256 y, __m256 z, __m256* basis)
+{
+    basis[0] = _mm256_set1_ps(0.282095f);
+    basis[1] = _mm256_mul_ps(_mm256_set1_ps(0.488603f), y);
+    basis[2] = _mm256_mul_ps(_mm256_set1_ps(0.488603f), z);
+    basis[3] = _mm256_mul_ps(_mm256_set1_ps(0.488603f), x);
+    basis[4] = _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(x, y));
+    basis[5] = _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(y, z));
+    basis[6] = _mm256_mul_ps(_mm256_set1_ps(0.315392f), _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(z, z)),
+                                                                      _mm256_set1_ps(1.0f)));
+    basis[7] = _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(x, z));
+    basis[8] = _mm256_mul_ps(_mm256_set1_ps(0.546274f), _mm256_sub_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+}
+
+// A block of directions and weighted colors transposed to SoA
+struct SHDirectionBlock
+{
+    __declspec(align(32)) float X[SHMaxBatchWidth];
+    __declspec(align(32)) float Y[SHMaxBatchWidth];
+    __declspec(align(32)) float Z[SHMaxBatchWidth];
+    __declspec(align(32)) float R[SHMaxBatchWidth];
+    __declspec(align(32)) float G[SHMaxBatchWidth];
+    __declspec(align(32)) float B[SHMaxBatchWidth];
+};
+
+static void LoadDirectionBlock(const Float3* dirs, const Float3* colors, const float* weights, uint32 width,
+                               SHDirectionBlock& block)
+{
+    for(uint32 i = 0; i < width; ++i)
+    {
+        block.X[i] = dirs[i].x;
+        block.Y[i] = dirs[i].y;
+        block.Z[i] = dirs[i].z;
+
+        if(colors != nullptr)
+        {
+            const float weight = weights != nullptr ? weights[i] : 1.0f;
+            block.R[i] = colors[i].x * weight;
+            block.G[i] = colors[i].y * weight;
+            block.B[i] = colors[i].z * weight;
+        }
+    }
+}
+
+static void ProjectBlocksSSE(const Float3* dirs, const Float3* colors, const float* weights, uint64 count, float* sums)
+{
+    __m128 acc[SHNumSums];
+    for(uint32 i = 0; i < SHNumSums; ++i)
+        acc[i] = _mm_setzero_ps();
+
+    SHDirectionBlock block;
+    for(uint64 first = 0; first < count; first += 4)
+    {
+        LoadDirectionBlock(dirs + first, colors + first, weights != nullptr ? weights + first : nullptr, 4, block);
+
+        __m128 basis[9];
+        SH9BasisSSE(_mm_load_ps(block.X), _mm_load_ps(block.Y), _mm_load_ps(block.Z), basis);
+        const __m128 r = _mm_load_ps(block.R);
+        const __m128 g = _mm_load_ps(block.G);
+        const __m128 b = _mm_load_ps(block.B);
+
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            acc[i * 3 + 0] = _mm_add_ps(acc[i * 3 + 0], _mm_mul_ps(basis[i], r));
+            acc[i * 3 + 1] = _mm_add_ps(acc[i * 3 + 1], _mm_mul_ps(basis[i], g));
+            acc[i * 3 + 2] = _mm_add_ps(acc[i * 3 + 2], _mm_mul_ps(basis[i], b));
+        }
+    }
+
+    __declspec(align(16)) float lanes[4];
+    for(uint32 i = 0; i < SHNumSums; ++i)
+    {
+        _mm_store_ps(lanes, acc[i]);
+        sums[i] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+}
+
+static void ProjectBlocksAVX(const Float3* dirs, const Float3* colors, const float* weights, uint64 count, float* sums)
+{
+    __m256 acc[SHNumSums];
+    for(uint32 i = 0; i < SHNumSums; ++i)
+        acc[i] = _mm256_setzero_ps();
+
+    SHDirectionBlock block;
+    for(uint64 first = 0; first < count; first += 8)
+    {
+        LoadDirectionBlock(dirs + first, colors + first, weights != nullptr ? weights + first : nullptr, 8, block);
+
+        __m256 basis[9];
+        SH9BasisAVX(_mm256_load_ps(block.X), _mm256_load_ps(block.Y), _mm256_load_ps(block.Z), basis);
+        const __m256 r = _mm256_load_ps(block.R);
+        const __m256 g = _mm256_load_ps(block.G);
+        const __m256 b = _mm256_load_ps(block.B);
+
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            acc[i * 3 + 0] = _mm256_add_ps(acc[i * 3 + 0], _mm256_mul_ps(basis[i], r));
+            acc[i * 3 + 1] = _mm256_add_ps(acc[i * 3 + 1], _mm256_mul_ps(basis[i], g));
+            acc[i * 3 + 2] = _mm256_add_ps(acc[i * 3 + 2], _mm256_mul_ps(basis[i], b));
+        }
+    }
+
+    __declspec(align(32)) float lanes[8];
+    for(uint32 i = 0; i < SHNumSums; ++i)
+    {
+        _mm256_store_ps(lanes, acc[i]);
+        sums[i] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+}
+
+SH9Color ProjectOntoSH9ColorBatch(const Float3* dirs, const Float3* colors, const float* weights, uint64 count)
+{
+    const uint32 width = UseAVX ? 8 : 4;
+    const uint64 numBlocked = count - count % width;
+
+    float sums[SHNumSums] = { 0.0f };
+    if(numBlocked > 0)
+    {
+        if(UseAVX)
+            ProjectBlocksAVX(dirs, colors, weights, numBlocked, sums);
+        else
+            ProjectBlocksSSE(dirs, colors, weights, numBlocked, sums);
+    }
+
+    SH9Color result;
+    for(uint32 i = 0; i < 9; ++i)
+        result.Coefficients[i] = Float3(sums[i * 3 + 0], sums[i * 3 + 1], sums[i * 3 + 2]);
+
+    for(uint64 i = numBlocked; i < count; ++i)
+        result += ProjectOntoSH9Color(dirs[i], colors[i]) * (weights != nullptr ? weights[i] : 1.0f);
+
+    return result;
+}
+
+static void EvalBlocksSSE(const float* shR, const float* shG, const float* shB, const Float3* dirs, uint64 count,
+                          Float3* results)
+{
+    SHDirectionBlock block;
+    __declspec(align(16)) float r[4];
+    __declspec(align(16)) float g[4];
+    __declspec(align(16)) float b[4];
+
+    for(uint64 first = 0; first < count; first += 4)
+    {
+        LoadDirectionBlock(dirs + first, nullptr, nullptr, 4, block);
+
+        __m128 basis[9];
+        SH9BasisSSE(_mm_load_ps(block.X), _mm_load_ps(block.Y), _mm_load_ps(block.Z), basis);
+
+        __m128 accR = _mm_setzero_ps();
+        __m128 accG = _mm_setzero_ps();
+        __m128 accB = _mm_setzero_ps();
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            accR = _mm_add_ps(accR, _mm_mul_ps(basis[i], _mm_set1_ps(shR[i])));
+            accG = _mm_add_ps(accG, _mm_mul_ps(basis[i], _mm_set1_ps(shG[i])));
+            accB = _mm_add_ps(accB, _mm_mul_ps(basis[i], _mm_set1_ps(shB[i])));
+        }
+
+        _mm_store_ps(r, accR);
+        _mm_store_ps(g, accG);
+        _mm_store_ps(b, accB);
+        for(uint32 lane = 0; lane < 4; ++lane)
+            results[first + lane] = Float3(r[lane], g[lane], b[lane]);
+    }
+}
+
+static void EvalBlocksAVX(const float* shR, const float* shG, const float* shB, const Float3* dirs, uint64 count,
+                          Float3* results)
+{
+    SHDirectionBlock block;
+    __declspec(align(32)) float r[8];
+    __declspec(align(32)) float g[8];
+    __declspec(align(32)) float b[8];
+
+    for(uint64 first = 0; first < count; first += 8)
+    {
+        LoadDirectionBlock(dirs + first, nullptr, nullptr, 8, block);
+
+        __m256 basis[9];
+        SH9BasisAVX(_mm256_load_ps(block.X), _mm256_load_ps(block.Y), _mm256_load_ps(block.Z), basis);
+
+        __m256 accR = _mm256_setzero_ps();
+        __m256 accG = _mm256_setzero_ps();
+        __m256 accB = _mm256_setzero_ps();
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            accR = _mm256_add_ps(accR, _mm256_mul_ps(basis[i], _mm256_set1_ps(shR[i])));
+            accG = _mm256_add_ps(accG, _mm256_mul_ps(basis[i], _mm256_set1_ps(shG[i])));
+            accB = _mm256_add_ps(accB, _mm256_mul_ps(basis[i], _mm256_set1_ps(shB[i])));
+        }
+
+        _mm256_store_ps(r, accR);
+        _mm256_store_ps(g, accG);
+        _mm256_store_ps(b, accB);
+        for(uint32 lane = 0; lane < 8; ++lane)
+            results[first + lane] = Float3(r[lane], g[lane], b[lane]);
+    }
+}
+
+void EvalSH9CosineBatch(const SH9Color& sh, const Float3* dirs, uint64 count, Float3* results)
+{
+    // Cosine kernel folded into the coefficients once instead of into every direction's basis
+    float shR[9];
+    float shG[9];
+    float shB[9];
+    for(uint32 i = 0; i < 9; ++i)
+    {
+        shR[i] = sh.Coefficients[i].x * SH9CosineKernel[i];
+        shG[i] = sh.Coefficients[i].y * SH9CosineKernel[i];
+        shB[i] = sh.Coefficients[i].z * SH9CosineKernel[i];
+    }
+
+    const uint32 width = UseAVX ? 8 : 4;
+    const uint64 numBlocked = count - count % width;
+    if(numBlocked > 0)
+    {
+        if(UseAVX)
+            EvalBlocksAVX(shR, shG, shB, dirs, numBlocked, results);
+        else
+            EvalBlocksSSE(shR, shG, shB, dirs, numBlocked, results);
+    }
+
+    for(uint64 i = numBlocked; i < count; ++i)
+        results[i] = EvalSH9Cosine(dirs[i], sh);
+}
+
+// Integral of x^a * y^b * z^c over the unit sphere
+static double SphereMonomialIntegral(uint32 a, uint32 b, uint32 c)
+{
+    if((a | b | c) & 1)
+        return 0.0;
+
+    return 2.0 * std::tgamma((a + 1) * 0.5) * std::tgamma((b + 1) * 0.5) * std::tgamma((c + 1) * 0.5)
+           / std::tgamma((a + b + c + 3) * 0.5);
+}
+
+// The basis functions as polynomials in x, y and z, same constants as ProjectOntoSH9
+struct SHPolynomialTerm
+{
+    float Coefficient;
+    uint32 X;
+    uint32 Y;
+    uint32 Z;
+};
+
+static const SHPolynomialTerm SH9Polynomials[9][2] =
+{
+    { { 0.282095f, 0, 0, 0 }, { 0.0f, 0, 0, 0 } },
+    { { 0.488603f, 0, 1, 0 }, { 0.0f, 0, 0, 0 } },
+    { { 0.488603f, 0, 0, 1 }, { 0.0f, 0, 0, 0 } },
+    { { 0.488603f, 1, 0, 0 }, { 0.0f, 0, 0, 0 } },
+    { { 1.092548f, 1, 1, 0 }, { 0.0f, 0, 0, 0 } },
+    { { 1.092548f, 0, 1, 1 }, { 0.0f, 0, 0, 0 } },
+    { { 3.0f * 0.315392f, 0, 0, 2 }, { -0.315392f, 0, 0, 0 } },
+    { { 1.092548f, 1, 0, 1 }, { 0.0f, 0, 0, 0 } },
+    { { 0.546274f, 2, 0, 0 }, { -0.546274f, 0, 2, 0 } },
+};
+
+// Non-zero entries of the triple product tensor, the integral of Y_a * Y_b * Y_c
+struct SHProductEntry
+{
+    uint32 A;
+    uint32 B;
+    uint32 C;
+    float Value;
+};
+
+static std::vector<SHProductEntry> BuildSHProductTable()
+{
+    std::vector<SHProductEntry> table;
+    for(uint32 a = 0; a < 9; ++a)
+    {
+        for(uint32 b = 0; b < 9; ++b)
+        {
+            for(uint32 c = 0; c < 9; ++c)
+            {
+                double integral = 0.0;
+                for(uint32 ta = 0; ta < 2; ++ta)
+                {
+                    for(uint32 tb = 0; tb < 2; ++tb)
+                    {
+                        for(uint32 tc = 0; tc < 2; ++tc)
+                        {
+                            const SHPolynomialTerm& termA = SH9Polynomials[a][ta];
+                            const SHPolynomialTerm& termB = SH9Polynomials[b][tb];
+                            const SHPolynomialTerm& termC = SH9Polynomials[c][tc];
+                            integral += double(termA.Coefficient) * termB.Coefficient * termC.Coefficient
+                                        * SphereMonomialIntegral(termA.X + termB.X + termC.X, termA.Y + termB.Y + termC.Y,
+                                                                 termA.Z + termB.Z + termC.Z);
+                        }
+                    }
+                }
+
+                if(std::abs(integral) > 1e-6)
+                {
+                    SHProductEntry entry = { a, b, c, float(integral) };
+                    table.push_back(entry);
+                }
+            }
+        }
+    }
+
+    return table;
+}
+
+static const std::vector<SHProductEntry> SHProductTable = BuildSHProductTable();
+
+SH9 MultiplySH9(const SH9& a, const SH9& b)
+{
+    SH9 result;
+    for(uint64 i = 0; i < SHProductTable.size(); ++i)
+    {
+        const SHProductEntry& entry = SHProductTable[i];
+        result.Coefficients[entry.C] += a.Coefficients[entry.A] * b.Coefficients[entry.B] * entry.Value;
+    }
+    return result;
+}
+
+SH9Color MultiplySH9(const SH9Color& a, const SH9& b)
+{
+    SH9Color result;
+    for(uint64 i = 0; i < SHProductTable.size(); ++i)
+    {
+        const SHProductEntry& entry = SHProductTable[i];
+        result.Coefficients[entry.C] += a.Coefficients[entry.A] * (b.Coefficients[entry.B] * entry.Value);
+    }
+    return result;
+}
+
+// Directions band 2 rotation is solved at, the basis is invertible there
+static const float SHRotationK = 0.707106781f;
+static const Float3 SHRotationDirs[5] =
+{
+    Float3(1.0f, 0.0f, 0.0f),
+    Float3(0.0f, 0.0f, 1.0f),
+    Float3(SHRotationK, SHRotationK, 0.0f),
+    Float3(SHRotationK, 0.0f, SHRotationK),
+    Float3(0.0f, SHRotationK, SHRotationK),
+};
+
+// Inverse of the band 2 basis at SHRotationDirs, computed once with Gauss-Jordan elimination
+struct SHBand2Inverse
+{
+    float M[5][5];
+
+    SHBand2Inverse()
+    {
+        double a[5][10];
+        for(uint32 d = 0; d < 5; ++d)
+        {
+            SH9 sh = ProjectOntoSH9(SHRotationDirs[d]);
+            for(uint32 j = 0; j < 5; ++j)
+            {
+                a[d][j] = sh.Coefficients[4 + j];
+                a[d][5 + j] = d == j ? 1.0 : 0.0;
+            }
+        }
+
+        for(uint32 col = 0; col < 5; ++col)
+        {
+            uint32 pivot = col;
+            for(uint32 row = col + 1; row < 5; ++row)
+                if(std::abs(a[row][col]) > std::abs(a[pivot][col]))
+                    pivot = row;
+            for(uint32 j = 0; j < 10; ++j)
+                std::swap(a[col][j], a[pivot][j]);
+
+            const double scale = 1.0 / a[col][col];
+            for(uint32 j = 0; j < 10; ++j)
+                a[col][j] *= scale;
+
+            for(uint32 row = 0; row < 5; ++row)
+            {
+                if(row == col)
+                    continue;
+                const double factor = a[row][col];
+                for(uint32 j = 0; j < 10; ++j)
+                    a[row][j] -= factor * a[col][j];
+            }
+        }
+
+        for(uint32 i = 0; i < 5; ++i)
+            for(uint32 j = 0; j < 5; ++j)
+                M[i][j] = float(a[i][5 + j]);
+    }
+};
+
+static const SHBand2Inverse Band2Inverse;
+
+SH9Rotation::SH9Rotation(const Float3x3& rotation)
+{
+    // Band 1 is a constant times (y, z, x), it transforms like a direction
+    static const uint32 Axes[3] = { 1, 2, 0 };
+    const float m[3][3] =
+    {
+        { rotation._11, rotation._12, rotation._13 },
+        { rotation._21, rotation._22, rotation._23 },
+        { rotation._31, rotation._32, rotation._33 },
+    };
+
+    for(uint32 i = 0; i < 3; ++i)
+        for(uint32 j = 0; j < 3; ++j)
+            Band1[i][j] = m[Axes[j]][Axes[i]];
+
+    // The rotated function at the fixed directions is the original one at the inversely rotated
+    // directions, the inverse basis turns those values back into coefficients
+    const Float3x3 inverse = Float3x3::Transpose(rotation);
+    float rotatedBasis[5][5];
+    for(uint32 d = 0; d < 5; ++d)
+    {
+        SH9 sh = ProjectOntoSH9(Float3::Transform(SHRotationDirs[d], inverse));
+        for(uint32 j = 0; j < 5; ++j)
+            rotatedBasis[d][j] = sh.Coefficients[4 + j];
+    }
+
+    for(uint32 i = 0; i < 5; ++i)
+    {
+        for(uint32 j = 0; j < 5; ++j)
+        {
+            Band2[i][j] = 0.0f;
+            for(uint32 d = 0; d < 5; ++d)
+                Band2[i][j] += Band2Inverse.M[i][d] * rotatedBasis[d][j];
+        }
+    }
+}
+
+SH9 SH9Rotation::Apply(const SH9& sh) const
+{
+    SH9 result;
+    result.Coefficients[0] = sh.Coefficients[0];
+
+    for(uint32 i = 0; i < 3; ++i)
+        for(uint32 j = 0; j < 3; ++j)
+            result.Coefficients[1 + i] += Band1[i][j] * sh.Coefficients[1 + j];
+
+    for(uint32 i = 0; i < 5; ++i)
+        for(uint32 j = 0; j < 5; ++j)
+            result.Coefficients[4 + i] += Band2[i][j] * sh.Coefficients[4 + j];
+
+    return result;
+}
+
+SH9Color SH9Rotation::Apply(const SH9Color& sh) const
+{
+    SH9Color result;
+    result.Coefficients[0] = sh.Coefficients[0];
+
+    for(uint32 i = 0; i < 3; ++i)
+        for(uint32 j = 0; j < 3; ++j)
+            result.Coefficients[1 + i] += sh.Coefficients[1 + j] * Band1[i][j];
+
+    for(uint32 i = 0; i < 5; ++i)
+        for(uint32 j = 0; j < 5; ++j)
+            result.Coefficients[4 + i] += sh.Coefficients[4 + j] * Band2[i][j];
+
+    return result;
+}
+
+void SH9Rotation::Apply(const SH9Color* sh, uint64 count, SH9Color* results) const
+{
+    __m128 band1[3][3];
+    __m128 band2[5][5];
+    for(uint32 i = 0; i < 3; ++i)
+        for(uint32 j = 0; j < 3; ++j)
+            band1[i][j] = _mm_set1_ps(Band1[i][j]);
+    for(uint32 i = 0; i < 5; ++i)
+        for(uint32 j = 0; j < 5; ++j)
+            band2[i][j] = _mm_set1_ps(Band2[i][j]);
+
+    __declspec(align(16)) float lanes[4];
+    for(uint64 p = 0; p < count; ++p)
+    {
+        // everything is loaded before anything is stored, sh and results may be the same array
+        __m128 c[9];
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            const Float3& coefficient = sh[p].Coefficients[i];
+            c[i] = _mm_setr_ps(coefficient.x, coefficient.y, coefficient.z, 0.0f);
+        }
+
+        __m128 rotated[9];
+        rotated[0] = c[0];
+        for(uint32 i = 0; i < 3; ++i)
+        {
+            rotated[1 + i] = _mm_mul_ps(band1[i][0], c[1]);
+            for(uint32 j = 1; j < 3; ++j)
+                rotated[1 + i] = _mm_add_ps(rotated[1 + i], _mm_mul_ps(band1[i][j], c[1 + j]));
+        }
+        for(uint32 i = 0; i < 5; ++i)
+        {
+            rotated[4 + i] = _mm_mul_ps(band2[i][0], c[4]);
+            for(uint32 j = 1; j < 5; ++j)
+                rotated[4 + i] = _mm_add_ps(rotated[4 + i], _mm_mul_ps(band2[i][j], c[4 + j]));
+        }
+
+        for(uint32 i = 0; i < 9; ++i)
+        {
+            _mm_store_ps(lanes, rotated[i]);
+            results[p].Coefficients[i] = Float3(lanes[0], lanes[1], lanes[2]);
+        }
+    }
+}
+
+SH9Color RotateSH9(const SH9Color& sh, const Float3x3& rotation)
+{
+    return SH9Rotation(rotation).Apply(sh);
+}
+
+}
@@ -11,6 +11,7 @@
 
 #include "..\\PCH.h"
 #include "GraphicsTypes.h"
+#include "Textures.h"
 #include "..\\SF11_Math.h"
 
 namespace SampleFramework11
@@ -219,14 +220,93 @@ SH9 ProjectOntoSH9(const Float3& dir);
 SH9Color ProjectOntoSH9Color(const Float3& dir, const Float3& color);
 Float3 EvalSH9Cosine(const Float3& dir, const SH9Color& sh);
 
+// Batch versions of the above. Directions are processed 8 at a time with AVX when the CPU has
+// it, 4 at a time with SSE otherwise, and the remainder goes through the scalar functions.
+// Results match the scalar functions up to float rounding and summation order.
+
+// Sum of ProjectOntoSH9Color(dirs[i], colors[i]) * weights[i], null weights count as 1
+SH9Color ProjectOntoSH9ColorBatch(const Float3* dirs, const Float3* colors, const float* weights, uint64 count);
+
+// EvalSH9Cosine(dirs[i], sh) for every direction, e.g. all the normals lit by one probe
+void EvalSH9CosineBatch(const SH9Color& sh, const Float3* dirs, uint64 count, Float3* results);
+
+// Product of the two functions projected back onto SH9, using the triple product tensor of the
+// basis. Not the same as operator*, which multiplies the coefficients.
+SH9 MultiplySH9(const SH9& a, const SH9& b);
+SH9Color MultiplySH9(const SH9Color& a, const SH9& b);
+
+// Rotates SH9 coefficients, so baked probes can follow a rotating transform. The per band
+// matrices are built once per rotation and then applied to any number of probes: band 1 is the
+// rotation matrix itself, band 2 is solved for from the basis at five fixed directions.
+class SH9Rotation
+{
+
+public:
+
+    // Light arriving from direction d arrives from Float3::Transform(d, rotation) afterwards
+    explicit SH9Rotation(const Float3x3& rotation);
+
+    SH9 Apply(const SH9& sh) const;
+    SH9Color Apply(const SH9Color& sh) const;
+
+    // Same as Apply on every element, with the color channels of a coefficient in one SSE register
+    void Apply(const SH9Color* sh, uint64 count, SH9Color* results) const;
+
+    float Band1[3][3];
+    float Band2[5][5];
+};
+
+SH9Color RotateSH9(const SH9Color& sh, const Float3x3& rotation);
+
 // H-basis functions
 H4 ProjectOntoH4(const Float3& dir);
 float EvalH4(const H4& h, const Float3& dir);
 H4 ConvertToH4(const SH9& sh);
 
-// Lighting environment generation functions
+// Lighting environment generation functions. This overload builds its basis table on every call
+// and is safe to call from several threads
 SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cubeMap);
 
+// Projects cubemaps onto SH9 on the CPU. The SH basis of every texel times its solid angle weight
+// only depends on the face size, so it is computed once per size and cached. Projecting is then a
+// multiply-add of the texel colors against that table, 8 texels at a time with AVX when the CPU
+// has it, with the rows of all faces split across threads. Results are summed in a fixed order so
+// they don't depend on the thread count. Not safe to use from several threads at once.
+class SHCubemapProjector
+{
+
+public:
+
+    SH9Color Project(const TextureData<Float4>& cubeMap);
+    SH9Color Project(const TextureData<Half4>& cubeMap);
+
+    void ClearCache();
+
+    // Times the scalar per texel loop against Project() for 16x16 to 1024x1024 faces and
+    // reports the largest coefficient difference
+    static void RunBenchmark();
+
+protected:
+
+    struct BasisTable
+    {
+        uint32 Width = 0;
+        uint32 Height = 0;
+        uint32 NumBlocks = 0;           // 8 texel blocks per row, padding texels have zero weight
+        float Normalization = 0.0f;     // 4 * Pi / sum of the weights
+        std::vector<float> Basis;       // per block, 9 coefficients x 8 texels
+    };
+
+    const BasisTable& GetTable(uint32 width, uint32 height);
+    template<typename T> SH9Color ProjectTexels(const TextureData<T>& cubeMap);
+
+    std::vector<std::unique_ptr<BasisTable>> tables;
+    std::vector<double> taskSums;
+};
+
+// Projects with a caller owned projector so its basis tables are reused across calls
+SH9Color ProjectCubemapToSH(ID3D11Device* device, ID3D11ShaderResourceView* cubeMap, SHCubemapProjector& projector);
+
 // Constants
 static const H4 H4Identity = H4(std::sqrt(2.0f * 3.14159f), 0.0f, 0.0f, 0.0f);
 
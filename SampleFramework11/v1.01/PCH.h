@@ -178,11 +178,9 @@ using namespace DirectX::PackedVector;
 #ifdef _DEBUG
 #pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Debug\\freeglut_static.lib")
 #pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Debug\\imgui.lib")
-#pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Debug\\qu3e.lib")
 #else
 #pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Release\\freeglut_static.lib")
 #pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Release\\imgui.lib")
-#pragma comment(lib, "..\\..\\Externals\\Qu3e\\lib\\Release\\qu3e.lib")
 #endif
 
 #include <AppPCH.h>
\ No newline at end of file
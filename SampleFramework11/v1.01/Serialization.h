@@ -73,6 +73,65 @@ public:
     static bool IsWriteSerializer() { return true; }
 };
 
+// Reads from a block of memory, e.g. a MappedFile. Reading past the end zero fills and marks the
+// serializer as overrun instead of throwing, so callers can treat truncated data as a miss.
+// SerializeInPlace() hands out a pointer into the block instead of copying.
+class MemoryReadSerializer
+{
+
+private:
+
+    const uint8* data;
+    uint64 size;
+    uint64 offset = 0;
+    bool overrun = false;
+
+public:
+
+    MemoryReadSerializer(const void* data_, uint64 size_) : data(reinterpret_cast<const uint8*>(data_)), size(size_)
+    {
+    }
+
+    template<typename T> void SerializeItem(T& item)
+    {
+        SerializeData(sizeof(T), &item);
+    }
+
+    void SerializeData(uint64 numBytes, void* dst)
+    {
+        const void* src = SerializeInPlace(numBytes);
+        if(src != nullptr)
+            memcpy(dst, src, size_t(numBytes));
+        else
+            memset(dst, 0, size_t(numBytes));
+    }
+
+    const void* SerializeInPlace(uint64 numBytes)
+    {
+        if(overrun || numBytes > size - offset)
+        {
+            overrun = true;
+            return nullptr;
+        }
+
+        const void* src = data + offset;
+        offset += numBytes;
+        return src;
+    }
+
+    void Seek(uint64 newOffset)
+    {
+        overrun |= newOffset > size;
+        offset = newOffset < size ? newOffset : size;
+    }
+
+    static bool IsReadSerializer() { return true; }
+    static bool IsWriteSerializer() { return false; }
+
+    uint64 Offset() const { return offset; }
+    bool Overrun() const { return overrun; }
+};
+
 class ComputeSizeSerializer
 {
 
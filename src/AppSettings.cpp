@@ -46,6 +46,12 @@ static const char* ShadingTechLabels[2] =
     "Clustered_Deferred",
 };
 
+static const char* LightClusterModesLabels[2] =
+{
+    "WorldGrid",
+    "Frustum",
+};
+
 namespace AppSettings
 {
     MSAAModesSetting MSAAMode;
@@ -87,6 +93,9 @@ namespace AppSettings
     BoolSetting EnableRealtimeCubemap;
     IntSetting DiffuseGIBounces;
     FloatSetting DiffuseGI_Intensity;
+    BoolSetting AdaptiveProbePlacement;
+    IntSetting ProbeUpdateBudget;
+    BoolSetting CompressSHProbes;
     FloatSetting NormalMapIntensity;
     FloatSetting DiffuseIntensity;
     FloatSetting Roughness;
@@ -99,6 +108,7 @@ namespace AppSettings
     FloatSetting BoxSizeX;
     FloatSetting BoxSizeY;
     FloatSetting BoxSizeZ;
+    FloatSetting ProbeFadeBand;
     OrientationSetting SceneOrientation;
     FloatSetting ModelRotationSpeed;
     BoolSetting DoubleSyncInterval;
@@ -107,6 +117,13 @@ namespace AppSettings
     FloatSetting BloomMagnitude;
     FloatSetting BloomBlurSigma;
     FloatSetting ManualExposure;
+    BoolSetting ParallelLightAssignment;
+    BoolSetting IncrementalLightAssignment;
+    LightClusterModesSetting LightClusterMode;
+    BoolSetting EnableFrustumCulling;
+    BoolSetting HierarchicalCulling;
+    BoolSetting InstancedRendering;
+    Button RunBenchmarks;
 
     ConstantBuffer<AppSettingsCBuffer> CBuffer;
 
@@ -231,6 +248,15 @@ namespace AppSettings
         DiffuseGI_Intensity.Initialize(tweakBar, "DiffuseGI_Intensity", "Scene Controls", "GI Intensity", "The intensity of Indirect diffuse from GI", 1.0000f, 0.0000f, 10.0000f, 0.1000f, ConversionMode::None, 1.0000f);
         Settings.AddSetting(&DiffuseGI_Intensity);
 
+        AdaptiveProbePlacement.Initialize(tweakBar, "AdaptiveProbePlacement", "Scene Controls", "Adaptive Probe Placement", "Place irradiance volume probes on an octree refined near the proxy geometry, dropping probes inside it, instead of a dense grid", false);
+        Settings.AddSetting(&AdaptiveProbePlacement);
+
+        ProbeUpdateBudget.Initialize(tweakBar, "ProbeUpdateBudget", "Scene Controls", "Probe Update Budget", "Irradiance volume probes relit per frame, picked by camera distance, light changes and time since their last update. 0 relights every probe every frame", 0, 0, 512);
+        Settings.AddSetting(&ProbeUpdateBudget);
+
+        CompressSHProbes.Initialize(tweakBar, "CompressSHProbes", "Scene Controls", "Compress SH Probes", "Shade from and cache the irradiance volume probes as 32 byte FP16 DC + 8-bit L1/L2 SH instead of 144 byte float SH", false);
+        Settings.AddSetting(&CompressSHProbes);
+
         NormalMapIntensity.Initialize(tweakBar, "NormalMapIntensity", "Scene Controls", "Normal Map Intensity", "", 1.0000f, 0.0000f, 1.0000f, 0.0100f, ConversionMode::None, 1.0000f);
         Settings.AddSetting(&NormalMapIntensity);
 
@@ -267,6 +293,9 @@ namespace AppSettings
         BoxSizeZ.Initialize(tweakBar, "BoxSizeZ", "Scene Controls", "BoxSizeZ", "", 1.0000f, -100.0000f, 100.0000f, 0.1000f, ConversionMode::None, 1.0000f);
         Settings.AddSetting(&BoxSizeZ);
 
+        ProbeFadeBand.Initialize(tweakBar, "ProbeFadeBand", "Scene Controls", "Probe Fade Band", "Width of the band at the faces of a probe's influence box over which its blend weight fades to zero, as a fraction of the box size", 0.2000f, 0.0000f, 1.0000f, 0.0100f, ConversionMode::None, 1.0000f);
+        Settings.AddSetting(&ProbeFadeBand);
+
         SceneOrientation.Initialize(tweakBar, "SceneOrientation", "Scene Controls", "Scene Orientation", "", Quaternion(0.0000f, 0.0000f, 0.0000f, 1.0000f));
         Settings.AddSetting(&SceneOrientation);
 
@@ -291,12 +320,35 @@ namespace AppSettings
         ManualExposure.Initialize(tweakBar, "ManualExposure", "Post Processing", "Manual Exposure", "Manual exposure value when auto-exposure is disabled", -2.5000f, -10.0000f, 10.0000f, 0.0100f, ConversionMode::None, 1.0000f);
         Settings.AddSetting(&ManualExposure);
 
+        ParallelLightAssignment.Initialize(tweakBar, "ParallelLightAssignment", "Performance", "Parallel Light Assignment", "Assign lights to clusters on the worker pool with SIMD sphere/cluster tests", true);
+        Settings.AddSetting(&ParallelLightAssignment);
+
+        IncrementalLightAssignment.Initialize(tweakBar, "IncrementalLightAssignment", "Performance", "Incremental Light Assignment", "Only rebuild and upload the cluster slices touched by lights that changed since the last frame", true);
+        Settings.AddSetting(&IncrementalLightAssignment);
+
+        LightClusterMode.Initialize(tweakBar, "LightClusterMode", "Performance", "Light Cluster Mode", "Cluster layout used for deferred shading. Probe relighting always uses the world grid", LightClusterModes::WorldGrid, 2, LightClusterModesLabels);
+        Settings.AddSetting(&LightClusterMode);
+
+        EnableFrustumCulling.Initialize(tweakBar, "EnableFrustumCulling", "Performance", "Enable Frustum Culling", "Skip scene objects and mesh parts whose bounding spheres are outside the view frustum", true);
+        Settings.AddSetting(&EnableFrustumCulling);
+
+        HierarchicalCulling.Initialize(tweakBar, "HierarchicalCulling", "Performance", "Hierarchical Culling", "Cull mesh part boxes through the scene bounding volume hierarchies instead of testing every bounding sphere", true);
+        Settings.AddSetting(&HierarchicalCulling);
+
+        InstancedRendering.Initialize(tweakBar, "InstancedRendering", "Performance", "Instanced Rendering", "Group visible mesh parts by model, mesh part, shader permutation and probe and draw each group with one instanced draw call", true);
+        Settings.AddSetting(&InstancedRendering);
+
+        RunBenchmarks.Initialize(tweakBar, "RunBenchmarks", "Performance", "Run Benchmarks", "Runs the light assignment, cluster mode, culling, render queue, SH and physics benchmarks, asserting that their fast paths match the reference ones");
+        Settings.AddSetting(&RunBenchmarks);
+
         TwHelper::SetOpened(tweakBar, "Anti Aliasing", true);
 
         TwHelper::SetOpened(tweakBar, "Scene Controls", true);
 
         TwHelper::SetOpened(tweakBar, "Post Processing", true);
 
+        TwHelper::SetOpened(tweakBar, "Performance", true);
+
         CBuffer.Initialize(device);
     }
 
@@ -343,6 +395,7 @@ namespace AppSettings
         CBuffer.Data.EnableRealtimeCubemap = EnableRealtimeCubemap;
         CBuffer.Data.DiffuseGIBounces = DiffuseGIBounces;
         CBuffer.Data.DiffuseGI_Intensity = DiffuseGI_Intensity;
+        CBuffer.Data.CompressSHProbes = CompressSHProbes;
         CBuffer.Data.NormalMapIntensity = NormalMapIntensity;
         CBuffer.Data.DiffuseIntensity = DiffuseIntensity;
         CBuffer.Data.Roughness = Roughness;
@@ -363,6 +416,7 @@ namespace AppSettings
         CBuffer.Data.BloomMagnitude = BloomMagnitude;
         CBuffer.Data.BloomBlurSigma = BloomBlurSigma;
         CBuffer.Data.ManualExposure = ManualExposure;
+        CBuffer.Data.LightClusterMode = LightClusterMode;
 
         CBuffer.ApplyChanges(context);
         CBuffer.SetVS(context, 7);
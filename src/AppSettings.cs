@@ -59,6 +59,12 @@ public class Settings
         Clustered_Deferred,
     }
 
+    enum LightClusterModes
+    {
+        WorldGrid,
+        Frustum,
+    }
+
     public class AntiAliasing
     {
         MSAAModes MSAAMode = MSAAModes.MSAA4x;
@@ -191,6 +197,21 @@ public class Settings
         [StepSize(0.1f)]
         float DiffuseGI_Intensity = 1.0f;
 
+        [UseAsShaderConstant(false)]
+        [HelpText("Place irradiance volume probes on an octree refined near the proxy geometry, dropping probes inside it, instead of a dense grid")]
+        bool AdaptiveProbePlacement = false;
+
+        [UseAsShaderConstant(false)]
+        [DisplayName("Probe Update Budget")]
+        [HelpText("Irradiance volume probes relit per frame, picked by camera distance, light changes and time since their last update. 0 relights every probe every frame")]
+        [MinValue(0)]
+        [MaxValue(512)]
+        int ProbeUpdateBudget = 0;
+
+        [DisplayName("Compress SH Probes")]
+        [HelpText("Shade from and cache the irradiance volume probes as 32 byte FP16 DC + 8-bit L1/L2 SH instead of 144 byte float SH")]
+        bool CompressSHProbes = false;
+
         [MinValue(0.0f)]
         [MaxValue(1.0f)]
         float NormalMapIntensity = 1.0f;
@@ -265,6 +286,13 @@ public class Settings
         [StepSize(0.1f)]
         float BoxSizeZ = 1.0f;
 
+        [MinValue(0.0f)]
+        [MaxValue(1.0f)]
+        [StepSize(0.01f)]
+        [UseAsShaderConstant(false)]
+        [HelpText("Width of the band at the faces of a probe's influence box over which its blend weight fades to zero, as a fraction of the box size")]
+        float ProbeFadeBand = 0.2f;
+
         // Orientation SceneOrientation = new Orientation(0.41f, -0.55f, -0.29f, 0.67f);
         Orientation SceneOrientation = new Orientation(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -311,6 +339,35 @@ public class Settings
         float ManualExposure = -2.5f;
     }
 
+    public class Performance
+    {
+        [UseAsShaderConstant(false)]
+        [HelpText("Assign lights to clusters on the worker pool with SIMD sphere/cluster tests")]
+        bool ParallelLightAssignment = true;
+
+        [UseAsShaderConstant(false)]
+        [HelpText("Only rebuild and upload the cluster slices touched by lights that changed since the last frame")]
+        bool IncrementalLightAssignment = true;
+
+        [HelpText("Cluster layout used for deferred shading. Probe relighting always uses the world grid")]
+        LightClusterModes LightClusterMode = LightClusterModes.WorldGrid;
+
+        [UseAsShaderConstant(false)]
+        [HelpText("Skip scene objects and mesh parts whose bounding spheres are outside the view frustum")]
+        bool EnableFrustumCulling = true;
+
+        [UseAsShaderConstant(false)]
+        [HelpText("Cull mesh part boxes through the scene bounding volume hierarchies instead of testing every bounding sphere")]
+        bool HierarchicalCulling = true;
+
+        [UseAsShaderConstant(false)]
+        [HelpText("Group visible mesh parts by model, mesh part, shader permutation and probe and draw each group with one instanced draw call")]
+        bool InstancedRendering = true;
+
+        [HelpText("Runs the light assignment, cluster mode, culling, render queue, SH and physics benchmarks, asserting that their fast paths match the reference ones")]
+        Button RunBenchmarks;
+    }
+
     // No auto-exposure for this sample
     const bool EnableAutoExposure = false;
     const float KeyValue = 0.115f;
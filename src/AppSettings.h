@@ -68,6 +68,16 @@ enum class ShadingTech
 
 typedef EnumSettingT<ShadingTech> ShadingTechSetting;
 
+enum class LightClusterModes
+{
+    WorldGrid = 0,
+    Frustum = 1,
+
+    NumValues
+};
+
+typedef EnumSettingT<LightClusterModes> LightClusterModesSetting;
+
 namespace AppSettings
 {
     static const bool EnableAutoExposure = false;
@@ -113,6 +123,9 @@ namespace AppSettings
     extern BoolSetting EnableRealtimeCubemap;
     extern IntSetting DiffuseGIBounces;
     extern FloatSetting DiffuseGI_Intensity;
+    extern BoolSetting AdaptiveProbePlacement;
+    extern IntSetting ProbeUpdateBudget;
+    extern BoolSetting CompressSHProbes;
     extern FloatSetting NormalMapIntensity;
     extern FloatSetting DiffuseIntensity;
     extern FloatSetting Roughness;
@@ -125,6 +138,7 @@ namespace AppSettings
     extern FloatSetting BoxSizeX;
     extern FloatSetting BoxSizeY;
     extern FloatSetting BoxSizeZ;
+    extern FloatSetting ProbeFadeBand;
     extern OrientationSetting SceneOrientation;
     extern FloatSetting ModelRotationSpeed;
     extern BoolSetting DoubleSyncInterval;
@@ -133,6 +147,13 @@ namespace AppSettings
     extern FloatSetting BloomMagnitude;
     extern FloatSetting BloomBlurSigma;
     extern FloatSetting ManualExposure;
+    extern BoolSetting ParallelLightAssignment;
+    extern BoolSetting IncrementalLightAssignment;
+    extern LightClusterModesSetting LightClusterMode;
+    extern BoolSetting EnableFrustumCulling;
+    extern BoolSetting HierarchicalCulling;
+    extern BoolSetting InstancedRendering;
+    extern Button RunBenchmarks;
 
     struct AppSettingsCBuffer
     {
@@ -173,6 +194,7 @@ namespace AppSettings
         bool32 EnableRealtimeCubemap;
         int32 DiffuseGIBounces;
         float DiffuseGI_Intensity;
+        bool32 CompressSHProbes;
         float NormalMapIntensity;
         float DiffuseIntensity;
         float Roughness;
@@ -193,6 +215,7 @@ namespace AppSettings
         float BloomMagnitude;
         float BloomBlurSigma;
         float ManualExposure;
+        int32 LightClusterMode;
     };
 
     extern ConstantBuffer<AppSettingsCBuffer> CBuffer;
@@ -37,6 +37,7 @@ cbuffer AppSettings : register(b7)
     bool EnableRealtimeCubemap;
     int DiffuseGIBounces;
     float DiffuseGI_Intensity;
+    bool CompressSHProbes;
     float NormalMapIntensity;
     float DiffuseIntensity;
     float Roughness;
@@ -57,6 +58,7 @@ cbuffer AppSettings : register(b7)
     float BloomMagnitude;
     float BloomBlurSigma;
     float ManualExposure;
+    int LightClusterMode;
 }
 
 static const int MSAAModes_MSAANone = 0;
@@ -86,6 +88,9 @@ static const int Scenes_Sponza = 2;
 static const int ShadingTech_Forward = 0;
 static const int ShadingTech_Clustered_Deferred = 1;
 
+static const int LightClusterModes_WorldGrid = 0;
+static const int LightClusterModes_Frustum = 1;
+
 static const bool EnableAutoExposure = false;
 static const float KeyValue = 0.1150f;
 static const float AdaptationRate = 0.5000f;
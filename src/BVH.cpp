@@ -0,0 +1,390 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static const float TraversalCost = 1.0f;
+
+static void growBounds(BBox &bounds, const BBox &box)
+{
+	bounds = MakeBBox(Float3Min(bounds.Min, box.Min), Float3Max(bounds.Max, box.Max));
+}
+
+static BBox emptyBounds()
+{
+	BBox bounds;
+	bounds.Min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	bounds.Max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return bounds;
+}
+
+static float surfaceArea(const BBox &bounds)
+{
+	Float3 size = Float3(bounds.Max) - Float3(bounds.Min);
+	if (size.x < 0.0f) return 0.0f;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static bool boxesOverlap(const BBox &a, const BBox &b)
+{
+	return a.Min.x <= b.Max.x && a.Max.x >= b.Min.x
+		&& a.Min.y <= b.Max.y && a.Max.y >= b.Min.y
+		&& a.Min.z <= b.Max.z && a.Max.z >= b.Min.z;
+}
+
+BVH::BVH() : _buildCost(0.0f)
+{
+}
+
+void BVH::Clear()
+{
+	_nodes.clear();
+	_primIndices.clear();
+	_buildCost = 0.0f;
+}
+
+void BVH::Build(const BBox *boxes, uint32 numPrimitives)
+{
+	Clear();
+	if (numPrimitives == 0) return;
+
+	_primIndices.resize(numPrimitives);
+	_centroids.resize(numPrimitives);
+	for (uint32 i = 0; i < numPrimitives; i++)
+	{
+		_primIndices[i] = i;
+		_centroids[i] = (Float3(boxes[i].Min) + Float3(boxes[i].Max)) * 0.5f;
+	}
+
+	// a binary tree with at least one primitive per leaf never has more than 2n - 1 nodes
+	_nodes.reserve(numPrimitives * 2);
+	buildNode(boxes, 0, numPrimitives, 0);
+
+	_buildCost = ComputeCost();
+}
+
+uint32 BVH::buildNode(const BBox *boxes, uint32 primBegin, uint32 primEnd, uint32 depth)
+{
+	const uint32 nodeIndex = (uint32)_nodes.size();
+	_nodes.push_back(Node());
+
+	BBox bounds = emptyBounds();
+	BBox centroidBounds = emptyBounds();
+	for (uint32 i = primBegin; i < primEnd; i++)
+	{
+		growBounds(bounds, boxes[_primIndices[i]]);
+		const Float3 &c = _centroids[_primIndices[i]];
+		centroidBounds = MakeBBox(Float3Min(centroidBounds.Min, c), Float3Max(centroidBounds.Max, c));
+	}
+
+	Node &node = _nodes[nodeIndex];
+	node.bounds = bounds;
+	node.primBegin = primBegin;
+	node.primCount = primEnd - primBegin;
+	node.rightChild = 0;
+
+	const uint32 count = primEnd - primBegin;
+	if (count <= MaxLeafSize)
+	{
+		return nodeIndex;
+	}
+
+	const Float3 centroidMin = centroidBounds.Min;
+	const Float3 centroidSize = Float3(centroidBounds.Max) - centroidMin;
+
+	// SAH can build long chains on skewed inputs. Once a median split is the only way left to
+	// keep the leaves of this subtree within the traversal stack, split at the median of the
+	// widest axis, which halves the count every level.
+	uint32 medianLevels = 0;
+	for (uint32 n = count; n > MaxLeafSize; n = (n + 1) / 2)
+	{
+		medianLevels++;
+	}
+
+	if (depth + medianLevels >= MaxDepth - 1)
+	{
+		const int axis = centroidSize.x >= centroidSize.y
+			? (centroidSize.x >= centroidSize.z ? 0 : 2)
+			: (centroidSize.y >= centroidSize.z ? 1 : 2);
+		const uint32 primMid = primBegin + count / 2;
+		const std::vector<Float3> &centroids = _centroids;
+		std::nth_element(&_primIndices[primBegin], &_primIndices[primMid], &_primIndices[0] + primEnd,
+			[&](uint32 a, uint32 b) { return centroids[a][axis] < centroids[b][axis]; });
+
+		buildNode(boxes, primBegin, primMid, depth + 1);
+		uint32 rightChild = buildNode(boxes, primMid, primEnd, depth + 1);
+		_nodes[nodeIndex].rightChild = rightChild;
+		return nodeIndex;
+	}
+
+	// Binned SAH over the centroid extent of every axis
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32 bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = centroidSize[axis];
+		if (extent <= 0.0f) continue;
+
+		BBox binBounds[NumBins];
+		uint32 binCounts[NumBins] = { 0 };
+		for (uint32 b = 0; b < NumBins; b++)
+		{
+			binBounds[b] = emptyBounds();
+		}
+
+		const float binScale = NumBins / extent;
+		for (uint32 i = primBegin; i < primEnd; i++)
+		{
+			uint32 prim = _primIndices[i];
+			uint32 bin = Min((uint32)((_centroids[prim][axis] - centroidMin[axis]) * binScale), NumBins - 1);
+			binCounts[bin]++;
+			growBounds(binBounds[bin], boxes[prim]);
+		}
+
+		// sweep from the right, then evaluate every split from the left
+		float rightArea[NumBins];
+		uint32 rightCount[NumBins];
+		BBox accum = emptyBounds();
+		uint32 accumCount = 0;
+		for (uint32 b = NumBins - 1; b > 0; b--)
+		{
+			growBounds(accum, binBounds[b]);
+			accumCount += binCounts[b];
+			rightArea[b] = surfaceArea(accum);
+			rightCount[b] = accumCount;
+		}
+
+		accum = emptyBounds();
+		accumCount = 0;
+		for (uint32 split = 1; split < NumBins; split++)
+		{
+			growBounds(accum, binBounds[split - 1]);
+			accumCount += binCounts[split - 1];
+			if (accumCount == 0 || rightCount[split] == 0) continue;
+
+			float cost = surfaceArea(accum) * accumCount + rightArea[split] * rightCount[split];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	uint32 primMid;
+	if (bestAxis < 0)
+	{
+		// all centroids in one spot, split the range in half
+		primMid = primBegin + count / 2;
+	}
+	else
+	{
+		// small nodes stay leaves when splitting does not pay for the extra traversal step
+		const float area = surfaceArea(bounds);
+		if (count <= MaxLeafSize * 4 && TraversalCost * area + bestCost >= area * count)
+		{
+			return nodeIndex;
+		}
+
+		const float binScale = NumBins / centroidSize[bestAxis];
+		const float minCoord = centroidMin[bestAxis];
+		const std::vector<Float3> &centroids = _centroids;
+		uint32 *mid = std::partition(&_primIndices[primBegin], &_primIndices[0] + primEnd, [&](uint32 prim)
+		{
+			return Min((uint32)((centroids[prim][bestAxis] - minCoord) * binScale), NumBins - 1) < bestSplit;
+		});
+		primMid = (uint32)(mid - &_primIndices[0]);
+
+		if (primMid == primBegin || primMid == primEnd)
+		{
+			primMid = primBegin + count / 2;
+		}
+	}
+
+	buildNode(boxes, primBegin, primMid, depth + 1);
+	uint32 rightChild = buildNode(boxes, primMid, primEnd, depth + 1);
+	_nodes[nodeIndex].rightChild = rightChild;
+
+	return nodeIndex;
+}
+
+void BVH::Refit(const BBox *boxes)
+{
+	// children always come after their parent
+	for (size_t n = _nodes.size(); n-- > 0;)
+	{
+		Node &node = _nodes[n];
+		if (node.rightChild == 0)
+		{
+			node.bounds = emptyBounds();
+			for (uint32 i = node.primBegin; i < node.primBegin + node.primCount; i++)
+			{
+				growBounds(node.bounds, boxes[_primIndices[i]]);
+			}
+		}
+		else
+		{
+			node.bounds = _nodes[n + 1].bounds;
+			growBounds(node.bounds, _nodes[node.rightChild].bounds);
+		}
+	}
+}
+
+float BVH::ComputeCost() const
+{
+	if (_nodes.empty()) return 0.0f;
+
+	float cost = 0.0f;
+	for (size_t n = 0; n < _nodes.size(); n++)
+	{
+		const Node &node = _nodes[n];
+		cost += surfaceArea(node.bounds) * (node.rightChild == 0 ? node.primCount : TraversalCost);
+	}
+
+	float rootArea = surfaceArea(_nodes[0].bounds);
+	return rootArea > 0.0f ? cost / rootArea : cost;
+}
+
+void BVH::CullFrustum(const Float4 *planes, uint32 numPlanes, std::vector<uint32> &visible) const
+{
+	Assert_(numPlanes <= 6);
+	if (_nodes.empty()) return;
+
+	// node index and the planes its parent was not fully inside of
+	struct StackEntry
+	{
+		uint32 node;
+		uint32 planeMask;
+	};
+
+	StackEntry stack[MaxDepth];
+	uint32 stackSize = 0;
+	stack[stackSize++].node = 0;
+	stack[0].planeMask = (1u << numPlanes) - 1;
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		const Node &node = _nodes[entry.node];
+
+		Float3 center = (Float3(node.bounds.Min) + Float3(node.bounds.Max)) * 0.5f;
+		Float3 extent = (Float3(node.bounds.Max) - Float3(node.bounds.Min)) * 0.5f;
+
+		uint32 planeMask = entry.planeMask;
+		bool outside = false;
+		for (uint32 p = 0; p < numPlanes && !outside; p++)
+		{
+			if ((planeMask & (1u << p)) == 0) continue;
+
+			const Float4 &plane = planes[p];
+			float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			float radius = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+
+			if (distance < -radius)
+				outside = true;
+			else if (distance >= radius)
+				planeMask &= ~(1u << p); // children are inside this plane too
+		}
+
+		if (outside) continue;
+
+		if (planeMask == 0 || node.rightChild == 0)
+		{
+			// fully inside, or a leaf whose box intersects: keep every primitive
+			visible.insert(visible.end(), &_primIndices[node.primBegin], &_primIndices[node.primBegin] + node.primCount);
+			continue;
+		}
+
+		Assert_(stackSize + 2 <= MaxDepth);
+		stack[stackSize].node = node.rightChild;
+		stack[stackSize++].planeMask = planeMask;
+		stack[stackSize].node = entry.node + 1;
+		stack[stackSize++].planeMask = planeMask;
+	}
+}
+
+void BVH::QueryBox(const BBox &box, std::vector<uint32> &result) const
+{
+	if (_nodes.empty()) return;
+
+	uint32 stack[MaxDepth];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		uint32 nodeIndex = stack[--stackSize];
+		const Node &node = _nodes[nodeIndex];
+		if (!boxesOverlap(node.bounds, box)) continue;
+
+		if (node.rightChild == 0)
+		{
+			for (uint32 i = node.primBegin; i < node.primBegin + node.primCount; i++)
+			{
+				result.push_back(_primIndices[i]);
+			}
+			continue;
+		}
+
+		Assert_(stackSize + 2 <= MaxDepth);
+		stack[stackSize++] = node.rightChild;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+}
+
+// Slab test, the reciprocal direction is infinite for axis aligned rays which the min/max handle
+static bool rayHitsBox(const BBox &box, const Float3 &origin, const Float3 &invDir, float maxT)
+{
+	float tMin = 0.0f;
+	float tMax = maxT;
+
+	const float boxMin[3] = { box.Min.x, box.Min.y, box.Min.z };
+	const float boxMax[3] = { box.Max.x, box.Max.y, box.Max.z };
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		float t0 = (boxMin[axis] - origin[axis]) * invDir[axis];
+		float t1 = (boxMax[axis] - origin[axis]) * invDir[axis];
+		if (t0 > t1) std::swap(t0, t1);
+
+		// NaN from 0 * inf, origin on a slab plane of a parallel ray, leaves the range as is
+		tMin = t0 > tMin ? t0 : tMin;
+		tMax = t1 < tMax ? t1 : tMax;
+		if (tMin > tMax) return false;
+	}
+	return true;
+}
+
+void BVH::QueryRay(const Float3 &origin, const Float3 &dir, float maxT, std::vector<uint32> &result) const
+{
+	if (_nodes.empty()) return;
+
+	const Float3 invDir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+
+	uint32 stack[MaxDepth];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		uint32 nodeIndex = stack[--stackSize];
+		const Node &node = _nodes[nodeIndex];
+		if (!rayHitsBox(node.bounds, origin, invDir, maxT)) continue;
+
+		if (node.rightChild == 0)
+		{
+			for (uint32 i = node.primBegin; i < node.primBegin + node.primCount; i++)
+			{
+				result.push_back(_primIndices[i]);
+			}
+			continue;
+		}
+
+		Assert_(stackSize + 2 <= MaxDepth);
+		stack[stackSize++] = node.rightChild;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include "Bounds.h"
+
+using namespace SampleFramework11;
+
+// Bounding volume hierarchy over axis aligned boxes, built with binned SAH.
+// Nodes are stored depth first: the left child of an inner node directly follows it, and every
+// node covers a contiguous range of primitives. Refit() keeps the topology and only recomputes
+// bounds, which is what moving objects need between rebuilds.
+class BVH
+{
+public:
+	struct Node
+	{
+		BBox bounds;
+		uint32 primBegin;
+		uint32 primCount;
+		uint32 rightChild; // 0 for leaves, the root is never a right child
+	};
+
+	BVH();
+
+	void Build(const BBox *boxes, uint32 numPrimitives);
+	void Refit(const BBox *boxes);
+	void Clear();
+
+	// Appends the primitives whose boxes are not fully outside the planes (see GetFrustumPlanes).
+	// Subtrees completely inside are appended without testing their children.
+	void CullFrustum(const Float4 *planes, uint32 numPlanes, std::vector<uint32> &visible) const;
+
+	// Appends the primitives whose boxes overlap box
+	void QueryBox(const BBox &box, std::vector<uint32> &result) const;
+
+	// Appends the primitives whose boxes the segment origin + t * dir, t in [0, maxT] touches
+	void QueryRay(const Float3 &origin, const Float3 &dir, float maxT, std::vector<uint32> &result) const;
+
+	// Sum of node surface areas weighted like the SAH build, used to tell when a refitted tree
+	// has degraded enough to rebuild
+	float ComputeCost() const;
+
+	inline bool isEmpty() const { return _nodes.empty(); }
+	inline uint32 getNumNodes() const { return (uint32)_nodes.size(); }
+	inline uint32 getNumPrimitives() const { return (uint32)_primIndices.size(); }
+	inline const BBox &getBounds() const { return _nodes[0].bounds; }
+	inline float getBuildCost() const { return _buildCost; }
+
+private:
+	static const uint32 MaxLeafSize = 4;
+	static const uint32 NumBins = 16;
+	static const uint32 MaxDepth = 128; // traversal stack size, Build() keeps leaves above this depth
+
+	uint32 buildNode(const BBox *boxes, uint32 primBegin, uint32 primEnd, uint32 depth);
+
+	std::vector<Node> _nodes;
+	std::vector<uint32> _primIndices;
+	std::vector<Float3> _centroids; // build scratch
+	float _buildCost;
+};
@@ -1,18 +1,7 @@
 #include "BoundUtils.h"
 
-Float3 Float3Max(const Float3 &a, const Float3 &b)
-{
-	return Float3(a.x > b.x ? a.x : b.x,
-		a.y > b.y ? a.y : b.y,
-		a.z > b.z ? a.z : b.z);
-}
-
-Float3 Float3Min(const Float3 &a, const Float3 &b)
-{
-	return Float3(a.x < b.x ? a.x : b.x,
-		a.y < b.y ? a.y : b.y,
-		a.z < b.z ? a.z : b.z);
-}
+#include <Graphics\\GraphicsTypes.h>
+#include <Graphics\\Model.h>
 
 BBox GetTransformedBBox(const BBox &bbox, const Float4x4 &transform)
 {
@@ -326,6 +315,16 @@ void ComputeFrustum(const XMMATRIX& viewProj, Frustum& frustum)
 	frustum.Planes[5] = XMPlaneFromPoints(corners[1], corners[0], corners[3]);
 }
 
+uint32 GetFrustumPlanes(const Frustum &frustum, bool ignoreNearZ, Float4 planes[6])
+{
+	const uint32 numPlanes = ignoreNearZ ? 5 : 6;
+	for (uint32 p = 0; p < numPlanes; p++)
+	{
+		planes[p] = Float4(frustum.Planes[p]);
+	}
+	return numPlanes;
+}
+
 // Tests a frustum for intersection with a sphere
 uint32 TestFrustumSphere(const Frustum& frustum, const BSphere& sphere, bool ignoreNearZ)
 {
@@ -1,23 +1,18 @@
 #pragma once
 
-#include "PCH.h"
+#include <vector>
 #include <SF11_Math.h>
-#include <Graphics\\GraphicsTypes.h>
-#include <Graphics\\Model.h>
+#include "Bounds.h"
 
-using namespace SampleFramework11;
+struct ID3D11Device;
+struct ID3D11DeviceContext;
 
-struct BSphere
+namespace SampleFramework11
 {
-	XMFLOAT3 Center;
-	float Radius;
-};
+	class Model;
+}
 
-struct BBox
-{
-	XMFLOAT3 Max;
-	XMFLOAT3 Min;
-};
+using namespace SampleFramework11;
 
 // Represents the 6 planes of a frustum
 Float4Align struct Frustum
@@ -42,6 +37,10 @@ void GetBoundCornersFromPoints(const XMFLOAT3* points, uint32 numPoints, uint32
 // Calculates the frustum planes given a view * projection matrix
 void ComputeFrustum(const XMMATRIX& viewProj, Frustum& frustum);
 
+// The frustum planes as plain floats, for BVH::CullFrustum. Returns how many were written, the
+// near plane is left out with ignoreNearZ.
+uint32 GetFrustumPlanes(const Frustum &frustum, bool ignoreNearZ, Float4 planes[6]);
+
 // Tests a frustum for intersection with a sphere
 uint32 TestFrustumSphere(const Frustum& frustum, const BSphere& sphere, bool ignoreNearZ);
 
@@ -50,7 +49,4 @@ void ComputeModelBounds(ID3D11Device* device, ID3D11DeviceContext* context,
 	// const Float4x4& world, 
 	Model* model,
 	std::vector<BSphere>& boundingSpheres, 
-	std::vector<BBox> &boundingBoxes);
-
-Float3 Float3Max(const Float3 &a, const Float3 &b);
-Float3 Float3Min(const Float3 &a, const Float3 &b);
\ No newline at end of file
+	std::vector<BBox> &boundingBoxes);
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include "CPUMath.h"
+
+using namespace SampleFramework11;
+
+// The bounding volume types, without the D3D and XMMATRIX functions of BoundUtils.h, so the
+// CPU side spatial structures (BVH, ProbePlacement) build without the framework too.
+struct BSphere
+{
+	XMFLOAT3 Center;
+	float Radius;
+};
+
+struct BBox
+{
+	XMFLOAT3 Max;
+	XMFLOAT3 Min;
+};
+
+inline Float3 Float3Max(const Float3 &a, const Float3 &b)
+{
+	return Float3(a.x > b.x ? a.x : b.x,
+		a.y > b.y ? a.y : b.y,
+		a.z > b.z ? a.z : b.z);
+}
+
+inline Float3 Float3Min(const Float3 &a, const Float3 &b)
+{
+	return Float3(a.x < b.x ? a.x : b.x,
+		a.y < b.y ? a.y : b.y,
+		a.z < b.z ? a.z : b.z);
+}
+
+inline BBox MakeBBox(const Float3 &boxMin, const Float3 &boxMax)
+{
+	BBox box;
+	box.Min = XMFLOAT3(boxMin.x, boxMin.y, boxMin.z);
+	box.Max = XMFLOAT3(boxMax.x, boxMax.y, boxMax.z);
+	return box;
+}
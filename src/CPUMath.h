@@ -0,0 +1,258 @@
+#pragma once
+#include "CPUTypes.h"
+
+// Vector math for the device-free modules. The app builds them against the framework's
+// SF11_Math.h so they take and return its types. Tests/ (and anything else without the
+// framework) defines REALTIME_GI_PORTABLE_MATH and gets the subset below instead: same names,
+// same semantics, no DirectXMath, Windows or D3D headers.
+#if defined(_MSC_VER) && !defined(REALTIME_GI_PORTABLE_MATH)
+
+#include <SF11_Math.h>
+
+#else
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#ifndef Assert_
+#define Assert_(x) assert(x)
+#endif
+
+// DirectXMath's storage type, what the bounds structs are made of
+struct XMFLOAT3
+{
+	float x, y, z;
+
+	XMFLOAT3() {}
+	XMFLOAT3(float x, float y, float z) : x(x), y(y), z(z) {}
+};
+
+namespace SampleFramework11
+{
+
+struct Float2
+{
+	float x, y;
+
+	Float2() : x(0.0f), y(0.0f) {}
+	Float2(float x) : x(x), y(x) {}
+	Float2(float x, float y) : x(x), y(y) {}
+
+	Float2 &operator+=(const Float2 &other) { x += other.x; y += other.y; return *this; }
+	Float2 operator+(const Float2 &other) const { return Float2(x + other.x, y + other.y); }
+	Float2 &operator-=(const Float2 &other) { x -= other.x; y -= other.y; return *this; }
+	Float2 operator-(const Float2 &other) const { return Float2(x - other.x, y - other.y); }
+	Float2 &operator*=(const Float2 &other) { x *= other.x; y *= other.y; return *this; }
+	Float2 operator*(const Float2 &other) const { return Float2(x * other.x, y * other.y); }
+	Float2 &operator*=(float s) { x *= s; y *= s; return *this; }
+	Float2 operator*(float s) const { return Float2(x * s, y * s); }
+	Float2 &operator/=(const Float2 &other) { x /= other.x; y /= other.y; return *this; }
+	Float2 operator/(const Float2 &other) const { return Float2(x / other.x, y / other.y); }
+	Float2 &operator/=(float s) { x /= s; y /= s; return *this; }
+	Float2 operator/(float s) const { return Float2(x / s, y / s); }
+	bool operator==(const Float2 &other) const { return x == other.x && y == other.y; }
+	bool operator!=(const Float2 &other) const { return !(*this == other); }
+	Float2 operator-() const { return Float2(-x, -y); }
+
+	static float Length(const Float2 &val) { return std::sqrt(val.x * val.x + val.y * val.y); }
+};
+
+struct Float3
+{
+	float x, y, z;
+
+	Float3() : x(0.0f), y(0.0f), z(0.0f) {}
+	Float3(float x) : x(x), y(x), z(x) {}
+	Float3(float x, float y, float z) : x(x), y(y), z(z) {}
+	Float3(const XMFLOAT3 &xyz) : x(xyz.x), y(xyz.y), z(xyz.z) {}
+
+	float operator[](unsigned int idx) const { assert(idx < 3); return *(&x + idx); }
+	Float3 &operator+=(const Float3 &other) { x += other.x; y += other.y; z += other.z; return *this; }
+	Float3 operator+(const Float3 &other) const { return Float3(x + other.x, y + other.y, z + other.z); }
+	Float3 &operator+=(float s) { x += s; y += s; z += s; return *this; }
+	Float3 operator+(float s) const { return Float3(x + s, y + s, z + s); }
+	Float3 &operator-=(const Float3 &other) { x -= other.x; y -= other.y; z -= other.z; return *this; }
+	Float3 operator-(const Float3 &other) const { return Float3(x - other.x, y - other.y, z - other.z); }
+	Float3 &operator-=(float s) { x -= s; y -= s; z -= s; return *this; }
+	Float3 operator-(float s) const { return Float3(x - s, y - s, z - s); }
+	Float3 &operator*=(const Float3 &other) { x *= other.x; y *= other.y; z *= other.z; return *this; }
+	Float3 operator*(const Float3 &other) const { return Float3(x * other.x, y * other.y, z * other.z); }
+	Float3 &operator*=(float s) { x *= s; y *= s; z *= s; return *this; }
+	Float3 operator*(float s) const { return Float3(x * s, y * s, z * s); }
+	Float3 &operator/=(const Float3 &other) { x /= other.x; y /= other.y; z /= other.z; return *this; }
+	Float3 operator/(const Float3 &other) const { return Float3(x / other.x, y / other.y, z / other.z); }
+	Float3 &operator/=(float s) { x /= s; y /= s; z /= s; return *this; }
+	Float3 operator/(float s) const { return Float3(x / s, y / s, z / s); }
+	bool operator==(const Float3 &other) const { return x == other.x && y == other.y && z == other.z; }
+	bool operator!=(const Float3 &other) const { return !(*this == other); }
+	Float3 operator-() const { return Float3(-x, -y, -z); }
+
+	Float2 To2D() const { return Float2(x, y); }
+	float Length() const { return Length(*this); }
+
+	static float Dot(const Float3 &a, const Float3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	static Float3 Cross(const Float3 &a, const Float3 &b)
+	{
+		return Float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+	// Like XMVector3Normalize, a zero vector stays zero
+	static Float3 Normalize(const Float3 &a)
+	{
+		float length = Length(a);
+		return length > 0.0f ? a / length : Float3(0.0f);
+	}
+	static float Distance(const Float3 &a, const Float3 &b) { return Length(a - b); }
+	static float Length(const Float3 &v) { return std::sqrt(Dot(v, v)); }
+};
+
+inline Float3 operator*(float a, const Float3 &b) { return b * a; }
+
+struct Float4
+{
+	float x, y, z, w;
+
+	Float4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+	Float4(float x) : x(x), y(x), z(x), w(x) {}
+	Float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+	Float4(const Float3 &xyz, float w = 0.0f) : x(xyz.x), y(xyz.y), z(xyz.z), w(w) {}
+
+	Float4 &operator+=(const Float4 &other) { x += other.x; y += other.y; z += other.z; w += other.w; return *this; }
+	Float4 operator+(const Float4 &other) const { return Float4(x + other.x, y + other.y, z + other.z, w + other.w); }
+	Float4 &operator-=(const Float4 &other) { x -= other.x; y -= other.y; z -= other.z; w -= other.w; return *this; }
+	Float4 operator-(const Float4 &other) const { return Float4(x - other.x, y - other.y, z - other.z, w - other.w); }
+	Float4 &operator*=(const Float4 &other) { x *= other.x; y *= other.y; z *= other.z; w *= other.w; return *this; }
+	Float4 operator*(const Float4 &other) const { return Float4(x * other.x, y * other.y, z * other.z, w * other.w); }
+	Float4 &operator/=(const Float4 &other) { x /= other.x; y /= other.y; z /= other.z; w /= other.w; return *this; }
+	Float4 operator/(const Float4 &other) const { return Float4(x / other.x, y / other.y, z / other.z, w / other.w); }
+	bool operator==(const Float4 &other) const { return x == other.x && y == other.y && z == other.z && w == other.w; }
+	bool operator!=(const Float4 &other) const { return !(*this == other); }
+	Float4 operator-() const { return Float4(-x, -y, -z, -w); }
+
+	Float3 To3D() const { return Float3(x, y, z); }
+	Float2 To2D() const { return Float2(x, y); }
+};
+
+template<typename T> T Lerp(const T &x, const T &y, float s)
+{
+	return x + (y - x) * s;
+}
+
+template<typename T> T Min(T a, T b)
+{
+	return a < b ? a : b;
+}
+
+template<typename T> T Max(T a, T b)
+{
+	return a < b ? b : a;
+}
+
+template<typename T> T Clamp(T val, T min, T max)
+{
+	Assert_(max >= min);
+
+	if (val < min)
+		val = min;
+	else if (val > max)
+		val = max;
+	return val;
+}
+
+template<typename T> T Saturate(T val)
+{
+	return Clamp<T>(val, T(0.0f), T(1.0f));
+}
+
+inline Float3 Saturate(Float3 val)
+{
+	return Float3(Clamp(val.x, 0.0f, 1.0f), Clamp(val.y, 0.0f, 1.0f), Clamp(val.z, 0.0f, 1.0f));
+}
+
+template<typename T> T Square(T x)
+{
+	return x * x;
+}
+
+const float Pi = 3.141592654f;
+const float Pi2 = 6.283185307f;
+const float Pi_2 = 1.570796327f;
+const float Pi_4 = 0.7853981635f;
+const float InvPi = 0.318309886f;
+const float InvPi2 = 0.159154943f;
+
+const float FP16Max = 65000.0f;
+
+}
+
+// DirectXMath's scalar FP16 conversions, round to nearest even, denormals and infinities kept
+inline uint16 XMConvertFloatToHalf(float value)
+{
+	uint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint32 sign = (bits & 0x80000000U) >> 16U;
+	bits = bits & 0x7FFFFFFFU;
+
+	uint32 result;
+	if (bits >= 0x47800000U)
+	{
+		// too large for a half, infinity or NaN
+		result = 0x7C00U | ((bits > 0x7F800000U) ? (0x200U | ((bits >> 13U) & 0x3FFU)) : 0U);
+	}
+	else if (bits <= 0x33000000U)
+	{
+		result = 0;
+	}
+	else if (bits < 0x38800000U)
+	{
+		// too small for a normalized half, denormalize
+		const uint32 shift = 125U - (bits >> 23U);
+		bits = 0x800000U | (bits & 0x7FFFFFU);
+		result = bits >> (shift + 1);
+		const uint32 sticky = (bits & ((1U << shift) - 1)) != 0;
+		result += (result | sticky) & ((bits >> shift) & 1U);
+	}
+	else
+	{
+		// rebias the exponent
+		bits += 0xC8000000U;
+		result = ((bits + 0x0FFFU + ((bits >> 13U) & 1U)) >> 13U) & 0x7FFFU;
+	}
+	return uint16(result | sign);
+}
+
+inline float XMConvertHalfToFloat(uint16 value)
+{
+	uint32 mantissa = value & 0x03FFU;
+	uint32 exponent = value & 0x7C00U;
+	if (exponent == 0x7C00U)
+	{
+		exponent = 0x8FU;
+	}
+	else if (exponent != 0)
+	{
+		exponent = (value >> 10) & 0x1FU;
+	}
+	else if (mantissa != 0)
+	{
+		// denormal, normalize it
+		exponent = 1;
+		do
+		{
+			exponent--;
+			mantissa <<= 1;
+		} while ((mantissa & 0x0400U) == 0);
+		mantissa &= 0x03FFU;
+	}
+	else
+	{
+		exponent = uint32(-112);
+	}
+
+	const uint32 bits = ((value & 0x8000U) << 16) | ((exponent + 112) << 23) | (mantissa << 13);
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+#endif
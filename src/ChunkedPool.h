@@ -0,0 +1,131 @@
+#pragma once
+
+#include "PCH.h"
+#include <Assert.h>
+
+using namespace SampleFramework11;
+
+// Growable array made of fixed size chunks. Elements never move once added, so pointers and
+// indices handed out stay valid until Clear(), and growing never copies what is already there.
+// Each chunk is one contiguous block; ForEachChunk() gives loops and uploads a pointer + count
+// per chunk instead of a per element lookup.
+template<typename T, uint32 ChunkSize = 256>
+class ChunkedPool
+{
+public:
+	ChunkedPool() : _size(0), _numHeapAllocations(0) {}
+	~ChunkedPool() { Release(); }
+
+	// Index of a new default constructed element
+	uint32 Add()
+	{
+		T *slot = allocSlot();
+		new (slot) T();
+		return _size++;
+	}
+
+	uint32 Add(const T &value)
+	{
+		T *slot = allocSlot();
+		new (slot) T(value);
+		return _size++;
+	}
+
+	// Makes room for count elements without constructing them
+	void Reserve(uint32 count)
+	{
+		while (_chunks.size() * ChunkSize < count)
+		{
+			allocChunk();
+		}
+	}
+
+	// Destroys every element, chunks are kept for reuse
+	void Clear()
+	{
+		for (uint32 i = 0; i < _size; i++)
+		{
+			(*this)[i].~T();
+		}
+		_size = 0;
+	}
+
+	void Release()
+	{
+		Clear();
+		for (size_t c = 0; c < _chunks.size(); c++)
+		{
+			_aligned_free(_chunks[c]);
+		}
+		_chunks.clear();
+	}
+
+	inline T &operator[](uint32 index)
+	{
+		Assert_(index < _size);
+		return _chunks[index / ChunkSize][index % ChunkSize];
+	}
+
+	inline const T &operator[](uint32 index) const
+	{
+		Assert_(index < _size);
+		return _chunks[index / ChunkSize][index % ChunkSize];
+	}
+
+	// Calls visit(T *elements, uint32 firstIndex, uint32 count) for every used chunk, in order
+	template<typename ChunkVisitor> void ForEachChunk(ChunkVisitor visit)
+	{
+		for (uint32 first = 0; first < _size; first += ChunkSize)
+		{
+			visit(_chunks[first / ChunkSize], first, Min(_size - first, ChunkSize));
+		}
+	}
+
+	template<typename ChunkVisitor> void ForEachChunk(ChunkVisitor visit) const
+	{
+		for (uint32 first = 0; first < _size; first += ChunkSize)
+		{
+			visit((const T *)_chunks[first / ChunkSize], first, Min(_size - first, ChunkSize));
+		}
+	}
+
+	// Copies all elements into one contiguous destination, e.g. a mapped GPU buffer
+	void CopyTo(T *dst) const
+	{
+		for (uint32 first = 0; first < _size; first += ChunkSize)
+		{
+			std::copy(_chunks[first / ChunkSize], _chunks[first / ChunkSize] + Min(_size - first, ChunkSize), dst + first);
+		}
+	}
+
+	inline uint32 size() const { return _size; }
+	inline bool empty() const { return _size == 0; }
+	inline uint32 getCapacity() const { return (uint32)_chunks.size() * ChunkSize; }
+	inline uint64 getMemoryUsage() const { return (uint64)_chunks.size() * ChunkSize * sizeof(T); }
+	inline uint64 getNumHeapAllocations() const { return _numHeapAllocations; }
+
+private:
+	ChunkedPool(const ChunkedPool &);
+	ChunkedPool &operator=(const ChunkedPool &);
+
+	void allocChunk()
+	{
+		T *chunk = (T *)_aligned_malloc(sizeof(T) * ChunkSize, __alignof(T) > 16 ? __alignof(T) : 16);
+		Assert_(chunk != nullptr);
+		_chunks.push_back(chunk);
+		_numHeapAllocations++;
+	}
+
+	T *allocSlot()
+	{
+		if (_size == getCapacity())
+		{
+			allocChunk();
+		}
+		return &_chunks[_size / ChunkSize][_size % ChunkSize];
+	}
+
+	std::vector<T *> _chunks;
+	uint32 _size;
+	uint64 _numHeapAllocations;
+};
@@ -151,7 +151,16 @@ float4 ClusteredDeferredPS(in PSInput input) : SV_Target0
 	float3 lighting = float3(0.0f, 0.0f, 0.0f);
 
 	// Load cluster data	
-	uint4 cluster_coord = uint4(surface.posWS * ClusterScale + ClusterBias, 0);
+	// World grid clusters are indexed by position, frustum clusters by screen uv and log view depth
+	float3 clusterPos = surface.posWS;
+	if (LightClusterMode == LightClusterModes_Frustum)
+	{
+		float2 screenSize;
+		RT0.GetDimensions(screenSize.x, screenSize.y);
+		clusterPos = float3((fragCoord.xy + 0.5f) / screenSize, log(surface.depthVS));
+	}
+
+	uint4 cluster_coord = uint4(clusterPos * ClusterScale + ClusterBias, 0);
 	ClusterData data = Clusters.Load(cluster_coord);
 
 	uint offset = data.offset;
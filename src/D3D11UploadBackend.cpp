@@ -0,0 +1,79 @@
+#include "D3D11UploadBackend.h"
+
+#include <Utility.h>
+
+void D3D11UploadBackend::Initialize(ID3D11DeviceContext *context)
+{
+	_context = context;
+}
+
+D3D11UploadBackend::Target &D3D11UploadBackend::getTarget(uint32 buffer)
+{
+	if (buffer >= _targets.size())
+	{
+		Target empty = { nullptr, 0, 0, 0 };
+		_targets.resize(buffer + 1, empty);
+	}
+	return _targets[buffer];
+}
+
+void D3D11UploadBackend::SetBuffer(uint32 buffer, ID3D11Buffer *target)
+{
+	Target &t = getTarget(buffer);
+	t.resource = target;
+	t.rowPitch = 0;
+	t.width = 0;
+	t.height = 0;
+}
+
+void D3D11UploadBackend::SetTexture3D(uint32 buffer, ID3D11Texture3D *target, uint32 width, uint32 height, uint32 texelSize)
+{
+	Target &t = getTarget(buffer);
+	t.resource = target;
+	t.rowPitch = width * texelSize;
+	t.width = width;
+	t.height = height;
+}
+
+void D3D11UploadBackend::UploadRange(uint32 buffer, uint32 offset, const void *data, uint32 size)
+{
+	const Target &t = _targets[buffer];
+	if (t.rowPitch == 0)
+	{
+		D3D11_BOX box = { offset, 0, 0, offset + size, 1, 1 };
+		_context->UpdateSubresource(t.resource, 0, &box, data, 0, 0);
+		return;
+	}
+
+	// Whole rows: the rest of the first slice, whole slices, then the rows of the last slice
+	Assert_(offset % t.rowPitch == 0 && size % t.rowPitch == 0);
+	const uint32 depthPitch = t.rowPitch * t.height;
+	const uint8 *src = reinterpret_cast<const uint8 *>(data);
+	uint32 row = offset / t.rowPitch;
+	uint32 numRows = size / t.rowPitch;
+	while (numRows > 0)
+	{
+		uint32 y = row % t.height;
+		uint32 z = row / t.height;
+		uint32 rows;
+		D3D11_BOX box;
+		if (y != 0 || numRows < t.height)
+		{
+			rows = Min(numRows, t.height - y);
+			D3D11_BOX rowBox = { 0, y, z, t.width, y + rows, z + 1 };
+			box = rowBox;
+		}
+		else
+		{
+			uint32 slices = numRows / t.height;
+			rows = slices * t.height;
+			D3D11_BOX sliceBox = { 0, 0, z, t.width, t.height, z + slices };
+			box = sliceBox;
+		}
+
+		_context->UpdateSubresource(t.resource, 0, &box, src, t.rowPitch, depthPitch);
+		src += rows * t.rowPitch;
+		row += rows;
+		numRows -= rows;
+	}
+}
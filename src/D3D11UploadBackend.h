@@ -0,0 +1,36 @@
+#pragma once
+#include "PCH.h"
+
+#include <InterfacePointers.h>
+
+#include "UploadManager.h"
+
+using namespace SampleFramework11;
+
+// UpdateSubresource into DEFAULT usage buffers and 3D textures. A texture is addressed like its
+// tightly packed data, ranges have to be whole rows, which UploadManager guarantees when the
+// row size is the buffer's granularity. Targets are set again whenever the owner recreates them.
+class D3D11UploadBackend : public UploadBackend
+{
+public:
+	void Initialize(ID3D11DeviceContext *context);
+
+	void SetBuffer(uint32 buffer, ID3D11Buffer *target);
+	void SetTexture3D(uint32 buffer, ID3D11Texture3D *target, uint32 width, uint32 height, uint32 texelSize);
+
+	virtual void UploadRange(uint32 buffer, uint32 offset, const void *data, uint32 size) override;
+
+private:
+	struct Target
+	{
+		ID3D11ResourcePtr resource;
+		uint32 rowPitch;            // 0 for buffers
+		uint32 width;
+		uint32 height;
+	};
+
+	Target &getTarget(uint32 buffer);
+
+	ID3D11DeviceContextPtr _context;
+	std::vector<Target> _targets;
+};
@@ -16,8 +16,22 @@ cbuffer VSConstants : register(b0)
     float4x4 World;
 	float4x4 View;
     float4x4 WorldViewProjection;
+    float4x4 PrevWorldViewProjection;
+	float4x4 ViewProjection;
+	uint InstanceOffset;
 }
 
+#if Instanced_
+	// Same layout as Mesh.hlsl, only the world matrix is used here
+	struct InstanceData
+	{
+		float4x4 World;
+		float4x4 PrevWorldViewProjection;
+	};
+
+	StructuredBuffer<InstanceData> Instances : register(t0);
+#endif
+
 // ================================================================================================
 // Input/Output structs
 // ================================================================================================
@@ -34,12 +48,17 @@ struct VSOutput
 // ================================================================================================
 // Vertex Shader
 // ================================================================================================
-VSOutput VS(in VSInput input)
+VSOutput VS(in VSInput input, in uint InstanceID : SV_InstanceID)
 {
     VSOutput output;
 
     // Calc the clip-space position
-    output.PositionCS = mul(input.PositionOS, WorldViewProjection);
+	#if Instanced_
+		float4x4 world = Instances[InstanceOffset + InstanceID].World;
+		output.PositionCS = mul(mul(input.PositionOS, world), ViewProjection);
+	#else
+		output.PositionCS = mul(input.PositionOS, WorldViewProjection);
+	#endif
 
     return output;
 }
\ No newline at end of file
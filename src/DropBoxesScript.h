@@ -1,10 +1,9 @@
 #include "SceneScriptBase.h"
 
 float dt = 1.0f / 60.0f;
-q3Scene scenegb(dt);
 
 std::vector<q3Body *> bodylist;
-std::vector<SceneObject *> meshlist;
+std::vector<SceneObjectHandle> meshlist;
 
 std::vector<PointLight *> scenePointLight;
 std::vector<Model *> modelcubes;
@@ -12,6 +11,8 @@ std::vector<Model *> modelcubes;
 class DropBoxesScript: public SceneScript
 {
 public:
+	DropBoxesScript() : physicsScene(dt) {}
+
 	virtual void InitScene(Scene *scene)
 	{
 		std::wstring proxyModelPath = L"..\\Content\\Models\\CornellBox\\UVUnwrapped\\cbox_unwrapped.FBX";
@@ -50,17 +51,17 @@ public:
 
 		//scene->getGlobalCameraPtr()->SetLookAt(Float3(0.0f, 2.5f, -10.0f), Float3(0.0f, 0.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f));
 
-		scenegb.SetGravity(q3Vec3(0, -100.0f, 0));
+		physicsScene.SetGravity(q3Vec3(0, -100.0f, 0));
 		//drop boxes
 		acc = 0;
 
 		// Create the floor
 		q3BodyDef bodyDef;
-		q3Body* body = scenegb.CreateBody(bodyDef);
+		q3Body* body = physicsScene.CreateBody(bodyDef);
 		//bodylist.push_back(body);
 
 		
-		SceneObject* doo = scene->addStaticOpaquePlaneObject(40.0f, Float3(0, 0, 0), Quaternion());
+		scene->addStaticOpaquePlaneObject(40.0f, Float3(0, 0, 0), Quaternion());
 		//meshlist.push_back(doo);
 		//scene->getSceneBoundingBox();
 		q3BoxDef boxDef;
@@ -79,7 +80,7 @@ public:
 			q3BodyDef bodyDef;
 			bodyDef.position.Set(0, 0, 20);
 			bodyDef.bodyType = eDynamicBody;
-			q3Body* body = scenegb.CreateBody(bodyDef);
+			q3Body* body = physicsScene.CreateBody(bodyDef);
 			body->ApplyLinearForce(q3Vec3(0,0,-1));
 			
 			q3Transform tx;
@@ -104,15 +105,14 @@ public:
 			bodyDef.angularVelocity *= q3Sign(q3RandomFloat(-1.0f, 1.0f));
 			bodyDef.linearVelocity.Set(q3RandomFloat(1.0f, 3.0f), q3RandomFloat(1.0f, 3.0f), q3RandomFloat(1.0f, 3.0f));
 			bodyDef.linearVelocity *= q3Sign(q3RandomFloat(-1.0f, 1.0f));
-			q3Body* body = scenegb.CreateBody(bodyDef);
+			q3Body* body = physicsScene.CreateBody(bodyDef);
 
 			bodylist.push_back(body);
 			
 
-			SceneObject* doo = scene->addDynamicOpaqueObject(modelcubes.at(0), 0.1f, Float3(bodyDef.position.x, bodyDef.position.y, bodyDef.position.z), Quaternion());
-			//SceneObject* doo = scene->addDynamicOpaqueBoxObject( 0.02f, Float3(0, 10, 0), Quaternion());
-			meshlist.push_back(doo);
-			float radius = doo->bound->bsphere->Radius;
+			SceneObjectHandle handle = scene->addDynamicOpaqueObject(modelcubes.at(0), 0.1f, Float3(bodyDef.position.x, bodyDef.position.y, bodyDef.position.z), Quaternion());
+			//SceneObjectHandle handle = scene->addDynamicOpaqueBoxObject( 0.02f, Float3(0, 10, 0), Quaternion());
+			meshlist.push_back(handle);
 			float lengthbox = 3;
 			q3Transform tx;
 
@@ -124,7 +124,7 @@ public:
 		}
 
 		//drop boxes
-		scenegb.Step();
+		physicsScene.Step();
 
 		for (int i = 0; i < bodylist.size(); i++)
 		{
@@ -141,11 +141,12 @@ public:
 			ret.SetTranslation(position);
 
 			//meshlist.at(i)->base ->SetTranslation(position);
-			*(meshlist.at(i)->base) = ret;//->SetTranslation(position);
+			*(scene->getSceneObject(meshlist.at(i))->base) = ret;//->SetTranslation(position);
 
 
 		}
 	}
 	float acc;
+	q3Scene physicsScene;
 	
 };
\ No newline at end of file
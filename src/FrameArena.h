@@ -0,0 +1,66 @@
+#pragma once
+
+#include "PCH.h"
+#include <Assert.h>
+
+using namespace SampleFramework11;
+
+// Linear allocator for scratch memory that lives across frames.
+// The backing block only changes in Reserve(); Allocate() bumps an offset and Reset() rewinds it,
+// so code that carves its buffers out of the arena never touches the heap in steady state.
+class FrameArena
+{
+public:
+	FrameArena() : _data(nullptr), _capacity(0), _offset(0), _numHeapAllocations(0) {}
+	~FrameArena() { Release(); }
+
+	// Makes sure the block holds at least capacity bytes. Growing drops everything allocated so far.
+	void Reserve(size_t capacity)
+	{
+		_offset = 0;
+		if (capacity <= _capacity) return;
+
+		Release();
+		_data = (uint8 *)_aligned_malloc(capacity, Alignment);
+		Assert_(_data != nullptr);
+		_capacity = capacity;
+		_numHeapAllocations++;
+	}
+
+	template<typename T> T *Allocate(size_t count)
+	{
+		size_t size = (sizeof(T) * count + Alignment - 1) & ~(Alignment - 1);
+		Assert_(_offset + size <= _capacity);
+
+		T *ptr = reinterpret_cast<T *>(_data + _offset);
+		_offset += size;
+		return ptr;
+	}
+
+	void Reset() { _offset = 0; }
+
+	void Release()
+	{
+		_data != nullptr ? _aligned_free(_data) : 0;
+		_data = nullptr;
+		_capacity = 0;
+		_offset = 0;
+	}
+
+	static size_t AlignedSize(size_t size) { return (size + Alignment - 1) & ~(Alignment - 1); }
+
+	inline size_t getCapacity() const { return _capacity; }
+	inline size_t getUsedSize() const { return _offset; }
+	inline uint64 getNumHeapAllocations() const { return _numHeapAllocations; }
+
+private:
+	static const size_t Alignment = 16;
+
+	FrameArena(const FrameArena &);
+	FrameArena &operator=(const FrameArena &);
+
+	uint8 *_data;
+	size_t _capacity;
+	size_t _offset;
+	uint64 _numHeapAllocations;
+};
@@ -0,0 +1,302 @@
+#include "FrustumCuller.h"
+#include "BVH.h"
+
+#include <Utility.h>
+#include <Timer.h>
+
+#include <intrin.h>
+#include <ppl.h>
+
+FrustumCuller::FrustumCuller() : _numSpheres(0), _numVisible(0)
+{
+}
+
+void FrustumCuller::Clear()
+{
+	// keeps the capacity, culling every frame does not touch the heap once it has warmed up
+	_x.clear();
+	_y.clear();
+	_z.clear();
+	_r.clear();
+	_numSpheres = 0;
+	_numVisible = 0;
+}
+
+uint32 FrustumCuller::AddSphere(const BSphere &sphere)
+{
+	// drop the padding of the last group of 4 before appending
+	_x.resize(_numSpheres);
+	_y.resize(_numSpheres);
+	_z.resize(_numSpheres);
+	_r.resize(_numSpheres);
+
+	_x.push_back(sphere.Center.x);
+	_y.push_back(sphere.Center.y);
+	_z.push_back(sphere.Center.z);
+	_r.push_back(sphere.Radius);
+
+	size_t padded = (_numSpheres + 4) & ~3;
+	_x.resize(padded, 0.0f);
+	_y.resize(padded, 0.0f);
+	_z.resize(padded, 0.0f);
+	_r.resize(padded, 0.0f);
+
+	return _numSpheres++;
+}
+
+void FrustumCuller::Resize(uint32 numSpheres)
+{
+	size_t padded = (numSpheres + 3) & ~3;
+	_x.resize(padded, 0.0f);
+	_y.resize(padded, 0.0f);
+	_z.resize(padded, 0.0f);
+	_r.resize(padded, 0.0f);
+	_numSpheres = numSpheres;
+	_numVisible = 0;
+}
+
+// Tests spheres [begin, end) and writes the visible ones to out. begin is a multiple of 4.
+uint32 FrustumCuller::cullRange(const XMVECTOR *planes, uint32 numPlanes, uint32 begin, uint32 end, uint32 *out) const
+{
+	uint32 numVisible = 0;
+
+	for (uint32 i = begin; i < end; i += 4)
+	{
+		XMVECTOR x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&_x[i]));
+		XMVECTOR y = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&_y[i]));
+		XMVECTOR z = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&_z[i]));
+		XMVECTOR negRadius = XMVectorNegate(XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&_r[i])));
+
+		XMVECTOR outside = XMVectorFalseInt();
+		for (uint32 p = 0; p < numPlanes; p++)
+		{
+			const XMVECTOR *plane = &planes[p * 4];
+			XMVECTOR distance = XMVectorMultiplyAdd(x, plane[0], plane[3]);
+			distance = XMVectorMultiplyAdd(y, plane[1], distance);
+			distance = XMVectorMultiplyAdd(z, plane[2], distance);
+			outside = XMVectorOrInt(outside, XMVectorLess(distance, negRadius));
+		}
+
+		uint32 visibleMask = ~(uint32)_mm_movemask_ps(outside) & 0xF;
+		visibleMask &= (1u << Min(end - i, 4u)) - 1;
+
+		while (visibleMask != 0)
+		{
+			unsigned long lane;
+			_BitScanForward(&lane, visibleMask);
+			visibleMask &= visibleMask - 1;
+
+			out[numVisible++] = i + lane;
+		}
+	}
+
+	return numVisible;
+}
+
+void FrustumCuller::Cull(const Frustum &frustum, bool ignoreNearZ)
+{
+	Cull(frustum, ignoreNearZ, _numSpheres > ChunkSize);
+}
+
+void FrustumCuller::Cull(const Frustum &frustum, bool ignoreNearZ, bool parallel)
+{
+	// Planes splatted once, a b c d per plane. Plane 5 is the near plane.
+	const uint32 numPlanes = ignoreNearZ ? 5 : 6;
+	XMVECTOR planes[6 * 4];
+	for (uint32 p = 0; p < numPlanes; p++)
+	{
+		planes[p * 4 + 0] = XMVectorSplatX(frustum.Planes[p]);
+		planes[p * 4 + 1] = XMVectorSplatY(frustum.Planes[p]);
+		planes[p * 4 + 2] = XMVectorSplatZ(frustum.Planes[p]);
+		planes[p * 4 + 3] = XMVectorSplatW(frustum.Planes[p]);
+	}
+
+	if (_visible.size() < _numSpheres)
+	{
+		_visible.resize(_numSpheres);
+	}
+
+	if (!parallel || _numSpheres <= ChunkSize)
+	{
+		_numVisible = _numSpheres > 0 ? cullRange(planes, numPlanes, 0, _numSpheres, &_visible[0]) : 0;
+		return;
+	}
+
+	// Every chunk writes into its own part of _visible, then the parts are packed in order
+	const uint32 numChunks = (_numSpheres + ChunkSize - 1) / ChunkSize;
+	_chunkCounts.resize(numChunks);
+
+	concurrency::parallel_for(uint32(0), numChunks, [&](uint32 chunk)
+	{
+		uint32 begin = chunk * ChunkSize;
+		uint32 end = Min(begin + ChunkSize, _numSpheres);
+		_chunkCounts[chunk] = cullRange(planes, numPlanes, begin, end, &_visible[begin]);
+	});
+
+	_numVisible = _chunkCounts[0];
+	for (uint32 chunk = 1; chunk < numChunks; chunk++)
+	{
+		memmove(&_visible[_numVisible], &_visible[chunk * ChunkSize], sizeof(uint32) * _chunkCounts[chunk]);
+		_numVisible += _chunkCounts[chunk];
+	}
+}
+
+void FrustumCuller::RunBenchmark()
+{
+	static const uint32 NumIterations = 16;
+
+	// Camera at the origin looking down +z, spheres in a box around it so about a fifth are visible
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(Pi_4, 16.0f / 9.0f, 0.1f, 500.0f);
+	Frustum frustum;
+	ComputeFrustum(XMMatrixMultiply(view, proj), frustum);
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> posDist(-400.0f, 400.0f);
+	std::uniform_real_distribution<float> radiusDist(0.25f, 4.0f);
+
+	std::vector<BSphere> spheres;
+	FrustumCuller culler;
+
+	DebugPrint(L"Frustum culling benchmark\n");
+
+	for (uint32 numSpheres = 1024; numSpheres <= 65536; numSpheres *= 4)
+	{
+		spheres.resize(numSpheres);
+		for (uint32 i = 0; i < numSpheres; i++)
+		{
+			spheres[i].Center = XMFLOAT3(posDist(rng), posDist(rng), posDist(rng));
+			spheres[i].Radius = radiusDist(rng);
+		}
+		culler.Resize(numSpheres);
+
+		Timer timer;
+
+		uint32 numScalarVisible = 0;
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			numScalarVisible = 0;
+			for (uint32 i = 0; i < numSpheres; i++)
+			{
+				numScalarVisible += TestFrustumSphere(frustum, spheres[i], false);
+			}
+		}
+		timer.Update();
+		double scalarMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			for (uint32 i = 0; i < numSpheres; i++)
+			{
+				culler.SetSphere(i, spheres[i]);
+			}
+		}
+		timer.Update();
+		double gatherMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			for (uint32 i = 0; i < numSpheres; i++)
+			{
+				culler.SetSphere(i, spheres[i]);
+			}
+			culler.Cull(frustum, false, false);
+		}
+		timer.Update();
+		double simdMs = timer.DeltaMillisecondsD() / NumIterations;
+		uint32 numSIMDVisible = culler.getNumVisible();
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			for (uint32 i = 0; i < numSpheres; i++)
+			{
+				culler.SetSphere(i, spheres[i]);
+			}
+			culler.Cull(frustum, false, true);
+		}
+		timer.Update();
+		double parallelMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		DebugPrint(ToString(numSpheres) + L" spheres: scalar " + ToString(scalarMs) + L"ms, SIMD " + ToString(simdMs)
+			+ L"ms, parallel SIMD " + ToString(parallelMs) + L"ms (gather " + ToString(gatherMs) + L"ms of that), visible "
+			+ ToString(numScalarVisible) + L" / " + ToString(numSIMDVisible) + L" / " + ToString(culler.getNumVisible()) + L"\n");
+	}
+}
+
+void FrustumCuller::RunBVHBenchmark()
+{
+	static const uint32 NumIterations = 16;
+
+	// A camera in the middle of a square world, looking along +z. The world grows with the object
+	// count at constant density, so the number of visible objects stays roughly the same.
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(Pi_4, 16.0f / 9.0f, 0.1f, 100.0f);
+	Frustum frustum;
+	ComputeFrustum(XMMatrixMultiply(view, proj), frustum);
+	Float4 planes[6];
+	const uint32 numPlanes = GetFrustumPlanes(frustum, false, planes);
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+
+	std::vector<BBox> boxes;
+	std::vector<uint32> visible;
+	BVH bvh;
+	FrustumCuller culler;
+
+	DebugPrint(L"BVH culling benchmark\n");
+
+	for (uint32 numObjects = 100; numObjects <= 100000; numObjects *= 10)
+	{
+		const float worldSize = 10.0f * sqrtf((float)numObjects);
+
+		boxes.resize(numObjects);
+		culler.Clear();
+		for (uint32 i = 0; i < numObjects; i++)
+		{
+			Float3 center((unitDist(rng) - 0.5f) * worldSize, (unitDist(rng) - 0.5f) * 20.0f, (unitDist(rng) - 0.5f) * worldSize);
+			Float3 halfSize = Float3(0.25f) + Float3(unitDist(rng), unitDist(rng), unitDist(rng)) * 2.0f;
+			boxes[i] = MakeBBox(center - halfSize, center + halfSize);
+
+			BSphere sphere = { XMFLOAT3(center.x, center.y, center.z), Float3::Length(halfSize) };
+			culler.AddSphere(sphere);
+		}
+
+		Timer timer;
+
+		timer.Update();
+		bvh.Build(&boxes[0], numObjects);
+		timer.Update();
+		double buildMs = timer.DeltaMillisecondsD();
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			culler.Cull(frustum, false, false);
+		}
+		timer.Update();
+		double flatMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			visible.clear();
+			bvh.CullFrustum(planes, numPlanes, visible);
+		}
+		timer.Update();
+		double bvhMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		bvh.Refit(&boxes[0]);
+		timer.Update();
+		double refitMs = timer.DeltaMillisecondsD();
+
+		DebugPrint(ToString(numObjects) + L" objects: flat SIMD " + ToString(flatMs) + L"ms (" + ToString(culler.getNumVisible())
+			+ L" visible), BVH " + ToString(bvhMs) + L"ms (" + ToString((uint32)visible.size()) + L" visible), build "
+			+ ToString(buildMs) + L"ms, refit " + ToString(refitMs) + L"ms, " + ToString(bvh.getNumNodes()) + L" nodes\n");
+	}
+}
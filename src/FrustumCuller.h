@@ -0,0 +1,61 @@
+#pragma once
+#include "BoundUtils.h"
+
+using namespace SampleFramework11;
+
+// Sphere/frustum culling over structure-of-arrays bounds. Spheres are tested 4 at a time
+// against every plane, large sets are split into chunks that run on the worker pool.
+// The output is a compact, ascending list of the indices of visible spheres.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	void Clear();
+	uint32 AddSphere(const BSphere &sphere);
+
+	// For bounds kept across frames: resize once, then overwrite only the spheres that moved
+	void Resize(uint32 numSpheres);
+	inline void SetSphere(uint32 index, const BSphere &sphere)
+	{
+		_x[index] = sphere.Center.x;
+		_y[index] = sphere.Center.y;
+		_z[index] = sphere.Center.z;
+		_r[index] = sphere.Radius;
+	}
+
+	// Same semantics as TestFrustumSphere: a sphere is culled only when it is fully behind a plane.
+	// The near plane is skipped when ignoreNearZ is set, for shadow casters behind the camera.
+	void Cull(const Frustum &frustum, bool ignoreNearZ);
+	void Cull(const Frustum &frustum, bool ignoreNearZ, bool parallel);
+
+	inline uint32 getNumSpheres() const { return _numSpheres; }
+	inline uint32 getNumVisible() const { return _numVisible; }
+	inline const uint32 *getVisibleIndices() const { return _visible.empty() ? nullptr : &_visible[0]; }
+
+	// Times the scalar TestFrustumSphere loop against the SIMD and parallel paths on 1k to 64k
+	// synthetic spheres. The SIMD timings include writing every sphere into the arrays, what a
+	// scene where everything moves pays each frame.
+	static void RunBenchmark();
+
+	// Times this flat culling against BVH::CullFrustum for 100 to 100k synthetic boxes, and
+	// building and refitting the BVH
+	static void RunBVHBenchmark();
+
+private:
+	// Below this many spheres one thread is faster than handing out chunks
+	static const uint32 ChunkSize = 4096;
+
+	uint32 cullRange(const XMVECTOR *planes, uint32 numPlanes, uint32 begin, uint32 end, uint32 *out) const;
+
+	// Padded to a multiple of 4, padding spheres are never reported
+	std::vector<float> _x;
+	std::vector<float> _y;
+	std::vector<float> _z;
+	std::vector<float> _r;
+	uint32 _numSpheres;
+
+	std::vector<uint32> _visible;
+	std::vector<uint32> _chunkCounts;
+	uint32 _numVisible;
+};
@@ -1,3 +1,4 @@
+#include "AppSettings.hlsl"
 #include "SHProbeLight.hlsli"
 
 cbuffer IndirectDiffuseConstants : register(b0)
@@ -0,0 +1,55 @@
+#include "InstanceBatcher.h"
+
+InstanceBatcher::InstanceBatcher()
+{
+}
+
+void InstanceBatcher::Clear()
+{
+	// capacity and hash buckets are kept, batching every pass does not touch the heap once warmed up
+	_items.clear();
+	_batches.clear();
+	_instances.clear();
+	_batchLookup.clear();
+}
+
+void InstanceBatcher::AddItem(const BatchKey &key, uint32 instance)
+{
+	auto found = _batchLookup.find(key);
+	uint32 batch;
+	if (found == _batchLookup.end())
+	{
+		batch = (uint32)_batches.size();
+		Batch newBatch = { key, 0, 0 };
+		_batches.push_back(newBatch);
+		_batchLookup.insert(std::make_pair(key, batch));
+	}
+	else
+	{
+		batch = found->second;
+	}
+
+	_batches[batch].numInstances++;
+
+	Item item = { batch, instance };
+	_items.push_back(item);
+}
+
+void InstanceBatcher::Build()
+{
+	// Counts were taken in AddItem, offsets then a stable scatter
+	uint32 offset = 0;
+	for (size_t b = 0; b < _batches.size(); b++)
+	{
+		_batches[b].firstInstance = offset;
+		offset += _batches[b].numInstances;
+		_batches[b].numInstances = 0;
+	}
+
+	_instances.resize(_items.size());
+	for (size_t i = 0; i < _items.size(); i++)
+	{
+		Batch &batch = _batches[_items[i].batch];
+		_instances[batch.firstInstance + batch.numInstances++] = _items[i].instance;
+	}
+}
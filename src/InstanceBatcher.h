@@ -0,0 +1,82 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <unordered_map>
+#include "CPUTypes.h"
+
+namespace SampleFramework11
+{
+	class Model;
+}
+
+// Groups mesh part draws that can share one instanced draw call. Items with the same
+// (shader permutation, model, mesh, part, probe) end up in one batch; batches come out in the
+// order their first item was added and keep the add order of their items, so a depth sorted
+// input stays roughly front to back. Nothing here touches the device.
+class InstanceBatcher
+{
+public:
+	struct BatchKey
+	{
+		uint32 permutation;
+		const SampleFramework11::Model *model;
+		uint32 mesh;
+		uint32 part;
+		uint32 probeIndex;
+
+		bool operator==(const BatchKey &other) const
+		{
+			return permutation == other.permutation && model == other.model && mesh == other.mesh
+				&& part == other.part && probeIndex == other.probeIndex;
+		}
+	};
+
+	// Instances [firstInstance, firstInstance + numInstances) of getInstances()
+	struct Batch
+	{
+		BatchKey key;
+		uint32 firstInstance;
+		uint32 numInstances;
+	};
+
+	InstanceBatcher();
+
+	void Clear();
+
+	// instance is caller data carried along, e.g. the index of the object's transforms
+	void AddItem(const BatchKey &key, uint32 instance);
+
+	void Build();
+
+	inline const std::vector<Batch> &getBatches() const { return _batches; }
+	inline const std::vector<uint32> &getInstances() const { return _instances; }
+	inline uint32 getNumItems() const { return (uint32)_items.size(); }
+
+	// Draw calls an unbatched loop would have issued minus the batches
+	inline uint32 getNumDrawCallsSaved() const { return (uint32)(_items.size() - _batches.size()); }
+
+private:
+	struct BatchKeyHash
+	{
+		size_t operator()(const BatchKey &key) const
+		{
+			size_t h = std::hash<const void *>()(key.model);
+			h ^= (size_t)key.permutation * 0x9E3779B1u + (h << 6) + (h >> 2);
+			h ^= (size_t)key.mesh * 0x85EBCA77u + (h << 6) + (h >> 2);
+			h ^= (size_t)key.part * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+			h ^= (size_t)key.probeIndex * 0x27D4EB2Fu + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct Item
+	{
+		uint32 batch;
+		uint32 instance;
+	};
+
+	std::vector<Item> _items;
+	std::vector<Batch> _batches;
+	std::vector<uint32> _instances;
+	std::unordered_map<BatchKey, uint32, BatchKeyHash> _batchLookup;
+};
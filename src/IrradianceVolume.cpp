@@ -4,9 +4,13 @@
 #include "DebugRenderer.h"
 #include "BoundUtils.h"
 
+#include <cfloat>
+
 IrradianceVolume::IrradianceVolume()
-	: _cubemapCamera(1.0f, 90.0f * (Pi / 180), 0.01f, 40.0f), // TODO: experiment with far clip plane
-	_dirLightCam(0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f), _weightSum(0.0f), _numBounces(1)
+	: _scene(nullptr), _cubemapCamera(1.0f, 90.0f * (Pi / 180), 0.01f, 40.0f), // TODO: experiment with far clip plane
+	_dirLightCam(0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f), _weightSum(0.0f), _numBounces(1),
+	_atlasesFromCache(false), _probeCacheSavePending(false), _atlasesDirty(false), _adaptivePlacement(true),
+	_frontSHBuffer(0), _compressedSHValid(false)
 
 {
 }
@@ -77,6 +81,7 @@ void IrradianceVolume::Initialize(ID3D11Device *device, ID3D11DeviceContext *con
 	opts.Add("CubemapSize_", _cubemapSizeGBuffer);
 	_relightSHIntegrateCS = CompileCSFromFile(_device, L"RelightSH.hlsl", "IntegrateCS", "cs_5_0", opts);
 	_relightSHReductionCS = CompileCSFromFile(_device, L"RelightSH.hlsl", "ReductionCS", "cs_5_0", opts);
+	_compressSHCS = CompileCSFromFile(_device, L"RelightSH.hlsl", "CompressCS", "cs_5_0", opts);
 
 	_indirectLightBounceVS = CompileVSFromFile(_device, L"IndirectDiffuse.hlsl", "VS");
 	_indirectLightBouncePS = CompilePSFromFile(_device, L"IndirectDiffuse.hlsl", "PS");
@@ -92,6 +97,13 @@ void IrradianceVolume::SetProbeDensity(float unitsBetweenProbes)
 	setupResourcesForScene();
 }
 
+void IrradianceVolume::SetAdaptivePlacement(bool enable)
+{
+	_adaptivePlacement = enable;
+	if (_scene == nullptr || !_scene->hasProxySceneObject()) return;
+	setupResourcesForScene();
+}
+
 void IrradianceVolume::SetScene(Scene *scene)
 {
 	_scene = scene;
@@ -102,83 +114,236 @@ void IrradianceVolume::SetScene(Scene *scene)
 
 void IrradianceVolume::setupResourcesForScene()
 {
-	BBox &bbox = _scene->getSceneBoundingBox();
-	Float3 diff = Float3(bbox.Max) - Float3(bbox.Min);
+	_probeCacheKey = ProbeCache::ComputeKey(_scene, _unitsBetweenProbes, _adaptivePlacement, _cubemapSizeGBuffer, _cubemapSizeTexcoord);
+	_atlasesFromCache = _probeCache.Load(_probeCacheKey);
+	_probeCacheSavePending = false;
 
-	Float3 numProbesAxis = diff * (float)(1.0 / _unitsBetweenProbes);
-	//uint32 probeNumX = (uint32)ceilf(numProbesAxis.x) - 1;
-	//uint32 probeNumY = (uint32)ceilf(numProbesAxis.y) - 1;
-	//uint32 probeNumZ = (uint32)ceilf(numProbesAxis.z) - 1;
+	if (_atlasesFromCache)
+	{
+		const ProbeCache::Contents &cached = _probeCache.getContents();
+		_cubemapNum = cached.numProbes;
+		_positionList.assign(cached.probePositions, cached.probePositions + cached.numProbes);
+	}
+	else
+	{
+		generateProbePositions();
+	}
 
-	//probeNumX = Max(probeNumX, (uint32)2);
-	//probeNumY = Max(probeNumY, (uint32)2);
-	//probeNumZ = Max(probeNumZ, (uint32)2);
+	createCubemapAtlasRTs();
+	createSHComputeBuffers();
+	updateProbeLookup();
 
-	//_cubemapNum = probeNumX * probeNumY * probeNumZ;
+	if (_atlasesFromCache)
+	{
+		uploadCachedAtlases();
+		_probeCache.Unload();
+	}
+	_atlasesDirty = !_atlasesFromCache;
 
-	//// TODO: find better way to calc this
+	_probeLights.clear();
+	_probeLights.resize(_cubemapNum);
 
+	// cached probes already hold SH, they only need refreshing for the current lights
+	_updateScheduler.Reset(&_positionList[0], &_probeRadii[0], _cubemapNum, &_probeIndirection, _atlasesFromCache);
+	_sceneLights.clear();
+}
 
-	//_positionList.clear();
-	//_positionList.resize(_cubemapNum);
-	//for (uint32 z = 0; z < probeNumZ; z++) {
-	//for (uint32 y = 0; y < probeNumY; y++) {
-	//for (uint32 x = 0; x < probeNumX; x++) {
-	//	uint32 index = z * probeNumY * probeNumX + y * probeNumX + x;
-	//	float posX = _unitsBetweenProbes * (1 + x);
-	//	float posY = _unitsBetweenProbes * (1 + y);
-	//	float posZ = _unitsBetweenProbes * (1 + z);
+void IrradianceVolume::generateProbePositions()
+{
+	BBox bbox = _scene->getSceneBoundingBox();
 
-	//	Float3 positionWS = Float3(posX, posY, posZ) + Float3(bbox.Min);
-	//	_positionList[index] = positionWS;
-	//}}}
+	if (!_adaptivePlacement)
+	{
+		ProbePlacement::PlaceGrid(bbox, _unitsBetweenProbes, _positionList);
+		_cubemapNum = (uint32)_positionList.size();
+		return;
+	}
 
-	uint32 numProbesX = (uint32)floorf(numProbesAxis.x);
-	uint32 numProbesY = (uint32)floorf(numProbesAxis.y);
-	uint32 numProbesZ = (uint32)floorf(numProbesAxis.z);
+	// Placement follows the proxy mesh, it is what the probes end up lighting
+	SceneObject *proxyObj = _scene->getProxySceneObjectPtr();
+	std::vector<Float3> vertices;
+	std::vector<Float3> normals;
+	std::vector<uint32> indices;
+	for (size_t i = 0; i < proxyObj->model->Meshes().size(); i++)
+	{
+		const Mesh &mesh = proxyObj->model->Meshes()[i];
+		const uint32 baseVertex = (uint32)vertices.size();
 
-	numProbesX = Max(numProbesX, (uint32)2);
-	numProbesY = Max(numProbesY, (uint32)2);
-	numProbesZ = Max(numProbesZ, (uint32)2);
+		// POSITION then NORMAL, see the proxy mesh input layout
+		for (uint32 v = 0; v < mesh.NumVertices(); v++)
+		{
+			const Float3 *vertex = reinterpret_cast<const Float3 *>(mesh.Vertices() + v * mesh.VertexStride());
+			vertices.push_back(Float3::Transform(vertex[0], *proxyObj->base));
+			normals.push_back(Float3::TransformDirection(vertex[1], *proxyObj->base));
+		}
 
-	_cubemapNum = numProbesX * numProbesY * numProbesZ;
+		for (uint32 idx = 0; idx < mesh.NumIndices(); idx++)
+		{
+			uint32 index = mesh.IndexBufferType() == IndexType::Index32Bit
+				? reinterpret_cast<const uint32 *>(mesh.Indices())[idx]
+				: reinterpret_cast<const uint16 *>(mesh.Indices())[idx];
+			indices.push_back(baseVertex + index);
+		}
+	}
 
-	float calcUnitDistX = diff.x / (numProbesX+1);
-	float calcUnitDistY = diff.y / (numProbesY+1);
-	float calcUnitDistZ = diff.z / (numProbesZ+1);
+	ProbePlacement::Settings settings;
+	settings.unitsBetweenProbes = _unitsBetweenProbes;
+	settings.maxProbes = MAX_PROBE_NUM;
 
 	_positionList.clear();
-	_positionList.resize(_cubemapNum);
-	for (uint32 z = 0; z < numProbesZ; z++) {
-		for (uint32 y = 0; y < numProbesY; y++) {
-			for (uint32 x = 0; x < numProbesX; x++) {
-				uint32 index = z * numProbesY * numProbesX + y * numProbesX + x;
-				float posX = calcUnitDistX * (1 + x);
-				float posY = calcUnitDistX  * (1 + y);
-				float posZ = calcUnitDistX  * (1 + z);
-
-				Float3 positionWS = Float3(posX, posY, posZ) + Float3(bbox.Min);
-				_positionList[index] = positionWS;
+	if (!indices.empty())
+	{
+		ProbePlacement::PlaceAdaptive(bbox, &vertices[0], &normals[0], &indices[0], (uint32)indices.size() / 3,
+			settings, _positionList);
+	}
+
+	// nothing to place around, fall back to the grid
+	if (_positionList.empty())
+		ProbePlacement::PlaceGrid(bbox, _unitsBetweenProbes, _positionList);
+
+	_cubemapNum = (uint32)_positionList.size();
+}
+
+void IrradianceVolume::updateProbeLookup()
+{
+	BBox bbox = _scene->getSceneBoundingBox();
+	ProbePlacement::BuildIndirectionGrid(bbox, _unitsBetweenProbes, &_positionList[0], _cubemapNum, _probeIndirection);
+
+	// Adaptive probes are sparser away from geometry, their lights reach as far as the local spacing.
+	// The nearest other probe comes from the grid buckets, widening the search until one is inside.
+	_probeRadii.assign(_cubemapNum, _unitsBetweenProbes * 2.0f);
+	if (!_adaptivePlacement || _cubemapNum < 2) return;
+
+	std::vector<uint32> candidates;
+	for (uint32 i = 0; i < _cubemapNum; i++)
+	{
+		float nearestSq = FLT_MAX;
+		for (float searchRadius = _unitsBetweenProbes; nearestSq == FLT_MAX; searchRadius *= 2.0f)
+		{
+			candidates.clear();
+			_probeIndirection.GatherProbes(_positionList[i], searchRadius, candidates);
+			for (size_t c = 0; c < candidates.size(); c++)
+			{
+				Float3 d = _positionList[candidates[c]] - _positionList[i];
+				float distanceSq = Float3::Dot(d, d);
+				if (candidates[c] != i && distanceSq <= searchRadius * searchRadius)
+					nearestSq = Min(nearestSq, distanceSq);
 			}
 		}
+		_probeRadii[i] = Max(_unitsBetweenProbes, sqrtf(nearestSq)) * 2.0f;
 	}
+}
 
+uint32 IrradianceVolume::FindProbe(const Float3 &pos) const
+{
+	return _probeIndirection.Lookup(pos);
+}
 
-	createCubemapAtlasRTs();
-	createSHComputeBuffers();
+void IrradianceVolume::uploadCachedAtlases()
+{
+	PIXEvent event(L"UploadCachedProbeAtlases");
+
+	// straight from the mapped file into the textures
+	const ProbeCache::Contents &cached = _probeCache.getContents();
+	_context->UpdateSubresource(_albedoCubemapRT.Texture, 0, nullptr, cached.albedoAtlas,
+		_albedoCubemapRT.Width * ProbeCache::AlbedoTexelSize, 0);
+	_context->UpdateSubresource(_normalCubemapRT.Texture, 0, nullptr, cached.normalAtlas,
+		_normalCubemapRT.Width * ProbeCache::NormalTexelSize, 0);
+	_context->UpdateSubresource(_proxyMeshTexCoordCubemapRT.Texture, 0, nullptr, cached.texcoordAtlas,
+		_proxyMeshTexCoordCubemapRT.Width * ProbeCache::TexcoordTexelSize, 0);
+}
 
-	_probeLights.clear();
-	_probeLights.resize(_cubemapNum);
+// Copies a render target into tightly packed rows
+static void readbackRenderTarget(ID3D11Device *device, ID3D11DeviceContext *context, const RenderTarget2D &rt,
+	uint32 texelSize, std::vector<uint8> &data)
+{
+	StagingTexture2D staging;
+	staging.Initialize(device, rt.Width, rt.Height, rt.Format);
+	context->CopyResource(staging.Texture, rt.Texture);
+
+	const uint32 rowSize = rt.Width * texelSize;
+	data.resize(rowSize * rt.Height);
+
+	uint32 pitch = 0;
+	const uint8 *mapped = reinterpret_cast<const uint8 *>(staging.Map(context, 0, pitch));
+	for (uint32 y = 0; y < rt.Height; y++)
+	{
+		memcpy(&data[y * rowSize], mapped + y * pitch, rowSize);
+	}
+	staging.Unmap(context, 0);
+}
+
+void IrradianceVolume::saveProbeCache()
+{
+	std::vector<uint8> albedo;
+	std::vector<uint8> normal;
+	std::vector<uint8> texcoord;
+	readbackRenderTarget(_device, _context, _albedoCubemapRT, ProbeCache::AlbedoTexelSize, albedo);
+	readbackRenderTarget(_device, _context, _normalCubemapRT, ProbeCache::NormalTexelSize, normal);
+	readbackRenderTarget(_device, _context, _proxyMeshTexCoordCubemapRT, ProbeCache::TexcoordTexelSize, texcoord);
+
+	StagingBuffer shStaging;
+	const StructuredBuffer &shBuffer = _relightSHBuffers[_frontSHBuffer];
+	shStaging.Initialize(_device, shBuffer.Size);
+	_context->CopyResource(shStaging.Buffer, shBuffer.Buffer);
+
+	ProbeCache::Contents contents;
+	contents.numProbes = _cubemapNum;
+	contents.cubemapSizeGBuffer = _cubemapSizeGBuffer;
+	contents.cubemapSizeTexcoord = _cubemapSizeTexcoord;
+	contents.probePositions = &_positionList[0];
+	contents.albedoAtlas = &albedo[0];
+	contents.normalAtlas = &normal[0];
+	contents.texcoordAtlas = &texcoord[0];
+	contents.probeSH = reinterpret_cast<const PaddedSH9Color *>(shStaging.Map(_context));
+	contents.compressedSH = nullptr;
+
+	// the float SH stays the source, the cache encodes it on the way out
+	const bool compress = AppSettings::CompressSHProbes;
+	ProbeCache::Save(_probeCacheKey, contents, compress);
+
+	if (compress)
+	{
+		SHProbeCompression::ErrorStats error = SHProbeCompression::MeasureError(contents.probeSH, _cubemapNum);
+		DebugPrint(L"Probe cache SH compressed to " + ToString(sizeof(CompressedSH9Color) * _cubemapNum / 1024) + L"KB, irradiance error max "
+			+ ToString(error.maxIrradianceError * 100.0f) + L"% mean " + ToString(error.meanIrradianceError * 100.0f) + L"%\n");
+	}
+
+	shStaging.Unmap(_context);
 }
 
 void IrradianceVolume::createSHComputeBuffers()
 {
 	_viewToWorldMatrixPalette.Initialize(_device, sizeof(Float4x4), 6 * _cubemapNum, 1);
 	_shIntegrationConstants.Initialize(_device);
+	_shCompressionConstants.Initialize(_device);
 
 	// 3 is #(rgb) channel ; 6 is #cubefaces
 	_relightIntegrationBuffer.Initialize(_device, sizeof(PackedSH9), _cubemapSizeGBuffer * 3 * 6 * _cubemapNum, 1, 1);
-	_relightSHBuffer.Initialize(_device, sizeof(PaddedSH9Color), _cubemapNum, 1, 1);
+	// last baked SH from the cache, so probes are lit before the first integration
+	std::vector<PaddedSH9Color> decodedSH;
+	const PaddedSH9Color *initialSH = nullptr;
+	if (_atlasesFromCache)
+	{
+		const ProbeCache::Contents &cached = _probeCache.getContents();
+		initialSH = cached.probeSH;
+		if (cached.compressedSH != nullptr)
+		{
+			decodedSH.resize(_cubemapNum);
+			SHProbeCompression::DecodeArray(cached.compressedSH, _cubemapNum, &decodedSH[0]);
+			initialSH = &decodedSH[0];
+		}
+	}
+
+	for (uint32 i = 0; i < 2; i++)
+	{
+		_relightSHBuffers[i].Initialize(_device, sizeof(PaddedSH9Color), _cubemapNum, 1, 1, false, false, initialSH);
+		_compressedSHBuffers[i].Initialize(_device, sizeof(CompressedSH9Color), _cubemapNum, 1, 1);
+	}
+	_frontSHBuffer = 0;
+	_compressedSHValid = false;
+
+	_probeUpdateListBuffer.Initialize(_device, sizeof(uint32), _cubemapNum, true);
 
 	_weightSum = 0.0f;
 	// Compute the final weight for integration
@@ -211,7 +376,7 @@ void IrradianceVolume::createSHComputeBuffers()
 		for (int cubeboxFaceIndex = 0; cubeboxFaceIndex < 6; cubeboxFaceIndex++)
 		{
 			_cubemapCamera.SetLookAt(eyePos,
-				_CubemapCameraStruct[cubeboxFaceIndex].LookAt,
+				_CubemapCameraStruct[cubeboxFaceIndex].LookAt + eyePos,
 				_CubemapCameraStruct[cubeboxFaceIndex].Up);
 
 			palette[currCubemap * 6 + cubeboxFaceIndex]
@@ -246,6 +411,8 @@ void IrradianceVolume::createCubemapAtlasRTs()
 
 void IrradianceVolume::RenderSceneAtlasGBuffer()
 {
+	if (_atlasesFromCache) return;
+
 	PIXEvent event(L"RenderSceneAtlasGBuffer");
 
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -288,6 +455,8 @@ void IrradianceVolume::RenderSceneAtlasGBuffer()
 
 void IrradianceVolume::RenderSceneAtlasProxyMeshTexcoord()
 {
+	if (_atlasesFromCache) return;
+
 	PIXEvent event(L"RenderProxyMeshTexcoordAtlas");
 
 	float clearColor[4] = { 0.0f, 0.0f, 1.0f, 0.0f }; // keep blue channel for sky light
@@ -332,6 +501,10 @@ void IrradianceVolume::RenderSceneAtlasProxyMeshTexcoord()
 
 	renderTarget[0] = nullptr;
 	_context->OMSetRenderTargets(1, renderTarget, nullptr);
+
+	// always rendered right after the G-buffer atlas
+	_probeCacheSavePending = true;
+	_atlasesDirty = false;
 }
 
 void IrradianceVolume::renderProxyModel()
@@ -462,7 +635,7 @@ void IrradianceVolume::renderProxyMeshDirectLighting()
 	_debugRenderer->QueueSprite(_dirLightDiffuseBufferRT.SRView, Float3(0, 0, 0), Float4(1, 1, 1, 1));
 }
 
-void IrradianceVolume::renderRelightCubemap()
+void IrradianceVolume::renderRelightCubemap(uint32 numUpdates)
 {
 	PIXEvent event(L"RenderRelightCubemap");
 
@@ -475,6 +648,7 @@ void IrradianceVolume::renderRelightCubemap()
 	_context->IASetVertexBuffers(0, 1, vbs, strides, offsets);
 	_context->IASetIndexBuffer(NULL, DXGI_FORMAT_R32_UINT, 0);
 	_context->IASetInputLayout(NULL);
+	_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	D3D11_VIEWPORT vp;
 	vp.TopLeftX = 0.0f;
@@ -491,23 +665,27 @@ void IrradianceVolume::renderRelightCubemap()
 	ID3D11RenderTargetView* rtvs[1] = { _relightCubemapRT.RTView };
 	_context->OMSetRenderTargets(1, rtvs, NULL);
 
-	ID3D11ShaderResourceView* srvs[4] = { 
+	ID3D11ShaderResourceView* srvs[5] = { 
 		_dirLightDiffuseBufferRT.SRView, 
 		_proxyMeshTexCoordCubemapRT.SRView, 
 		_albedoCubemapRT.SRView, 
 		_indirectLightDiffuseBufferRT.SRView,
+		_probeUpdateListBuffer.SRView,
 	};
-	_context->PSSetShaderResources(0, 4, srvs);
+	_context->PSSetShaderResources(0, 5, srvs);
+	_context->VSSetShaderResources(0, 5, srvs);
 
 	ID3D11SamplerState* sampStates[1] = {
 		_samplerStates.Linear(),
 	};
 	_context->PSSetSamplers(0, 1, sampStates);
 
-	_context->Draw(3, 0);
+	// only the rows of the probes being updated
+	_context->DrawInstanced(6, numUpdates, 0, 0);
 
-	srvs[0] = srvs[1] = srvs[2] = srvs[3] = NULL;
-	_context->PSSetShaderResources(0, 4, srvs);
+	srvs[0] = srvs[1] = srvs[2] = srvs[3] = srvs[4] = NULL;
+	_context->PSSetShaderResources(0, 5, srvs);
+	_context->VSSetShaderResources(0, 5, srvs);
 	sampStates[0] = nullptr;
 	_context->PSSetSamplers(0, 1, sampStates);
 	rtvs[0] = { nullptr };
@@ -539,35 +717,100 @@ void IrradianceVolume::Update()
 	for (uint32 i = 0; i < _cubemapNum; i++)
 	{
 		_probeLights[i].cPos = _positionList[i];
-		_probeLights[i].cRadius = _unitsBetweenProbes * 2.0f;
+		_probeLights[i].cRadius = _probeRadii[i];
 		_probeLights[i].cProbeIndex = i;
 		_probeLights[i].cIntensity = AppSettings::DiffuseGI_Intensity;
 	}
+
+	// what changed since last frame decides which probes get relit first
+	if (AppSettings::LightDirection.Changed() || AppSettings::LightColor.Changed() || AppSettings::SkyColor.Changed()
+		|| AppSettings::DiffuseGIBounces.Changed())
+	{
+		_updateScheduler.InvalidateAll();
+	}
+
+	// rewrite the cache in the other SH format
+	if (AppSettings::CompressSHProbes.Changed())
+		_probeCacheSavePending = true;
+
+	const ChunkedPool<PointLight> &pointLights = _scene->getPointLights();
+	_sceneLights.resize(pointLights.size());
+	if (!_sceneLights.empty())
+		pointLights.CopyTo(&_sceneLights[0]);
+	_updateScheduler.UpdateLights(_sceneLights.empty() ? nullptr : &_sceneLights[0], (uint32)_sceneLights.size());
+}
+
+void IrradianceVolume::uploadProbeUpdateList()
+{
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	_context->Map(_probeUpdateListBuffer.Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+	memcpy(mappedResource.pData, &_probeUpdateList[0], sizeof(uint32) * _probeUpdateList.size());
+	_context->Unmap(_probeUpdateListBuffer.Buffer, 0);
 }
 
 void IrradianceVolume::MainRender()
 {
 	if (!_scene->hasProxySceneObject()) return;
 
+	// Compressed probes follow the float ones, turning compression on packs the whole front set once
+	const bool compress = AppSettings::CompressSHProbes;
+	if (compress && !_compressedSHValid)
+		compressSH(_frontSHBuffer, _cubemapNum, false);
+	_compressedSHValid = compress;
+
+	const uint32 budget = AppSettings::ProbeUpdateBudget > 0 ? (uint32)AppSettings::ProbeUpdateBudget : _cubemapNum;
+	const uint32 numUpdates = _updateScheduler.Schedule(_mainCamera->Position(), budget, _probeUpdateList);
+	if (numUpdates == 0) return;
+	uploadProbeUpdateList();
+
+	// Shading reads the front buffer while the back one is written, they swap once it is complete.
+	// Probes left out this frame keep their last result.
+	const uint32 frontSH = _frontSHBuffer;
+	const uint32 backSH = 1 - _frontSHBuffer;
+	const bool partialUpdate = numUpdates < _cubemapNum;
+	if (partialUpdate)
+	{
+		_context->CopyResource(_relightSHBuffers[backSH].Buffer, _relightSHBuffers[frontSH].Buffer);
+		if (compress)
+			_context->CopyResource(_compressedSHBuffers[backSH].Buffer, _compressedSHBuffers[frontSH].Buffer);
+	}
+
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 	_context->ClearRenderTargetView(_indirectLightDiffuseBufferRT.RTView, clearColor);
 
+	// A partial update can't iterate bounces over probes it doesn't relight, it gathers one bounce
+	// from the last complete set instead so bounces build up over successive updates
+	if (partialUpdate && _numBounces > 1)
+		renderIndirectBounces(frontSH);
+
 	renderProxyMeshShadowMap();
 	renderProxyMeshDirectLighting();
-	renderRelightCubemap();
-	IntegrateSH();
+	renderRelightCubemap(numUpdates);
+	IntegrateSH(_relightSHBuffers[backSH], numUpdates);
+	if (compress)
+		compressSH(backSH, numUpdates, true);
 
-	for (int i = 1; i < _numBounces; i++)
+	for (int i = 1; i < _numBounces && !partialUpdate; i++)
 	{
-		renderIndirectBounces();
+		renderIndirectBounces(backSH);
 		renderProxyMeshShadowMap();
 		renderProxyMeshDirectLighting();
-		renderRelightCubemap();
-		IntegrateSH();
+		renderRelightCubemap(numUpdates);
+		IntegrateSH(_relightSHBuffers[backSH], numUpdates);
+		if (compress)
+			compressSH(backSH, numUpdates, true);
+	}
+
+	_frontSHBuffer = 1 - _frontSHBuffer;
+
+	if (_probeCacheSavePending)
+	{
+		saveProbeCache();
+		_probeCacheSavePending = false;
 	}
 }
 
-void IrradianceVolume::renderIndirectBounces()
+void IrradianceVolume::renderIndirectBounces(uint32 shBuffer)
 {
 	PIXEvent indirectEvent(L"RenderIndirectBounces");
 
@@ -616,8 +859,11 @@ void IrradianceVolume::renderIndirectBounces()
 
 	_context->PSSetShaderResources(0, _countof(srvs), srvs);
 	
-	ID3D11ShaderResourceView *shProbeLightSrv[] = { _relightSHBuffer.SRView };
-	_context->PSSetShaderResources(11, 1, shProbeLightSrv); // t11 is defined in SHProbeLight.hlsli
+	// t11 and t14 are defined in SHProbeLight.hlsli, AppSettings::CompressSHProbes picks one
+	ID3D11ShaderResourceView *shProbeLightSrv[] = { _relightSHBuffers[shBuffer].SRView };
+	_context->PSSetShaderResources(11, 1, shProbeLightSrv);
+	ID3D11ShaderResourceView *compressedSHSrv[] = { _compressedSHBuffers[shBuffer].SRView };
+	_context->PSSetShaderResources(14, 1, compressedSHSrv);
 
 	renderProxyModel();
 
@@ -628,12 +874,13 @@ void IrradianceVolume::renderIndirectBounces()
 	ID3D11ShaderResourceView* nullSRVs[_countof(srvs)] = { nullptr };
 	_context->PSSetShaderResources(0, _countof(srvs), nullSRVs);
 	_context->PSSetShaderResources(11, 1, nullSRVs);
+	_context->PSSetShaderResources(14, 1, nullSRVs);
 	_context->OMSetBlendState(_blendStates.BlendDisabled(), blendFactor, 0xFFFFFFFF);
 
 	_debugRenderer->QueueSprite(_indirectLightDiffuseBufferRT.SRView, Float3(128, 0, 0), Float4(1, 1, 1, 1));
 }
 
-void IrradianceVolume::IntegrateSH()
+void IrradianceVolume::IntegrateSH(StructuredBuffer &target, uint32 numUpdates)
 {
 	PIXEvent intEvent(L"SH Integration");
 
@@ -646,17 +893,17 @@ void IrradianceVolume::IntegrateSH()
 	_context->CSSetShader(_relightSHIntegrateCS, NULL, 0);
 
 	// Set shader resources
-	ID3D11ShaderResourceView* srvs[2] = { _relightCubemapRT.SRView, _viewToWorldMatrixPalette.SRView };
-	_context->CSSetShaderResources(0, 2, srvs);
+	ID3D11ShaderResourceView* srvs[3] = { _relightCubemapRT.SRView, _viewToWorldMatrixPalette.SRView, _probeUpdateListBuffer.SRView };
+	_context->CSSetShaderResources(0, 3, srvs);
 
 	// Set the output textures
 	ID3D11UnorderedAccessView* outputBuffer[1] = { _relightIntegrationBuffer.UAView };
 	_context->CSSetUnorderedAccessViews(0, 1, outputBuffer, NULL);
 
 	// Do the initial integration + reduction
-	_context->Dispatch(_cubemapNum, _cubemapSizeGBuffer, 6);
+	_context->Dispatch(numUpdates, _cubemapSizeGBuffer, 6);
 
-	// clear srvs
+	// clear srvs, the update list stays bound for the reduction
 	// Set shader resources
 	srvs[0] = nullptr;
 	srvs[1] = nullptr;
@@ -669,7 +916,7 @@ void IrradianceVolume::IntegrateSH()
 
 	ID3D11UnorderedAccessView* buffers[2] = {
 		_relightIntegrationBuffer.UAView,
-		_relightSHBuffer.UAView,
+		target.UAView,
 	};
 
 	// Set outputs
@@ -684,7 +931,7 @@ void IrradianceVolume::IntegrateSH()
 	//_context->CSSetShaderResources(0, 2, srvs);
 
 	// Do the final reduction
-	_context->Dispatch(_cubemapNum, 3, 1);
+	_context->Dispatch(numUpdates, 3, 1);
 
 	// Clear out the SRV's and RT's
 	//srvs[0] = srvs[1] = NULL;
@@ -692,6 +939,34 @@ void IrradianceVolume::IntegrateSH()
 
 	buffers[0] = buffers[1] = NULL;
 	_context->CSSetUnorderedAccessViews(0, 2, buffers, NULL);
+	srvs[2] = nullptr;
+	_context->CSSetShaderResources(0, 3, srvs);
+	_context->CSSetShader(nullptr, NULL, 0);
+}
+
+void IrradianceVolume::compressSH(uint32 shBuffer, uint32 numProbes, bool fromUpdateList)
+{
+	PIXEvent compressEvent(L"SH Compression");
+
+	_shCompressionConstants.Data.NumProbes = numProbes;
+	_shCompressionConstants.Data.FromUpdateList = fromUpdateList;
+	_shCompressionConstants.ApplyChanges(_context);
+	_shCompressionConstants.SetCS(_context, 1);
+
+	_context->CSSetShader(_compressSHCS, NULL, 0);
+
+	ID3D11ShaderResourceView* srvs[3] = { _relightSHBuffers[shBuffer].SRView, nullptr, _probeUpdateListBuffer.SRView };
+	_context->CSSetShaderResources(0, 3, srvs);
+
+	ID3D11UnorderedAccessView* outputBuffer[1] = { _compressedSHBuffers[shBuffer].UAView };
+	_context->CSSetUnorderedAccessViews(0, 1, outputBuffer, NULL);
+
+	_context->Dispatch(DispatchSize(64, numProbes), 1, 1);
+
+	srvs[0] = srvs[2] = nullptr;
+	_context->CSSetShaderResources(0, 3, srvs);
+	outputBuffer[0] = nullptr;
+	_context->CSSetUnorderedAccessViews(0, 1, outputBuffer, NULL);
 	_context->CSSetShader(nullptr, NULL, 0);
 }
 
@@ -8,6 +8,11 @@
 
 #include "Light.h"
 #include "LightClusters.h"
+#include "SHProbeBaker.h"
+#include "SHProbeCompression.h"
+#include "ProbeCache.h"
+#include "ProbePlacement.h"
+#include "ProbeUpdateScheduler.h"
 
 using namespace SampleFramework11;
 
@@ -23,6 +28,7 @@ public:
 	
 	void SetScene(Scene *scene);
 	void SetProbeDensity(float unitsBetweenProbes);
+	void SetAdaptivePlacement(bool enable);
 
 	void RenderSceneAtlasGBuffer();
 	void RenderSceneAtlasProxyMeshTexcoord();
@@ -36,16 +42,53 @@ public:
 
 	const std::vector<Float3> &getPositionList() { return _positionList; }
 
-	StructuredBuffer *getRelightSHStructuredBufferPtr() { return &_relightSHBuffer; }
+	// Index of the probe for a world position, a grid lookup into the compact probe list
+	uint32 FindProbe(const Float3 &pos) const;
+
+	// True after placement changed until the atlas passes ran again
+	inline bool atlasesDirty() const { return _atlasesDirty; }
+
+	// The last complete set of probe SH, partial updates go to the other buffer first
+	StructuredBuffer *getRelightSHStructuredBufferPtr() { return &_relightSHBuffers[_frontSHBuffer]; }
+
+	// Compressed copy of the front SH buffer, only kept up to date while AppSettings::CompressSHProbes is on
+	StructuredBuffer *getCompressedSHStructuredBufferPtr() { return &_compressedSHBuffers[_frontSHBuffer]; }
+
+	inline const ProbeUpdateScheduler::Stats &getProbeUpdateStats() const { return _updateScheduler.getStats(); }
 
 	static const int MAX_PROBE_NUM = 16384 / 32; // 16384, texture max height / texcoord height per probe
 
 private:
 	void setupResourcesForScene();
+	void generateProbePositions();
+	void updateProbeLookup();
 	void createCubemapAtlasRTs();
 	void createSHComputeBuffers();
 	void renderProxyModel();
 
+	// Probe cache, see ProbeCache.h. Atlases loaded from the cache are never re-rendered; freshly
+	// rendered ones are written out once the first SH integration after them has run.
+	void uploadCachedAtlases();
+	void saveProbeCache();
+
+	ProbeCache _probeCache;
+	Hash _probeCacheKey;
+	bool _atlasesFromCache;
+	bool _probeCacheSavePending;
+	bool _atlasesDirty;
+
+	bool _adaptivePlacement;
+	ProbePlacement::IndirectionGrid _probeIndirection;
+	std::vector<float> _probeRadii;
+
+	// Probes relit per frame, see ProbeUpdateScheduler.h
+	void uploadProbeUpdateList();
+
+	ProbeUpdateScheduler _updateScheduler;
+	std::vector<uint32> _probeUpdateList;
+	std::vector<PointLight> _sceneLights;
+	StructuredBuffer _probeUpdateListBuffer;
+
 	struct ProxyMeshVSContants
 	{
 		Float4x4 WorldViewProjection;
@@ -90,7 +133,7 @@ private:
 	// ===============================
 	void renderProxyMeshDirectLighting();
 	void renderProxyMeshShadowMap();
-	void renderRelightCubemap();
+	void renderRelightCubemap(uint32 numUpdates);
 
 	RenderTarget2D _relightCubemapRT;
 	RenderTarget2D _dirLightDiffuseBufferRT;
@@ -131,7 +174,7 @@ private:
 	uint32 _indirectLightMapSize;
 
 	// SH /////////////////////
-	void IntegrateSH();
+	void IntegrateSH(StructuredBuffer &target, uint32 numUpdates);
 
 	struct PackedSH9
 	{
@@ -140,15 +183,16 @@ private:
 		Float4 chunk2;
 	};
 
-	struct PaddedSH9Color
-	{
-		Float4 sh9[9];
-	};
-	
 	struct SHIntegrationConstants
 	{
 		Float4Align float FinalWeight;
 	};
+
+	struct SHCompressionConstants
+	{
+		uint32 NumProbes;
+		bool32 FromUpdateList;
+	};
 	
 	float _weightSum;
 
@@ -159,9 +203,18 @@ private:
 
 	ComputeShaderPtr _relightSHIntegrateCS;
 	ComputeShaderPtr _relightSHReductionCS;
+	ComputeShaderPtr _compressSHCS;
 
 	StructuredBuffer _relightIntegrationBuffer;
-	StructuredBuffer _relightSHBuffer;
+	StructuredBuffer _relightSHBuffers[2];
+	uint32 _frontSHBuffer;
+
+	// CompressedSH9Color per probe, paired with _relightSHBuffers. Valid while compression stays on.
+	void compressSH(uint32 shBuffer, uint32 numProbes, bool fromUpdateList);
+
+	ConstantBuffer<SHCompressionConstants> _shCompressionConstants;
+	StructuredBuffer _compressedSHBuffers[2];
+	bool _compressedSHValid;
 
 	std::vector<SHProbeLight> _probeLights;
 
@@ -169,7 +222,7 @@ private:
 	PixelShaderPtr _indirectLightBouncePS;
 
 	// Indirect bounces //////////////////////////////////
-	void renderIndirectBounces();
+	void renderIndirectBounces(uint32 shBuffer);
 
 	struct InDirectDiffuseConstants
 	{
@@ -1,6 +1,5 @@
 #pragma once
-#include <SF11_Math.h>
-#include <Graphics\\GraphicsTypes.h>
+#include "CPUMath.h"
 
 using namespace SampleFramework11;
 
@@ -2,6 +2,14 @@
 #include "Scene.h"
 #include "BoundUtils.h"
 #include "IrradianceVolume.h"
+#include "AppSettings.h"
+
+#include <Utility.h>
+#include <Timer.h>
+#include <Graphics\\Profiler.h>
+
+#include <intrin.h>
+#include <ppl.h>
 
 LightClusters::~LightClusters()
 {
@@ -9,18 +17,33 @@ LightClusters::~LightClusters()
 	_lightIndices != nullptr ? free(_lightIndices) : 0;
 }
 
-void LightClusters::Initialize(ID3D11Device *device, ID3D11DeviceContext *context, IrradianceVolume *irradianceVolume)
+void LightClusters::Initialize(ID3D11Device *device, ID3D11DeviceContext *context, IrradianceVolume *irradianceVolume,
+	ClusterMode mode)
 {
 	_context = context;
 	_device = device;
 	_scene = nullptr;
 	_irradianceVolume = irradianceVolume;
 
+	_mode = mode;
+	_camera = nullptr;
+	_frustumParams = Float4(0.0f, 0.0f, 0.0f, 0.0f);
+
 	_referenceScale = 0.05f;
-	_referenceNumLightIndices = 32 * 8 * 32 * 128;
 
 	_clusters = nullptr;
 	_lightIndices = nullptr;
+	_numLightIndices = 0;
+	_lightIndicesCapacity = 0;
+
+	_numPointLightsInCluster = nullptr;
+	_numSHProbeLightsInCluster = nullptr;
+	_pointLightWriteCursor = nullptr;
+	_shProbeLightWriteCursor = nullptr;
+	_numScratchGrowths = 0;
+	_fullRebuild = true;
+
+	memset(&_clusterStats, 0, sizeof(ClusterStats));
 }
 
 void LightClusters::genClusterResources()
@@ -40,21 +63,36 @@ void LightClusters::genClusterResources()
 	//_clustersWSAABB.Min.y = bMin.y;
 	//_clustersWSAABB.Min.z = bMin.z;
 
-	Float3 size = bMax - bMin;
-	Float3 clusterSize = size * _referenceScale;
-	_cx = Max((int)ceilf(clusterSize.x), 4);
-	_cy = Max((int)ceilf(clusterSize.y), 4);
-	_cz = Max((int)ceilf(clusterSize.z), 4);
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		_cx = FRUSTUM_CX;
+		_cy = FRUSTUM_CY;
+		_cz = FRUSTUM_CZ;
+
+		// Scale and bias come from the camera, force the tables to be rebuilt
+		_frustumParams = Float4(0.0f, 0.0f, 0.0f, 0.0f);
+		updateFrustumClusters();
+	}
+	else
+	{
+		Float3 size = bMax - bMin;
+		Float3 clusterSize = size * _referenceScale;
+		_cx = Max((int)ceilf(clusterSize.x), 4);
+		_cy = Max((int)ceilf(clusterSize.y), 4);
+		_cz = Max((int)ceilf(clusterSize.z), 4);
 
-	_clusterScale = Float3((float)_cx, (float)_cy, (float)_cz) / size;
-	_clusterBias = -_clusterScale * Float3(_clustersWSAABB.Min);
+		_clusterScale = Float3((float)_cx, (float)_cy, (float)_cz) / size;
+		_clusterBias = -_clusterScale * Float3(_clustersWSAABB.Min);
+	}
 
 	int dim = _cx * _cy * _cz;
 	_clusters = (ClusterData *)realloc(_clusters, sizeof(ClusterData) * dim);
-	_lightIndices = (uint32 *)realloc(_lightIndices, sizeof(uint32) * _referenceNumLightIndices);
 
-	_maxNumLightIndicesPerCluster = _referenceNumLightIndices / dim;
-	_lightIndicesList.Initialize(_device, sizeof(uint32), _referenceNumLightIndices, true);
+	// The light index list grows with the actual light-cluster overlaps, start at one per cluster
+	reserveLightIndices(dim);
+	_lightIndicesList.Initialize(_device, sizeof(uint32), _lightIndicesCapacity, false, false, false, false, nullptr, true);
+
+	allocScratchBuffers();
 
 	// Allocate 3D Texture for clusters
 	{
@@ -64,9 +102,9 @@ void LightClusters::genClusterResources()
 		desc.Depth = _cz;
 		desc.MipLevels = 1;
 		desc.Format = DXGI_FORMAT_R32G32_UINT;
-		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.Usage = D3D11_USAGE_DEFAULT; // updated per dirty slice with UpdateSubresource
 		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		desc.CPUAccessFlags = 0;
 		desc.MiscFlags = 0;
 		HRESULT hr = _device->CreateTexture3D(&desc, NULL, &_clusterTex);
 		assert(SUCCEEDED(hr));
@@ -81,6 +119,50 @@ void LightClusters::genClusterResources()
 		hr = _device->CreateShaderResourceView(_clusterTex, &srvDesc, &_clusterTexShaderView);
 		assert(SUCCEEDED(hr));
 	}
+
+	// New layout, new upload buffers
+	_uploadBackend.Initialize(_context);
+	_uploads.Initialize(&_uploadBackend);
+	_clusterTexUpload = _uploads.AddBuffer(dim * sizeof(ClusterData), _cx * sizeof(ClusterData));
+	_uploadBackend.SetTexture3D(_clusterTexUpload, _clusterTex, _cx, _cy, sizeof(ClusterData));
+	_lightIndicesUpload = _uploads.AddBuffer(_lightIndicesCapacity * sizeof(uint32), sizeof(uint32));
+	_uploadBackend.SetBuffer(_lightIndicesUpload, _lightIndicesList.Buffer);
+}
+
+void LightClusters::allocScratchBuffers()
+{
+	const size_t dim = _cx * _cy * _cz;
+
+	_scratchArena.Reserve(FrameArena::AlignedSize(sizeof(uint32) * dim) * 4);
+
+	_numPointLightsInCluster = _scratchArena.Allocate<uint32>(dim); // [CZ][CY][CX]
+	_numSHProbeLightsInCluster = _scratchArena.Allocate<uint32>(dim);
+	_pointLightWriteCursor = _scratchArena.Allocate<uint32>(dim);
+	_shProbeLightWriteCursor = _scratchArena.Allocate<uint32>(dim);
+
+	// The only full clear, every build leaves the counts at zero again
+	memset(_numPointLightsInCluster, 0, sizeof(uint32) * dim);
+	memset(_numSHProbeLightsInCluster, 0, sizeof(uint32) * dim);
+	memset(_clusters, 0, sizeof(ClusterData) * dim);
+	_numLightIndices = 0;
+
+	SliceInfo emptySlice = {};
+	_slices.assign(_cz, emptySlice);
+
+	// New grid, nothing from the previous one can be reused
+	_sliceDirty.assign(_cz, 0);
+	_dirtySlices.clear();
+	_fullRebuild = true;
+}
+
+void LightClusters::reserveLightIndices(uint32 numLightIndices)
+{
+	if (numLightIndices <= _lightIndicesCapacity) return;
+
+	// Grow by half again so a slowly rising light count does not realloc every frame
+	_lightIndicesCapacity = Max(numLightIndices, _lightIndicesCapacity + _lightIndicesCapacity / 2);
+	_lightIndices = (uint32 *)realloc(_lightIndices, sizeof(uint32) * _lightIndicesCapacity);
+	_numScratchGrowths++;
 }
 
 void LightClusters::SetScene(Scene *scene)
@@ -90,35 +172,299 @@ void LightClusters::SetScene(Scene *scene)
 	genClusterResources();
 }
 
-void LightClusters::assignPointLightToCluster(int index, bool isSHProbeLight, const Float3 &pos, float radius, 
-	uint16 *pointLightIndexInCluster, uint16 *shProbeLightIndexInCluster, 
-	uint16 *numPointLightsInCluster, uint16 *numSHProbeLightInCluster, Float3 &inv_scale)
+void LightClusters::SetCamera(const Camera *camera)
+{
+	_camera = camera;
+}
+
+// Rebuilds the view space cluster extents when near/far or the field of view changed.
+// Tiles are uniform in screen space, slice k starts at near * (far / near)^(k / cz).
+void LightClusters::updateFrustumClusters()
+{
+	Assert_(_camera != nullptr);
+
+	const Float4x4 &proj = _camera->ProjectionMatrix();
+	Float4 params(_camera->NearClip(), _camera->FarClip(), proj._11, proj._22);
+	if (params.x == _frustumParams.x && params.y == _frustumParams.y && params.z == _frustumParams.z && params.w == _frustumParams.w)
+	{
+		return;
+	}
+
+	_frustumParams = params;
+
+	const float nearZ = params.x;
+	const float farZ = params.y;
+	const float logDepthRange = logf(farZ / nearZ);
+
+	_clusterScale = Float3((float)_cx, (float)_cy, _cz / logDepthRange);
+	_clusterBias = Float3(0.0f, 0.0f, -logf(nearZ) * _clusterScale.z);
+
+	_sliceDepths.resize(_cz + 1);
+	for (uint32 z = 0; z < _cz; z++)
+	{
+		_sliceDepths[z] = nearZ * powf(farZ / nearZ, (float)z / _cz);
+	}
+	_sliceDepths[_cz] = farZ;
+
+	// Padded by 4 so the SIMD visitor can always load a full vector
+	_frustumTileMinX.resize(_cz * _cx + 4, 0.0f);
+	_frustumTileMaxX.resize(_cz * _cx + 4, 0.0f);
+	_frustumTileMinY.resize(_cz * _cy + 4, 0.0f);
+	_frustumTileMaxY.resize(_cz * _cy + 4, 0.0f);
+
+	for (uint32 z = 0; z < _cz; z++)
+	{
+		const float d0 = _sliceDepths[z];
+		const float d1 = _sliceDepths[z + 1];
+
+		for (uint32 x = 0; x < _cx; x++)
+		{
+			float a = (2.0f * x / _cx - 1.0f) / params.z;
+			float b = (2.0f * (x + 1) / _cx - 1.0f) / params.z;
+			_frustumTileMinX[z * _cx + x] = Min(a * d0, a * d1);
+			_frustumTileMaxX[z * _cx + x] = Max(b * d0, b * d1);
+		}
+
+		// row 0 is the top of the screen
+		for (uint32 y = 0; y < _cy; y++)
+		{
+			float a = (1.0f - 2.0f * (y + 1) / _cy) / params.w;
+			float b = (1.0f - 2.0f * y / _cy) / params.w;
+			_frustumTileMinY[z * _cy + y] = Min(a * d0, a * d1);
+			_frustumTileMaxY[z * _cy + y] = Max(b * d0, b * d1);
+		}
+	}
+
+	_fullRebuild = true;
+}
+
+void LightClusters::gatherLightSpheres()
 {
+	static const std::vector<SHProbeLight> noSHProbeLights;
+	const std::vector<SHProbeLight> &shProbeLights = _irradianceVolume != nullptr ? _irradianceVolume->getSHProbeLights() : noSHProbeLights;
+
+	const size_t numLights = _scene->getNumPointLights() + shProbeLights.size();
+	if (_lightSpheres.capacity() < numLights)
+	{
+		_numScratchGrowths++;
+		_lightSpheres.reserve(numLights);
+	}
+
+	_lightSpheres.clear();
+
+	for (int i = 0; i < _scene->getNumPointLights(); i++)
+	{
+		const PointLight *pl = _scene->getPointLight(i);
+		LightSphere light = { pl->cPos, pl->cRadius };
+		_lightSpheres.push_back(light);
+	}
+
+	for (size_t i = 0; i < shProbeLights.size(); i++)
+	{
+		LightSphere light = { shProbeLights[i].cPos, shProbeLights[i].cRadius };
+		_lightSpheres.push_back(light);
+	}
+
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		const Float4x4 &view = _camera->ViewMatrix();
+		for (size_t i = 0; i < _lightSpheres.size(); i++)
+		{
+			_lightSpheres[i].pos = Float3::Transform(_lightSpheres[i].pos, view);
+		}
+	}
+}
+
+bool LightClusters::computeLightClusterBounds(const Float3 &pos, float radius, LightClusterBounds &bounds)
+{
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		return computeFrustumClusterBounds(pos, radius, bounds);
+	}
+
 	Float3 posBoundCoord = (pos - _clustersWSAABB.Min);
 
 	// Assert_(posBoundCoord.x >= 0.0f && posBoundCoord.y >= 0.0f && posBoundCoord.z >= 0.0f);
 	if (posBoundCoord.x < 0.0f && posBoundCoord.y < 0.0f && posBoundCoord.z < 0.0f)
 	{
-		return; // skip lights that are out of bounds
+		return false; // skip lights that are out of bounds
 	}
 
 	Float3 posClusterCoord = posBoundCoord * _clusterScale;
 	Float3 minPosClusterCoord = (posBoundCoord - radius) * _clusterScale;
 	Float3 maxPosClusterCoord = (posBoundCoord + radius) * _clusterScale;
 
-	Uint3 posClusterIntCoord = Uint3((uint32)floorf(posClusterCoord.x), (uint32)floorf(posClusterCoord.y), (uint32)floorf(posClusterCoord.z));
+	bounds.center = Uint3((uint32)floorf(posClusterCoord.x), (uint32)floorf(posClusterCoord.y), (uint32)floorf(posClusterCoord.z));
+
+	bounds.minCoord = Uint3(
+		(uint32)floorf(Max(minPosClusterCoord.x, 0.0f)),
+		(uint32)floorf(Max(minPosClusterCoord.y, 0.0f)),
+		(uint32)floorf(Max(minPosClusterCoord.z, 0.0f)));
+	bounds.maxCoord = Uint3(
+		(uint32)ceilf(Min(maxPosClusterCoord.x, (float)_cx)),
+		(uint32)ceilf(Min(maxPosClusterCoord.y, (float)_cy)),
+		(uint32)ceilf(Min(maxPosClusterCoord.z, (float)_cz)));
+
+	bounds.radiusSqr = radius * radius;
+
+	return true;
+}
+
+// pos is in view space. Depth range picks the slices, the screen rect of the sphere's view
+// space box picks the tiles; x / z and y / z are extreme at the nearest or farthest depth.
+bool LightClusters::computeFrustumClusterBounds(const Float3 &pos, float radius, LightClusterBounds &bounds)
+{
+	const float z0 = Max(pos.z - radius, _sliceDepths[0]);
+	const float z1 = Min(pos.z + radius, _sliceDepths[_cz]);
+	if (z0 >= z1)
+	{
+		return false; // behind the near plane or past the far plane
+	}
+
+	float minNdcX = Min((pos.x - radius) / z0, (pos.x - radius) / z1) * _frustumParams.z;
+	float maxNdcX = Max((pos.x + radius) / z0, (pos.x + radius) / z1) * _frustumParams.z;
+	float minNdcY = Min((pos.y - radius) / z0, (pos.y - radius) / z1) * _frustumParams.w;
+	float maxNdcY = Max((pos.y + radius) / z0, (pos.y + radius) / z1) * _frustumParams.w;
+
+	float minTileX = (minNdcX * 0.5f + 0.5f) * _cx;
+	float maxTileX = (maxNdcX * 0.5f + 0.5f) * _cx;
+	float minTileY = (0.5f - maxNdcY * 0.5f) * _cy;
+	float maxTileY = (0.5f - minNdcY * 0.5f) * _cy;
+	if (maxTileX <= 0.0f || minTileX >= _cx || maxTileY <= 0.0f || minTileY >= _cy)
+	{
+		return false; // off screen
+	}
+
+	float minSlice = logf(z0) * _clusterScale.z + _clusterBias.z;
+	float maxSlice = logf(z1) * _clusterScale.z + _clusterBias.z;
+
+	bounds.center = Uint3(0, 0, 0);
+	bounds.minCoord = Uint3(
+		(uint32)floorf(Max(minTileX, 0.0f)),
+		(uint32)floorf(Max(minTileY, 0.0f)),
+		(uint32)floorf(Max(minSlice, 0.0f)));
+	bounds.maxCoord = Uint3(
+		(uint32)ceilf(Min(maxTileX, (float)_cx)),
+		(uint32)ceilf(Min(maxTileY, (float)_cy)),
+		(uint32)ceilf(Min(maxSlice, (float)_cz)));
+
+	bounds.radiusSqr = radius * radius;
+
+	return true;
+}
+
+// Sphere against the view space box of every cluster in bounds
+template<typename ClusterVisitor>
+void LightClusters::visitFrustumLightClusters(const LightSphere &light, const LightClusterBounds &bounds, ClusterVisitor visit)
+{
+	const Float3 &pos = light.pos;
+
+	for (uint32 z = bounds.minCoord.z; z < bounds.maxCoord.z; z++)
+	{
+		float dz = Max(Max(_sliceDepths[z] - pos.z, pos.z - _sliceDepths[z + 1]), 0.0f);
+		dz *= dz;
+
+		const float *minX = &_frustumTileMinX[z * _cx];
+		const float *maxX = &_frustumTileMaxX[z * _cx];
+		const float *minY = &_frustumTileMinY[z * _cy];
+		const float *maxY = &_frustumTileMaxY[z * _cy];
+
+		for (uint32 y = bounds.minCoord.y; y < bounds.maxCoord.y; y++)
+		{
+			float dy = Max(Max(minY[y] - pos.y, pos.y - maxY[y]), 0.0f);
+			dy *= dy;
+			dy += dz;
+
+			for (uint32 x = bounds.minCoord.x; x < bounds.maxCoord.x; x++)
+			{
+				float dx = Max(Max(minX[x] - pos.x, pos.x - maxX[x]), 0.0f);
+				dx *= dx;
+				dx += dy;
+
+				if (dx < bounds.radiusSqr)
+				{
+					visit(z * _cy * _cx + y * _cx + x);
+				}
+			}
+		}
+	}
+}
+
+// Slice visitor for frustum clusters, same contract and float operations as visitFrustumLightClusters
+template<typename ClusterVisitor>
+void LightClusters::visitFrustumSliceClusters(uint32 z, const LightSphere *lights, const LightClusterBounds *bounds,
+	uint32 numLights, ClusterVisitor visit)
+{
+	const uint32 sliceBase = z * _cy * _cx;
+	const float *minX = &_frustumTileMinX[z * _cx];
+	const float *maxX = &_frustumTileMaxX[z * _cx];
+	const float *minY = &_frustumTileMinY[z * _cy];
+	const float *maxY = &_frustumTileMaxY[z * _cy];
+
+	for (uint32 i = 0; i < numLights; i++)
+	{
+		const LightClusterBounds &b = bounds[i];
+		if (z < b.minCoord.z || z >= b.maxCoord.z)
+		{
+			continue;
+		}
+
+		const Float3 &pos = lights[i].pos;
+
+		float dz = Max(Max(_sliceDepths[z] - pos.z, pos.z - _sliceDepths[z + 1]), 0.0f);
+		dz *= dz;
+
+		const XMVECTOR posX = XMVectorReplicate(pos.x);
+		const XMVECTOR radiusSqr = XMVectorReplicate(b.radiusSqr);
+
+		for (uint32 y = b.minCoord.y; y < b.maxCoord.y; y++)
+		{
+			float dy = Max(Max(minY[y] - pos.y, pos.y - maxY[y]), 0.0f);
+			dy *= dy;
+			dy += dz;
+
+			const XMVECTOR dyVec = XMVectorReplicate(dy);
+
+			for (uint32 x = b.minCoord.x; x < b.maxCoord.x; x += 4)
+			{
+				XMVECTOR lo = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&minX[x]));
+				XMVECTOR hi = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&maxX[x]));
+
+				XMVECTOR dx = XMVectorMax(XMVectorMax(XMVectorSubtract(lo, posX), XMVectorSubtract(posX, hi)), XMVectorZero());
+				dx = XMVectorAdd(XMVectorMultiply(dx, dx), dyVec);
+
+				uint32 hitMask = (uint32)_mm_movemask_ps(XMVectorLess(dx, radiusSqr));
+				hitMask &= (1u << Min(b.maxCoord.x - x, 4u)) - 1;
+
+				while (hitMask != 0)
+				{
+					unsigned long lane;
+					_BitScanForward(&lane, hitMask);
+					hitMask &= hitMask - 1;
+
+					visit(sliceBase + y * _cx + x + lane, i);
+				}
+			}
+		}
+	}
+}
 
-	uint32 posXClusterIntCoordMin = (uint32)floorf(Max(minPosClusterCoord.x, 0.0f));
-	uint32 posXClusterIntCoordMax = (uint32)ceilf(Min(maxPosClusterCoord.x, (float)_cx));
-	uint32 posYClusterIntCoordMin = (uint32)floorf(Max(minPosClusterCoord.y, 0.0f));
-	uint32 posYClusterIntCoordMax = (uint32)ceilf(Min(maxPosClusterCoord.y, (float)_cy));
-	uint32 posZClusterIntCoordMin = (uint32)floorf(Max(minPosClusterCoord.z, 0.0f));
-	uint32 posZClusterIntCoordMax = (uint32)ceilf(Min(maxPosClusterCoord.z, (float)_cz));
+template<typename ClusterVisitor>
+void LightClusters::visitLightClusters(const LightSphere &light, const LightClusterBounds &bounds,
+	const Float3 &inv_scale, ClusterVisitor visit)
+{
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		visitFrustumLightClusters(light, bounds, visit);
+		return;
+	}
 
-	Uint3 minPosClusterIntCoord = Uint3(posXClusterIntCoordMin, posYClusterIntCoordMin, posZClusterIntCoordMin);
-	Uint3 maxPosClusterIntCoord = Uint3(posXClusterIntCoordMax, posYClusterIntCoordMax, posZClusterIntCoordMax);
+	const Float3 &pos = light.pos;
+	const Uint3 &posClusterIntCoord = bounds.center;
+	const Uint3 &minPosClusterIntCoord = bounds.minCoord;
+	const Uint3 &maxPosClusterIntCoord = bounds.maxCoord;
 
-	const float radius_sqr = radius * radius;
+	const float radius_sqr = bounds.radiusSqr;
 
 	for (uint32 z = minPosClusterIntCoord.z; z < maxPosClusterIntCoord.z; z++)
 	{
@@ -139,186 +485,749 @@ void LightClusters::assignPointLightToCluster(int index, bool isSHProbeLight, co
 
 				if (dx < radius_sqr)
 				{
-					int clusterIndex = z * _cy * _cx + y * _cx + x;
-					
-					if (!isSHProbeLight)
-					{
-						// Assert_(numPointLightsInCluster[z][y][x] < NUM_LIGHTS_PER_CLUSTER_MAX);
-						// if (numPointLightsInCluster[z][y][x] >= _maxNumLightIndicesPerCluster)
-						if (numPointLightsInCluster[clusterIndex] >= _maxNumLightIndicesPerCluster)
-						{
-							printf("numPointLightInCluster reached maximum\n");
-							continue;
-						}
-
-						//int curPtCount = _clusters[clusterIndex].counts >> 16;
-						//int curPtCount = _clusters[z][y][x].counts >> 16;
-						//curPtCount++;
-
-						// clear original 
-						//_clusters[z][y][x].counts &= 0xFFFF;
-						//_clusters[z][y][x].counts |= (curPtCount << 16);
-
-						/*_clusters[clusterIndex].counts &= 0xFFFF;
-						_clusters[clusterIndex].counts |= (curPtCount << 16);*/
-
-						_clusters[clusterIndex].counts++;
-
-						int numPt = numPointLightsInCluster[clusterIndex]++;
-
-						int pointLightIndexInClusterIndex =
-							z * _cy * _cx * _maxNumLightIndicesPerCluster +
-							y * _cx * _maxNumLightIndicesPerCluster +
-							x * _maxNumLightIndicesPerCluster + numPt;
-						// pointLightIndexInCluster[z][y][x][numPointLightsInCluster[z][y][x]++] = i;
-						pointLightIndexInCluster[pointLightIndexInClusterIndex] = index;
-					}
-					else
-					{
-						// Assert_(numPointLightsInCluster[z][y][x] < NUM_LIGHTS_PER_CLUSTER_MAX);
-						// if (numPointLightsInCluster[z][y][x] >= _maxNumLightIndicesPerCluster)
-						if (numSHProbeLightInCluster[clusterIndex] >= _maxNumLightIndicesPerCluster)
-						{
-							printf("numPointLightInCluster reached maximum\n");
-							continue;
-						}
-
-						int curPtCount = _clusters[clusterIndex].counts >> 16;
-						//int curPtCount = _clusters[z][y][x].counts >> 16;
-						curPtCount++;
-
-						// clear original 
-						//_clusters[z][y][x].counts &= 0xFFFF;
-						//_clusters[z][y][x].counts |= (curPtCount << 16);
-
-						_clusters[clusterIndex].counts &= 0xFFFF;
-						_clusters[clusterIndex].counts |= (curPtCount << 16);
-
-						int numPt = numSHProbeLightInCluster[clusterIndex]++;
-
-						int shProbleLightIndexInClusterIndex =
-							z * _cy * _cx * _maxNumLightIndicesPerCluster +
-							y * _cx * _maxNumLightIndicesPerCluster +
-							x * _maxNumLightIndicesPerCluster + numPt;
-						// pointLightIndexInCluster[z][y][x][numPointLightsInCluster[z][y][x]++] = i;
-						shProbeLightIndexInCluster[shProbleLightIndexInClusterIndex] = index;
-					}
+					visit(z * _cy * _cx + y * _cx + x);
 				}
 			}
 		}
 	}
 }
 
-void LightClusters::AssignLightToClusters()
+// Visits every (cluster, light) overlap in one z slice. Slices are independent, and lights are
+// visited in ascending order, so per cluster results match the serial path exactly.
+// The x loop tests 4 clusters at a time with the exact same float operations as the scalar code.
+template<typename ClusterVisitor>
+void LightClusters::visitSliceClusters(uint32 z, const LightSphere *lights, const LightClusterBounds *bounds,
+	uint32 numLights, const Float3 &inv_scale, ClusterVisitor visit)
 {
-	if (_scene == nullptr) return;
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		visitFrustumSliceClusters(z, lights, bounds, numLights, visit);
+		return;
+	}
 
-	int dim = _cx * _cy * _cz;
+	const XMVECTOR clusterMinX = XMVectorReplicate(_clustersWSAABB.Min.x);
+	const XMVECTOR invScaleX = XMVectorReplicate(inv_scale.x);
+	const uint32 sliceBase = z * _cy * _cx;
 
-	// Reset clusters and indices
-	memset(&_clusters[0], 0, sizeof(ClusterData) * dim);
-	memset(&_lightIndices[0], 0, sizeof(uint32) * _referenceNumLightIndices);
-	_numLightIndices = 0;
+	for (uint32 i = 0; i < numLights; i++)
+	{
+		const LightClusterBounds &b = bounds[i];
+		if (z < b.minCoord.z || z >= b.maxCoord.z)
+		{
+			continue;
+		}
+
+		const Float3 &pos = lights[i].pos;
+
+		float dz = (b.center.z == z) ? 0.0f : _clustersWSAABB.Min.z + (b.center.z < z ? z : z + 1) * inv_scale.z - pos.z;
+		dz *= dz;
+
+		const XMVECTOR posX = XMVectorReplicate(pos.x);
+		const XMVECTOR centerX = XMVectorReplicate((float)b.center.x);
+		const XMVECTOR radiusSqr = XMVectorReplicate(b.radiusSqr);
+
+		for (uint32 y = b.minCoord.y; y < b.maxCoord.y; y++)
+		{
+			float dy = (b.center.y == y) ? 0.0f : _clustersWSAABB.Min.y + (b.center.y < y ? y : y + 1) * inv_scale.y - pos.y;
+			dy *= dy;
+			dy += dz;
 
-	// PointLights - // [CZ][CY][CX][NUM_LIGHTS_PER_CLUSTER_MAX];
-	uint16 *pointLightIndexInCluster = (uint16 *)calloc(dim * _maxNumLightIndicesPerCluster, sizeof(uint16));
-	uint16 *shProbeLightIndexInCluster = (uint16 *)calloc(dim * _maxNumLightIndicesPerCluster, sizeof(uint16)); // TODO: make the size right
-	uint16 *numPointLightsInCluster = (uint16 *)calloc(dim, sizeof(uint16)); // [CZ][CY][CX]; // TODO: check uint16 is enough
-	uint16 *numShProbeLightsInCluster = (uint16 *)calloc(dim, sizeof(uint16)); // [CZ][CY][CX]; // TODO: check uint16 is enough
-	//memset(pointLightIndexInCluster, 0, sizeof(pointLightIndexInCluster));
-	//memset(numPointLightsInCluster, 0, sizeof(numPointLightsInCluster));
+			const XMVECTOR dyVec = XMVectorReplicate(dy);
 
+			for (uint32 x = b.minCoord.x; x < b.maxCoord.x; x += 4)
+			{
+				XMVECTOR xLo = XMVectorSet((float)x, (float)(x + 1), (float)(x + 2), (float)(x + 3));
+				XMVECTOR xHi = XMVectorAdd(xLo, g_XMOne);
+
+				XMVECTOR dxLo = XMVectorSubtract(XMVectorAdd(clusterMinX, XMVectorMultiply(xLo, invScaleX)), posX);
+				XMVECTOR dxHi = XMVectorSubtract(XMVectorAdd(clusterMinX, XMVectorMultiply(xHi, invScaleX)), posX);
+
+				// nearest face is x on the far side of the light, x + 1 on the near side, 0 inside
+				XMVECTOR dx = XMVectorSelect(XMVectorZero(), dxLo, XMVectorLess(centerX, xLo));
+				dx = XMVectorSelect(dx, dxHi, XMVectorGreater(centerX, xLo));
+				dx = XMVectorAdd(XMVectorMultiply(dx, dx), dyVec);
+
+				uint32 hitMask = (uint32)_mm_movemask_ps(XMVectorLess(dx, radiusSqr));
+				hitMask &= (1u << Min(b.maxCoord.x - x, 4u)) - 1;
+
+				while (hitMask != 0)
+				{
+					unsigned long lane;
+					_BitScanForward(&lane, hitMask);
+					hitMask &= hitMask - 1;
+
+					visit(sliceBase + y * _cx + x + lane, i);
+				}
+			}
+		}
+	}
+}
+
+// Totals of the count pass for slice z, needed before any offset can be assigned
+void LightClusters::summarizeSlice(uint32 z)
+{
+	SliceInfo &slice = _slices[z];
+	slice.numLightIndices = 0;
+	slice.maxLightsPerCluster = 0;
+	slice.numOccupiedClusters = 0;
+
+	const uint32 clusterEnd = (z + 1) * _cy * _cx;
+	for (uint32 clusterIndex = z * _cy * _cx; clusterIndex < clusterEnd; clusterIndex++)
+	{
+		uint32 numLights = _numPointLightsInCluster[clusterIndex] + _numSHProbeLightsInCluster[clusterIndex];
+		slice.numLightIndices += numLights;
+		slice.maxLightsPerCluster = Max(slice.maxLightsPerCluster, numLights);
+		slice.numOccupiedClusters += numLights > 0 ? 1 : 0;
+	}
+}
+
+// Exclusive prefix sum of the counts in slice z starting at the slice offset. Packs ClusterData,
+// points the write cursors at each cluster's range and clears the counts for the next build.
+void LightClusters::finalizeSlice(uint32 z)
+{
+	uint32 offset = _slices[z].offset;
+
+	const uint32 clusterEnd = (z + 1) * _cy * _cx;
+	for (uint32 clusterIndex = z * _cy * _cx; clusterIndex < clusterEnd; clusterIndex++)
+	{
+		uint32 numPointLights = _numPointLightsInCluster[clusterIndex];
+		uint32 numSHProbeLights = _numSHProbeLightsInCluster[clusterIndex];
+
+		// The shader reads point light count from the low 16 bits, sh probe light count from the high 16 bits
+		Assert_(numPointLights <= 0xFFFF && numSHProbeLights <= 0xFFFF);
+
+		// TODO: make this work with spot light
+		_clusters[clusterIndex].offset = offset;
+		_clusters[clusterIndex].counts = numPointLights | (numSHProbeLights << 16);
+
+		// point lights first, then sh probe lights
+		_pointLightWriteCursor[clusterIndex] = offset;
+		_shProbeLightWriteCursor[clusterIndex] = offset + numPointLights;
+
+		_numPointLightsInCluster[clusterIndex] = 0;
+		_numSHProbeLightsInCluster[clusterIndex] = 0;
+
+		offset += numPointLights + numSHProbeLights;
+	}
+}
+
+void LightClusters::updateClusterStats()
+{
+	_clusterStats.numLights = (uint32)_lightClusterBounds.size();
+	_clusterStats.numClusters = _cx * _cy * _cz;
+	_clusterStats.numLightIndices = 0;
+	_clusterStats.maxLightsPerCluster = 0;
+	_clusterStats.numOccupiedClusters = 0;
+
+	// Slice totals stay valid for slices an incremental build did not touch
+	for (uint32 z = 0; z < _cz; z++)
+	{
+		_clusterStats.numLightIndices += _slices[z].numLightIndices;
+		_clusterStats.maxLightsPerCluster = Max(_clusterStats.maxLightsPerCluster, _slices[z].maxLightsPerCluster);
+		_clusterStats.numOccupiedClusters += _slices[z].numOccupiedClusters;
+	}
+
+	_clusterStats.meanLightsPerCluster = (float)_clusterStats.numLightIndices / _clusterStats.numClusters;
+	_clusterStats.meanLightsPerOccupiedCluster = _clusterStats.numOccupiedClusters > 0 ?
+		(float)_clusterStats.numLightIndices / _clusterStats.numOccupiedClusters : 0.0f;
+}
+
+// Lays the slices out back to back. Incremental builds leave headroom after every slice so a
+// rebuilt slice usually fits in place without moving the ones after it.
+void LightClusters::layoutSlices(bool withHeadroom)
+{
+	uint32 offset = 0;
+	for (uint32 z = 0; z < _cz; z++)
+	{
+		SliceInfo &slice = _slices[z];
+		slice.offset = offset;
+		slice.capacity = slice.numLightIndices;
+		if (withHeadroom)
+		{
+			slice.capacity += slice.numLightIndices / 4 + 16;
+		}
+		offset += slice.capacity;
+	}
+
+	reserveLightIndices(offset);
+	_numLightIndices = offset;
+}
+
+void LightClusters::computeAllLightBounds(const LightSphere *lights, uint32 numLights, bool parallel)
+{
+	if (_lightClusterBounds.capacity() < numLights)
+	{
+		_numScratchGrowths++;
+	}
+	_lightClusterBounds.resize(numLights);
+	LightClusterBounds *bounds = numLights > 0 ? &_lightClusterBounds[0] : nullptr;
+
+	auto computeBounds = [&](uint32 i)
+	{
+		if (!computeLightClusterBounds(lights[i].pos, lights[i].radius, bounds[i]))
+		{
+			// empty range, no cluster will pick it up
+			bounds[i].minCoord = Uint3(0, 0, 0);
+			bounds[i].maxCoord = Uint3(0, 0, 0);
+		}
+	};
+
+	if (parallel)
+	{
+		concurrency::parallel_for(uint32(0), numLights, computeBounds);
+	}
+	else
+	{
+		for (uint32 i = 0; i < numLights; i++)
+		{
+			computeBounds(i);
+		}
+	}
+}
+
+template<typename SliceFunc>
+static void forEachSlice(const std::vector<uint32> &slices, bool parallel, SliceFunc func)
+{
+	if (parallel)
+	{
+		concurrency::parallel_for_each(slices.begin(), slices.end(), func);
+	}
+	else
+	{
+		std::for_each(slices.begin(), slices.end(), func);
+	}
+}
+
+// Two pass build: count the overlaps of every cluster, prefix sum the counts into offsets,
+// then scatter light indices straight into _lightIndices. Nothing is dropped, and the list
+// holds exactly one entry per light-cluster overlap.
+void LightClusters::assignLights(const LightSphere *lights, uint32 numPointLights, uint32 numSHProbeLights, bool parallel)
+{
+	const uint32 numLights = numPointLights + numSHProbeLights;
 	Float3 inv_scale = Float3(1.0f) / _clusterScale;
 
-	// Point light assignment
-	for (int i = 0; i < _scene->getNumPointLights(); i++)
+	computeAllLightBounds(lights, numLights, parallel);
+	const LightClusterBounds *bounds = numLights > 0 ? &_lightClusterBounds[0] : nullptr;
+
+	auto countLight = [&](uint32 clusterIndex, uint32 lightIndex)
+	{
+		if (lightIndex < numPointLights)
+			_numPointLightsInCluster[clusterIndex]++;
+		else
+			_numSHProbeLightsInCluster[clusterIndex]++;
+	};
+
+	auto scatterLight = [&](uint32 clusterIndex, uint32 lightIndex)
+	{
+		if (lightIndex < numPointLights)
+			_lightIndices[_pointLightWriteCursor[clusterIndex]++] = lightIndex;
+		else
+			_lightIndices[_shProbeLightWriteCursor[clusterIndex]++] = lightIndex - numPointLights;
+	};
+
+	// Count pass
+	if (!parallel)
+	{
+		for (uint32 i = 0; i < numLights; i++)
+		{
+			visitLightClusters(lights[i], bounds[i], inv_scale, [&](uint32 clusterIndex) { countLight(clusterIndex, i); });
+		}
+
+		for (uint32 z = 0; z < _cz; z++)
+		{
+			summarizeSlice(z);
+		}
+	}
+	else
 	{
-		PointLight *pl = &_scene->getPointLightPtr()[i];
-		assignPointLightToCluster(i, false, pl->cPos, pl->cRadius, pointLightIndexInCluster, shProbeLightIndexInCluster, numPointLightsInCluster, numShProbeLightsInCluster, inv_scale);
+		// Each worker owns whole z slices, so no cluster is written by two threads
+		concurrency::parallel_for(uint32(0), _cz, [&](uint32 z)
+		{
+			visitSliceClusters(z, lights, bounds, numLights, inv_scale, countLight);
+			summarizeSlice(z);
+		});
 	}
 
-	// sh probe light assignment - same as point light
-	for (size_t i = 0; i < _irradianceVolume->getSHProbeLights().size(); i++)
+	// Exclusive prefix sum over slices gives every slice its range in _lightIndices
+	layoutSlices(false);
+
+	// Scatter pass
+	if (!parallel)
+	{
+		for (uint32 z = 0; z < _cz; z++)
+		{
+			finalizeSlice(z);
+		}
+
+		for (uint32 i = 0; i < numLights; i++)
+		{
+			visitLightClusters(lights[i], bounds[i], inv_scale, [&](uint32 clusterIndex) { scatterLight(clusterIndex, i); });
+		}
+	}
+	else
 	{
-		const SHProbeLight *sl = &_irradianceVolume->getSHProbeLights()[i];
-		assignPointLightToCluster((int)i, true, sl->cPos, sl->cRadius, pointLightIndexInCluster, shProbeLightIndexInCluster, numPointLightsInCluster, numShProbeLightsInCluster, inv_scale);
+		concurrency::parallel_for(uint32(0), _cz, [&](uint32 z)
+		{
+			finalizeSlice(z);
+			visitSliceClusters(z, lights, bounds, numLights, inv_scale, scatterLight);
+		});
 	}
 
-	int curLightIndicesArrIndex = 0;
+	// Everything was rewritten, and the incremental state no longer matches
+	_dirtySlices.resize(_cz);
 	for (uint32 z = 0; z < _cz; z++)
 	{
-		for (uint32 y = 0; y < _cy; y++)
+		_dirtySlices[z] = z;
+	}
+	_fullRebuild = true;
+
+	updateClusterStats();
+}
+
+void LightClusters::markSlicesDirty(const LightClusterBounds &bounds)
+{
+	uint32 zEnd = Min(bounds.maxCoord.z, _cz);
+	for (uint32 z = bounds.minCoord.z; z < zEnd; z++)
+	{
+		_sliceDirty[z] = 1;
+	}
+}
+
+// Compares every light with its state from the last build. Lights that were added, removed or
+// changed mark the slices they covered before and after as dirty.
+void LightClusters::detectDirtyLights(const LightSphere *lights, const LightClusterBounds *bounds, uint32 numLights, std::vector<LightState> &states)
+{
+	const uint32 numPrevLights = (uint32)states.size();
+
+	// removed
+	for (uint32 i = numLights; i < numPrevLights; i++)
+	{
+		markSlicesDirty(states[i].bounds);
+	}
+
+	if (states.capacity() < numLights)
+	{
+		_numScratchGrowths++;
+	}
+	states.resize(numLights);
+
+	for (uint32 i = 0; i < numLights; i++)
+	{
+		Hash hash = GenerateHash(&lights[i], sizeof(LightSphere));
+		if (i < numPrevLights)
 		{
-			for (uint32 x = 0; x < _cx; x++)
+			if (states[i].hash == hash)
 			{
-				uint32 clusterIndex = z * _cy * _cx + y * _cx + x;
+				continue;
+			}
 
-				// TODO: make this work with spot light
-				// _clusters[z][y][x].offset = curLightIndicesArrIndex;
-				_clusters[clusterIndex].offset = curLightIndicesArrIndex;
+			// moved or resized
+			markSlicesDirty(states[i].bounds);
+		}
 
-				// for (int k = 0; k < numPointLightsInCluster[z][y][x]; k++)
-				for (int k = 0; k < numPointLightsInCluster[clusterIndex]; k++)
-				{
-					int pointLightIndexInClusterIndex = z * _cy * _cx * _maxNumLightIndicesPerCluster
-						+ y * _cx * _maxNumLightIndicesPerCluster
-						+ x * _maxNumLightIndicesPerCluster
-						+ k;
+		markSlicesDirty(bounds[i]);
+		states[i].hash = hash;
+		states[i].bounds = bounds[i];
+	}
+}
 
-					// _lightIndices[curLightIndicesArrIndex++] = pointLightIndexInCluster[z][y][x][k];
-					_lightIndices[curLightIndicesArrIndex++] = pointLightIndexInCluster[pointLightIndexInClusterIndex];
-				}
+// Rebuilds only the z slices touched by lights that changed since the last call. Slices own
+// their range of _lightIndices, so a rebuilt slice is written in place as long as it fits its
+// capacity; otherwise everything is laid out again.
+void LightClusters::assignLightsIncremental(const LightSphere *lights, uint32 numPointLights, uint32 numSHProbeLights, bool parallel)
+{
+	const uint32 numLights = numPointLights + numSHProbeLights;
+	Float3 inv_scale = Float3(1.0f) / _clusterScale;
 
-				// probe light
-				for (int k = 0; k < numShProbeLightsInCluster[clusterIndex]; k++)
-				{
-					int shProbeLightIndexInClusterIndex = z * _cy * _cx * _maxNumLightIndicesPerCluster
-						+ y * _cx * _maxNumLightIndicesPerCluster
-						+ x * _maxNumLightIndicesPerCluster
-						+ k;
+	computeAllLightBounds(lights, numLights, parallel);
+	const LightClusterBounds *bounds = numLights > 0 ? &_lightClusterBounds[0] : nullptr;
 
-					// _lightIndices[curLightIndicesArrIndex++] = pointLightIndexInCluster[z][y][x][k];
-					_lightIndices[curLightIndicesArrIndex++] = shProbeLightIndexInCluster[shProbeLightIndexInClusterIndex];
-				}
+	bool relayout = _fullRebuild;
+	if (_fullRebuild)
+	{
+		// every light counts as added
+		_pointLightStates.clear();
+		_shProbeLightStates.clear();
+	}
+
+	std::fill(_sliceDirty.begin(), _sliceDirty.end(), (uint8)(_fullRebuild ? 1 : 0));
+	detectDirtyLights(lights, bounds, numPointLights, _pointLightStates);
+	detectDirtyLights(lights + numPointLights, bounds + numPointLights, numSHProbeLights, _shProbeLightStates);
+
+	_dirtySlices.clear();
+	for (uint32 z = 0; z < _cz; z++)
+	{
+		if (_sliceDirty[z])
+		{
+			_dirtySlices.push_back(z);
+		}
+	}
+
+	if (_dirtySlices.empty())
+	{
+		return;
+	}
+
+	auto countSlice = [&](uint32 z)
+	{
+		visitSliceClusters(z, lights, bounds, numLights, inv_scale, [&](uint32 clusterIndex, uint32 lightIndex)
+		{
+			if (lightIndex < numPointLights)
+				_numPointLightsInCluster[clusterIndex]++;
+			else
+				_numSHProbeLightsInCluster[clusterIndex]++;
+		});
+		summarizeSlice(z);
+	};
+
+	forEachSlice(_dirtySlices, parallel, countSlice);
+
+	for (size_t i = 0; i < _dirtySlices.size(); i++)
+	{
+		const SliceInfo &slice = _slices[_dirtySlices[i]];
+		relayout = relayout || slice.numLightIndices > slice.capacity;
+	}
+
+	if (relayout)
+	{
+		// Offsets of every slice change, so the clean ones need counts and a rewrite as well
+		_sliceWorkList.clear();
+		for (uint32 z = 0; z < _cz; z++)
+		{
+			if (!_sliceDirty[z])
+			{
+				_sliceWorkList.push_back(z);
 			}
 		}
+		forEachSlice(_sliceWorkList, parallel, countSlice);
+
+		_dirtySlices.resize(_cz);
+		for (uint32 z = 0; z < _cz; z++)
+		{
+			_dirtySlices[z] = z;
+		}
+
+		layoutSlices(true);
 	}
 
-	_numLightIndices = curLightIndicesArrIndex;
+	forEachSlice(_dirtySlices, parallel, [&](uint32 z)
+	{
+		finalizeSlice(z);
+		visitSliceClusters(z, lights, bounds, numLights, inv_scale, [&](uint32 clusterIndex, uint32 lightIndex)
+		{
+			if (lightIndex < numPointLights)
+				_lightIndices[_pointLightWriteCursor[clusterIndex]++] = lightIndex;
+			else
+				_lightIndices[_shProbeLightWriteCursor[clusterIndex]++] = lightIndex - numPointLights;
+		});
+	});
+
+	_fullRebuild = false;
 
-	free(numPointLightsInCluster);
-	free(numShProbeLightsInCluster);
-	free(pointLightIndexInCluster);
-	free(shProbeLightIndexInCluster);
+	updateClusterStats();
 }
 
-void LightClusters::UploadClustersData()
+void LightClusters::AssignLightToClusters()
 {
 	if (_scene == nullptr) return;
 
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	CPUProfileBlock profileBlock(L"Light Assignment");
 
-	// Upload lightIndices structured buffer
-	BYTE* mappedData = NULL;
-	_context->Map(_lightIndicesList.Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-	mappedData = reinterpret_cast<BYTE*>(mappedResource.pData);
-	memcpy(mappedData, _lightIndices, sizeof(uint32) * _numLightIndices);
-	_context->Unmap(_lightIndicesList.Buffer, 0);
+	if (_mode == FRUSTUM_CLUSTERS)
+	{
+		updateFrustumClusters();
+	}
 
-	// Upload 3D Texture
-	_context->Map(_clusterTex, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-	mappedData = reinterpret_cast<BYTE*>(mappedResource.pData);
-	for (uint32 z = 0; z < _cz; z++)
+	gatherLightSpheres();
+
+	uint32 numPointLights = (uint32)_scene->getNumPointLights();
+	uint32 numSHProbeLights = (uint32)_lightSpheres.size() - numPointLights;
+	const LightSphere *lights = _lightSpheres.empty() ? nullptr : &_lightSpheres[0];
+	bool parallel = AppSettings::ParallelLightAssignment ? true : false;
+
+	if (AppSettings::IncrementalLightAssignment)
 	{
-		for (uint32 y = 0; y < _cy; y++)
+		assignLightsIncremental(lights, numPointLights, numSHProbeLights, parallel);
+	}
+	else
+	{
+		assignLights(lights, numPointLights, numSHProbeLights, parallel);
+	}
+}
+
+void LightClusters::RunAssignmentBenchmark()
+{
+	if (_scene == nullptr) return;
+
+	static const uint32 NumIterations = 8;
+
+	const uint32 dim = _cx * _cy * _cz;
+	const Float3 boundMin = Float3(_clustersWSAABB.Min);
+	const Float3 boundSize = Float3(_clustersWSAABB.Max) - boundMin;
+	const Float3 clusterSize = Float3(1.0f) / _clusterScale;
+	const float maxClusterSize = Max(Max(clusterSize.x, clusterSize.y), clusterSize.z);
+
+	// Fixed seed so runs are comparable
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+
+	std::vector<LightSphere> lights;
+	std::vector<ClusterData> serialClusters(dim);
+	std::vector<uint32> serialLightIndices;
+
+	DebugPrint(L"Light assignment benchmark, " + ToString(_cx) + L"x" + ToString(_cy) + L"x" + ToString(_cz) + L" clusters\n");
+
+	for (uint32 numLights = 64; numLights <= 65536; numLights *= 4)
+	{
+		lights.resize(numLights);
+		for (uint32 i = 0; i < numLights; i++)
 		{
-			int clusterIndex = z * _cy * _cx + y * _cx;
-			// TODO: check for bug
-			memcpy(mappedData + z * mappedResource.DepthPitch
-				+ y * mappedResource.RowPitch,
-				// _clusters[z][y], _cx* sizeof(ClusterData));
-				&_clusters[clusterIndex], _cx * sizeof(ClusterData));
+			lights[i].pos = boundMin + boundSize * Float3(unitDist(rng), unitDist(rng), unitDist(rng));
+			lights[i].radius = maxClusterSize * (0.25f + 0.75f * unitDist(rng));
 		}
+
+		// Warm up both paths so scratch storage is sized for this light count
+		assignLights(&lights[0], numLights, 0, false);
+		assignLights(&lights[0], numLights, 0, true);
+
+		Timer timer;
+		uint64 numAllocations = getNumScratchAllocations();
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			assignLights(&lights[0], numLights, 0, false);
+		}
+		timer.Update();
+		double serialMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		memcpy(&serialClusters[0], _clusters, sizeof(ClusterData) * dim);
+		serialLightIndices.assign(_lightIndices, _lightIndices + _numLightIndices);
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			assignLights(&lights[0], numLights, 0, true);
+		}
+		timer.Update();
+		double parallelMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		numAllocations = getNumScratchAllocations() - numAllocations;
+
+		Assert_(_numLightIndices == serialLightIndices.size());
+		Assert_(memcmp(&serialClusters[0], _clusters, sizeof(ClusterData) * dim) == 0);
+		Assert_(_numLightIndices == 0 || memcmp(&serialLightIndices[0], _lightIndices, sizeof(uint32) * _numLightIndices) == 0);
+
+		DebugPrint(ToString(numLights) + L" lights: serial " + ToString(serialMs) + L"ms, parallel "
+			+ ToString(parallelMs) + L"ms, " + ToString(_numLightIndices) + L" indices, max "
+			+ ToString(_clusterStats.maxLightsPerCluster) + L" / mean " + ToString(_clusterStats.meanLightsPerOccupiedCluster)
+			+ L" lights per occupied cluster, " + ToString(numAllocations) + L" scratch allocations\n");
 	}
-	_context->Unmap(_clusterTex, 0);
+
+	benchmarkIncrementalAssignment();
+}
+
+void LightClusters::benchmarkIncrementalAssignment()
+{
+	static const uint32 NumFrames = 120;
+	static const uint32 NumPointLights = 256;
+	static const uint32 NumSHProbeLights = 64;
+
+	const uint32 dim = _cx * _cy * _cz;
+	const Float3 boundMin = Float3(_clustersWSAABB.Min);
+	const Float3 boundSize = Float3(_clustersWSAABB.Max) - boundMin;
+	const Float3 clusterSize = Float3(1.0f) / _clusterScale;
+	const float maxClusterSize = Max(Max(clusterSize.x, clusterSize.y), clusterSize.z);
+	const Float3 inv_scale = Float3(1.0f) / _clusterScale;
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+
+	auto randomLight = [&]()
+	{
+		LightSphere light;
+		light.pos = boundMin + boundSize * Float3(unitDist(rng), unitDist(rng), unitDist(rng));
+		light.radius = maxClusterSize * (0.25f + 0.75f * unitDist(rng));
+		return light;
+	};
+
+	std::vector<LightSphere> pointLights(NumPointLights);
+	std::vector<LightSphere> probeLights(NumSHProbeLights);
+	std::generate(pointLights.begin(), pointLights.end(), randomLight);
+	std::generate(probeLights.begin(), probeLights.end(), randomLight);
+
+	std::vector<LightSphere> lights;
+	std::vector<std::vector<uint32>> refPointLists(dim);
+	std::vector<std::vector<uint32>> refProbeLists(dim);
+
+	_fullRebuild = true;
+
+	uint64 numDirtySlices = 0;
+
+	for (uint32 frame = 0; frame < NumFrames; frame++)
+	{
+		// Move a few lights, and every now and then add or remove one
+		if (frame > 0)
+		{
+			uint32 numMoved = 1 + (uint32)(unitDist(rng) * 4.0f);
+			for (uint32 m = 0; m < numMoved; m++)
+			{
+				LightSphere &light = pointLights[(size_t)(unitDist(rng) * (pointLights.size() - 1))];
+				light.pos = light.pos + clusterSize * Float3(unitDist(rng) - 0.5f, unitDist(rng) - 0.5f, unitDist(rng) - 0.5f);
+				light.radius = maxClusterSize * (0.25f + 0.75f * unitDist(rng));
+			}
+
+			if (frame % 7 == 0)
+			{
+				probeLights[(size_t)(unitDist(rng) * (probeLights.size() - 1))] = randomLight();
+			}
+
+			if (frame % 10 == 0)
+			{
+				pointLights.push_back(randomLight());
+			}
+			else if (frame % 15 == 0)
+			{
+				pointLights.pop_back();
+			}
+		}
+
+		lights = pointLights;
+		lights.insert(lights.end(), probeLights.begin(), probeLights.end());
+		const uint32 numPointLights = (uint32)pointLights.size();
+		const uint32 numLights = (uint32)lights.size();
+
+		assignLightsIncremental(&lights[0], numPointLights, (uint32)probeLights.size(), true);
+		numDirtySlices += _dirtySlices.size();
+
+		// Reference: plain per cluster lists from the scalar path, in light order
+		for (uint32 c = 0; c < dim; c++)
+		{
+			refPointLists[c].clear();
+			refProbeLists[c].clear();
+		}
+
+		for (uint32 i = 0; i < numLights; i++)
+		{
+			LightClusterBounds bounds;
+			if (!computeLightClusterBounds(lights[i].pos, lights[i].radius, bounds)) continue;
+
+			visitLightClusters(lights[i], bounds, inv_scale, [&](uint32 clusterIndex)
+			{
+				if (i < numPointLights)
+					refPointLists[clusterIndex].push_back(i);
+				else
+					refProbeLists[clusterIndex].push_back(i - numPointLights);
+			});
+		}
+
+		for (uint32 c = 0; c < dim; c++)
+		{
+			const ClusterData &cluster = _clusters[c];
+			uint32 numPoint = cluster.counts & 0xFFFF;
+			uint32 numProbe = cluster.counts >> 16;
+
+			Assert_(numPoint == refPointLists[c].size() && numProbe == refProbeLists[c].size());
+			for (uint32 k = 0; k < numPoint; k++)
+			{
+				Assert_(_lightIndices[cluster.offset + k] == refPointLists[c][k]);
+			}
+			for (uint32 k = 0; k < numProbe; k++)
+			{
+				Assert_(_lightIndices[cluster.offset + numPoint + k] == refProbeLists[c][k]);
+			}
+		}
+	}
+
+	DebugPrint(L"Incremental light assignment: " + ToString(NumFrames) + L" frames, "
+		+ ToString((double)numDirtySlices / NumFrames) + L" of " + ToString(_cz) + L" slices rebuilt per frame\n");
+
+	// Synthetic lights are gone, the scene lights need a full build again
+	_fullRebuild = true;
+}
+
+void LightClusters::RunClusterModeBenchmark(ID3D11Device *device, ID3D11DeviceContext *context, Scene *scenes, uint32 numScenes)
+{
+	static const uint32 NumIterations = 8;
+	static const wchar *ModeNames[] = { L"world grid", L"frustum" };
+
+	DebugPrint(L"Light cluster mode benchmark, point lights only, seen from each scene's saved camera\n");
+
+	for (uint32 sceneIndex = 0; sceneIndex < numScenes; sceneIndex++)
+	{
+		Scene *scene = &scenes[sceneIndex];
+		DebugPrint(L"Scene " + ToString(sceneIndex) + L": " + ToString(scene->getNumPointLights()) + L" point lights\n");
+
+		for (uint32 mode = WORLD_GRID_CLUSTERS; mode <= FRUSTUM_CLUSTERS; mode++)
+		{
+			LightClusters clusters;
+			clusters.Initialize(device, context, nullptr, (ClusterMode)mode);
+			clusters.SetCamera(scene->getSceneCameraSavedPtr());
+			clusters.SetScene(scene);
+
+			clusters.gatherLightSpheres();
+			const uint32 numLights = (uint32)clusters._lightSpheres.size();
+			const LightSphere *lights = numLights > 0 ? &clusters._lightSpheres[0] : nullptr;
+
+			// warm up
+			clusters.assignLights(lights, numLights, 0, true);
+
+			Timer timer;
+			timer.Update();
+			for (uint32 iter = 0; iter < NumIterations; iter++)
+			{
+				clusters.assignLights(lights, numLights, 0, true);
+			}
+			timer.Update();
+
+			const ClusterStats &stats = clusters.getClusterStats();
+			float clustersPerLight = numLights > 0 ? (float)stats.numLightIndices / numLights : 0.0f;
+
+			DebugPrint(std::wstring(L"  ") + ModeNames[mode] + L": " + ToString(clusters._cx) + L"x" + ToString(clusters._cy) + L"x"
+				+ ToString(clusters._cz) + L" clusters, " + ToString(clustersPerLight) + L" clusters touched per light, "
+				+ ToString(stats.numOccupiedClusters) + L" occupied, " + ToString(clusters.getMemoryUsage() / 1024) + L" KB, "
+				+ ToString(timer.DeltaMillisecondsD() / NumIterations) + L"ms\n");
+		}
+	}
+}
+
+void LightClusters::UploadClustersData()
+{
+	if (_scene == nullptr) return;
+
+	// The GPU list follows the CPU capacity, SRV users fetch the view every frame.
+	// Growing always comes with a relayout, so every slice is dirty when this happens.
+	if (_lightIndicesList.NumElements < _lightIndicesCapacity)
+	{
+		_lightIndicesList.Initialize(_device, sizeof(uint32), _lightIndicesCapacity, false, false, false, false, nullptr, true);
+		_uploadBackend.SetBuffer(_lightIndicesUpload, _lightIndicesList.Buffer);
+		_uploads.ResizeBuffer(_lightIndicesUpload, _lightIndicesCapacity * sizeof(uint32));
+	}
+
+	// Consecutive dirty slices are written as one span, both for the 3D texture and the index
+	// list. Rows and indices that came out the same as last frame are dropped by the diff.
+	const uint32 sliceSize = _cx * _cy;
+	size_t i = 0;
+	while (i < _dirtySlices.size())
+	{
+		uint32 zBegin = _dirtySlices[i];
+		uint32 zEnd = zBegin + 1;
+		for (i++; i < _dirtySlices.size() && _dirtySlices[i] == zEnd; i++)
+		{
+			zEnd++;
+		}
+
+		_uploads.Write(_clusterTexUpload, zBegin * sliceSize * sizeof(ClusterData), &_clusters[zBegin * sliceSize],
+			(zEnd - zBegin) * sliceSize * sizeof(ClusterData));
+
+		uint32 indexBegin = _slices[zBegin].offset;
+		uint32 indexEnd = _slices[zEnd - 1].offset + _slices[zEnd - 1].capacity;
+		if (indexEnd > indexBegin)
+		{
+			_uploads.Write(_lightIndicesUpload, indexBegin * sizeof(uint32), &_lightIndices[indexBegin],
+				(indexEnd - indexBegin) * sizeof(uint32));
+		}
+	}
+
+	_uploads.Flush();
 }
\ No newline at end of file
@@ -2,7 +2,11 @@
 #include "PCH.h"
 #include <InterfacePointers.h>
 #include <Graphics//GraphicsTypes.h>
+#include <Graphics\\Camera.h>
 #include "BoundUtils.h"
+#include "FrameArena.h"
+#include "D3D11UploadBackend.h"
+#include <MurmurHash.h>
 
 using namespace SampleFramework11;
 
@@ -11,12 +15,63 @@ class Scene;
 class LightClusters
 {
 public:
+	// How the cluster grid is laid out, and what ClusterScale/ClusterBias map to cluster coords:
+	// WORLD_GRID_CLUSTERS: uniform grid over the scene AABB, coord = posWS * scale + bias.
+	// FRUSTUM_CLUSTERS: screen tiles with exponential depth slices between the camera clip planes,
+	// coord = float3(screenUV, log(depthVS)) * scale + bias.
+	enum ClusterMode
+	{
+		WORLD_GRID_CLUSTERS = 0,
+		FRUSTUM_CLUSTERS = 1
+	};
+
+	// Light-cluster overlap statistics of the last assignment
+	struct ClusterStats
+	{
+		uint32 numLights;
+		uint32 numClusters;
+		uint32 numOccupiedClusters;
+		uint32 numLightIndices;
+		uint32 maxLightsPerCluster;
+		float meanLightsPerCluster;
+		float meanLightsPerOccupiedCluster;
+	};
 
-	void Initialize(ID3D11Device *device, ID3D11DeviceContext *context, IrradianceVolume *irradianceVolume);
+	void Initialize(ID3D11Device *device, ID3D11DeviceContext *context, IrradianceVolume *irradianceVolume,
+		ClusterMode mode = WORLD_GRID_CLUSTERS);
 	void SetScene(Scene *scene);
+
+	// Frustum clusters follow this camera, it has to be set before SetScene
+	void SetCamera(const Camera *camera);
 	void AssignLightToClusters();
 	void UploadClustersData();
 
+	// Times the serial and parallel assignment paths on synthetic light sets and asserts that
+	// both produce the same cluster data, then animates a light set and asserts that every
+	// incremental update matches a from-scratch reference build
+	void RunAssignmentBenchmark();
+
+	// Builds world grid and frustum clusters for the point lights of every scene, seen from the
+	// scene's saved camera, and compares clusters touched per light, memory and build time.
+	static void RunClusterModeBenchmark(ID3D11Device *device, ID3D11DeviceContext *context, Scene *scenes, uint32 numScenes);
+
+	// Forces the next incremental assignment to rebuild and upload every slice
+	inline void InvalidateClusters() { _fullRebuild = true; }
+
+	// Z slices rewritten by the last assignment, these are the only ones UploadClustersData sends
+	inline const std::vector<uint32> &getDirtySlices() const { return _dirtySlices; }
+
+	// Bytes written, changed and sent by the last UploadClustersData
+	inline const UploadManager::FrameStats &getUploadStats() const { return _uploads.getFrameStats(); }
+
+	// Heap allocations made for assignment scratch memory since startup
+	inline uint64 getNumScratchAllocations() const { return _scratchArena.getNumHeapAllocations() + _numScratchGrowths; }
+	inline const ClusterStats &getClusterStats() const { return _clusterStats; }
+
+	// Bytes of the cluster texture plus the light index list
+	inline uint64 getMemoryUsage() const { return (uint64)_cx * _cy * _cz * sizeof(ClusterData) + (uint64)_lightIndicesCapacity * sizeof(uint32); }
+	inline ClusterMode getClusterMode() const { return _mode; }
+
 	inline Float3 getClusterScale() { return _clusterScale; }
 	inline Float3 getClusterBias() { return _clusterBias; }
 
@@ -32,11 +87,27 @@ private:
 	//static const int NUM_LIGHTS_PER_CLUSTER_MAX = 10;
 	//static const int NUM_LIGHT_INDICES_MAX = CX * CY * CZ * NUM_LIGHTS_PER_CLUSTER_MAX;
 
+	// Frustum grid, fixed whatever the size of the scene
+	static const uint32 FRUSTUM_CX = 16;
+	static const uint32 FRUSTUM_CY = 8;
+	static const uint32 FRUSTUM_CZ = 32;
+
 private:
-	void genClusterResources();
-	void assignPointLightToCluster(int index, bool isSHProbeLight, const Float3 &pos, float radius, 
-		uint16 *pointLightIndexInCluster, uint16 *shProbeLightIndexInCluster, 
-		uint16 *numPointLightsInCluster, uint16 *numSHProbeLightInCluster, Float3 &inv_scale);
+	// Point lights first, then sh probe lights. World space, or view space for frustum clusters.
+	struct LightSphere
+	{
+		Float3 pos;
+		float radius;
+	};
+
+	// Range of clusters touched by a light, [minCoord, maxCoord)
+	struct LightClusterBounds
+	{
+		Uint3 center;
+		Uint3 minCoord;
+		Uint3 maxCoord;
+		float radiusSqr;
+	};
 
 	struct ClusterData
 	{
@@ -44,6 +115,50 @@ private:
 		uint32 counts;
 	};
 
+	// Z slices are the unit of parallel work and of incremental rebuilds. Each one owns the
+	// range [offset, offset + capacity) of _lightIndices, capacity has headroom in incremental mode.
+	struct SliceInfo
+	{
+		uint32 offset;
+		uint32 capacity;
+		uint32 numLightIndices;
+		uint32 maxLightsPerCluster;
+		uint32 numOccupiedClusters;
+	};
+
+	// What a light looked like at the last incremental build
+	struct LightState
+	{
+		Hash hash;
+		LightClusterBounds bounds;
+	};
+
+	void genClusterResources();
+	void allocScratchBuffers();
+	void reserveLightIndices(uint32 numLightIndices);
+	void gatherLightSpheres();
+	void assignLights(const LightSphere *lights, uint32 numPointLights, uint32 numSHProbeLights, bool parallel);
+	void assignLightsIncremental(const LightSphere *lights, uint32 numPointLights, uint32 numSHProbeLights, bool parallel);
+	void computeAllLightBounds(const LightSphere *lights, uint32 numLights, bool parallel);
+	bool computeLightClusterBounds(const Float3 &pos, float radius, LightClusterBounds &bounds);
+	bool computeFrustumClusterBounds(const Float3 &pos, float radius, LightClusterBounds &bounds);
+	void updateFrustumClusters();
+	void detectDirtyLights(const LightSphere *lights, const LightClusterBounds *bounds, uint32 numLights, std::vector<LightState> &states);
+	void markSlicesDirty(const LightClusterBounds &bounds);
+	void layoutSlices(bool withHeadroom);
+	template<typename ClusterVisitor> void visitLightClusters(const LightSphere &light, const LightClusterBounds &bounds,
+		const Float3 &inv_scale, ClusterVisitor visit);
+	template<typename ClusterVisitor> void visitSliceClusters(uint32 z, const LightSphere *lights, const LightClusterBounds *bounds,
+		uint32 numLights, const Float3 &inv_scale, ClusterVisitor visit);
+	template<typename ClusterVisitor> void visitFrustumLightClusters(const LightSphere &light, const LightClusterBounds &bounds,
+		ClusterVisitor visit);
+	template<typename ClusterVisitor> void visitFrustumSliceClusters(uint32 z, const LightSphere *lights, const LightClusterBounds *bounds,
+		uint32 numLights, ClusterVisitor visit);
+	void summarizeSlice(uint32 z);
+	void finalizeSlice(uint32 z);
+	void updateClusterStats();
+	void benchmarkIncrementalAssignment();
+
 	ID3D11DevicePtr _device;
 	ID3D11DeviceContextPtr _context;
 	ID3D11Texture3DPtr _clusterTex;
@@ -51,14 +166,43 @@ private:
 
 	StructuredBuffer _lightIndicesList;
 
+	// Dirty slices are diffed against the last upload, one texture row or one index at a time
+	UploadManager _uploads;
+	D3D11UploadBackend _uploadBackend;
+	uint32 _clusterTexUpload;
+	uint32 _lightIndicesUpload;
+
 	uint32 _numLightIndices;
-	uint32 _maxNumLightIndicesPerCluster;
+	uint32 _lightIndicesCapacity;
 	//uint32 _lightIndices[NUM_LIGHT_INDICES_MAX];
 	//ClusterData _clusters[CZ][CY][CX];
 
 	uint32 *_lightIndices;
 	ClusterData *_clusters;
 
+	std::vector<LightSphere> _lightSpheres;
+	std::vector<LightClusterBounds> _lightClusterBounds;
+	std::vector<SliceInfo> _slices;
+
+	// Incremental assignment state
+	std::vector<LightState> _pointLightStates;
+	std::vector<LightState> _shProbeLightStates;
+	std::vector<uint8> _sliceDirty;
+	std::vector<uint32> _dirtySlices;
+	std::vector<uint32> _sliceWorkList;
+	bool _fullRebuild;
+
+	// Count and scatter scratch, carved out of _scratchArena in genClusterResources.
+	// Counts are back to zero after every build, cursors are rewritten by finalizeSlice.
+	FrameArena _scratchArena;
+	uint32 *_numPointLightsInCluster;
+	uint32 *_numSHProbeLightsInCluster;
+	uint32 *_pointLightWriteCursor;
+	uint32 *_shProbeLightWriteCursor;
+	uint64 _numScratchGrowths;
+
+	ClusterStats _clusterStats;
+
 	// cluster size
 	uint32 _cx;
 	uint32 _cy;
@@ -66,7 +210,17 @@ private:
 	BBox _clustersWSAABB;
 
 	float _referenceScale;
-	uint32 _referenceNumLightIndices;
+
+	// Frustum mode: view space extents of the clusters, rebuilt when the projection changes.
+	// Depth bounds per slice, x bounds per (slice, column) and y bounds per (slice, row).
+	ClusterMode _mode;
+	const Camera *_camera;
+	Float4 _frustumParams; // near, far, proj._11, proj._22 the tables were built for
+	std::vector<float> _sliceDepths;
+	std::vector<float> _frustumTileMinX;
+	std::vector<float> _frustumTileMaxX;
+	std::vector<float> _frustumTileMinY;
+	std::vector<float> _frustumTileMaxY;
 
 	Scene *_scene;
 	Float3 _clusterScale;
@@ -36,6 +36,8 @@ cbuffer VSConstants : register(b0)
 	float4x4 View;
     float4x4 WorldViewProjection;
     float4x4 PrevWorldViewProjection;
+	float4x4 ViewProjection;
+	uint InstanceOffset;
 }
 
 cbuffer PSConstants : register(b0)
@@ -76,6 +78,17 @@ Texture2D EmissiveMap : register(t7);
 //TextureCube<float3> SpecularCubemapArray1 : register(t8);
 //TextureCube<float3> SpecularCubemapArray2 : register(t9);
 
+#if Instanced_
+	// Per instance transforms of the batch start at InstanceOffset
+	struct InstanceData
+	{
+		float4x4 World;
+		float4x4 PrevWorldViewProjection;
+	};
+
+	StructuredBuffer<InstanceData> Instances : register(t0);
+#endif
+
 SamplerState AnisoSampler : register(s0);
 SamplerState EVSMSampler : register(s1);
 SamplerState LinearSampler : register(s2);
@@ -167,31 +180,42 @@ struct PSOutput
 //=================================================================================================
 // Vertex Shader
 //=================================================================================================
-VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID)
+VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID, in uint InstanceID : SV_InstanceID)
 {
     VSOutput output;
 
+	#if Instanced_
+		InstanceData instance = Instances[InstanceOffset + InstanceID];
+		float4x4 world = instance.World;
+		float4x4 worldViewProjection = mul(world, ViewProjection);
+		float4x4 prevWorldViewProjection = instance.PrevWorldViewProjection;
+	#else
+		float4x4 world = World;
+		float4x4 worldViewProjection = WorldViewProjection;
+		float4x4 prevWorldViewProjection = PrevWorldViewProjection;
+	#endif
+
     // Calc the world-space position
-    output.PositionWS = mul(float4(input.PositionOS, 1.0f), World).xyz;
+    output.PositionWS = mul(float4(input.PositionOS, 1.0f), world).xyz;
 
 	// Calc the view-space depth
 	output.DepthVS = mul(float4(output.PositionWS, 1.0f), View).z;
 
     // Calc the clip-space position
-    output.PositionCS = mul(float4(input.PositionOS, 1.0f), WorldViewProjection);
+    output.PositionCS = mul(float4(input.PositionOS, 1.0f), worldViewProjection);
 
 	// Rotate the normal into world space
-    output.NormalWS = normalize(mul(input.NormalOS, (float3x3)World));
+    output.NormalWS = normalize(mul(input.NormalOS, (float3x3)world));
 
-    output.PrevPosition = mul(float4(input.PositionOS, 1.0f), PrevWorldViewProjection).xyw;
+    output.PrevPosition = mul(float4(input.PositionOS, 1.0f), prevWorldViewProjection).xyw;
 
 	#if UseMaps_
 		output.UV = input.UV;
 	#endif
 
     #if UseNormalMapping_
-        output.TangentWS = normalize(mul(input.TangentOS, (float3x3)World));
-        output.BitangentWS = normalize(mul(input.BitangentOS, (float3x3)World));
+        output.TangentWS = normalize(mul(input.TangentOS, (float3x3)world));
+        output.BitangentWS = normalize(mul(input.BitangentOS, (float3x3)world));
     #endif
 
     return output;
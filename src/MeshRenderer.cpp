@@ -17,6 +17,7 @@
 #include <Graphics\\ShaderCompilation.h>
 #include <App.h>
 #include <Graphics\\Textures.h>
+#include <Graphics\\Profiler.h>
 
 #include "AppSettings.h"
 #include "SharedConstants.h"
@@ -134,12 +135,12 @@ void MeshRenderer::GenPSRecursive(ID3D11Device *device, int depth, bool32 *descS
 
 void MeshRenderer::LoadShaders()
 {
-	_totalShaderNum = (int)pow(2, 5) + (int)pow(2, 8) + 8;
+	_totalShaderNum = (int)pow(2, 6) + (int)pow(2, 8) + 9;
 
     CompileOptions opts;
 
 	// Mesh.hlsl
-	const char *vsDescs[] = { "UseNormalMapping_", "UseAlbedoMap_", "UseMetallicMap_", "UseRoughnessMap_", "UseEmissiveMap_" };
+	const char *vsDescs[] = { "UseNormalMapping_", "UseAlbedoMap_", "UseMetallicMap_", "UseRoughnessMap_", "UseEmissiveMap_", "Instanced_" };
 	const char *psDescs[] = { "UseNormalMapping_", "UseAlbedoMap_", "UseMetallicMap_", "UseRoughnessMap_", "UseEmissiveMap_", "CreateCubemap_", "CentroidSampling_", "IsGBuffer_" };
 	GenVSShaderPermutations(_device, L"Mesh.hlsl", "VS", vsDescs, _countof(vsDescs), _meshVertexShaders);
 	GenPSShaderPermutations(_device, L"Mesh.hlsl", "PS", psDescs, _countof(psDescs), _meshPixelShaders);
@@ -149,6 +150,12 @@ void MeshRenderer::LoadShaders()
 	if (RenderShaderProgress(_curShaderNum++, _totalShaderNum) == false)
 		return;
 
+	opts.Reset();
+	opts.Add("Instanced_", 1);
+	_meshDepthInstancedVS = CompileVSFromFile(_device, L"DepthOnly.hlsl", "VS", "vs_5_0", opts);
+	if (RenderShaderProgress(_curShaderNum++, _totalShaderNum) == false)
+		return;
+
 	// EVSMConvert.hlsl
     _fullScreenVS = CompileVSFromFile(_device, L"EVSMConvert.hlsl", "FullScreenVS");
 	if (RenderShaderProgress(_curShaderNum++, _totalShaderNum) == false)
@@ -240,6 +247,9 @@ void MeshRenderer::ReMapMeshShaders()
 {
 	_meshVertexShadersMap.clear();
 	_meshPixelShadersMap.clear();
+	_meshInstancedVertexShadersMap.clear();
+	_meshShaderPermutations.clear();
+	_meshSortIds.clear();
 
 	// re-map shader for cubemap
 	for (uint64 i = 0; i < _scene->getNumModels(); i++)
@@ -259,6 +269,9 @@ void MeshRenderer::SetScene(Scene *scene)
 
 	_meshVertexShadersMap.clear();
 	_meshPixelShadersMap.clear();
+	_meshInstancedVertexShadersMap.clear();
+	_meshShaderPermutations.clear();
+	_meshSortIds.clear();
 
 	// generate input layout for every model's mesh
 	for (uint64 i = 0; i < _scene->getNumModels(); i++)
@@ -299,12 +312,20 @@ void MeshRenderer::GenMeshShaderMap(const Model *model)
 
 		uint32 vsbits = boolArrToUint32(arr, 5);
 		uint32 psbits = boolArrToUint32(arr, 8);
+		uint32 instancedvsbits = vsbits | (1 << 5);
 
 		VertexShaderPtr vs = _meshVertexShaders[vsbits];
 		PixelShaderPtr ps = _meshPixelShaders[psbits];
 
 		_meshVertexShadersMap.insert(std::make_pair(&mesh, vs));
 		_meshPixelShadersMap.insert(std::make_pair(&mesh, ps));
+		_meshInstancedVertexShadersMap.insert(std::make_pair(&mesh, _meshVertexShaders[instancedvsbits]));
+
+		// the pixel shader bits cover every vertex shader option but instancing
+		_meshShaderPermutations.insert(std::make_pair(&mesh, psbits));
+
+		// dense id for the render queue key, meshes of one model stay next to each other
+		_meshSortIds.insert(std::make_pair(&mesh, (uint32)_meshSortIds.size()));
 	}
 }
 
@@ -343,6 +364,8 @@ void MeshRenderer::Initialize(ID3D11Device* device, ID3D11DeviceContext* context
 	_drawingCubemap = false;
 	_drawingGBuffer = false;
 	_initializeProbes = true;
+	_drawStats = DrawStats();
+	_lastFrameDrawStats = DrawStats();
 
 	_blendStates.Initialize(device);
 	_rasterizerStates.Wireframe();
@@ -380,6 +403,8 @@ void MeshRenderer::Initialize(ID3D11Device* device, ID3D11DeviceContext* context
 
 void MeshRenderer::Update()
 {
+	_lastFrameDrawStats = _drawStats;
+	_drawStats = DrawStats();
 }
 
 void MeshRenderer::CreateReductionTargets(uint32 width, uint32 height)
@@ -632,7 +657,10 @@ void MeshRenderer::Render(ID3D11DeviceContext* context, const Camera& camera, co
 
 	//Set Cubemap
 
-	// DoSceneObjectsFrustumTests(camera, false);
+	if (AppSettings::EnableFrustumCulling)
+	{
+		DoSceneObjectsFrustumTests(camera, world, false);
+	}
 
     // Set states
     float blendFactor[4] = {1, 1, 1, 1};
@@ -680,104 +708,140 @@ void MeshRenderer::Render(ID3D11DeviceContext* context, const Camera& camera, co
     context->HSSetShader(nullptr, nullptr, 0);
     context->GSSetShader(nullptr, nullptr, 0);
 
-	_scene->sortSceneObjects(camera.ViewMatrix());
-	RenderSceneObjects(context, world, camera, envMap, envMapSH, jitterOffset, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
-	RenderSceneObjects(context, world, camera, envMap, envMapSH, jitterOffset, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	// draw order comes from the render queue, sorted by state and depth
+	if (AppSettings::InstancedRendering)
+	{
+		RenderSceneObjectsInstanced(context, world, camera, envMap, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
+		RenderSceneObjectsInstanced(context, world, camera, envMap, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	}
+	else
+	{
+		RenderSceneObjects(context, world, camera, envMap, envMapSH, jitterOffset, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
+		RenderSceneObjects(context, world, camera, envMap, envMapSH, jitterOffset, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	}
 
 	// TODO: refactor
     ID3D11ShaderResourceView* nullSRVs[8] = { nullptr };
     context->PSSetShaderResources(0, 8, nullSRVs);
 }
 
-void MeshRenderer::RenderSceneObjects(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera,
-	ID3D11ShaderResourceView* envMap, const SH9Color& envMapSH,
-	Float2 jitterOffset, SceneObject *sceneObjectsArr, int numSceneObjs)
+void MeshRenderer::gatherDrawItems(const Float4x4 &world, const Camera& camera, SceneObject *sceneObjectsArr, int numSceneObjs,
+	bool depthOnly)
 {
-	for (uint64 objIndex = 0; objIndex < numSceneObjs; objIndex++)
+	ProbeManager &probeManager = *_scene->getProbeManagerPtr();
+	const Float4x4 viewMatrix = world * camera.ViewMatrix();
+	const float nearClip = camera.NearClip();
+	const float invDepthRange = 1.0f / (camera.FarClip() - nearClip);
+
+	_renderQueue.Clear();
+	_drawItems.clear();
+	_objectInstanceData.clear();
+	_objectWVPs.clear();
+	_objectProbeIndices.clear();
+	_objectPositions.clear();
+
+	for (int objIndex = 0; objIndex < numSceneObjs; objIndex++)
 	{
+		SceneObject &obj = sceneObjectsArr[objIndex];
+
 		// Frustum culling on scene object bound
-		/*if (!sceneObjectsArr[objIndex].bound->frustumTest)
+		if (AppSettings::EnableFrustumCulling && !obj.bound->frustumTest)
 		{
 			continue;
-		}*/
-
-		ModelPartsBound *partsBound = sceneObjectsArr[objIndex].bound->modelPartsBound;
-		Float4x4 worldMat = *sceneObjectsArr[objIndex].base * world;
-		Model *model = sceneObjectsArr[objIndex].model;
-
-		// Set VS constant buffer
-		_meshVSConstants.Data.World = Float4x4::Transpose(worldMat);
-		_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
-		_meshVSConstants.Data.WorldViewProjection = Float4x4::Transpose(worldMat * camera.ViewProjectionMatrix());
-		_meshVSConstants.Data.PrevWorldViewProjection = *sceneObjectsArr[objIndex].prevWVP;
-		_meshVSConstants.ApplyChanges(context);
-		_meshVSConstants.SetVS(context, 0);
+		}
 
-		*sceneObjectsArr[objIndex].prevWVP = _meshVSConstants.Data.WorldViewProjection;
+		Float4x4 worldMat = *obj.base * world;
+		uint32 object = (uint32)_objectInstanceData.size();
 
-		ID3D11ShaderResourceView *chosenEnvMap = nullptr;
+		InstanceData data;
+		data.World = Float4x4::Transpose(worldMat);
+		data.PrevWorldViewProjection = *obj.prevWVP;
+		_objectInstanceData.push_back(data);
+		_objectWVPs.push_back(Float4x4::Transpose(worldMat * camera.ViewProjectionMatrix()));
 
-		//if (!_initializeProbes)
-		// {	
-			//Get cubemap
-			Float3 objPos = sceneObjectsArr[objIndex].base->Translation();
-			RenderTarget2D cubemapRT;
-			CreateCubemap *cubeMap = nullptr;
-			// RenderTarget2D blendRenderTargetViews[2];
-			// ID3D11ShaderResourceViewPtr blendCubeMaps[2];
+		if (!depthOnly)
+		{
+			*obj.prevWVP = _objectWVPs.back();
+		}
+		_objectPositions.push_back(obj.base->Translation());
 
-			ProbeManager &probeManager = *_scene->getProbeManagerPtr();
-			_meshPSConstants.Data.probeIndex = probeManager.GetNNProbe(&cubeMap, objPos);
+		float depth01 = (Float3::Transform(obj.base->Translation(), viewMatrix).z - nearClip) * invDepthRange;
 
-			if (cubeMap == nullptr)
-			{
-				chosenEnvMap = envMap;
-			}
-			else
+		const ModelPartsBound *partsBound = obj.bound->modelPartsBound;
+		uint32 partCount = 0;
+		for (uint32 meshIdx = 0; meshIdx < obj.model->Meshes().size(); ++meshIdx)
+		{
+			const Mesh& mesh = obj.model->Meshes()[meshIdx];
+			for (uint32 partIdx = 0; partIdx < mesh.MeshParts().size(); ++partIdx)
 			{
-				cubeMap->GetPreFilterRT(cubemapRT);
-				chosenEnvMap = cubemapRT.SRView;
+				// Frustum culling on parts
+				if (!AppSettings::EnableFrustumCulling || partsBound->FrustumTests[partCount++])
+				{
+					// depth passes have a single shader and no textures, only the mesh matters
+					uint64 key = depthOnly ? RenderQueue::MakeKey(0, _meshSortIds[&mesh], 0, depth01)
+						: RenderQueue::MakeKey(_meshShaderPermutations[&mesh], _meshSortIds[&mesh], mesh.MeshParts()[partIdx].MaterialIdx, depth01);
+
+					DrawItem item = { object, obj.model, meshIdx, partIdx };
+					_renderQueue.Add(key, (uint32)_drawItems.size());
+					_drawItems.push_back(item);
+				}
 			}
+		}
+	}
 
-			/*	std::vector<CreateCubemap> blendCubeMapsVec;
-				probeManager.GetBlendProbes(blendCubeMapsVec, objPos);
-				CreateCubemap &blendCubemap1 = blendCubeMapsVec.at(0);
-				CreateCubemap &blendCubemap2 = blendCubeMapsVec.at(1);
+	// probes for all visible objects in one batched lookup
+	_objectProbeIndices.resize(_objectPositions.size(), 0);
+	if (!depthOnly && !_objectPositions.empty())
+	{
+		probeManager.GetNNProbes(_objectPositions.data(), (uint32)_objectPositions.size(), _objectProbeIndices.data());
+	}
 
-				blendCubemap1.GetPreFilterTargetViews(blendRenderTargetViews[0]);
-				blendCubemap2.GetPreFilterTargetViews(blendRenderTargetViews[1]);
+	_renderQueue.Sort();
+}
 
-				blendCubeMaps[0] = blendRenderTargetViews[0].SRView;
-				blendCubeMaps[1] = blendRenderTargetViews[1].SRView;
+void MeshRenderer::RenderSceneObjects(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera,
+	ID3D11ShaderResourceView* envMap, const SH9Color& envMapSH,
+	Float2 jitterOffset, SceneObject *sceneObjectsArr, int numSceneObjs)
+{
+	gatherDrawItems(world, camera, sceneObjectsArr, numSceneObjs, false);
 
-				_meshPSConstants.Data.ProbePosWS[0] = blendCubemap1.GetPosition();
-				_meshPSConstants.Data.ProbePosWS[1] = blendCubemap2.GetPosition();
-				_meshPSConstants.Data.BoxSize[0] = blendCubemap1.GetBoxSize();
-				_meshPSConstants.Data.BoxSize[1] = blendCubemap2.GetBoxSize();
-				_meshPSConstants.Data.ObjPos = objPos;*/
-		// }
+	_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
 
-		// Per object constants
-		_meshPSConstants.ApplyChanges(context);
-		_meshPSConstants.SetPS(context, 0);
+	// Items come sorted by state, only set what changed since the last draw
+	uint32 prevObject = uint32(-1);
+	uint32 prevProbeIndex = uint32(-1);
+	const Mesh *prevMesh = nullptr;
 
-		// Draw all meshes
-		uint32 partCount = 0;
-		for (uint64 meshIdx = 0; meshIdx < model->Meshes().size(); ++meshIdx)
+	const std::vector<RenderQueue::Item> &queueItems = _renderQueue.getItems();
+	for (size_t i = 0; i < queueItems.size(); i++)
+	{
+		const DrawItem &item = _drawItems[queueItems[i].payload];
+		const Mesh& mesh = item.model->Meshes()[item.mesh];
+
+		if (item.object != prevObject)
 		{
-			const Mesh& mesh = model->Meshes()[meshIdx];
+			// Set VS constant buffer
+			const InstanceData &data = _objectInstanceData[item.object];
+			_meshVSConstants.Data.World = data.World;
+			_meshVSConstants.Data.WorldViewProjection = _objectWVPs[item.object];
+			_meshVSConstants.Data.PrevWorldViewProjection = data.PrevWorldViewProjection;
+			_meshVSConstants.ApplyChanges(context);
+			_meshVSConstants.SetVS(context, 0);
+			prevObject = item.object;
+		}
 
-			//if (partsBound->BoundingSpheres.size() == 1) // which means the mesh has only one part - which is the assimp-type mesh
-			//{
-			//	if (!partsBound->FrustumTests[0])
-			//	{
-			//		continue;
-			//	}
-			//}
+		if (_objectProbeIndices[item.object] != prevProbeIndex)
+		{
+			// Per object constants
+			_meshPSConstants.Data.probeIndex = _objectProbeIndices[item.object];
+			_meshPSConstants.ApplyChanges(context);
+			_meshPSConstants.SetPS(context, 0);
+			prevProbeIndex = _objectProbeIndices[item.object];
+		}
 
+		if (&mesh != prevMesh)
+		{
 			// Set per mesh shaders
-			// TODO: sort by view depth
-			// TODO: batch draw calls for static object
 			context->VSSetShader(_meshVertexShadersMap[&mesh], nullptr, 0);
 			context->PSSetShader(_meshPixelShadersMap[&mesh],  nullptr, 0);
 			
@@ -790,44 +854,33 @@ void MeshRenderer::RenderSceneObjects(ID3D11DeviceContext* context, const Float4
 			context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 			// Set the input layout
-			// context->IASetInputLayout(_meshInputLayouts[meshIdx]);
 			context->IASetInputLayout(_meshInputLayouts[&mesh]);
+			prevMesh = &mesh;
+		}
 
-			// Draw all parts
-			for (uint64 partIdx = 0; partIdx < mesh.MeshParts().size(); ++partIdx)
-			{
-				const MeshPart& part = mesh.MeshParts()[partIdx];
-				const MeshMaterial& material = model->Materials()[part.MaterialIdx];
+		const MeshPart& part = mesh.MeshParts()[item.part];
+		const MeshMaterial& material = item.model->Materials()[part.MaterialIdx];
 
-				// Frustum culling on parts
-				//if (partsBound->FrustumTests[partCount++])
-				{
-					const MeshPart& part = mesh.MeshParts()[partIdx];
-					const MeshMaterial& material = model->Materials()[part.MaterialIdx];
-
-					// Set the textures
-					// TODO : strip out unnecessary cases for unique
-					ID3D11ShaderResourceView* psTextures[] =
-					{
-						material.DiffuseMap,
-						material.NormalMap,
-						_varianceShadowMap.SRView,
-						envMap, 
-						_specularLookupTexture,
-						material.RoughnessMap, 
-						material.MetallicMap, 
-						material.EmissiveMap,
-						//_scene->getProbeManagerPtr()->GetProbeArray().SRView,
-						/*blendCubeMaps[0],
-						blendCubeMaps[1]*/
-					};
-
-					context->PSSetShaderResources(0, _countof(psTextures), psTextures);
-					context->DrawIndexed(part.IndexCount, part.IndexStart, 0);
-				}
-			}
-		}
+		// Set the textures
+		// TODO : strip out unnecessary cases for unique
+		ID3D11ShaderResourceView* psTextures[] =
+		{
+			material.DiffuseMap,
+			material.NormalMap,
+			_varianceShadowMap.SRView,
+			envMap, 
+			_specularLookupTexture,
+			material.RoughnessMap, 
+			material.MetallicMap, 
+			material.EmissiveMap,
+		};
+
+		context->PSSetShaderResources(0, _countof(psTextures), psTextures);
+		context->DrawIndexed(part.IndexCount, part.IndexStart, 0);
 	}
+
+	_drawStats.numDrawCalls += _renderQueue.getNumItems();
+	_drawStats.numInstances += _renderQueue.getNumItems();
 }
 
 // Renders all meshes using depth-only rendering
@@ -836,7 +889,10 @@ void MeshRenderer::RenderDepth(ID3D11DeviceContext* context, const Camera& camer
 {
     PIXEvent event(L"Mesh Depth Rendering");
 
-	// DoSceneObjectsFrustumTests(camera, shadowRendering);
+	if (AppSettings::EnableFrustumCulling)
+	{
+		DoSceneObjectsFrustumTests(camera, world, shadowRendering);
+	}
 
     // Set states
     float blendFactor[4] = {1, 1, 1, 1};
@@ -855,38 +911,47 @@ void MeshRenderer::RenderDepth(ID3D11DeviceContext* context, const Camera& camer
     context->DSSetShader(nullptr, nullptr, 0);
     context->HSSetShader(nullptr, nullptr, 0);
 
-	_scene->sortSceneObjects(camera.ViewMatrix());
-	RenderDepthSceneObjects(context, world, camera, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
-	RenderDepthSceneObjects(context, world, camera, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	// draw order comes from the render queue, sorted by state and depth
+	if (AppSettings::InstancedRendering)
+	{
+		RenderDepthSceneObjectsInstanced(context, world, camera, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
+		RenderDepthSceneObjectsInstanced(context, world, camera, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	}
+	else
+	{
+		RenderDepthSceneObjects(context, world, camera, _scene->getStaticOpaqueObjectsPtr(), _scene->getNumStaticOpaqueObjects());
+		RenderDepthSceneObjects(context, world, camera, _scene->getDynamicOpaqueObjectsPtr(), _scene->getNumDynamicOpaueObjects());
+	}
 }
 
 void MeshRenderer::RenderDepthSceneObjects(ID3D11DeviceContext* context, const Float4x4 &world, 
 	const Camera& camera, SceneObject *sceneObjectsArr, int numSceneObjs)
 {
-	for (uint64 objIndex = 0; objIndex < numSceneObjs; objIndex++)
-	{
-		// Frustum culling on scene object bound
-		/*if (!sceneObjectsArr[objIndex].bound->frustumTest)
-		{
-			continue;
-		}*/
+	gatherDrawItems(world, camera, sceneObjectsArr, numSceneObjs, true);
 
-		ModelPartsBound *partsBound = sceneObjectsArr[objIndex].bound->modelPartsBound;
-		Float4x4 worldMat = *sceneObjectsArr[objIndex].base * world;
-		Model *model = sceneObjectsArr[objIndex].model;
+	_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
 
-		// Set constant buffers
-		_meshVSConstants.Data.World = Float4x4::Transpose(worldMat);
-		_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
-		_meshVSConstants.Data.WorldViewProjection = Float4x4::Transpose(worldMat * camera.ViewProjectionMatrix());
-		_meshVSConstants.ApplyChanges(context);
-		_meshVSConstants.SetVS(context, 0);
+	uint32 prevObject = uint32(-1);
+	const Mesh *prevMesh = nullptr;
 
-		uint32 partCount = 0;
-		for (uint32 meshIdx = 0; meshIdx < model->Meshes().size(); ++meshIdx)
+	const std::vector<RenderQueue::Item> &queueItems = _renderQueue.getItems();
+	for (size_t i = 0; i < queueItems.size(); i++)
+	{
+		const DrawItem &item = _drawItems[queueItems[i].payload];
+		const Mesh& mesh = item.model->Meshes()[item.mesh];
+
+		if (item.object != prevObject)
 		{
-			const Mesh& mesh = model->Meshes()[meshIdx];
+			// Set constant buffers
+			_meshVSConstants.Data.World = _objectInstanceData[item.object].World;
+			_meshVSConstants.Data.WorldViewProjection = _objectWVPs[item.object];
+			_meshVSConstants.ApplyChanges(context);
+			_meshVSConstants.SetVS(context, 0);
+			prevObject = item.object;
+		}
 
+		if (&mesh != prevMesh)
+		{
 			// Set the vertices and indices
 			ID3D11Buffer* vertexBuffers[1] = { mesh.VertexBuffer() };
 			UINT vertexStrides[1] = { mesh.VertexStride() };
@@ -897,19 +962,179 @@ void MeshRenderer::RenderDepthSceneObjects(ID3D11DeviceContext* context, const F
 
 			// Set the input layout
 			context->IASetInputLayout(_meshDepthInputLayouts[&mesh]);
+			prevMesh = &mesh;
+		}
 
-			// Draw all parts
-			for (uint64 partIdx = 0; partIdx < mesh.MeshParts().size(); ++partIdx)
-			{
-				// Frustum culling on parts
-				//if (partsBound->FrustumTests[partCount++])
-				{
-					const MeshPart& part = mesh.MeshParts()[partIdx];
-					context->DrawIndexed(part.IndexCount, part.IndexStart, 0);
-				}
-			}
+		const MeshPart& part = mesh.MeshParts()[item.part];
+		context->DrawIndexed(part.IndexCount, part.IndexStart, 0);
+	}
+
+	_drawStats.numDrawCalls += _renderQueue.getNumItems();
+	_drawStats.numInstances += _renderQueue.getNumItems();
+}
+
+void MeshRenderer::uploadInstanceData(ID3D11DeviceContext* context)
+{
+	const std::vector<uint32> &instances = _instanceBatcher.getInstances();
+	const uint32 numInstances = (uint32)instances.size();
+	if (numInstances == 0) return;
+
+	if (_instanceBuffer.Buffer == nullptr || numInstances > _instanceBuffer.NumElements)
+	{
+		uint32 capacity = Max(numInstances, _instanceBuffer.Buffer == nullptr ? 256 : _instanceBuffer.NumElements * 2);
+		_instanceBuffer.Initialize(_device, sizeof(InstanceData), capacity, true);
+	}
+
+	// Batches are contiguous ranges, write the object transforms in batch order
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	DXCall(context->Map(_instanceBuffer.Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+	InstanceData *dst = static_cast<InstanceData *>(mapped.pData);
+	for (uint32 i = 0; i < numInstances; i++)
+	{
+		dst[i] = _objectInstanceData[instances[i]];
+	}
+	context->Unmap(_instanceBuffer.Buffer, 0);
+
+	ID3D11ShaderResourceView *vsSRVs[1] = { _instanceBuffer.SRView };
+	context->VSSetShaderResources(0, 1, vsSRVs);
+}
+
+void MeshRenderer::buildInstanceBatches(bool depthOnly)
+{
+	// Fed in queue order, so batches come out sorted by state and roughly front to back
+	_instanceBatcher.Clear();
+
+	const std::vector<RenderQueue::Item> &queueItems = _renderQueue.getItems();
+	for (size_t i = 0; i < queueItems.size(); i++)
+	{
+		const DrawItem &item = _drawItems[queueItems[i].payload];
+		const Mesh *mesh = &item.model->Meshes()[item.mesh];
+
+		// The probe index is a pixel shader constant, objects only share a batch with the same probe
+		InstanceBatcher::BatchKey key = { depthOnly ? 0 : _meshShaderPermutations[mesh], item.model, item.mesh, item.part,
+			_objectProbeIndices[item.object] };
+		_instanceBatcher.AddItem(key, item.object);
+	}
+
+	_instanceBatcher.Build();
+}
+
+void MeshRenderer::RenderDepthSceneObjectsInstanced(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera, SceneObject *sceneObjectsArr, int numSceneObjs)
+{
+	gatherDrawItems(world, camera, sceneObjectsArr, numSceneObjs, true);
+	buildInstanceBatches(true);
+	uploadInstanceData(context);
+
+	_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
+	_meshVSConstants.Data.ViewProjection = Float4x4::Transpose(camera.ViewProjectionMatrix()); // world is in the instance transforms
+	context->VSSetShader(_meshDepthInstancedVS, nullptr, 0);
+
+	const Mesh *prevMesh = nullptr;
+	const std::vector<InstanceBatcher::Batch> &batches = _instanceBatcher.getBatches();
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		const InstanceBatcher::Batch &batch = batches[b];
+		const Mesh &mesh = batch.key.model->Meshes()[batch.key.mesh];
+
+		if (&mesh != prevMesh)
+		{
+			ID3D11Buffer* vertexBuffers[1] = { mesh.VertexBuffer() };
+			UINT vertexStrides[1] = { mesh.VertexStride() };
+			UINT offsets[1] = { 0 };
+			context->IASetVertexBuffers(0, 1, vertexBuffers, vertexStrides, offsets);
+			context->IASetIndexBuffer(mesh.IndexBuffer(), mesh.IndexBufferFormat(), 0);
+			context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			context->IASetInputLayout(_meshDepthInputLayouts[&mesh]);
+			prevMesh = &mesh;
+		}
+
+		_meshVSConstants.Data.InstanceOffset = batch.firstInstance;
+		_meshVSConstants.ApplyChanges(context);
+		_meshVSConstants.SetVS(context, 0);
+
+		const MeshPart& part = mesh.MeshParts()[batch.key.part];
+		context->DrawIndexedInstanced(part.IndexCount, batch.numInstances, part.IndexStart, 0, 0);
+	}
+
+	_drawStats.numDrawCalls += (uint32)batches.size();
+	_drawStats.numInstances += _instanceBatcher.getNumItems();
+	_drawStats.numDrawCallsSaved += _instanceBatcher.getNumDrawCallsSaved();
+
+	ID3D11ShaderResourceView *nullSRVs[1] = { nullptr };
+	context->VSSetShaderResources(0, 1, nullSRVs);
+}
+
+void MeshRenderer::RenderSceneObjectsInstanced(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera,
+	ID3D11ShaderResourceView* envMap, SceneObject *sceneObjectsArr, int numSceneObjs)
+{
+	gatherDrawItems(world, camera, sceneObjectsArr, numSceneObjs, false);
+	buildInstanceBatches(false);
+	uploadInstanceData(context);
+
+	_meshVSConstants.Data.View = Float4x4::Transpose(camera.ViewMatrix());
+	_meshVSConstants.Data.ViewProjection = Float4x4::Transpose(camera.ViewProjectionMatrix()); // world is in the instance transforms
+
+	const Mesh *prevMesh = nullptr;
+	uint32 prevProbeIndex = uint32(-1);
+	const std::vector<InstanceBatcher::Batch> &batches = _instanceBatcher.getBatches();
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		const InstanceBatcher::Batch &batch = batches[b];
+		const Model *model = batch.key.model;
+		const Mesh &mesh = model->Meshes()[batch.key.mesh];
+
+		if (&mesh != prevMesh)
+		{
+			context->VSSetShader(_meshInstancedVertexShadersMap[&mesh], nullptr, 0);
+			context->PSSetShader(_meshPixelShadersMap[&mesh], nullptr, 0);
+
+			ID3D11Buffer* vertexBuffers[1] = { mesh.VertexBuffer() };
+			UINT vertexStrides[1] = { mesh.VertexStride() };
+			UINT offsets[1] = { 0 };
+			context->IASetVertexBuffers(0, 1, vertexBuffers, vertexStrides, offsets);
+			context->IASetIndexBuffer(mesh.IndexBuffer(), mesh.IndexBufferFormat(), 0);
+			context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			context->IASetInputLayout(_meshInputLayouts[&mesh]);
+			prevMesh = &mesh;
+		}
+
+		if (batch.key.probeIndex != prevProbeIndex)
+		{
+			_meshPSConstants.Data.probeIndex = batch.key.probeIndex;
+			_meshPSConstants.ApplyChanges(context);
+			_meshPSConstants.SetPS(context, 0);
+			prevProbeIndex = batch.key.probeIndex;
 		}
+
+		_meshVSConstants.Data.InstanceOffset = batch.firstInstance;
+		_meshVSConstants.ApplyChanges(context);
+		_meshVSConstants.SetVS(context, 0);
+
+		const MeshPart& part = mesh.MeshParts()[batch.key.part];
+		const MeshMaterial& material = model->Materials()[part.MaterialIdx];
+
+		ID3D11ShaderResourceView* psTextures[] =
+		{
+			material.DiffuseMap,
+			material.NormalMap,
+			_varianceShadowMap.SRView,
+			envMap,
+			_specularLookupTexture,
+			material.RoughnessMap,
+			material.MetallicMap,
+			material.EmissiveMap,
+		};
+
+		context->PSSetShaderResources(0, _countof(psTextures), psTextures);
+		context->DrawIndexedInstanced(part.IndexCount, batch.numInstances, part.IndexStart, 0, 0);
 	}
+
+	_drawStats.numDrawCalls += (uint32)batches.size();
+	_drawStats.numInstances += _instanceBatcher.getNumItems();
+	_drawStats.numDrawCallsSaved += _instanceBatcher.getNumDrawCallsSaved();
+
+	ID3D11ShaderResourceView *nullSRVs[1] = { nullptr };
+	context->VSSetShaderResources(0, 1, nullSRVs);
 }
 
 // Renders meshes using cascaded shadow mapping
@@ -1120,46 +1345,51 @@ void MeshRenderer::RenderShadowMap(ID3D11DeviceContext* context, const Camera& c
         depthStencil->Release();
 }
 
-void MeshRenderer::DoSceneObjectModelPartsFrustumTests(const Frustum &frustum, const Camera& camera, bool ignoreNearZ, ModelPartsBound& mesh)
+// Tests the MeshPart spheres of every opaque object in one batch. Object visibility is derived
+// from its parts, so it does not depend on the merged object sphere being up to date.
+void MeshRenderer::DoSceneObjectsFrustumTests(const Camera &camera, const Float4x4 &world, bool ignoreNearZ)
 {
-	mesh.FrustumTests.clear();
-	mesh.NumSuccessfulTests = 0;
+	CPUProfileBlock profileBlock(L"Frustum Culling");
 
-	for (uint32 i = 0; i < mesh.BoundingSpheres.size(); ++i)
-	{
-		const BSphere& sphere = mesh.BoundingSpheres[i];
-		uint32 test = TestFrustumSphere(frustum, sphere, ignoreNearZ);
-		mesh.FrustumTests.push_back(test);
-		mesh.NumSuccessfulTests += test;
-	}
-}
+	SceneObject *objectArrays[2] = { _scene->getStaticOpaqueObjectsPtr(), _scene->getDynamicOpaqueObjectsPtr() };
+	int numObjects[2] = { _scene->getNumStaticOpaqueObjects(), _scene->getNumDynamicOpaueObjects() };
 
-void MeshRenderer::DoSceneObjectFrustumTest(SceneObject *obj, const Camera &camera, bool ignoreNearZ)
-{
+	// Bounds are in scene space, the scene transform goes into the frustum
 	Frustum frustum;
-	ComputeFrustum(camera.ViewProjectionMatrix().ToSIMD(), frustum);
+	ComputeFrustum((world * camera.ViewProjectionMatrix()).ToSIMD(), frustum);
 
-	uint32 test = TestFrustumSphere(frustum, *obj->bound->bsphere, ignoreNearZ);
-	obj->bound->frustumTest = test > 0;
-	
-	// early out - do not transform if the scene obj bounding box is not in view
-	if (test)
+	for (int arr = 0; arr < 2; arr++)
 	{
-		DoSceneObjectModelPartsFrustumTests(frustum, camera, ignoreNearZ, *obj->bound->modelPartsBound);
+		for (int i = 0; i < numObjects[arr]; i++)
+		{
+			ModelPartsBound *partsBound = objectArrays[arr][i].bound->modelPartsBound;
+			partsBound->FrustumTests.assign(partsBound->BoundingSpheres.size(), 0);
+			partsBound->NumSuccessfulTests = 0;
+		}
 	}
-}
 
-void MeshRenderer::DoSceneObjectsFrustumTests(const Camera &camera, bool ignoreNearZ)
-{
-	for (uint64 i = 0; i < _scene->getNumStaticOpaqueObjects(); i++)
+	// Part boxes through the scene BVHs, or part spheres in batches. Results point straight at the parts.
+	if (AppSettings::HierarchicalCulling)
+	{
+		_scene->cullOpaqueMeshParts(frustum, ignoreNearZ, _visibleParts);
+	}
+	else
 	{
-		SceneObject *obj = &_scene->getStaticOpaqueObjectsPtr()[i];
-		DoSceneObjectFrustumTest(obj, camera, ignoreNearZ);
+		_scene->cullOpaqueMeshPartSpheres(frustum, ignoreNearZ, _visibleParts);
 	}
 
-	for (uint64 i = 0; i < _scene->getNumDynamicOpaueObjects(); i++)
+	for (size_t i = 0; i < _visibleParts.size(); i++)
 	{
-		SceneObject *obj = &_scene->getDynamicOpaqueObjectsPtr()[i];
-		DoSceneObjectFrustumTest(obj, camera, ignoreNearZ);
+		_visibleParts[i].partsBound->FrustumTests[_visibleParts[i].part] = 1;
+		_visibleParts[i].partsBound->NumSuccessfulTests++;
+	}
+
+	for (int arr = 0; arr < 2; arr++)
+	{
+		for (int i = 0; i < numObjects[arr]; i++)
+		{
+			SceneObjectBound *bound = objectArrays[arr][i].bound;
+			bound->frustumTest = bound->modelPartsBound->NumSuccessfulTests > 0;
+		}
 	}
 }
@@ -21,6 +21,8 @@
 
 #include "AppSettings.h"
 #include "Scene.h"
+#include "InstanceBatcher.h"
+#include "RenderQueue.h"
 
 using namespace SampleFramework11;
 
@@ -74,6 +76,16 @@ public:
 	inline ID3D11SamplerStatePtr GetEVSMSamplerStatePtr() { return _evsmSampler; }	
 	inline ID3D11ShaderResourceViewPtr GetSpecularLookupTexturePtr() { return _specularLookupTexture; }
 
+	// Mesh part draws of the last frame, over every pass
+	struct DrawStats
+	{
+		uint32 numDrawCalls;
+		uint32 numInstances;
+		uint32 numDrawCallsSaved;
+	};
+
+	inline const DrawStats &getLastFrameDrawStats() const { return _lastFrameDrawStats; }
+
 
 	// Constant buffers
 	struct MeshVSConstants
@@ -82,6 +94,15 @@ public:
 		Float4Align Float4x4 View;
 		Float4Align Float4x4 WorldViewProjection;
 		Float4Align Float4x4 PrevWorldViewProjection;
+		Float4Align Float4x4 ViewProjection;
+		uint32 InstanceOffset;
+	};
+
+	// Mesh.hlsl/DepthOnly.hlsl InstanceData, transposed like the constant buffer matrices
+	struct InstanceData
+	{
+		Float4x4 World;
+		Float4x4 PrevWorldViewProjection;
 	};
 
 	struct MeshPSConstants
@@ -134,13 +155,25 @@ protected:
 		ID3D11ShaderResourceView* envMap, const SH9Color& envMapSH,
 		Float2 jitterOffset, SceneObject *sceneObjectsArr, int numSceneObjs);
 
+	// Same output as the functions above, visible parts are grouped with InstanceBatcher and
+	// every batch is one instanced draw
+	void RenderDepthSceneObjectsInstanced(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera, SceneObject *sceneObjectsArr, int numSceneObjs);
+	void RenderSceneObjectsInstanced(ID3D11DeviceContext* context, const Float4x4 &world, const Camera& camera,
+		ID3D11ShaderResourceView* envMap, SceneObject *sceneObjectsArr, int numSceneObjs);
+	void uploadInstanceData(ID3D11DeviceContext* context);
+	void buildInstanceBatches(bool depthOnly);
+
+	// Fills the per object data and the render queue with every visible part, then sorts it.
+	// prevWVP is only advanced for the colour pass.
+	void gatherDrawItems(const Float4x4 &world, const Camera& camera, SceneObject *sceneObjectsArr, int numSceneObjs,
+		bool depthOnly);
+
     void GenAndCacheMeshInputLayout(const Model* model);
 	void GenMeshShaderMap(const Model *model);
 
-	// Performs frustum/sphere intersection tests for all MeshPart's
-	void DoSceneObjectModelPartsFrustumTests(const Frustum &frustum, const Camera& camera, bool ignoreNearZ, ModelPartsBound& mesh);
-	void DoSceneObjectFrustumTest(SceneObject *obj, const Camera &camera, bool ignoreNearZ);
-	void DoSceneObjectsFrustumTests(const Camera &camera, bool ignoreNearZ);
+	// Performs frustum/sphere intersection tests for all MeshPart's, results go to
+	// ModelPartsBound::FrustumTests and SceneObjectBound::frustumTest
+	void DoSceneObjectsFrustumTests(const Camera &camera, const Float4x4 &world, bool ignoreNearZ);
 
 
     ID3D11DevicePtr _device;
@@ -153,6 +186,8 @@ protected:
     // const Model* _model = nullptr;
 	Scene *_scene = nullptr;
 
+	std::vector<Scene::MeshPartRef> _visibleParts;
+
     DepthStencilBuffer _shadowMap;
     RenderTarget2D  _varianceShadowMap;
     RenderTarget2D _tempVSM;
@@ -163,6 +198,9 @@ protected:
 	std::unordered_map<const Mesh *, ID3D11InputLayoutPtr> _meshInputLayouts;
 	std::unordered_map<const Mesh *, VertexShaderPtr> _meshVertexShadersMap;
 	std::unordered_map<const Mesh *, PixelShaderPtr>  _meshPixelShadersMap;
+	std::unordered_map<const Mesh *, VertexShaderPtr> _meshInstancedVertexShadersMap;
+	std::unordered_map<const Mesh *, uint32> _meshShaderPermutations;
+	std::unordered_map<const Mesh *, uint32> _meshSortIds;
 
 	std::unordered_map<uint32, VertexShaderPtr> _meshVertexShaders;
 	std::unordered_map<uint32, PixelShaderPtr> _meshPixelShaders;
@@ -172,6 +210,30 @@ protected:
 
 	std::unordered_map<const Mesh *, ID3D11InputLayoutPtr> _meshDepthInputLayouts;
     VertexShaderPtr _meshDepthVS;
+    VertexShaderPtr _meshDepthInstancedVS;
+
+	// Instancing, _objectInstanceData holds one entry per visible object and the batcher's
+	// instance lists index into it
+	InstanceBatcher _instanceBatcher;
+	std::vector<InstanceData> _objectInstanceData;
+	StructuredBuffer _instanceBuffer;
+
+	// Visible parts for the current pass, the render queue payload indexes _drawItems and
+	// DrawItem::object indexes the per object arrays
+	struct DrawItem
+	{
+		uint32 object;
+		const Model *model;
+		uint32 mesh;
+		uint32 part;
+	};
+	RenderQueue _renderQueue;
+	std::vector<DrawItem> _drawItems;
+	std::vector<Float4x4> _objectWVPs;
+	std::vector<uint32> _objectProbeIndices;
+	std::vector<Float3> _objectPositions;
+	DrawStats _drawStats;
+	DrawStats _lastFrameDrawStats;
 
     VertexShaderPtr _fullScreenVS;
     PixelShaderPtr _evsmConvertPS;
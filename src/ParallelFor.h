@@ -0,0 +1,38 @@
+#pragma once
+#include "CPUTypes.h"
+
+#ifdef _MSC_VER
+#include <ppl.h>
+#else
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+
+// function(i) for every i in [begin, end), in no particular order and from several threads.
+// concurrency::parallel_for where the Concurrency Runtime exists, a pool of std::threads that
+// hand out indices one at a time everywhere else.
+template<typename Function> void ParallelFor(uint32 begin, uint32 end, const Function &function)
+{
+	if (begin >= end) return;
+
+#ifdef _MSC_VER
+	concurrency::parallel_for(begin, end, function);
+#else
+	std::atomic<uint32> next(begin);
+	auto worker = [&]()
+	{
+		for (uint32 i = next++; i < end; i = next++)
+			function(i);
+	};
+
+	const uint32 numThreads = std::min(std::max(std::thread::hardware_concurrency(), 1u), end - begin);
+	std::vector<std::thread> threads;
+	for (uint32 t = 1; t < numThreads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+#endif
+}
@@ -0,0 +1,393 @@
+#include "PhysicsBenchmark.h"
+
+#include <Utility.h>
+#include <Timer.h>
+
+#include <thread>
+
+static const float StepDt = 1.0f / 60.0f;
+static const uint32 TowerHeight = 10;
+
+// Boxes are stacked TowerHeight high on a grid far enough apart that towers only touch the floor
+static void createBoxTowers(q3Scene &scene, uint32 numBoxes, std::vector<q3Body *> &bodies)
+{
+	static const float TowerSpacing = 3.0f;
+
+	q3Transform tx;
+	q3Identity(tx);
+
+	q3BodyDef floorDef;
+	q3Body *floor = scene.CreateBody(floorDef);
+	q3BoxDef floorBoxDef;
+	floorBoxDef.Set(tx, q3Vec3(1000.0f, 1.0f, 1000.0f));
+	floor->AddBox(floorBoxDef);
+
+	uint32 numTowers = (numBoxes + TowerHeight - 1) / TowerHeight;
+	uint32 gridSize = 1;
+	while (gridSize * gridSize < numTowers)
+		gridSize++;
+
+	// Small deterministic offsets so the stacks are not perfectly aligned
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+
+	bodies.clear();
+	for (uint32 i = 0; i < numBoxes; i++)
+	{
+		uint32 tower = i / TowerHeight;
+		q3BodyDef bodyDef;
+		bodyDef.bodyType = eDynamicBody;
+		bodyDef.position.Set((tower % gridSize) * TowerSpacing + jitter(rng), 1.0f + (i % TowerHeight) * 1.05f,
+			(tower / gridSize) * TowerSpacing + jitter(rng));
+		bodyDef.axis.Set(0.0f, 1.0f, 0.0f);
+		bodyDef.angle = jitter(rng);
+
+		q3Body *body = scene.CreateBody(bodyDef);
+		q3BoxDef boxDef;
+		boxDef.Set(tx, q3Vec3(1.0f, 1.0f, 1.0f));
+		body->AddBox(boxDef);
+		bodies.push_back(body);
+	}
+}
+
+// Milliseconds per step
+static double stepScene(q3Scene &scene, uint32 numSteps)
+{
+	Timer timer;
+	timer.Update();
+	for (uint32 i = 0; i < numSteps; i++)
+		scene.Step();
+	timer.Update();
+
+	return timer.DeltaMillisecondsD() / numSteps;
+}
+
+static bool bodiesMatch(const std::vector<q3Body *> &a, const std::vector<q3Body *> &b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		q3Transform txA = a[i]->GetTransform();
+		q3Transform txB = b[i]->GetTransform();
+		q3Vec3 velocitiesA[2] = { a[i]->GetLinearVelocity(), a[i]->GetAngularVelocity() };
+		q3Vec3 velocitiesB[2] = { b[i]->GetLinearVelocity(), b[i]->GetAngularVelocity() };
+
+		if (memcmp(&txA, &txB, sizeof(q3Transform)) != 0 || memcmp(velocitiesA, velocitiesB, sizeof(velocitiesA)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+void PhysicsBenchmark::RunNarrowPhaseBenchmark()
+{
+	static const uint32 NumWarmupSteps = 10;
+	static const uint32 NumTimedSteps = 20;
+	static const uint32 BoxCounts[] = { 1000, 5000, 20000 };
+
+	uint32 numThreads = Max(std::thread::hardware_concurrency(), 1u);
+
+	DebugPrint(L"Narrow phase benchmark, " + ToString(numThreads) + L" threads\n");
+
+	for (uint32 i = 0; i < ArraySize_(BoxCounts); i++)
+	{
+		std::unique_ptr<q3Scene> serialScene(new q3Scene(StepDt));
+		std::unique_ptr<q3Scene> parallelScene(new q3Scene(StepDt));
+		std::vector<q3Body *> serialBodies;
+		std::vector<q3Body *> parallelBodies;
+		createBoxTowers(*serialScene, BoxCounts[i], serialBodies);
+		createBoxTowers(*parallelScene, BoxCounts[i], parallelBodies);
+		parallelScene->SetThreadCount(numThreads);
+
+		stepScene(*serialScene, NumWarmupSteps);
+		stepScene(*parallelScene, NumWarmupSteps);
+		double serialMs = stepScene(*serialScene, NumTimedSteps);
+		double parallelMs = stepScene(*parallelScene, NumTimedSteps);
+
+		bool match = bodiesMatch(serialBodies, parallelBodies);
+
+		DebugPrint(ToString(BoxCounts[i]) + L" boxes: step " + ToString(serialMs) + L"ms serial, " + ToString(parallelMs)
+			+ L"ms parallel (" + ToString(serialMs / parallelMs) + L"x), results "
+			+ (match ? L"bit-identical\n" : L"DIFFER\n"));
+	}
+}
+
+void PhysicsBenchmark::RunIslandSolveBenchmark()
+{
+	static const uint32 NumBoxes = 5000;
+	static const uint32 NumWarmupSteps = 10;
+	static const uint32 NumTimedSteps = 20;
+
+	uint32 maxThreads = Max(std::thread::hardware_concurrency(), 1u);
+
+	DebugPrint(L"Island solve benchmark, " + ToString(NumBoxes) + L" boxes\n");
+
+	std::vector<uint32> threadCounts;
+	for (uint32 numThreads = 1; numThreads < maxThreads; numThreads *= 2)
+		threadCounts.push_back(numThreads);
+	threadCounts.push_back(maxThreads);
+
+	// The single threaded run stays alive as the reference for the others
+	std::unique_ptr<q3Scene> referenceScene;
+	std::vector<q3Body *> referenceBodies;
+	double referenceMs = 0.0;
+
+	for (uint32 i = 0; i < threadCounts.size(); i++)
+	{
+		uint32 numThreads = threadCounts[i];
+		std::unique_ptr<q3Scene> scene(new q3Scene(StepDt));
+		std::vector<q3Body *> bodies;
+		createBoxTowers(*scene, NumBoxes, bodies);
+		scene->SetThreadCount(numThreads);
+
+		stepScene(*scene, NumWarmupSteps);
+		double ms = stepScene(*scene, NumTimedSteps);
+
+		if (numThreads == 1)
+		{
+			referenceMs = ms;
+			referenceScene = std::move(scene);
+			referenceBodies = bodies;
+			DebugPrint(L"1 thread: step " + ToString(ms) + L"ms\n");
+			continue;
+		}
+
+		bool match = bodiesMatch(referenceBodies, bodies);
+
+		DebugPrint(ToString(numThreads) + L" threads: step " + ToString(ms) + L"ms (" + ToString(referenceMs / ms)
+			+ L"x), results " + (match ? L"bit-identical\n" : L"DIFFER\n"));
+	}
+}
+
+// Lowest top box of all towers, and how far any box moved sideways from where it started
+static void measureTowers(const std::vector<q3Body *> &bodies, const std::vector<q3Vec3> &startPositions,
+						  float &minTopHeight, float &maxDrift)
+{
+	minTopHeight = FLT_MAX;
+	maxDrift = 0.0f;
+
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		q3Vec3 position = bodies[i]->GetTransform().position;
+		float dx = position.x - startPositions[i].x;
+		float dz = position.z - startPositions[i].z;
+		maxDrift = Max(maxDrift, std::sqrt(dx * dx + dz * dz));
+
+		if (i % TowerHeight == TowerHeight - 1)
+			minTopHeight = Min(minTopHeight, position.y);
+	}
+}
+
+void PhysicsBenchmark::RunContactSolverBenchmark()
+{
+	static const uint32 NumWarmupSteps = 10;
+	static const uint32 NumTimedSteps = 20;
+	static const uint32 BoxCounts[] = { 1000, 5000, 20000 };
+	static const uint32 NumStabilityBoxes = 1000;
+	static const uint32 NumStabilitySteps = 300;
+
+	DebugPrint(L"Contact solver benchmark\n");
+
+	for (uint32 i = 0; i < ArraySize_(BoxCounts); i++)
+	{
+		std::unique_ptr<q3Scene> scalarScene(new q3Scene(StepDt));
+		std::unique_ptr<q3Scene> simdScene(new q3Scene(StepDt));
+		std::vector<q3Body *> scalarBodies;
+		std::vector<q3Body *> simdBodies;
+		createBoxTowers(*scalarScene, BoxCounts[i], scalarBodies);
+		createBoxTowers(*simdScene, BoxCounts[i], simdBodies);
+		simdScene->SetEnableSimdSolver(true);
+
+		stepScene(*scalarScene, NumWarmupSteps);
+		stepScene(*simdScene, NumWarmupSteps);
+		double scalarMs = stepScene(*scalarScene, NumTimedSteps);
+		double simdMs = stepScene(*simdScene, NumTimedSteps);
+
+		DebugPrint(ToString(BoxCounts[i]) + L" boxes: step " + ToString(scalarMs) + L"ms scalar, " + ToString(simdMs)
+			+ L"ms SSE (" + ToString(scalarMs / simdMs) + L"x)\n");
+	}
+
+	// The solvers visit constraints in a different order, so the runs are compared by how the
+	// towers hold up rather than bit for bit
+	for (uint32 simd = 0; simd < 2; simd++)
+	{
+		std::unique_ptr<q3Scene> scene(new q3Scene(StepDt));
+		std::vector<q3Body *> bodies;
+		createBoxTowers(*scene, NumStabilityBoxes, bodies);
+		scene->SetEnableSimdSolver(simd != 0);
+
+		std::vector<q3Vec3> startPositions;
+		for (size_t i = 0; i < bodies.size(); i++)
+			startPositions.push_back(bodies[i]->GetTransform().position);
+
+		stepScene(*scene, NumStabilitySteps);
+
+		float minTopHeight = 0.0f;
+		float maxDrift = 0.0f;
+		measureTowers(bodies, startPositions, minTopHeight, maxDrift);
+
+		uint32 numAwake = 0;
+		for (size_t i = 0; i < bodies.size(); i++)
+			numAwake += bodies[i]->IsAwake() ? 1 : 0;
+
+		DebugPrint((simd ? L"SSE" : L"Scalar") + std::wstring(L" after ") + ToString(NumStabilitySteps) + L" steps: lowest top box "
+			+ ToString(minTopHeight) + L", max drift " + ToString(maxDrift) + L", " + ToString(numAwake) + L" of "
+			+ ToString(NumStabilityBoxes) + L" boxes awake\n");
+	}
+}
+
+static q3Body *createLooseBox(q3Scene &scene, std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> area(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> height(2.0f, 20.0f);
+
+	q3BodyDef bodyDef;
+	bodyDef.bodyType = eDynamicBody;
+	bodyDef.position.Set(area(rng), height(rng), area(rng));
+
+	q3Transform tx;
+	q3Identity(tx);
+	q3BoxDef boxDef;
+	boxDef.Set(tx, q3Vec3(1.0f, 1.0f, 1.0f));
+
+	q3Body *body = scene.CreateBody(bodyDef);
+	body->AddBox(boxDef);
+
+	return body;
+}
+
+static std::wstring allocatorStatsString(const wchar *name, const q3AllocatorStats &stats)
+{
+	return std::wstring(name) + L": " + ToString(stats.liveCount) + L" live (" + ToString(stats.liveBytes / 1024)
+		+ L"KB), peak " + ToString(stats.peakCount) + L" (" + ToString(stats.peakBytes / 1024) + L"KB), "
+		+ ToString(stats.reservedBytes / 1024) + L"KB reserved, " + ToString(stats.Fragmentation() * 100.0f)
+		+ L"% unused\n";
+}
+
+void PhysicsBenchmark::RunAllocationBenchmark()
+{
+	static const uint32 NumBoxes = 5000;
+	static const uint32 NumSteps = 200;
+	static const uint32 NumChurnPerStep = 250;
+
+	DebugPrint(L"Allocation benchmark, " + ToString(NumBoxes) + L" boxes, " + ToString(NumChurnPerStep)
+		+ L" removed and created per step\n");
+
+	std::unique_ptr<q3Scene> scene(new q3Scene(StepDt));
+	std::mt19937 rng(7);
+
+	q3Transform tx;
+	q3Identity(tx);
+	q3BodyDef floorDef;
+	q3Body *floor = scene->CreateBody(floorDef);
+	q3BoxDef floorBoxDef;
+	floorBoxDef.Set(tx, q3Vec3(1000.0f, 1.0f, 1000.0f));
+	floor->AddBox(floorBoxDef);
+
+	std::vector<q3Body *> bodies;
+	for (uint32 i = 0; i < NumBoxes; i++)
+		bodies.push_back(createLooseBox(*scene, rng));
+
+	Timer timer;
+	double churnMs = 0.0;
+	double stepMs = 0.0;
+
+	for (uint32 step = 0; step < NumSteps; step++)
+	{
+		timer.Update();
+		for (uint32 i = 0; i < NumChurnPerStep; i++)
+		{
+			uint32 index = std::uniform_int_distribution<uint32>(0, uint32(bodies.size()) - 1)(rng);
+			scene->RemoveBody(bodies[index]);
+			bodies[index] = createLooseBox(*scene, rng);
+		}
+		timer.Update();
+		churnMs += timer.DeltaMillisecondsD();
+
+		stepMs += stepScene(*scene, 1);
+	}
+
+	double numChurned = double(NumSteps) * NumChurnPerStep;
+	DebugPrint(L"Remove and create: " + ToString(churnMs * 1000.0 / numChurned) + L"us per body, step "
+		+ ToString(stepMs / NumSteps) + L"ms\n");
+
+	q3AllocatorStats heapStats;
+	q3AllocatorStats contactStats;
+	q3AllocatorStats stackStats;
+	scene->GetMemoryStats(&heapStats, &contactStats, &stackStats);
+
+	DebugPrint(allocatorStatsString(L"Heap", heapStats));
+	DebugPrint(allocatorStatsString(L"Contacts", contactStats));
+	DebugPrint(allocatorStatsString(L"Stack", stackStats));
+}
+
+void PhysicsBenchmark::RunBroadPhaseBenchmark()
+{
+	static const uint32 NumWarmupSteps = 10;
+	static const uint32 NumTimedSteps = 30;
+	static const uint32 BoxCounts[] = { 5000, 20000 };
+	static const float BoxSpacing = 2.5f;
+
+	uint32 maxThreads = Max(std::thread::hardware_concurrency(), 1u);
+
+	DebugPrint(L"Broadphase benchmark\n");
+
+	std::vector<uint32> threadCounts(1, 1);
+	if (maxThreads > 1)
+		threadCounts.push_back(maxThreads);
+
+	for (uint32 i = 0; i < ArraySize_(BoxCounts); i++)
+	{
+		for (uint32 t = 0; t < threadCounts.size(); t++)
+		{
+			uint32 numThreads = threadCounts[t];
+			std::unique_ptr<q3Scene> scene(new q3Scene(StepDt));
+			scene->SetThreadCount(numThreads);
+
+			// Kinematic boxes never get contacts with each other, the narrow phase stays idle
+			std::mt19937 rng(11);
+			float extent = std::pow(float(BoxCounts[i]), 1.0f / 3.0f) * BoxSpacing * 0.5f;
+			std::uniform_real_distribution<float> position(-extent, extent);
+			std::uniform_real_distribution<float> velocity(-6.0f, 6.0f);
+
+			q3Transform tx;
+			q3Identity(tx);
+			q3BoxDef boxDef;
+			boxDef.Set(tx, q3Vec3(1.0f, 1.0f, 1.0f));
+
+			for (uint32 j = 0; j < BoxCounts[i]; j++)
+			{
+				q3BodyDef bodyDef;
+				bodyDef.bodyType = eKinematicBody;
+				bodyDef.position.Set(position(rng), position(rng), position(rng));
+				bodyDef.linearVelocity.Set(velocity(rng), velocity(rng), velocity(rng));
+				scene->CreateBody(bodyDef)->AddBox(boxDef);
+			}
+
+			stepScene(*scene, NumWarmupSteps);
+
+			double totalMs = 0.0;
+			uint64 numMoves = 0;
+			uint64 numQueryPairs = 0;
+			uint64 numPairs = 0;
+
+			for (uint32 step = 0; step < NumTimedSteps; step++)
+			{
+				totalMs += stepScene(*scene, 1);
+
+				q3BroadPhaseStats stats;
+				scene->GetBroadPhaseStats(&stats);
+				numMoves += stats.moveCount;
+				numQueryPairs += stats.queryPairCount;
+				numPairs += stats.pairCount;
+			}
+
+			DebugPrint(ToString(BoxCounts[i]) + L" boxes, " + ToString(numThreads) + L" threads: "
+				+ ToString(numMoves / NumTimedSteps) + L" moved, " + ToString(numPairs / NumTimedSteps)
+				+ L" pairs per step, step " + ToString(totalMs / NumTimedSteps) + L"ms, "
+				+ ToString(numQueryPairs / (totalMs / 1000.0) / 1000000.0) + L"M query pairs/s\n");
+		}
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "PCH.h"
+
+using namespace SampleFramework11;
+
+// Headless qu3e scenes for timing q3Scene::Step. The threading benchmarks step every scene
+// with different thread counts, and the bodies of all runs have to end up bit-identical.
+class PhysicsBenchmark
+{
+public:
+	// Towers of stacked boxes on a static floor, 1k, 5k and 20k boxes
+	static void RunNarrowPhaseBenchmark();
+
+	// 5k boxes in 500 separate towers, so 500 islands, stepped with 1, 2, 4... up to all
+	// hardware threads
+	static void RunIslandSolveBenchmark();
+
+	// Scalar against SSE contact solving for 1k, 5k and 20k boxes, then 1k boxes settled for
+	// five seconds with each to compare how well the towers stay stacked
+	static void RunContactSolverBenchmark();
+
+	// Keeps 5k boxes alive while removing and creating 250 random ones every step, times the
+	// churn and the steps and prints the qu3e allocator statistics
+	static void RunAllocationBenchmark();
+
+	// 5k and 20k kinematic boxes flying through each other, so every step is mostly
+	// broadphase work. Reports moved proxies and pairs per step and pairs per second, with one
+	// thread and with all hardware threads.
+	static void RunBroadPhaseBenchmark();
+};
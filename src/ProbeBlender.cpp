@@ -0,0 +1,153 @@
+#include "ProbeBlender.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+
+ProbeBlender::ProbeBlender() : _fadeFraction(0.0f)
+{
+}
+
+void ProbeBlender::Build(const Float3 *positions, const Float3 *boxSizes, uint32 numProbes, float fadeFraction)
+{
+	_fadeFraction = Saturate(fadeFraction);
+	_volumes.resize(numProbes);
+	_boxes.resize(numProbes);
+
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		// the box size sliders go negative, only the extent matters
+		Float3 halfExtent = Float3(std::abs(boxSizes[i].x), std::abs(boxSizes[i].y), std::abs(boxSizes[i].z));
+
+		_volumes[i].position = positions[i];
+		_volumes[i].boxSize = halfExtent;
+		_volumes[i].volume = halfExtent.x * halfExtent.y * halfExtent.z;
+
+		_boxes[i] = MakeBBox(positions[i] - halfExtent, positions[i] + halfExtent);
+	}
+
+	if (numProbes > 0)
+	{
+		_bvh.Build(&_boxes[0], numProbes);
+	}
+	else
+	{
+		_bvh.Clear();
+	}
+}
+
+void ProbeBlender::Clear()
+{
+	_volumes.clear();
+	_boxes.clear();
+	_bvh.Clear();
+}
+
+float ProbeBlender::ComputeInfluence(const Float3 &pos, const Float3 &probePos, const Float3 &boxSize, float fadeFraction)
+{
+	float influence = 1.0f;
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		float halfExtent = std::abs(boxSize[axis]);
+		float distance = std::abs(pos[axis] - probePos[axis]);
+		if (halfExtent <= 0.0f || distance > halfExtent) return 0.0f;
+
+		float fade = fadeFraction * halfExtent;
+		if (fade > 0.0f)
+		{
+			influence = Min(influence, Saturate((halfExtent - distance) / fade));
+		}
+	}
+	return influence;
+}
+
+void ProbeBlender::finishBlend(Candidate *best, uint32 numBest, const Float3 &pos, const ProbeKDTree &nearestProbes,
+	BlendResult &result) const
+{
+	float weightSum = 0.0f;
+	for (uint32 i = 0; i < numBest; i++)
+	{
+		weightSum += best[i].influence;
+	}
+
+	if (numBest == 0 || weightSum <= 0.0f)
+	{
+		// outside every box, fall back to the nearest probe
+		uint32 nearest = nearestProbes.FindNearest(pos);
+		result.count = nearest == ProbeKDTree::InvalidIndex ? 0 : 1;
+		result.probeIndices[0] = nearest;
+		result.weights[0] = 1.0f;
+		return;
+	}
+
+	result.count = numBest;
+	for (uint32 i = 0; i < numBest; i++)
+	{
+		result.probeIndices[i] = best[i].probeIndex;
+		result.weights[i] = best[i].influence / weightSum;
+	}
+}
+
+void ProbeBlender::computeBlend(const Float3 &pos, const ProbeKDTree &nearestProbes, std::vector<uint32> &candidates,
+	BlendResult &result) const
+{
+	BBox point;
+	point.Min = XMFLOAT3(pos.x, pos.y, pos.z);
+	point.Max = point.Min;
+
+	candidates.clear();
+	_bvh.QueryBox(point, candidates);
+
+	Candidate best[MaxBlendProbes];
+	uint32 numBest = 0;
+
+	for (size_t c = 0; c < candidates.size(); c++)
+	{
+		const ProbeVolume &volume = _volumes[candidates[c]];
+		Candidate candidate = { candidates[c], ComputeInfluence(pos, volume.position, volume.boxSize, _fadeFraction), volume.volume };
+		if (candidate.influence <= 0.0f) continue;
+		if (numBest == MaxBlendProbes && !isPreferred(candidate, best[numBest - 1])) continue;
+
+		uint32 slot = numBest < MaxBlendProbes ? numBest++ : numBest - 1;
+		while (slot > 0 && isPreferred(candidate, best[slot - 1]))
+		{
+			best[slot] = best[slot - 1];
+			slot--;
+		}
+		best[slot] = candidate;
+	}
+
+	finishBlend(best, numBest, pos, nearestProbes, result);
+}
+
+void ProbeBlender::ComputeBlend(const Float3 &pos, const ProbeKDTree &nearestProbes, BlendResult &result) const
+{
+	std::vector<uint32> candidates;
+	computeBlend(pos, nearestProbes, candidates, result);
+}
+
+void ProbeBlender::ComputeBlendBatch(const Float3 *positions, uint32 numPositions, const ProbeKDTree &nearestProbes,
+	BlendResult *results) const
+{
+	const uint32 numChunks = (numPositions + BatchChunkSize - 1) / BatchChunkSize;
+	auto blendChunk = [&](uint32 chunk)
+	{
+		std::vector<uint32> candidates;
+		uint32 end = Min(numPositions, (chunk + 1) * BatchChunkSize);
+		for (uint32 i = chunk * BatchChunkSize; i < end; i++)
+		{
+			computeBlend(positions[i], nearestProbes, candidates, results[i]);
+		}
+	};
+
+	if (numChunks > 4)
+	{
+		ParallelFor(0, numChunks, blendChunk);
+	}
+	else
+	{
+		for (uint32 chunk = 0; chunk < numChunks; chunk++)
+			blendChunk(chunk);
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "BVH.h"
+#include "ProbeKDTree.h"
+
+using namespace SampleFramework11;
+
+// Blend weights for box shaped probe influence volumes. A probe fully influences the points in
+// its box (position +- |BoxSize|) and fades to zero over a band at the box faces, the band being
+// fadeFraction of each half extent. A query returns up to MaxBlendProbes probes ordered by
+// influence, ties going to the smaller box and then the lower index, with weights normalized to
+// sum to one. Points outside every box get the nearest probe with weight one, like before.
+// Candidate boxes come from a BVH, so a query only touches the probes around the point.
+class ProbeBlender
+{
+public:
+	static const uint32 MaxBlendProbes = 4;
+
+	struct BlendResult
+	{
+		uint32 count;
+		uint32 probeIndices[MaxBlendProbes];
+		float weights[MaxBlendProbes];
+	};
+
+	ProbeBlender();
+
+	void Build(const Float3 *positions, const Float3 *boxSizes, uint32 numProbes, float fadeFraction);
+	void Clear();
+
+	// 1 inside the inner box, 0 outside the box, linear across the fade band
+	static float ComputeInfluence(const Float3 &pos, const Float3 &probePos, const Float3 &boxSize, float fadeFraction);
+
+	// nearestProbes is the kd-tree over the same probes, used when no box contains pos
+	void ComputeBlend(const Float3 &pos, const ProbeKDTree &nearestProbes, BlendResult &result) const;
+
+	// ComputeBlend for every position, large batches are split across threads
+	void ComputeBlendBatch(const Float3 *positions, uint32 numPositions, const ProbeKDTree &nearestProbes,
+		BlendResult *results) const;
+
+	inline float getFadeFraction() const { return _fadeFraction; }
+	inline uint32 getNumProbes() const { return (uint32)_volumes.size(); }
+
+private:
+	static const uint32 BatchChunkSize = 64;
+
+	struct ProbeVolume
+	{
+		Float3 position;
+		Float3 boxSize;
+		float volume;
+	};
+
+	struct Candidate
+	{
+		uint32 probeIndex;
+		float influence;
+		float volume;
+	};
+
+	static inline bool isPreferred(const Candidate &a, const Candidate &b)
+	{
+		if (a.influence != b.influence) return a.influence > b.influence;
+		if (a.volume != b.volume) return a.volume < b.volume;
+		return a.probeIndex < b.probeIndex;
+	}
+
+	void computeBlend(const Float3 &pos, const ProbeKDTree &nearestProbes, std::vector<uint32> &candidates,
+		BlendResult &result) const;
+	void finishBlend(Candidate *best, uint32 numBest, const Float3 &pos, const ProbeKDTree &nearestProbes,
+		BlendResult &result) const;
+
+	std::vector<ProbeVolume> _volumes;
+	std::vector<BBox> _boxes;
+	BVH _bvh;
+	float _fadeFraction;
+};
@@ -0,0 +1,271 @@
+#include "ProbeCache.h"
+#include "Scene.h"
+#include "IrradianceVolume.h"
+
+#include <Serialization.h>
+#include <Utility.h>
+
+static const std::wstring CacheDir = L"ProbeCache\\";
+static const uint32 CacheMagic = 0x43425250; // "PRBC"
+static const uint64 SectionAlignment = 16;
+
+static uint64 alignOffset(uint64 offset)
+{
+	return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+}
+
+ProbeCache::ProbeCache()
+{
+	memset(&_contents, 0, sizeof(_contents));
+}
+
+std::wstring ProbeCache::getCachePath(const Hash &key)
+{
+	return CacheDir + key.ToString() + L".probecache";
+}
+
+void ProbeCache::getSectionSizes(uint32 numProbes, uint32 cubemapSizeGBuffer, uint32 cubemapSizeTexcoord, bool compressedSH,
+	uint64 sizes[NumSections])
+{
+	const uint64 gbufferTexels = uint64(6 * cubemapSizeGBuffer) * numProbes * cubemapSizeGBuffer;
+	const uint64 texcoordTexels = uint64(6 * cubemapSizeTexcoord) * numProbes * cubemapSizeTexcoord;
+
+	sizes[PositionsSection] = sizeof(Float3) * numProbes;
+	sizes[AlbedoSection] = gbufferTexels * AlbedoTexelSize;
+	sizes[NormalSection] = gbufferTexels * NormalTexelSize;
+	sizes[TexcoordSection] = texcoordTexels * TexcoordTexelSize;
+	sizes[SHSection] = (compressedSH ? sizeof(CompressedSH9Color) : sizeof(PaddedSH9Color)) * numProbes;
+}
+
+Hash ProbeCache::ComputeKey(Scene *scene, float unitsBetweenProbes, bool adaptivePlacement, uint32 cubemapSizeGBuffer,
+	uint32 cubemapSizeTexcoord)
+{
+	// Hash every model once, then hash the list of (model hash, transform) with the settings
+	std::unordered_map<const Model *, Hash> modelHashes;
+	auto hashModel = [&](const Model *model) -> Hash
+	{
+		auto found = modelHashes.find(model);
+		if (found != modelHashes.end()) return found->second;
+
+		std::vector<Hash> meshHashes;
+		for (size_t i = 0; i < model->Meshes().size(); i++)
+		{
+			const Mesh &mesh = model->Meshes()[i];
+			Hash vertexHash = GenerateHash(mesh.Vertices(), int(mesh.NumVertices() * mesh.VertexStride()));
+			Hash indexHash = GenerateHash(mesh.Indices(), int(mesh.NumIndices() * mesh.IndexSize()));
+			meshHashes.push_back(vertexHash);
+			meshHashes.push_back(indexHash);
+
+			// part ranges and the material each one uses
+			const std::vector<MeshPart> &parts = mesh.MeshParts();
+			if (!parts.empty())
+				meshHashes.push_back(GenerateHash(&parts[0], int(sizeof(MeshPart) * parts.size())));
+		}
+
+		// The atlases bake the material constants and textures in. Textures are identified by
+		// their file names, the SRVs are different objects every run.
+		for (size_t i = 0; i < model->Materials().size(); i++)
+		{
+			const MeshMaterial &material = model->Materials()[i];
+			const float constants[] =
+			{
+				material.AmbientAlbedo.x, material.AmbientAlbedo.y, material.AmbientAlbedo.z,
+				material.DiffuseAlbedo.x, material.DiffuseAlbedo.y, material.DiffuseAlbedo.z,
+				material.SpecularAlbedo.x, material.SpecularAlbedo.y, material.SpecularAlbedo.z,
+				material.Emissive.x, material.Emissive.y, material.Emissive.z,
+				material.SpecularPower, material.Alpha,
+			};
+			meshHashes.push_back(GenerateHash(constants, int(sizeof(constants))));
+
+			const std::wstring *mapNames[] =
+			{
+				&material.DiffuseMapName, &material.NormalMapName, &material.RoughnessMapName,
+				&material.MetallicMapName, &material.EmissiveMapName,
+			};
+			for (uint32 m = 0; m < ArraySize_(mapNames); m++)
+			{
+				// empty names hash to a distinct value, so a map moving between slots changes the key
+				meshHashes.push_back(GenerateHash(mapNames[m]->c_str(), int(sizeof(wchar) * mapNames[m]->length()), m));
+			}
+		}
+
+		Hash hash = meshHashes.empty() ? Hash() : GenerateHash(&meshHashes[0], int(sizeof(Hash) * meshHashes.size()));
+		modelHashes[model] = hash;
+		return hash;
+	};
+
+	std::vector<uint8> keyData;
+	auto append = [&](const void *data, size_t size)
+	{
+		const uint8 *bytes = reinterpret_cast<const uint8 *>(data);
+		keyData.insert(keyData.end(), bytes, bytes + size);
+	};
+
+	append(&Version, sizeof(Version));
+	append(&unitsBetweenProbes, sizeof(unitsBetweenProbes));
+	uint32 placement = adaptivePlacement ? 1 : 0;
+	append(&placement, sizeof(placement));
+	append(&cubemapSizeGBuffer, sizeof(cubemapSizeGBuffer));
+	append(&cubemapSizeTexcoord, sizeof(cubemapSizeTexcoord));
+
+	BBox bbox = scene->getSceneBoundingBox();
+	append(&bbox.Min, sizeof(bbox.Min));
+	append(&bbox.Max, sizeof(bbox.Max));
+
+	SceneObject *staticObjects = scene->getStaticOpaqueObjectsPtr();
+	for (int i = 0; i < scene->getNumStaticOpaqueObjects(); i++)
+	{
+		Hash modelHash = hashModel(staticObjects[i].model);
+		append(&modelHash, sizeof(modelHash));
+		append(staticObjects[i].base, sizeof(Float4x4));
+	}
+
+	if (scene->hasProxySceneObject())
+	{
+		SceneObject *proxy = scene->getProxySceneObjectPtr();
+		Hash modelHash = hashModel(proxy->model);
+		append(&modelHash, sizeof(modelHash));
+		append(proxy->base, sizeof(Float4x4));
+	}
+
+	return GenerateHash(&keyData[0], int(keyData.size()));
+}
+
+bool ProbeCache::Load(const Hash &key)
+{
+	Unload();
+
+	if (!_file.Open(getCachePath(key).c_str())) return false;
+
+	MemoryReadSerializer serializer(_file.Data(), _file.Size());
+	Header header;
+	SerializeItem(serializer, header);
+
+	// the probe count also sizes the atlas textures and probe buffers, never trust more than they hold
+	bool valid = !serializer.Overrun() && header.magic == CacheMagic && header.version == Version
+		&& header.keyA == key.A && header.keyB == key.B && header.numProbes > 0
+		&& header.numProbes <= uint32(IrradianceVolume::MAX_PROBE_NUM);
+
+	// every section inside the file, the mapping is the only copy of the data
+	const void *sections[NumSections] = { nullptr };
+	if (valid)
+	{
+		uint64 sizes[NumSections];
+		getSectionSizes(header.numProbes, header.cubemapSizeGBuffer, header.cubemapSizeTexcoord, header.compressedSH != 0, sizes);
+		for (uint32 s = 0; s < NumSections && valid; s++)
+		{
+			serializer.Seek(header.sectionOffsets[s]);
+			sections[s] = serializer.SerializeInPlace(sizes[s]);
+			valid = sections[s] != nullptr;
+		}
+	}
+
+	if (!valid)
+	{
+		DebugPrint(L"Ignoring stale probe cache " + getCachePath(key) + L"\n");
+		Unload();
+		return false;
+	}
+
+	_contents.numProbes = header.numProbes;
+	_contents.cubemapSizeGBuffer = header.cubemapSizeGBuffer;
+	_contents.cubemapSizeTexcoord = header.cubemapSizeTexcoord;
+	_contents.probePositions = reinterpret_cast<const Float3 *>(sections[PositionsSection]);
+	_contents.albedoAtlas = reinterpret_cast<const uint8 *>(sections[AlbedoSection]);
+	_contents.normalAtlas = reinterpret_cast<const uint8 *>(sections[NormalSection]);
+	_contents.texcoordAtlas = reinterpret_cast<const uint8 *>(sections[TexcoordSection]);
+	if (header.compressedSH)
+		_contents.compressedSH = reinterpret_cast<const CompressedSH9Color *>(sections[SHSection]);
+	else
+		_contents.probeSH = reinterpret_cast<const PaddedSH9Color *>(sections[SHSection]);
+	return true;
+}
+
+void ProbeCache::Unload()
+{
+	_file.Close();
+	memset(&_contents, 0, sizeof(_contents));
+}
+
+bool ProbeCache::Save(const Hash &key, const Contents &contents, bool compressSH)
+{
+	Header header;
+	header.magic = CacheMagic;
+	header.version = Version;
+	header.keyA = key.A;
+	header.keyB = key.B;
+	header.numProbes = contents.numProbes;
+	header.cubemapSizeGBuffer = contents.cubemapSizeGBuffer;
+	header.cubemapSizeTexcoord = contents.cubemapSizeTexcoord;
+	header.compressedSH = compressSH ? 1 : 0;
+
+	uint64 sizes[NumSections];
+	getSectionSizes(contents.numProbes, contents.cubemapSizeGBuffer, contents.cubemapSizeTexcoord, compressSH, sizes);
+
+	std::vector<CompressedSH9Color> compressedSH;
+	if (compressSH)
+	{
+		compressedSH.resize(contents.numProbes);
+		SHProbeCompression::EncodeArray(contents.probeSH, contents.numProbes, &compressedSH[0]);
+	}
+
+	ComputeSizeSerializer headerSize;
+	SerializeItem(headerSize, header);
+
+	uint64 offset = headerSize.Size();
+	for (uint32 s = 0; s < NumSections; s++)
+	{
+		offset = alignOffset(offset);
+		header.sectionOffsets[s] = offset;
+		offset += sizes[s];
+	}
+
+	const void *sections[NumSections] =
+	{
+		contents.probePositions,
+		contents.albedoAtlas,
+		contents.normalAtlas,
+		contents.texcoordAtlas,
+		compressSH ? static_cast<const void *>(&compressedSH[0]) : contents.probeSH,
+	};
+
+	// The cache only saves time, so failing to write it is logged and otherwise ignored
+	if (DirectoryExists(CacheDir.c_str()) == false && CreateDirectory(CacheDir.c_str(), nullptr) == FALSE)
+	{
+		DebugPrint(L"Could not create " + CacheDir + L", " + GetWin32ErrorString(GetLastError()) + L"\n");
+		return false;
+	}
+
+	// written under a temporary name first, a crash mid-write never leaves a file that looks valid
+	std::wstring path = getCachePath(key);
+	std::wstring tempPath = path + L".tmp";
+	try
+	{
+		FileWriteSerializer serializer(tempPath.c_str());
+		SerializeItem(serializer, header);
+
+		static const uint8 padding[SectionAlignment] = { 0 };
+		offset = headerSize.Size();
+		for (uint32 s = 0; s < NumSections; s++)
+		{
+			serializer.SerializeData(header.sectionOffsets[s] - offset, padding);
+			serializer.SerializeData(sizes[s], sections[s]);
+			offset = header.sectionOffsets[s] + sizes[s];
+		}
+	}
+	catch (Exception &exception)
+	{
+		DebugPrint(L"Could not write " + tempPath + L", " + exception.GetMessage() + L"\n");
+		DeleteFile(tempPath.c_str());
+		return false;
+	}
+
+	if (MoveFileEx(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) == FALSE)
+	{
+		DebugPrint(L"Could not replace " + path + L", " + GetWin32ErrorString(GetLastError()) + L"\n");
+		DeleteFile(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
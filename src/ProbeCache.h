@@ -0,0 +1,105 @@
+#pragma once
+#include "PCH.h"
+
+#include <FileIO.h>
+#include <MurmurHash.h>
+
+#include "SHProbeCompression.h"
+
+using namespace SampleFramework11;
+
+class Scene;
+
+// Versioned on-disk cache of everything IrradianceVolume renders from static geometry: probe
+// positions, the albedo/normal/proxy texcoord atlases and the SH from the last bake. Files are
+// keyed by a hash of the static scene content, probe spacing and cubemap sizes, so any change to
+// those simply misses. Load() memory maps the file and getContents() points straight into it;
+// the atlases can be uploaded from there without another copy and the atlas passes skipped.
+// The SH section is either float or compressed SH, the header records which.
+class ProbeCache
+{
+public:
+	// Bump whenever the layout or anything baked into the atlases changes
+	static const uint32 Version = 3;
+
+	// Atlas rows are tightly packed, 6 faces wide and one face high per probe
+	struct Contents
+	{
+		uint32 numProbes;
+		uint32 cubemapSizeGBuffer;
+		uint32 cubemapSizeTexcoord;
+
+		const Float3 *probePositions;
+		const uint8 *albedoAtlas;           // R8G8B8A8_UNORM
+		const uint8 *normalAtlas;           // R16G16_FLOAT
+		const uint8 *texcoordAtlas;         // R8G8B8A8_UNORM
+		const PaddedSH9Color *probeSH;          // exactly one of these is set after Load()
+		const CompressedSH9Color *compressedSH;
+	};
+
+	static const uint32 AlbedoTexelSize = 4;
+	static const uint32 NormalTexelSize = 4;
+	static const uint32 TexcoordTexelSize = 4;
+
+	ProbeCache();
+
+	// Static opaque objects and the proxy mesh: model geometry, materials, texture names and
+	// transforms, plus the scene bounds
+	static Hash ComputeKey(Scene *scene, float unitsBetweenProbes, bool adaptivePlacement, uint32 cubemapSizeGBuffer,
+		uint32 cubemapSizeTexcoord);
+
+	// False if there is no valid file for the key. The previous file is unmapped either way.
+	bool Load(const Hash &key);
+	void Unload();
+
+	// Writes probeSH, encoded as CompressedSH9Color if compressSH is set. Write failures are logged
+	// and return false, the next run then just misses the cache.
+	static bool Save(const Hash &key, const Contents &contents, bool compressSH);
+
+	inline bool isLoaded() const { return _file.IsOpen(); }
+	inline const Contents &getContents() const { return _contents; }
+
+private:
+	enum Section
+	{
+		PositionsSection = 0,
+		AlbedoSection,
+		NormalSection,
+		TexcoordSection,
+		SHSection,
+		NumSections
+	};
+
+	struct Header
+	{
+		uint32 magic;
+		uint32 version;
+		uint64 keyA;
+		uint64 keyB;
+		uint32 numProbes;
+		uint32 cubemapSizeGBuffer;
+		uint32 cubemapSizeTexcoord;
+		uint32 compressedSH;
+		uint64 sectionOffsets[NumSections];
+
+		template<typename TSerializer> void Serialize(TSerializer &serializer)
+		{
+			SerializeItem(serializer, magic);
+			SerializeItem(serializer, version);
+			SerializeItem(serializer, keyA);
+			SerializeItem(serializer, keyB);
+			SerializeItem(serializer, numProbes);
+			SerializeItem(serializer, cubemapSizeGBuffer);
+			SerializeItem(serializer, cubemapSizeTexcoord);
+			SerializeItem(serializer, compressedSH);
+			SerializeArray(serializer, sectionOffsets, NumSections);
+		}
+	};
+
+	static std::wstring getCachePath(const Hash &key);
+	static void getSectionSizes(uint32 numProbes, uint32 cubemapSizeGBuffer, uint32 cubemapSizeTexcoord, bool compressedSH,
+		uint64 sizes[NumSections]);
+
+	MappedFile _file;
+	Contents _contents;
+};
@@ -0,0 +1,239 @@
+#include "ProbeKDTree.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+static inline float distanceSq(const Float3 &a, const Float3 &b)
+{
+	float x = a.x - b.x;
+	float y = a.y - b.y;
+	float z = a.z - b.z;
+	return x * x + y * y + z * z;
+}
+
+ProbeKDTree::ProbeKDTree()
+{
+}
+
+void ProbeKDTree::Build(const Float3 *positions, uint32 numPoints)
+{
+	_points.resize(numPoints);
+	_splitAxes.assign(numPoints, 0);
+	for (uint32 i = 0; i < numPoints; i++)
+	{
+		_points[i].pos = positions[i];
+		_points[i].index = i;
+	}
+
+	buildRange(0, numPoints);
+}
+
+void ProbeKDTree::Clear()
+{
+	_points.clear();
+	_splitAxes.clear();
+}
+
+void ProbeKDTree::buildRange(uint32 begin, uint32 end)
+{
+	if (end - begin <= MaxLeafSize) return;
+
+	// split the widest axis at the median
+	Float3 minPos = _points[begin].pos;
+	Float3 maxPos = _points[begin].pos;
+	for (uint32 i = begin + 1; i < end; i++)
+	{
+		const Float3 &p = _points[i].pos;
+		minPos = Float3(Min(minPos.x, p.x), Min(minPos.y, p.y), Min(minPos.z, p.z));
+		maxPos = Float3(Max(maxPos.x, p.x), Max(maxPos.y, p.y), Max(maxPos.z, p.z));
+	}
+
+	Float3 extent = maxPos - minPos;
+	uint32 axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	uint32 mid = (begin + end) / 2;
+	std::nth_element(_points.begin() + begin, _points.begin() + mid, _points.begin() + end,
+		[axis](const Point &a, const Point &b) { return a.pos[axis] < b.pos[axis]; });
+	_splitAxes[mid] = (uint8)axis;
+
+	buildRange(begin, mid);
+	buildRange(mid + 1, end);
+}
+
+uint32 ProbeKDTree::FindNearest(const Float3 &pos) const
+{
+	uint32 bestIndex = InvalidIndex;
+	float bestDistanceSq = FLT_MAX;
+	if (!_points.empty())
+	{
+		nearestRange(pos, 0, (uint32)_points.size(), bestIndex, bestDistanceSq);
+	}
+	return bestIndex;
+}
+
+void ProbeKDTree::nearestRange(const Float3 &pos, uint32 begin, uint32 end, uint32 &bestIndex, float &bestDistanceSq) const
+{
+	if (end - begin <= MaxLeafSize)
+	{
+		for (uint32 i = begin; i < end; i++)
+		{
+			float d = distanceSq(pos, _points[i].pos);
+			if (isCloser(d, _points[i].index, bestDistanceSq, bestIndex))
+			{
+				bestDistanceSq = d;
+				bestIndex = _points[i].index;
+			}
+		}
+		return;
+	}
+
+	uint32 mid = (begin + end) / 2;
+	const Point &split = _points[mid];
+	float d = distanceSq(pos, split.pos);
+	if (isCloser(d, split.index, bestDistanceSq, bestIndex))
+	{
+		bestDistanceSq = d;
+		bestIndex = split.index;
+	}
+
+	// near side first, the far side only if the splitting plane is close enough (ties included)
+	float planeDist = pos[_splitAxes[mid]] - split.pos[_splitAxes[mid]];
+	if (planeDist < 0.0f)
+	{
+		nearestRange(pos, begin, mid, bestIndex, bestDistanceSq);
+		if (planeDist * planeDist <= bestDistanceSq)
+			nearestRange(pos, mid + 1, end, bestIndex, bestDistanceSq);
+	}
+	else
+	{
+		nearestRange(pos, mid + 1, end, bestIndex, bestDistanceSq);
+		if (planeDist * planeDist <= bestDistanceSq)
+			nearestRange(pos, begin, mid, bestIndex, bestDistanceSq);
+	}
+}
+
+void ProbeKDTree::KNearest::insert(uint32 index, float distanceSq)
+{
+	if (count == k && !isCloser(distanceSq, index, distancesSq[count - 1], indices[count - 1]))
+		return;
+
+	// insertion into the sorted list, dropping the farthest when full
+	uint32 slot = count < k ? count++ : count - 1;
+	while (slot > 0 && isCloser(distanceSq, index, distancesSq[slot - 1], indices[slot - 1]))
+	{
+		distancesSq[slot] = distancesSq[slot - 1];
+		indices[slot] = indices[slot - 1];
+		slot--;
+	}
+	distancesSq[slot] = distanceSq;
+	indices[slot] = index;
+}
+
+uint32 ProbeKDTree::FindKNearest(const Float3 &pos, uint32 k, uint32 *indices, float *distancesSq) const
+{
+	Assert_(k <= MaxKNearest);
+
+	KNearest result;
+	result.k = Min(k, (uint32)_points.size());
+	result.count = 0;
+	if (result.k > 0)
+	{
+		kNearestRange(pos, 0, (uint32)_points.size(), result);
+	}
+
+	for (uint32 i = 0; i < result.count; i++)
+	{
+		indices[i] = result.indices[i];
+		if (distancesSq != nullptr)
+			distancesSq[i] = result.distancesSq[i];
+	}
+	return result.count;
+}
+
+void ProbeKDTree::kNearestRange(const Float3 &pos, uint32 begin, uint32 end, KNearest &result) const
+{
+	if (end - begin <= MaxLeafSize)
+	{
+		for (uint32 i = begin; i < end; i++)
+		{
+			result.insert(_points[i].index, distanceSq(pos, _points[i].pos));
+		}
+		return;
+	}
+
+	uint32 mid = (begin + end) / 2;
+	const Point &split = _points[mid];
+	result.insert(split.index, distanceSq(pos, split.pos));
+
+	float planeDist = pos[_splitAxes[mid]] - split.pos[_splitAxes[mid]];
+	if (planeDist < 0.0f)
+	{
+		kNearestRange(pos, begin, mid, result);
+		if (planeDist * planeDist <= result.bound())
+			kNearestRange(pos, mid + 1, end, result);
+	}
+	else
+	{
+		kNearestRange(pos, mid + 1, end, result);
+		if (planeDist * planeDist <= result.bound())
+			kNearestRange(pos, begin, mid, result);
+	}
+}
+
+void ProbeKDTree::FindInRadius(const Float3 &pos, float radius, std::vector<uint32> &result) const
+{
+	if (!_points.empty())
+	{
+		radiusRange(pos, radius * radius, 0, (uint32)_points.size(), result);
+	}
+}
+
+void ProbeKDTree::radiusRange(const Float3 &pos, float radiusSq, uint32 begin, uint32 end, std::vector<uint32> &result) const
+{
+	if (end - begin <= MaxLeafSize)
+	{
+		for (uint32 i = begin; i < end; i++)
+		{
+			if (distanceSq(pos, _points[i].pos) <= radiusSq)
+				result.push_back(_points[i].index);
+		}
+		return;
+	}
+
+	uint32 mid = (begin + end) / 2;
+	const Point &split = _points[mid];
+	if (distanceSq(pos, split.pos) <= radiusSq)
+		result.push_back(split.index);
+
+	float planeDist = pos[_splitAxes[mid]] - split.pos[_splitAxes[mid]];
+	if (planeDist <= 0.0f || planeDist * planeDist <= radiusSq)
+		radiusRange(pos, radiusSq, begin, mid, result);
+	if (planeDist >= 0.0f || planeDist * planeDist <= radiusSq)
+		radiusRange(pos, radiusSq, mid + 1, end, result);
+}
+
+void ProbeKDTree::FindNearestBatch(const Float3 *positions, uint32 numPositions, uint32 *indices) const
+{
+	const uint32 numChunks = (numPositions + BatchChunkSize - 1) / BatchChunkSize;
+	auto findChunk = [&](uint32 chunk)
+	{
+		uint32 end = Min(numPositions, (chunk + 1) * BatchChunkSize);
+		for (uint32 i = chunk * BatchChunkSize; i < end; i++)
+		{
+			indices[i] = FindNearest(positions[i]);
+		}
+	};
+
+	if (numChunks > 4)
+	{
+		ParallelFor(0, numChunks, findChunk);
+	}
+	else
+	{
+		for (uint32 chunk = 0; chunk < numChunks; chunk++)
+			findChunk(chunk);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <cfloat>
+#include "CPUMath.h"
+
+using namespace SampleFramework11;
+
+// Kd-tree over probe positions for nearest, k-nearest and radius queries.
+// The tree is implicit: Build() reorders a packed copy of the points so the median of every
+// range is its split point, and only the split axis is stored next to it. Ranges of up to
+// MaxLeafSize points are scanned linearly. Distance ties go to the higher probe index, which is
+// what the old linear search in ProbeManager returned.
+class ProbeKDTree
+{
+public:
+	static const uint32 InvalidIndex = uint32(-1);
+	static const uint32 MaxKNearest = 32;
+
+	ProbeKDTree();
+
+	void Build(const Float3 *positions, uint32 numPoints);
+	void Clear();
+
+	// InvalidIndex when the tree is empty
+	uint32 FindNearest(const Float3 &pos) const;
+
+	// Writes up to k (<= MaxKNearest) indices nearest first, returns how many were written
+	uint32 FindKNearest(const Float3 &pos, uint32 k, uint32 *indices, float *distancesSq = nullptr) const;
+
+	// Appends the points within radius of pos, in no particular order
+	void FindInRadius(const Float3 &pos, float radius, std::vector<uint32> &result) const;
+
+	// FindNearest for every position, large batches are split across threads
+	void FindNearestBatch(const Float3 *positions, uint32 numPositions, uint32 *indices) const;
+
+	inline bool isEmpty() const { return _points.empty(); }
+	inline uint32 getNumPoints() const { return (uint32)_points.size(); }
+
+private:
+	static const uint32 MaxLeafSize = 8;
+	static const uint32 BatchChunkSize = 64;
+
+	struct Point
+	{
+		Float3 pos;
+		uint32 index;
+	};
+
+	struct KNearest
+	{
+		uint32 k;
+		uint32 count;
+		uint32 indices[MaxKNearest];
+		float distancesSq[MaxKNearest];
+
+		inline float bound() const { return count < k ? FLT_MAX : distancesSq[count - 1]; }
+		void insert(uint32 index, float distanceSq);
+	};
+
+	static inline bool isCloser(float distanceSq, uint32 index, float bestDistanceSq, uint32 bestIndex)
+	{
+		return distanceSq < bestDistanceSq || (distanceSq == bestDistanceSq && index > bestIndex);
+	}
+
+	void buildRange(uint32 begin, uint32 end);
+	void nearestRange(const Float3 &pos, uint32 begin, uint32 end, uint32 &bestIndex, float &bestDistanceSq) const;
+	void kNearestRange(const Float3 &pos, uint32 begin, uint32 end, KNearest &result) const;
+	void radiusRange(const Float3 &pos, float radiusSq, uint32 begin, uint32 end, std::vector<uint32> &result) const;
+
+	std::vector<Point> _points;
+	std::vector<uint8> _splitAxes; // per point, the axis its range was split on
+};
@@ -42,9 +42,37 @@ void ProbeManager::AddProbe(const Float3 &pos, const Float3 &boxSize)
 	newProbe.BoxSize = boxSize;
 	_probes.push_back(newProbe);
 
+	_probePositions.push_back(pos);
+	_probeBoxSizes.push_back(boxSize);
+	_probeTreeDirty = true;
+	_probeBlenderDirty = true;
+
 	_probeNum++;
 }
 
+void ProbeManager::UpdateProbe(uint32 index, const Float3 &pos, const Float3 &boxSize)
+{
+	Assert_(index < _cubemaps.size());
+
+	_cubemaps[index].SetPosition(pos);
+	_cubemaps[index].SetBoxSize(boxSize);
+	_probes[index].pos = pos;
+	_probes[index].BoxSize = boxSize;
+
+	if (_probePositions[index] != pos)
+	{
+		_probePositions[index] = pos;
+		_probeTreeDirty = true;
+		_probeBlenderDirty = true;
+	}
+
+	if (_probeBoxSizes[index] != boxSize)
+	{
+		_probeBoxSizes[index] = boxSize;
+		_probeBlenderDirty = true;
+	}
+}
+
 uint32 ProbeManager::GetProbeNums()
 {
 	return _probeNum;
@@ -73,50 +101,55 @@ int ProbeManager::GetNNProbe(CreateCubemap **nearCubemap, const Float3 &objPos)
 	return NNIndex;
 }
 
+void ProbeManager::GetNNProbes(const Float3 *objPositions, uint32 numPositions, uint32 *probeIndices)
+{
+	getProbeTree().FindNearestBatch(objPositions, numPositions, probeIndices);
+}
 
-//void ProbeManager::GetBlendProbes(std::vector<CreateCubemap> &blendCubemaps, Float3 objPos)
-//{
-//	uint32 firstIndex, secondIndex;
-//	CalTwoNN(objPos, firstIndex, secondIndex);
-//
-//	blendCubemaps.push_back(_cubemaps.at(firstIndex));
-//	if (secondIndex == std::numeric_limits<uint32>::max())
-//		blendCubemaps.push_back(_cubemaps.at(firstIndex));
-//	else
-//		blendCubemaps.push_back(_cubemaps.at(secondIndex));
-//}
-
-RenderTarget2D &ProbeManager::GetProbeArray()
+uint32 ProbeManager::GetKNNProbes(const Float3 &objPos, uint32 k, uint32 *probeIndices, float *distancesSq)
 {
-	return _cubemapArray;
+	return getProbeTree().FindKNearest(objPos, k, probeIndices, distancesSq);
 }
 
-float ProbeManager::CalDistance(const Float3 &probePos, const Float3 &objPos)
+void ProbeManager::GetProbesInRadius(const Float3 &pos, float radius, std::vector<uint32> &probeIndices)
 {
-	float x = probePos[0] - objPos[0];
-	float y = probePos[1] - objPos[1];
-	float z = probePos[2] - objPos[2];
+	getProbeTree().FindInRadius(pos, radius, probeIndices);
+}
 
-	return sqrt(x * x + y * y + z * z);
+
+void ProbeManager::GetBlendProbes(const Float3 *objPositions, uint32 numPositions, ProbeBlender::BlendResult *blends)
+{
+	getProbeBlender().ComputeBlendBatch(objPositions, numPositions, getProbeTree(), blends);
 }
 
+RenderTarget2D &ProbeManager::GetProbeArray()
+{
+	return _cubemapArray;
+}
 
-uint32 ProbeManager::CalNN(const Float3 &objPos)
+const ProbeKDTree &ProbeManager::getProbeTree()
 {
-	float minDis = FLT_MAX;
-	uint32 maxIndex = -1;
+	if (_probeTreeDirty)
+	{
+		_probeTree.Build(_probePositions.data(), (uint32)_probePositions.size());
+		_probeTreeDirty = false;
+	}
+	return _probeTree;
+}
 
-	for (uint32 probeIndex = 0; probeIndex < _cubemaps.size(); ++probeIndex)
+const ProbeBlender &ProbeManager::getProbeBlender()
+{
+	if (_probeBlenderDirty || _probeBlender.getFadeFraction() != Saturate(AppSettings::ProbeFadeBand.Value()))
 	{
-		float distance = CalDistance(_cubemaps.at(probeIndex).GetPosition(), objPos);
-		if (minDis >= distance)
-		{
-			maxIndex = probeIndex;
-			minDis = distance;
-		}
+		_probeBlender.Build(_probePositions.data(), _probeBoxSizes.data(), (uint32)_probePositions.size(), AppSettings::ProbeFadeBand);
+		_probeBlenderDirty = false;
 	}
+	return _probeBlender;
+}
 
-	return maxIndex;
+uint32 ProbeManager::CalNN(const Float3 &objPos)
+{
+	return getProbeTree().FindNearest(objPos);
 }
 
 
@@ -124,27 +157,9 @@ void ProbeManager::CalTwoNN(const Float3 &objPos, uint32 &first, uint32 &second)
 {
 	if (_cubemaps.size() == 0) return;
 
-	float minDis[2] = { FLT_MAX, FLT_MAX };
-	uint32 firstIndex = -1, secondIndex = -1;
-
-	for (uint32 probeIndex = 0; probeIndex < _cubemaps.size(); ++probeIndex)
-	{
-		float distance = CalDistance(_cubemaps.at(probeIndex).GetPosition(), objPos);
-		
-		if (distance < minDis[0])
-		{
-			minDis[1] = minDis[0];
-			minDis[0] = distance;
-			secondIndex = firstIndex;
-			firstIndex = probeIndex;
-		}
-		else if (distance <= minDis[1])
-		{
-			minDis[1] = distance;
-			secondIndex = probeIndex;
-		}
-	}
+	uint32 nearest[2];
+	uint32 found = getProbeTree().FindKNearest(objPos, 2, nearest);
 
-	first = firstIndex;
-	second = secondIndex;
+	first = nearest[0];
+	second = found > 1 ? nearest[1] : ProbeKDTree::InvalidIndex;
 }
@@ -7,6 +7,8 @@ Manage the probes created by Cubemap(header)
 #pragma once
 
 #include "CreateCubemap.h"
+#include "ProbeKDTree.h"
+#include "ProbeBlender.h"
 
 class ProbeManager
 {
@@ -16,11 +18,20 @@ public:
 	void Initialize(ID3D11Device *device, ID3D11DeviceContext *context);
 
 	void AddProbe(const Float3 &pos, const Float3 &boxSize);
+	void UpdateProbe(uint32 index, const Float3 &pos, const Float3 &boxSize);
 	uint32 GetProbeNums();
 	void GetProbe(CreateCubemap **cubemap, uint32 index);
 	int GetNNProbe(CreateCubemap **nearCubemap, const Float3 &objPos);
+
+	// Nearest probe for every position in one call, ProbeKDTree::InvalidIndex when there are no probes
+	void GetNNProbes(const Float3 *objPositions, uint32 numPositions, uint32 *probeIndices);
+	uint32 GetKNNProbes(const Float3 &objPos, uint32 k, uint32 *probeIndices, float *distancesSq = nullptr);
+	void GetProbesInRadius(const Float3 &pos, float radius, std::vector<uint32> &probeIndices);
 	RenderTarget2D &GetProbeArray();
-	// void GetBlendProbes(std::vector<CreateCubemap> &blendCubemaps, Float3 objPos);
+
+	// Up to ProbeBlender::MaxBlendProbes probes and normalized weights for every position, from the
+	// probe influence boxes with AppSettings::ProbeFadeBand
+	void GetBlendProbes(const Float3 *objPositions, uint32 numPositions, ProbeBlender::BlendResult *blends);
 
 	struct Probe
 	{
@@ -30,11 +41,19 @@ public:
 
 	std::vector<Probe> _probes;
 private:
-	float CalDistance(const Float3 &probePos, const Float3 &objPos); //Calculate distance between object and a single probe.
 	uint32 CalNN(const Float3 &objPos);
 	void CalTwoNN(const Float3 &objPos, uint32 &first, uint32 &second);
+	const ProbeKDTree &getProbeTree();
+	const ProbeBlender &getProbeBlender();
 
+	// Packed probe positions, the kd-tree is rebuilt from them when probes are added or moved
 	std::vector<Float3> _probePositions;
+	ProbeKDTree _probeTree;
+	bool _probeTreeDirty = true;
+
+	std::vector<Float3> _probeBoxSizes;
+	ProbeBlender _probeBlender;
+	bool _probeBlenderDirty = true;
 
 	RenderTarget2D _cubemapArray;
 	ID3D11ShaderResourceViewPtr _cubemapArrRSV;
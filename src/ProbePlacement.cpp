@@ -0,0 +1,415 @@
+#include "ProbePlacement.h"
+#include "BVH.h"
+#include "ProbeKDTree.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static const uint32 MaxOctreeDepth = 20; // lattice coordinates are packed in 21 bits per axis
+static const uint32 InsideTestChunkSize = 64;
+
+ProbePlacement::Settings::Settings()
+	: unitsBetweenProbes(1.0f), maxEmptySpacing(8.0f), maxProbes(512), numInsideRays(16), insideThreshold(0.25f)
+{
+}
+
+// Separating axis test of a triangle against a box, Akenine-Moller
+static bool triangleOverlapsBox(const Float3 &center, const Float3 &halfSize, const Float3 &a, const Float3 &b, const Float3 &c)
+{
+	static const Float3 BoxAxes[3] = { Float3(1.0f, 0.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f), Float3(0.0f, 0.0f, 1.0f) };
+
+	const Float3 v[3] = { a - center, b - center, c - center };
+
+	// box faces
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		float minV = Min(v[0][axis], Min(v[1][axis], v[2][axis]));
+		float maxV = Max(v[0][axis], Max(v[1][axis], v[2][axis]));
+		if (minV > halfSize[axis] || maxV < -halfSize[axis]) return false;
+	}
+
+	// triangle plane
+	const Float3 edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+	Float3 normal = Float3::Cross(edges[0], edges[1]);
+	float planeDist = Float3::Dot(normal, v[0]);
+	float planeRadius = halfSize.x * std::abs(normal.x) + halfSize.y * std::abs(normal.y) + halfSize.z * std::abs(normal.z);
+	if (std::abs(planeDist) > planeRadius) return false;
+
+	// edge x box axis
+	for (uint32 e = 0; e < 3; e++)
+	{
+		for (uint32 axis = 0; axis < 3; axis++)
+		{
+			Float3 sepAxis = Float3::Cross(BoxAxes[axis], edges[e]);
+			float p0 = Float3::Dot(v[0], sepAxis);
+			float p1 = Float3::Dot(v[1], sepAxis);
+			float p2 = Float3::Dot(v[2], sepAxis);
+			float radius = halfSize.x * std::abs(sepAxis.x) + halfSize.y * std::abs(sepAxis.y) + halfSize.z * std::abs(sepAxis.z);
+			if (Min(p0, Min(p1, p2)) > radius || Max(p0, Max(p1, p2)) < -radius) return false;
+		}
+	}
+
+	return true;
+}
+
+// Moller-Trumbore, returns the hit distance or a negative value
+static float intersectTriangle(const Float3 &origin, const Float3 &dir, const Float3 &a, const Float3 &b, const Float3 &c)
+{
+	const Float3 e1 = b - a;
+	const Float3 e2 = c - a;
+	const Float3 p = Float3::Cross(dir, e2);
+	const float det = Float3::Dot(e1, p);
+	if (std::abs(det) < 1e-12f) return -1.0f;
+
+	const float invDet = 1.0f / det;
+	const Float3 s = origin - a;
+	const float u = Float3::Dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f) return -1.0f;
+
+	const Float3 q = Float3::Cross(s, e1);
+	const float v = Float3::Dot(dir, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f) return -1.0f;
+
+	return Float3::Dot(e2, q) * invDet;
+}
+
+static inline uint64 packLattice(uint32 x, uint32 y, uint32 z)
+{
+	return (uint64(z) << 42) | (uint64(y) << 21) | uint64(x);
+}
+
+static inline bool insideBounds(const Float3 &pos, const BBox &bounds)
+{
+	return pos.x > bounds.Min.x && pos.y > bounds.Min.y && pos.z > bounds.Min.z
+		&& pos.x < bounds.Max.x && pos.y < bounds.Max.y && pos.z < bounds.Max.z;
+}
+
+struct OctreeBuilder
+{
+	const Float3 *vertices;
+	const uint32 *indices;
+	BBox bounds;
+	Float3 rootMin;
+	float finestCell;
+	float margin;
+	uint32 maxDepth;
+	uint32 minLeafDepth;
+
+	std::vector<uint64> corners;
+	uint32 numLeaves;
+
+	// node (x, y, z) at depth covers [x, x + 1) * size of that depth
+	void build(uint32 depth, uint32 x, uint32 y, uint32 z, const std::vector<uint32> &triangles)
+	{
+		const uint32 shift = maxDepth - depth;
+		const float size = finestCell * float(1u << shift);
+		const Float3 nodeMin = rootMin + Float3(float(x), float(y), float(z)) * size;
+		const Float3 nodeMax = nodeMin + Float3(size, size, size);
+
+		if (nodeMin.x >= bounds.Max.x || nodeMin.y >= bounds.Max.y || nodeMin.z >= bounds.Max.z
+			|| nodeMax.x <= bounds.Min.x || nodeMax.y <= bounds.Min.y || nodeMax.z <= bounds.Min.z)
+			return;
+
+		const Float3 center = (nodeMin + nodeMax) * 0.5f;
+		const float halfSize = size * 0.5f + margin;
+		const Float3 halfSizes(halfSize, halfSize, halfSize);
+
+		std::vector<uint32> touching;
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const uint32 *tri = &indices[triangles[i] * 3];
+			if (triangleOverlapsBox(center, halfSizes, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]))
+				touching.push_back(triangles[i]);
+		}
+
+		if (depth < minLeafDepth || (depth < maxDepth && !touching.empty()))
+		{
+			for (uint32 child = 0; child < 8; child++)
+			{
+				build(depth + 1, x * 2 + (child & 1), y * 2 + ((child >> 1) & 1), z * 2 + (child >> 2), touching);
+			}
+			return;
+		}
+
+		numLeaves++;
+		for (uint32 corner = 0; corner < 8; corner++)
+		{
+			uint32 cx = (x + (corner & 1)) << shift;
+			uint32 cy = (y + ((corner >> 1) & 1)) << shift;
+			uint32 cz = (z + (corner >> 2)) << shift;
+			if (insideBounds(rootMin + Float3(float(cx), float(cy), float(cz)) * finestCell, bounds))
+				corners.push_back(packLattice(cx, cy, cz));
+		}
+	}
+};
+
+void ProbePlacement::PlaceGrid(const BBox &bounds, float unitsBetweenProbes, std::vector<Float3> &positions)
+{
+	Float3 diff = Float3(bounds.Max) - Float3(bounds.Min);
+	Float3 numProbesAxis = diff * (float)(1.0 / unitsBetweenProbes);
+
+	uint32 numProbesX = Max((uint32)floorf(numProbesAxis.x), (uint32)2);
+	uint32 numProbesY = Max((uint32)floorf(numProbesAxis.y), (uint32)2);
+	uint32 numProbesZ = Max((uint32)floorf(numProbesAxis.z), (uint32)2);
+
+	// n probes per axis split it into n + 1 equal parts, none on the boundary
+	float calcUnitDistX = diff.x / (numProbesX + 1);
+	float calcUnitDistY = diff.y / (numProbesY + 1);
+	float calcUnitDistZ = diff.z / (numProbesZ + 1);
+
+	positions.resize(numProbesX * numProbesY * numProbesZ);
+	for (uint32 z = 0; z < numProbesZ; z++)
+	{
+		for (uint32 y = 0; y < numProbesY; y++)
+		{
+			for (uint32 x = 0; x < numProbesX; x++)
+			{
+				uint32 index = z * numProbesY * numProbesX + y * numProbesX + x;
+				Float3 offset(calcUnitDistX * (1 + x), calcUnitDistY * (1 + y), calcUnitDistZ * (1 + z));
+				positions[index] = offset + Float3(bounds.Min);
+			}
+		}
+	}
+}
+
+void ProbePlacement::PlaceAdaptive(const BBox &bounds, const Float3 *vertices, const Float3 *normals, const uint32 *indices,
+	uint32 numTriangles, const Settings &settings, std::vector<Float3> &positions, Stats *stats)
+{
+	const Float3 diff = Float3(bounds.Max) - Float3(bounds.Min);
+	const float maxExtent = Max(diff.x, Max(diff.y, diff.z));
+
+	// Rays for the inside test, spread evenly over the sphere
+	std::vector<Float3> rayDirs(settings.numInsideRays);
+	for (uint32 i = 0; i < settings.numInsideRays; i++)
+	{
+		float y = 1.0f - (2.0f * i + 1.0f) / settings.numInsideRays;
+		float r = sqrtf(Max(1.0f - y * y, 0.0f));
+		float phi = i * 2.39996323f;
+		rayDirs[i] = Float3(r * cosf(phi), y, r * sinf(phi));
+	}
+
+	std::vector<BBox> triangleBoxes(numTriangles);
+	for (uint32 t = 0; t < numTriangles; t++)
+	{
+		const uint32 *tri = &indices[t * 3];
+		triangleBoxes[t] = MakeBBox(Float3Min(vertices[tri[0]], Float3Min(vertices[tri[1]], vertices[tri[2]])),
+			Float3Max(vertices[tri[0]], Float3Max(vertices[tri[1]], vertices[tri[2]])));
+	}
+
+	BVH triangleBVH;
+	if (numTriangles > 0)
+		triangleBVH.Build(&triangleBoxes[0], numTriangles);
+
+	std::vector<uint32> allTriangles(numTriangles);
+	for (uint32 t = 0; t < numTriangles; t++)
+		allTriangles[t] = t;
+
+	// 2^depth - 1 finest cells span the bounds, the extra cell keeps probes half a cell off the walls
+	uint32 maxDepth = 1;
+	while (maxDepth < MaxOctreeDepth && (float(1u << (maxDepth + 1)) - 1.0f) * settings.unitsBetweenProbes <= maxExtent)
+		maxDepth++;
+
+	const float rayLength = Float3::Length(diff) + 1.0f;
+	std::vector<uint8> inside;
+
+	for (;;)
+	{
+		OctreeBuilder octree;
+		octree.vertices = vertices;
+		octree.indices = indices;
+		octree.bounds = bounds;
+		octree.finestCell = maxExtent / (float(1u << maxDepth) - 1.0f);
+		octree.rootMin = Float3(bounds.Min) - Float3(octree.finestCell * 0.5f);
+		octree.margin = octree.finestCell * 0.5f;
+		octree.maxDepth = maxDepth;
+		octree.numLeaves = 0;
+
+		uint32 emptyLevels = 0;
+		while (float(2u << emptyLevels) <= settings.maxEmptySpacing && emptyLevels < maxDepth)
+			emptyLevels++;
+		octree.minLeafDepth = maxDepth - emptyLevels;
+
+		octree.build(0, 0, 0, 0, allTriangles);
+
+		std::sort(octree.corners.begin(), octree.corners.end());
+		octree.corners.erase(std::unique(octree.corners.begin(), octree.corners.end()), octree.corners.end());
+
+		const uint32 numCandidates = (uint32)octree.corners.size();
+		std::vector<Float3> candidates(numCandidates);
+		for (uint32 i = 0; i < numCandidates; i++)
+		{
+			const uint64 key = octree.corners[i];
+			Float3 lattice(float(key & 0x1FFFFF), float((key >> 21) & 0x1FFFFF), float(key >> 42));
+			candidates[i] = octree.rootMin + lattice * octree.finestCell;
+		}
+
+		// Inside test: the nearest hit along each ray, solid if too many of them are back faces
+		inside.assign(numCandidates, 0);
+		const uint32 numChunks = (numCandidates + InsideTestChunkSize - 1) / InsideTestChunkSize;
+		ParallelFor(0, numChunks, [&](uint32 chunk)
+		{
+			std::vector<uint32> hits;
+			const uint32 end = Min(numCandidates, (chunk + 1) * InsideTestChunkSize);
+			for (uint32 c = chunk * InsideTestChunkSize; c < end; c++)
+			{
+				uint32 numBackFaces = 0;
+				for (uint32 r = 0; r < settings.numInsideRays; r++)
+				{
+					hits.clear();
+					triangleBVH.QueryRay(candidates[c], rayDirs[r], rayLength, hits);
+
+					float nearestT = FLT_MAX;
+					uint32 nearestTri = uint32(-1);
+					for (size_t h = 0; h < hits.size(); h++)
+					{
+						const uint32 *tri = &indices[hits[h] * 3];
+						float t = intersectTriangle(candidates[c], rayDirs[r], vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+						if (t > 0.0f && (t < nearestT || (t == nearestT && hits[h] < nearestTri)))
+						{
+							nearestT = t;
+							nearestTri = hits[h];
+						}
+					}
+
+					if (nearestTri == uint32(-1)) continue;
+
+					const uint32 *tri = &indices[nearestTri * 3];
+					Float3 normal = normals[tri[0]] + normals[tri[1]] + normals[tri[2]];
+					if (Float3::Dot(normal, rayDirs[r]) > 0.0f)
+						numBackFaces++;
+				}
+
+				inside[c] = numBackFaces > settings.insideThreshold * settings.numInsideRays;
+			}
+		});
+
+		positions.clear();
+		for (uint32 i = 0; i < numCandidates; i++)
+		{
+			if (!inside[i])
+				positions.push_back(candidates[i]);
+		}
+
+		if (stats != nullptr)
+		{
+			stats->numLeaves = octree.numLeaves;
+			stats->numCandidates = numCandidates;
+			stats->numRejectedInside = numCandidates - (uint32)positions.size();
+			stats->finestSpacing = octree.finestCell;
+		}
+
+		if (positions.size() <= settings.maxProbes || maxDepth == 1) break;
+		maxDepth--;
+	}
+
+	if (positions.size() > settings.maxProbes)
+		positions.resize(settings.maxProbes);
+}
+
+uint32 ProbePlacement::IndirectionGrid::Lookup(const Float3 &pos) const
+{
+	if (probeIndices.empty()) return ProbeKDTree::InvalidIndex;
+
+	uint32 cell[3];
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		float c = (pos[axis] - origin[axis]) / cellSize[axis];
+		cell[axis] = (uint32)Clamp(c, 0.0f, float(dims[axis] - 1));
+	}
+	return probeIndices[(cell[2] * dims[1] + cell[1]) * dims[0] + cell[0]];
+}
+
+void ProbePlacement::IndirectionGrid::GatherProbes(const Float3 &pos, float radius, std::vector<uint32> &result) const
+{
+	if (cellProbes.empty()) return;
+
+	// cells clamp the same way probes were bucketed, so a probe inside the box is in the range
+	uint32 first[3];
+	uint32 last[3];
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		float c0 = (pos[axis] - radius - origin[axis]) / cellSize[axis];
+		float c1 = (pos[axis] + radius - origin[axis]) / cellSize[axis];
+		first[axis] = (uint32)Clamp(c0, 0.0f, float(dims[axis] - 1));
+		last[axis] = (uint32)Clamp(c1, 0.0f, float(dims[axis] - 1));
+	}
+
+	for (uint32 z = first[2]; z <= last[2]; z++)
+	{
+		for (uint32 y = first[1]; y <= last[1]; y++)
+		{
+			const uint32 row = (z * dims[1] + y) * dims[0];
+			result.insert(result.end(), cellProbes.begin() + cellStarts[row + first[0]],
+				cellProbes.begin() + cellStarts[row + last[0] + 1]);
+		}
+	}
+}
+
+void ProbePlacement::BuildIndirectionGrid(const BBox &bounds, float cellSize, const Float3 *positions, uint32 numProbes,
+	IndirectionGrid &grid)
+{
+	const Float3 diff = Float3(bounds.Max) - Float3(bounds.Min);
+	grid.origin = Float3(bounds.Min);
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		grid.dims[axis] = Clamp((uint32)ceilf(diff[axis] / cellSize), 1u, MaxGridDim);
+	}
+	grid.cellSize = Float3(diff.x / grid.dims[0], diff.y / grid.dims[1], diff.z / grid.dims[2]);
+
+	const uint32 numCells = grid.dims[0] * grid.dims[1] * grid.dims[2];
+	if (numProbes == 0)
+	{
+		grid.probeIndices.clear();
+		grid.cellStarts.clear();
+		grid.cellProbes.clear();
+		return;
+	}
+
+	std::vector<Float3> cellCenters(numCells);
+	for (uint32 z = 0; z < grid.dims[2]; z++)
+	{
+		for (uint32 y = 0; y < grid.dims[1]; y++)
+		{
+			for (uint32 x = 0; x < grid.dims[0]; x++)
+			{
+				cellCenters[(z * grid.dims[1] + y) * grid.dims[0] + x] =
+					grid.origin + (Float3(float(x), float(y), float(z)) + 0.5f) * grid.cellSize;
+			}
+		}
+	}
+
+	ProbeKDTree tree;
+	tree.Build(positions, numProbes);
+	grid.probeIndices.resize(numCells);
+	tree.FindNearestBatch(&cellCenters[0], numCells, &grid.probeIndices[0]);
+
+	// Counting sort of the probes by cell, probe order is kept within a cell
+	std::vector<uint32> probeCells(numProbes);
+	grid.cellStarts.assign(numCells + 1, 0);
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		uint32 cell[3];
+		for (uint32 axis = 0; axis < 3; axis++)
+		{
+			float c = (positions[i][axis] - grid.origin[axis]) / grid.cellSize[axis];
+			cell[axis] = (uint32)Clamp(c, 0.0f, float(grid.dims[axis] - 1));
+		}
+		probeCells[i] = (cell[2] * grid.dims[1] + cell[1]) * grid.dims[0] + cell[0];
+		grid.cellStarts[probeCells[i] + 1]++;
+	}
+
+	for (uint32 c = 0; c < numCells; c++)
+	{
+		grid.cellStarts[c + 1] += grid.cellStarts[c];
+	}
+
+	std::vector<uint32> cursor(grid.cellStarts.begin(), grid.cellStarts.end() - 1);
+	grid.cellProbes.resize(numProbes);
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		grid.cellProbes[cursor[probeCells[i]]++] = i;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include "Bounds.h"
+
+using namespace SampleFramework11;
+
+// Probe placement for IrradianceVolume, pure CPU functions of the scene bounds and geometry.
+// PlaceGrid() is the dense grid the volume always used. PlaceAdaptive() subdivides an octree
+// over the bounds down to the probe spacing only where cells touch geometry, leaves empty space
+// at a coarser spacing, puts probes on the corners of the leaves and drops the ones that end up
+// inside solid geometry. Probes come out in a fixed order, so placement is deterministic.
+class ProbePlacement
+{
+public:
+	struct Settings
+	{
+		float unitsBetweenProbes;   // finest spacing, used near geometry
+		float maxEmptySpacing;      // coarsest spacing in empty space, in multiples of unitsBetweenProbes
+		uint32 maxProbes;           // the spacing doubles until the probes fit
+		uint32 numInsideRays;
+		float insideThreshold;      // a probe whose rays see back faces more often than this is inside
+
+		Settings();
+	};
+
+	struct Stats
+	{
+		uint32 numLeaves;
+		uint32 numCandidates;
+		uint32 numRejectedInside;
+		float finestSpacing;
+	};
+
+	// Uniform grid over the bounds with the nearest probe of every cell, so finding the probe for
+	// a position is an index computation instead of a search over the compact probe list. Every
+	// probe is also bucketed into the cell it lies in (clamped to the grid), for radius queries.
+	struct IndirectionGrid
+	{
+		Float3 origin;
+		Float3 cellSize;
+		uint32 dims[3];
+		std::vector<uint32> probeIndices;   // nearest probe per cell
+		std::vector<uint32> cellStarts;     // per cell, where its probes start in cellProbes, plus an end
+		std::vector<uint32> cellProbes;
+
+		uint32 Lookup(const Float3 &pos) const;
+
+		// Appends the probes bucketed in every cell the box around the sphere touches, a superset
+		// of the probes within radius of pos, in cell order
+		void GatherProbes(const Float3 &pos, float radius, std::vector<uint32> &result) const;
+	};
+
+	static const uint32 MaxGridDim = 128;
+
+	static void PlaceGrid(const BBox &bounds, float unitsBetweenProbes, std::vector<Float3> &positions);
+
+	// Triangles are indices into vertices; normals are per vertex and tell solid from empty space
+	static void PlaceAdaptive(const BBox &bounds, const Float3 *vertices, const Float3 *normals, const uint32 *indices,
+		uint32 numTriangles, const Settings &settings, std::vector<Float3> &positions, Stats *stats = nullptr);
+
+	static void BuildIndirectionGrid(const BBox &bounds, float cellSize, const Float3 *positions, uint32 numProbes,
+		IndirectionGrid &grid);
+};
@@ -0,0 +1,155 @@
+#include "ProbeUpdateScheduler.h"
+
+#include <algorithm>
+#include <cstring>
+
+ProbeUpdateScheduler::Weights::Weights() : distance(32.0f), lightChange(1024.0f)
+{
+}
+
+ProbeUpdateScheduler::ProbeUpdateScheduler() : _maxRadius(0.0f), _grid(nullptr), _frame(0)
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void ProbeUpdateScheduler::Reset(const Float3 *positions, const float *radii, uint32 numProbes,
+	const ProbePlacement::IndirectionGrid *grid, bool haveResults)
+{
+	_positions.assign(positions, positions + numProbes);
+	_radii.assign(radii, radii + numProbes);
+
+	ProbeState initial = { haveResults ? 0 : NeverUpdated, haveResults };
+	_states.assign(numProbes, initial);
+	_frame = 0;
+
+	_maxRadius = 0.0f;
+	for (uint32 i = 0; i < numProbes; i++)
+		_maxRadius = Max(_maxRadius, radii[i]);
+
+	_grid = numProbes > 0 ? grid : nullptr;
+
+	memset(&_stats, 0, sizeof(_stats));
+	_stats.numProbes = numProbes;
+}
+
+void ProbeUpdateScheduler::InvalidateAll()
+{
+	for (size_t i = 0; i < _states.size(); i++)
+		_states[i].lightChanged = true;
+}
+
+void ProbeUpdateScheduler::NotifyLightChanged(const Float3 &pos, float radius)
+{
+	notifyRange(pos, radius);
+}
+
+void ProbeUpdateScheduler::notifyRange(const Float3 &pos, float radius)
+{
+	if (_grid == nullptr) return;
+
+	// Gather with the largest probe radius, then check each probe's own
+	_scratchIndices.clear();
+	_grid->GatherProbes(pos, radius + _maxRadius, _scratchIndices);
+	for (size_t i = 0; i < _scratchIndices.size(); i++)
+	{
+		uint32 probe = _scratchIndices[i];
+		float reach = radius + _radii[probe];
+		if (Float3::Distance(pos, _positions[probe]) <= reach)
+			_states[probe].lightChanged = true;
+	}
+}
+
+void ProbeUpdateScheduler::UpdateLights(const PointLight *lights, uint32 numLights)
+{
+	const uint32 numPrev = (uint32)_prevLights.size();
+	for (uint32 i = 0; i < Max(numLights, numPrev); i++)
+	{
+		if (i >= numPrev)
+		{
+			notifyRange(lights[i].cPos, lights[i].cRadius);
+			continue;
+		}
+
+		const PointLight &prev = _prevLights[i];
+		if (i >= numLights)
+		{
+			notifyRange(prev.cPos, prev.cRadius);
+			continue;
+		}
+
+		const PointLight &light = lights[i];
+		if (light.cPos != prev.cPos || light.cRadius != prev.cRadius || light.cColor != prev.cColor)
+		{
+			notifyRange(prev.cPos, prev.cRadius);
+			notifyRange(light.cPos, light.cRadius);
+		}
+	}
+
+	_prevLights.assign(lights, lights + numLights);
+}
+
+uint32 ProbeUpdateScheduler::Schedule(const Float3 &cameraPos, uint32 budget, std::vector<uint32> &updateList)
+{
+	_frame++;
+	updateList.clear();
+
+	const uint32 numProbes = (uint32)_states.size();
+	_candidates.clear();
+	_priorities.resize(numProbes);
+
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		const ProbeState &state = _states[i];
+		if (state.lastUpdateFrame == NeverUpdated)
+		{
+			updateList.push_back(i);
+			continue;
+		}
+
+		float staleness = float(_frame - state.lastUpdateFrame);
+		float distance = Float3::Distance(cameraPos, _positions[i]);
+		float radius = Max(_radii[i], 1e-4f);
+		_priorities[i] = staleness + _weights.distance * radius / (radius + distance)
+			+ (state.lightChanged ? _weights.lightChange : 0.0f);
+		_candidates.push_back(i);
+	}
+
+	// Probes without any result go first and all at once, the budget applies to the rest
+	if (updateList.empty())
+	{
+		const uint32 count = Min(budget, (uint32)_candidates.size());
+		auto higherPriority = [&](uint32 a, uint32 b)
+		{
+			return _priorities[a] > _priorities[b] || (_priorities[a] == _priorities[b] && a < b);
+		};
+
+		if (count < _candidates.size())
+			std::nth_element(_candidates.begin(), _candidates.begin() + count, _candidates.end(), higherPriority);
+
+		updateList.assign(_candidates.begin(), _candidates.begin() + count);
+		std::sort(updateList.begin(), updateList.end());
+	}
+
+	for (size_t i = 0; i < updateList.size(); i++)
+	{
+		_states[updateList[i]].lastUpdateFrame = _frame;
+		_states[updateList[i]].lightChanged = false;
+	}
+
+	// Staleness after this frame's updates
+	_stats.numProbes = numProbes;
+	_stats.numUpdated = (uint32)updateList.size();
+	_stats.numPending = 0;
+	_stats.maxStaleness = 0;
+	double stalenessSum = 0.0;
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		uint32 staleness = _frame - _states[i].lastUpdateFrame;
+		_stats.maxStaleness = Max(_stats.maxStaleness, staleness);
+		_stats.numPending += _states[i].lightChanged ? 1 : 0;
+		stalenessSum += staleness;
+	}
+	_stats.meanStaleness = numProbes > 0 ? float(stalenessSum / numProbes) : 0.0f;
+
+	return (uint32)updateList.size();
+}
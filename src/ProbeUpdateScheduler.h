@@ -0,0 +1,84 @@
+#pragma once
+#include "Light.h"
+#include "ProbePlacement.h"
+
+using namespace SampleFramework11;
+
+// Picks which irradiance volume probes to relight each frame when only a budget of them can be.
+// A probe's priority grows by one per frame since its last update, plus a bonus that falls off
+// with its distance to the camera and a large bonus once a light change reached its influence
+// radius. Probes that never had an update (new placement) all go in the first list regardless of
+// the budget so the volume never shows unlit probes. Lists are sorted by probe index and
+// deterministic for the same inputs. Nothing here touches the device.
+class ProbeUpdateScheduler
+{
+public:
+	struct Weights
+	{
+		float distance;         // priority at the camera, halved one probe radius away
+		float lightChange;      // priority of a probe whose lighting changed
+
+		Weights();
+	};
+
+	struct Stats
+	{
+		uint32 numProbes;
+		uint32 numUpdated;      // in the last list
+		uint32 numPending;      // probes with a light change not picked up yet
+		uint32 maxStaleness;    // frames since the least recently updated probe's last update
+		float meanStaleness;
+	};
+
+	ProbeUpdateScheduler();
+
+	// New probe set. The grid is the owner's indirection grid over the same probes, it finds the
+	// probes near a light change and has to outlive the next Reset. With haveResults the probes
+	// already hold SH (e.g. from the probe cache) and are only marked as changed, otherwise they all
+	// need an update.
+	void Reset(const Float3 *positions, const float *radii, uint32 numProbes, const ProbePlacement::IndirectionGrid *grid,
+		bool haveResults);
+
+	// Global lighting changes, e.g. the sun or sky
+	void InvalidateAll();
+
+	// Marks every probe whose influence radius overlaps the sphere
+	void NotifyLightChanged(const Float3 &pos, float radius);
+
+	// Compares against the lights seen last call, moved/resized/recolored, added and removed
+	// lights notify both where they were and where they are
+	void UpdateLights(const PointLight *lights, uint32 numLights);
+
+	// Advances a frame and writes the probes to update, at most budget of them once every probe
+	// had its first update. Returns the list size.
+	uint32 Schedule(const Float3 &cameraPos, uint32 budget, std::vector<uint32> &updateList);
+
+	inline const Stats &getStats() const { return _stats; }
+	inline Weights &getWeights() { return _weights; }
+
+private:
+	static const uint32 NeverUpdated = uint32(-1);
+
+	struct ProbeState
+	{
+		uint32 lastUpdateFrame;
+		bool32 lightChanged;
+	};
+
+	void notifyRange(const Float3 &pos, float radius);
+
+	std::vector<Float3> _positions;
+	std::vector<float> _radii;
+	std::vector<ProbeState> _states;
+	float _maxRadius;
+	const ProbePlacement::IndirectionGrid *_grid;
+
+	std::vector<PointLight> _prevLights;
+	std::vector<uint32> _scratchIndices;
+	std::vector<uint32> _candidates;
+	std::vector<float> _priorities;
+
+	Weights _weights;
+	Stats _stats;
+	uint32 _frame;
+};
@@ -31,6 +31,8 @@
 #include "Light.h"
 #include "ShadowMapSettings.h"
 #include "LoadScenes.h"
+#include "PhysicsBenchmark.h"
+#include "SHMathBenchmark.h"
 
 using namespace SampleFramework11;
 using std::wstring;
@@ -42,6 +44,7 @@ const float WindowHeightF = static_cast<float>(WindowHeight);
 
 static const float NearClip = 0.01f;
 static const float FarClip = 300.0f;
+static const uint32 InitialPointLightCapacity = 1024;
 
 
 Realtime_GI::Realtime_GI() :  App(L"Realtime GI (CSCI 580)", MAKEINTRESOURCEW(IDI_DEFAULT)),
@@ -203,9 +206,15 @@ void Realtime_GI::Initialize()
 	_lightClusters.Initialize(_deviceManager.Device(), _deviceManager.ImmediateContext(), &_irradianceVolume);
 	_lightClusters.SetScene(&_scenes[AppSettings::CurrentScene]);
 
+	_frustumLightClusters.Initialize(_deviceManager.Device(), _deviceManager.ImmediateContext(), &_irradianceVolume,
+		LightClusters::FRUSTUM_CLUSTERS);
+	_frustumLightClusters.SetCamera(&_camera);
+	_frustumLightClusters.SetScene(&_scenes[AppSettings::CurrentScene]);
+
 	_irradianceVolume.Initialize(_deviceManager.Device(), _deviceManager.ImmediateContext(), 
 		&_meshRenderer, &_camera, &_pointLightBuffer, &_lightClusters, &_debugRenderer, &_shProbeLightBuffer);
 
+	_irradianceVolume.SetAdaptivePlacement(AppSettings::AdaptiveProbePlacement);
 	_irradianceVolume.SetScene(&_scenes[AppSettings::CurrentScene]);
 
 	_ssr.Initialize(_deviceManager.Device(), _deviceManager.ImmediateContext(), &_camera, &_colorTarget, &_rt1Target, &_rt2Target
@@ -280,12 +289,9 @@ void Realtime_GI::UpdateSpecularProbeProperties()
 						AppSettings::BoxSizeY.SetValue(boxSize.y);
 						AppSettings::BoxSizeZ.SetValue(boxSize.z);
 					}
-					cubeMap->SetPosition(Float3(AppSettings::ProbeX, AppSettings::ProbeY, AppSettings::ProbeZ));
-					_scenes[AppSettings::CurrentScene].getProbeManagerPtr()->_probes.at(probeIndex).pos = 
-						Float3(AppSettings::ProbeX, AppSettings::ProbeY, AppSettings::ProbeZ);
-					cubeMap->SetBoxSize(Float3(AppSettings::BoxSizeX, AppSettings::BoxSizeY, AppSettings::BoxSizeZ));
-					_scenes[AppSettings::CurrentScene].getProbeManagerPtr()->_probes.at(probeIndex).BoxSize =
-						Float3(AppSettings::BoxSizeX, AppSettings::BoxSizeY, AppSettings::BoxSizeZ);
+					_scenes[AppSettings::CurrentScene].getProbeManagerPtr()->UpdateProbe(probeIndex,
+						Float3(AppSettings::ProbeX, AppSettings::ProbeY, AppSettings::ProbeZ),
+						Float3(AppSettings::BoxSizeX, AppSettings::BoxSizeY, AppSettings::BoxSizeZ));
 				}
 			}
 		}
@@ -419,9 +425,16 @@ void Realtime_GI::CreateQuadBuffers()
 
 void Realtime_GI::CreateLightBuffers()
 {
-	_pointLightBuffer.Initialize(_deviceManager.Device(), sizeof(PointLight), Scene::MAX_SCENE_LIGHTS, true);
-	_shProbeLightBuffer.Initialize(_deviceManager.Device(), sizeof(SHProbeLight), IrradianceVolume::MAX_PROBE_NUM, true);
+	_pointLightBuffer.Initialize(_deviceManager.Device(), sizeof(PointLight), InitialPointLightCapacity, false, false, false, false, nullptr, true);
+	_shProbeLightBuffer.Initialize(_deviceManager.Device(), sizeof(SHProbeLight), IrradianceVolume::MAX_PROBE_NUM, false, false, false, false, nullptr, true);
 	_probeStructBuffer.Initialize(_deviceManager.Device(), sizeof(Probe), 12, true);
+
+	_lightUploadBackend.Initialize(_deviceManager.ImmediateContext());
+	_lightUploads.Initialize(&_lightUploadBackend);
+	_pointLightUpload = _lightUploads.AddBuffer(_pointLightBuffer.Size, sizeof(PointLight));
+	_lightUploadBackend.SetBuffer(_pointLightUpload, _pointLightBuffer.Buffer);
+	_shProbeLightUpload = _lightUploads.AddBuffer(_shProbeLightBuffer.Size, sizeof(SHProbeLight));
+	_lightUploadBackend.SetBuffer(_shProbeLightUpload, _shProbeLightBuffer.Buffer);
 }
 
 void Realtime_GI::ApplyMomentum(float &prevVal, float &val, float deltaTime)
@@ -442,13 +455,13 @@ void Realtime_GI::QueueDebugCommands()
 	{
 		for (int i = 0; i < _scenes[AppSettings::CurrentScene].getNumStaticOpaqueObjects(); i++)
 		{
-			BBox &b = _scenes[AppSettings::CurrentScene].getStaticObjectBBoxPtr()[i];
+			BBox &b = *_scenes[AppSettings::CurrentScene].getStaticOpaqueObjectsPtr()[i].bound->bbox;
 			_debugRenderer.QueueBBoxTranslucent(b, Float4(0.7f, 0.3f, 0.3f, 0.1f));
 		}
 
 		for (int i = 0; i < _scenes[AppSettings::CurrentScene].getNumDynamicOpaueObjects(); i++)
 		{
-			BBox &b = _scenes[AppSettings::CurrentScene].getDynamicObjectBBoxPtr()[i];
+			BBox &b = *_scenes[AppSettings::CurrentScene].getDynamicOpaqueObjectsPtr()[i].bound->bbox;
 			_debugRenderer.QueueBBoxTranslucent(b, Float4(0.3f, 0.7f, 0.3f, 0.1f));
 		}
 
@@ -467,7 +480,7 @@ void Realtime_GI::QueueDebugCommands()
 
 	for (int i = 0; i < _scenes[AppSettings::CurrentScene].getNumPointLights(); i++)
 	{
-		Float3 &pos = _scenes[AppSettings::CurrentScene].getPointLightPtr()[i].cPos;
+		Float3 &pos = _scenes[AppSettings::CurrentScene].getPointLight(i)->cPos;
 		_debugRenderer.QueueLightSphere(pos, Float4(1.0f, 1.0f, 1.0f, 0.2f), 0.2f);
 	}
 
@@ -500,6 +513,9 @@ void Realtime_GI::Update(const Timer& timer)
 {
     AppSettings::UpdateUI();
 
+	// latches last frame's draw counters
+	_meshRenderer.Update();
+
 	if (!AppSettings::PauseSceneScript)
 	{
 		_scenes[AppSettings::CurrentScene].Update(timer);
@@ -621,6 +637,27 @@ void Realtime_GI::Update(const Timer& timer)
 		_irradianceVolume.SetNumOfBounces(AppSettings::DiffuseGIBounces);
 	}
 
+	if (AppSettings::AdaptiveProbePlacement.Changed())
+	{
+		_irradianceVolume.SetAdaptivePlacement(AppSettings::AdaptiveProbePlacement);
+	}
+
+	if (AppSettings::RunBenchmarks)
+	{
+		_lightClusters.RunAssignmentBenchmark();
+		LightClusters::RunClusterModeBenchmark(_deviceManager.Device(), _deviceManager.ImmediateContext(), _scenes, _numScenes);
+		FrustumCuller::RunBenchmark();
+		FrustumCuller::RunBVHBenchmark();
+		RenderQueue::RunBenchmark();
+		SHCubemapProjector::RunBenchmark();
+		SHMathBenchmark::Run();
+		PhysicsBenchmark::RunNarrowPhaseBenchmark();
+		PhysicsBenchmark::RunIslandSolveBenchmark();
+		PhysicsBenchmark::RunContactSolverBenchmark();
+		PhysicsBenchmark::RunAllocationBenchmark();
+		PhysicsBenchmark::RunBroadPhaseBenchmark();
+	}
+
     // Toggle VSYNC
     if(kbState.RisingEdge(KeyboardState::V))
         _deviceManager.SetVSYNCEnabled(!_deviceManager.VSYNCEnabled());
@@ -637,6 +674,7 @@ void Realtime_GI::Update(const Timer& timer)
 		_meshRenderer.SetScene(currScene);
         AppSettings::SceneOrientation.SetValue(currScene->getSceneOrientation());
 		_lightClusters.SetScene(currScene);
+		_frustumLightClusters.SetScene(currScene);
 		_irradianceVolume.SetScene(currScene);
 
 		_prevScene = &_scenes[AppSettings::CurrentScene];
@@ -788,7 +826,7 @@ void Realtime_GI::Render(const Timer& timer)
 
     AppSettings::UpdateCBuffer(context);
 
-	if (_firstFrame || AppSettings::CurrentScene.Changed() || AppSettings::EnableRealtimeCubemap)
+	if (_firstFrame || AppSettings::CurrentScene.Changed() || AppSettings::EnableRealtimeCubemap || _irradianceVolume.atlasesDirty())
 	{
 		// render cubemap every time scene has changed
 		RenderSceneCubemaps(context);
@@ -975,8 +1013,9 @@ void Realtime_GI::RenderLightsDeferred()
 	_deferredPassConstants.Data.FarPlane = FarClip;
 	_deferredPassConstants.Data.ProjTermA = FarClip / (FarClip - NearClip);
 	_deferredPassConstants.Data.ProjTermB = (-FarClip * NearClip) / (FarClip - NearClip);
-	_deferredPassConstants.Data.ClusterScale = _lightClusters.getClusterScale();
-	_deferredPassConstants.Data.ClusterBias = _lightClusters.getClusterBias();
+	LightClusters &shadingClusters = GetShadingLightClusters();
+	_deferredPassConstants.Data.ClusterScale = shadingClusters.getClusterScale();
+	_deferredPassConstants.Data.ClusterBias = shadingClusters.getClusterBias();
 	_deferredPassConstants.Data.WorldToView = Float4x4::Transpose(_camera.ViewMatrix());
 	_deferredPassConstants.Data.invNDCToWorldZ = CreateInvDeviceZToWorldZTransform(_camera.ProjectionMatrix());
 	_deferredPassConstants.ApplyChanges(context);
@@ -994,12 +1033,13 @@ void Realtime_GI::RenderLightsDeferred()
 		_pointLightBuffer.SRView,
 		_envMap,
 		_meshRenderer.GetSpecularLookupTexturePtr(),
-		_lightClusters.getLightIndicesListSRV(),
-		_lightClusters.getClusterTexSRV(),
+		shadingClusters.getLightIndicesListSRV(),
+		shadingClusters.getClusterTexSRV(),
 		_shProbeLightBuffer.SRView,
 		_irradianceVolume.getRelightSHStructuredBufferPtr()->SRView,
 		_scenes[AppSettings::CurrentScene].getProbeManagerPtr()->GetProbeArray().SRView,
-		_probeStructBuffer.SRView
+		_probeStructBuffer.SRView,
+		_irradianceVolume.getCompressedSHStructuredBufferPtr()->SRView
 	};
 
 	ID3D11SamplerState* sampStates[2] = {
@@ -1183,6 +1223,38 @@ void Realtime_GI::RenderHUD()
 		+ ToString(_camera.Position()[2]) + L", ";
 	_spriteRenderer.RenderText(_font, posText.c_str(), transform, XMFLOAT4(1, 1, 0, 1));
 
+	transform._42 += 25.0f;
+	const LightClusters::ClusterStats &clusterStats = GetShadingLightClusters().getClusterStats();
+	wstring clusterText(L"Light Clusters: ");
+	clusterText += ToString(clusterStats.numLightIndices) + L" indices, max " + ToString(clusterStats.maxLightsPerCluster)
+		+ L", mean " + ToString(clusterStats.meanLightsPerOccupiedCluster) + L" lights per occupied cluster";
+	_spriteRenderer.RenderText(_font, clusterText.c_str(), transform, XMFLOAT4(1, 1, 0, 1));
+
+	transform._42 += 25.0f;
+	const MeshRenderer::DrawStats &drawStats = _meshRenderer.getLastFrameDrawStats();
+	wstring drawText(L"Mesh Draws: ");
+	drawText += ToString(drawStats.numDrawCalls) + L" draw calls for " + ToString(drawStats.numInstances)
+		+ L" mesh parts, " + ToString(drawStats.numDrawCallsSaved) + L" saved by instancing";
+	_spriteRenderer.RenderText(_font, drawText.c_str(), transform, XMFLOAT4(1, 1, 0, 1));
+
+	transform._42 += 25.0f;
+	const ProbeUpdateScheduler::Stats &probeStats = _irradianceVolume.getProbeUpdateStats();
+	wstring probeUpdateText(L"Probe Updates: ");
+	probeUpdateText += ToString(probeStats.numUpdated) + L" of " + ToString(probeStats.numProbes) + L" probes, staleness max "
+		+ ToString(probeStats.maxStaleness) + L" mean " + ToString(probeStats.meanStaleness) + L" frames, "
+		+ ToString(probeStats.numPending) + L" waiting on light changes";
+	_spriteRenderer.RenderText(_font, probeUpdateText.c_str(), transform, XMFLOAT4(1, 1, 0, 1));
+
+	transform._42 += 25.0f;
+	const UploadManager::FrameStats &lightUploadStats = _lightUploads.getFrameStats();
+	const UploadManager::FrameStats &clusterUploadStats = GetShadingLightClusters().getUploadStats();
+	wstring uploadText(L"Uploads: lights ");
+	uploadText += ToString(lightUploadStats.bytesUploaded / 1024) + L" of " + ToString(lightUploadStats.bytesWritten / 1024)
+		+ L" KB, clusters " + ToString(clusterUploadStats.bytesUploaded / 1024) + L" of "
+		+ ToString(clusterUploadStats.bytesWritten / 1024) + L" KB, "
+		+ ToString(lightUploadStats.numUploads + clusterUploadStats.numUploads) + L" copies";
+	_spriteRenderer.RenderText(_font, uploadText.c_str(), transform, XMFLOAT4(1, 1, 0, 1));
+
 	/*Float3 trans = _scenes[0].getStaticOpaqueObjectsPtr()->base->Translation();
 	transform._42 += 25.0f;
 	wstring objText(L"Object Position: ");
@@ -1211,35 +1283,51 @@ void Realtime_GI::RenderHUD()
 
 void Realtime_GI::UploadLights()
 {
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-
 	Scene *curScene = &_scenes[AppSettings::CurrentScene];
 	// pointlights
 	if (curScene->getNumPointLights() > 0)
 	{
-		_deviceManager.ImmediateContext()->Map(_pointLightBuffer.Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		PointLight *pointLightGPUBufferPtr = static_cast<PointLight *>(mappedResource.pData);
+		// scenes have no light limit, grow the buffer geometrically
+		uint32 numPointLights = (uint32)curScene->getNumPointLights();
+		if (numPointLights > _pointLightBuffer.NumElements)
+		{
+			_pointLightBuffer.Initialize(_deviceManager.Device(), sizeof(PointLight), Max(numPointLights, _pointLightBuffer.NumElements * 2), false, false, false, false, nullptr, true);
+			_lightUploadBackend.SetBuffer(_pointLightUpload, _pointLightBuffer.Buffer);
+			_lightUploads.ResizeBuffer(_pointLightUpload, _pointLightBuffer.Size);
+		}
 
-		PointLight *pointLightPtr = curScene->getPointLightPtr();
-		memcpy(pointLightGPUBufferPtr, pointLightPtr, sizeof(PointLight) * curScene->getNumPointLights());
-		_deviceManager.ImmediateContext()->Unmap(_pointLightBuffer.Buffer, 0);//!
+		// straight from the pool chunks, only the lights that moved or changed are uploaded
+		curScene->getPointLights().ForEachChunk([&](const PointLight *lights, uint32 first, uint32 count)
+		{
+			_lightUploads.Write(_pointLightUpload, first * sizeof(PointLight), lights, count * sizeof(PointLight));
+		});
 	}
 
 	// sh probe lights
-	if (_irradianceVolume.getSHProbeLights().size() > 0)
+	const std::vector<SHProbeLight> &shProbeLights = _irradianceVolume.getSHProbeLights();
+	if (shProbeLights.size() > 0)
 	{
-		_deviceManager.ImmediateContext()->Map(_shProbeLightBuffer.Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		SHProbeLight *shProbeLightGPUBufferPtr = static_cast<SHProbeLight *>(mappedResource.pData);
-		const std::vector<SHProbeLight> &shProbeLights = _irradianceVolume.getSHProbeLights();
-		memcpy(shProbeLightGPUBufferPtr, &shProbeLights[0], sizeof(SHProbeLight) * shProbeLights.size());
-		_deviceManager.ImmediateContext()->Unmap(_shProbeLightBuffer.Buffer, 0);
+		_lightUploads.Write(_shProbeLightUpload, 0, &shProbeLights[0], (uint32)(sizeof(SHProbeLight) * shProbeLights.size()));
 	}
+
+	_lightUploads.Flush();
 }
 
 void Realtime_GI::AssignLightAndUploadClusters()
 {
 	_lightClusters.AssignLightToClusters();
 	_lightClusters.UploadClustersData();
+
+	if (AppSettings::LightClusterMode == LightClusterModes::Frustum)
+	{
+		_frustumLightClusters.AssignLightToClusters();
+		_frustumLightClusters.UploadClustersData();
+	}
+}
+
+LightClusters &Realtime_GI::GetShadingLightClusters()
+{
+	return AppSettings::LightClusterMode == LightClusterModes::Frustum ? _frustumLightClusters : _lightClusters;
 }
 
 int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
@@ -26,6 +26,7 @@
 #include "MeshRenderer.h"
 #include "Scene.h"
 #include "LightClusters.h"
+#include "D3D11UploadBackend.h"
 
 #include "CreateCubemap.h"
 #include "IrradianceVolume.h"
@@ -162,6 +163,12 @@ protected:
 	StructuredBuffer _pointLightBuffer;
 	StructuredBuffer _shProbeLightBuffer;
 
+	// Light buffers are DEFAULT usage, UploadLights() only sends what changed
+	UploadManager _lightUploads;
+	D3D11UploadBackend _lightUploadBackend;
+	uint32 _pointLightUpload;
+	uint32 _shProbeLightUpload;
+
 	StructuredBuffer _probeStructBuffer;
 
 	SamplerStates _samplerStates;
@@ -198,6 +205,7 @@ protected:
 
 	void UploadLights();
 	void AssignLightAndUploadClusters();
+	LightClusters &GetShadingLightClusters();
 
 	void ApplyMomentum(float &prevVal, float &val, float deltaTime);
 	void QueueDebugCommands();
@@ -205,6 +213,7 @@ protected:
 
 	DebugRenderer _debugRenderer;
 	LightClusters _lightClusters;
+	LightClusters _frustumLightClusters; // deferred shading only, probe relighting needs the world grid
 	IrradianceVolume _irradianceVolume;
 
 
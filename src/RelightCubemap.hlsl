@@ -4,6 +4,7 @@ Texture2D DirectDiffuseMap : register(t0);
 Texture2D ProxyMeshTexcoordAtlas :register(t1);
 Texture2D AlbedoMapAtlas : register(t2);
 Texture2D IndirectBouncesMap : register(t3);
+StructuredBuffer<uint> ProbeUpdateList : register(t4);
 
 SamplerState LinearSampler : register(s0);
 
@@ -13,25 +14,26 @@ struct VSOutput
     float2 TexCoord : TEXCOORD;
 };
 
-VSOutput VS(in uint VertexID : SV_VertexID)
+// One instance per probe in the update list, covering that probe's row of the atlas
+VSOutput VS(in uint VertexID : SV_VertexID, in uint InstanceID : SV_InstanceID)
 {
     VSOutput output;
 
-    if(VertexID == 0)
-    {
-        output.Position = float4(-1.0f, 1.0f, 1.0f, 1.0f);
-        output.TexCoord = float2(0.0f, 0.0f);
-    }
-    else if(VertexID == 1)
-    {
-        output.Position = float4(3.0f, 1.0f, 1.0f, 1.0f);
-        output.TexCoord = float2(2.0f, 0.0f);
-    }
-    else
-    {
-        output.Position = float4(-1.0f, -3.0f, 1.0f, 1.0f);
-        output.TexCoord = float2(0.0f, 2.0f);
-    }
+    uint2 rtSize;
+    AlbedoMapAtlas.GetDimensions(rtSize.x, rtSize.y);
+    const uint cubemapSize = rtSize.x / 6;
+    const uint probeIndex = ProbeUpdateList[InstanceID];
+
+    // two triangles, corners (0, 0) (1, 0) (0, 1) and (0, 1) (1, 0) (1, 1)
+    float2 corner = float2(VertexID == 1 || VertexID >= 4 ? 1.0f : 0.0f,
+                           VertexID == 2 || VertexID == 3 || VertexID == 5 ? 1.0f : 0.0f);
+
+    float rowTop = float(probeIndex * cubemapSize) / rtSize.y;
+    float rowBottom = float((probeIndex + 1) * cubemapSize) / rtSize.y;
+    float y = lerp(rowTop, rowBottom, corner.y);
+
+    output.Position = float4(corner.x * 2.0f - 1.0f, 1.0f - y * 2.0f, 1.0f, 1.0f);
+    output.TexCoord = float2(corner.x, y);
 
     return output;
 }
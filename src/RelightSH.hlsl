@@ -1,5 +1,6 @@
 // Modified from MJP's DX11 Radiosity integration shader - Robin Wu
 #include <SH.hlsl>
+#include "SHCompression.hlsli"
 
 //======================================================================================
 // Constant buffers
@@ -9,6 +10,12 @@ cbuffer SHIntegrationConstants : register(b0)
 	float FinalWeight;
 }
 
+cbuffer SHCompressionConstants : register(b1)
+{
+	uint NumCompressedProbes;
+	bool CompressFromUpdateList;
+}
+
 //======================================================================================
 // Resources
 //======================================================================================
@@ -21,6 +28,10 @@ struct PackedSH9
 
 Texture2D<float4> RelightMap : register(t0);
 StructuredBuffer<float4x4> ViewToWorldMatrixPalette : register(t1);
+
+// Probes relit this frame, one group per entry. Integration results are stored per entry and
+// only the listed probes of the SH output are written.
+StructuredBuffer<uint> ProbeUpdateList : register(t2);
 RWStructuredBuffer<PackedSH9> PackedSH9OutputBuffer : register(u0);
 
 
@@ -64,7 +75,7 @@ void IntegrateCS(uint3 GroupID : SV_GroupID, uint3 DispatchThreadID : SV_Dispatc
 				 uint3 GroupThreadID : SV_GroupThreadID, uint GroupIndex : SV_GroupIndex)
 {
 	// Gather RGB from the texels
-	const uint cubemapID = GroupID.x;
+	const uint cubemapID = ProbeUpdateList[GroupID.x];
 	const uint rowIndex = GroupID.y;
 	const uint cubeFace = GroupID.z;
 	const uint columnIndex = GroupThreadID.x;
@@ -137,7 +148,7 @@ void IntegrateCS(uint3 GroupID : SV_GroupID, uint3 DispatchThreadID : SV_Dispatc
 				GroupID.y + 
 				CubemapSize_ * i + 
 				CubemapSize_ * 3 * cubeFace + 
-				CubemapSize_ * 3 * 6 * cubemapID] = packed;
+				CubemapSize_ * 3 * 6 * GroupID.x] = packed;
 		}
 	}
 }
@@ -201,26 +212,44 @@ void ReductionCS(uint3 GroupID : SV_GroupID, uint3 DispatchThreadID : SV_Dispatc
 		output.chunk1 *= FinalWeight;
 		output.chunk2 *= FinalWeight;
 
+		const uint probeIndex = ProbeUpdateList[GroupID.x];
+
 		// Not sure if this non-linear write will hit performance
 		[unroll(3)]
 		for (uint a = 0; a < 3; ++a)
 		{
-			SH9OutputBuffer[GroupID.x].c[a][location.y] = output.chunk0[a];
+			SH9OutputBuffer[probeIndex].c[a][location.y] = output.chunk0[a];
 			// SH9OutputBuffer[GroupID.x * 9 + a * 3 + location.y] = output.chunk0[a];
 		}
 
 		[unroll(3)]
 		for (uint b = 3; b < 6; ++b)
 		{
-			SH9OutputBuffer[GroupID.x].c[b][location.y] = output.chunk1[b - 3];
+			SH9OutputBuffer[probeIndex].c[b][location.y] = output.chunk1[b - 3];
 			// SH9OutputBuffer[GroupID.x * 9 + b * 3 + location.y] = output.chunk1[b];
 		}
 
 		[unroll(3)]
 		for (uint c = 6; c < 9; ++c)
 		{
-			SH9OutputBuffer[GroupID.x].c[c][location.y] = output.chunk2[c - 6];
+			SH9OutputBuffer[probeIndex].c[c][location.y] = output.chunk2[c - 6];
 			// SH9OutputBuffer[GroupID.x * 9 + c * 3 + location.y] = output.chunk2[c];
 		}
 	}
 }
+
+StructuredBuffer<PaddedSH9Color> SH9CompressInput : register(t0);
+RWStructuredBuffer<CompressedSH9Color> CompressedSH9OutputBuffer : register(u0);
+
+//======================================================================================
+// Packs the probes the reduction just wrote, or every probe, into the compressed buffer
+//======================================================================================
+[numthreads(64, 1, 1)]
+void CompressCS(uint3 DispatchThreadID : SV_DispatchThreadID)
+{
+	if(DispatchThreadID.x >= NumCompressedProbes)
+		return;
+
+	const uint probeIndex = CompressFromUpdateList ? ProbeUpdateList[DispatchThreadID.x] : DispatchThreadID.x;
+	CompressedSH9OutputBuffer[probeIndex] = CompressSH9Color(SH9CompressInput[probeIndex]);
+}
@@ -0,0 +1,160 @@
+#include "RenderQueue.h"
+#include "Scene.h"
+
+#include <Utility.h>
+#include <Timer.h>
+
+uint64 RenderQueue::MakeKey(uint32 permutation, uint32 mesh, uint32 material, float depth01)
+{
+	const uint32 maxDepth = (1u << DepthBits) - 1;
+	uint32 depth = (uint32)(Saturate(depth01) * maxDepth);
+
+	uint64 key = permutation & ((1u << PermutationBits) - 1);
+	key = (key << MeshBits) | (mesh & ((1u << MeshBits) - 1));
+	key = (key << MaterialBits) | (material & ((1u << MaterialBits) - 1));
+	key = (key << DepthBits) | depth;
+	return key;
+}
+
+uint32 RenderQueue::SortableFloatBits(float value)
+{
+	// flip every bit of negatives and only the sign of positives, unsigned order then matches float order
+	uint32 bits = *reinterpret_cast<uint32 *>(&value);
+	return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+void RenderQueue::Clear()
+{
+	_items.clear();
+}
+
+void RenderQueue::Add(uint64 key, uint32 payload)
+{
+	Item item = { key, payload };
+	_items.push_back(item);
+}
+
+void RenderQueue::Sort()
+{
+	static const uint32 NumDigits = 8;
+	const size_t numItems = _items.size();
+	if (numItems < 2) return;
+
+	// All digit histograms in one pass
+	uint32 counts[NumDigits][256];
+	memset(counts, 0, sizeof(counts));
+	for (size_t i = 0; i < numItems; i++)
+	{
+		uint64 key = _items[i].key;
+		for (uint32 d = 0; d < NumDigits; d++)
+		{
+			counts[d][(key >> (d * 8)) & 0xFF]++;
+		}
+	}
+
+	_scratch.resize(numItems);
+	Item *src = &_items[0];
+	Item *dst = &_scratch[0];
+
+	for (uint32 d = 0; d < NumDigits; d++)
+	{
+		// every key has the same digit, e.g. unused permutation bits
+		uint32 *digitCounts = counts[d];
+		if (digitCounts[(src[0].key >> (d * 8)) & 0xFF] == numItems) continue;
+
+		uint32 offsets[256];
+		uint32 offset = 0;
+		for (uint32 b = 0; b < 256; b++)
+		{
+			offsets[b] = offset;
+			offset += digitCounts[b];
+		}
+
+		for (size_t i = 0; i < numItems; i++)
+		{
+			dst[offsets[(src[i].key >> (d * 8)) & 0xFF]++] = src[i];
+		}
+
+		std::swap(src, dst);
+	}
+
+	if (src != &_items[0])
+	{
+		_items.swap(_scratch);
+	}
+}
+
+void RenderQueue::RunBenchmark()
+{
+	static const uint32 NumIterations = 8;
+
+	XMMATRIX viewSIMD = XMMatrixLookAtLH(XMVectorSet(0.0f, 5.0f, -50.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	Float4x4 view;
+	XMStoreFloat4x4(&view, viewSIMD);
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> posDist(-100.0f, 100.0f);
+
+	std::vector<Float4x4> bases;
+	std::vector<SceneObject> objects;
+	std::vector<SceneObject> sorted;
+	RenderQueue queue;
+
+	DebugPrint(L"Render queue benchmark\n");
+
+	for (uint32 numObjects = 1000; numObjects <= 100000; numObjects *= 10)
+	{
+		bases.resize(numObjects);
+		objects.resize(numObjects);
+		for (uint32 i = 0; i < numObjects; i++)
+		{
+			bases[i] = Float4x4::TranslationMatrix(Float3(posDist(rng), posDist(rng), posDist(rng)));
+			objects[i] = SceneObject();
+			objects[i].base = &bases[i];
+		}
+
+		Timer timer;
+
+		// what sortSceneObjects used to do, two transforms per comparison
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			sorted = objects;
+			std::sort(sorted.begin(), sorted.end(), OpaqueObjectDepthCompare(view));
+		}
+		timer.Update();
+		double comparatorMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			queue.Clear();
+			for (uint32 i = 0; i < numObjects; i++)
+			{
+				float depth = Float3::Transform(objects[i].base->Translation(), view).z;
+				queue.Add(RenderQueue::SortableFloatBits(depth), i);
+			}
+			queue.Sort();
+
+			sorted.resize(numObjects);
+			for (uint32 i = 0; i < numObjects; i++)
+			{
+				sorted[i] = objects[queue.getItems()[i].payload];
+			}
+		}
+		timer.Update();
+		double radixMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		// both orders have to agree on depth
+		bool sameOrder = true;
+		std::vector<SceneObject> reference = objects;
+		std::stable_sort(reference.begin(), reference.end(), OpaqueObjectDepthCompare(view));
+		for (uint32 i = 0; i < numObjects && sameOrder; i++)
+		{
+			sameOrder = reference[i].base == sorted[i].base;
+		}
+
+		DebugPrint(ToString(numObjects) + L" objects: std::sort comparator " + ToString(comparatorMs) + L"ms, keys + radix sort "
+			+ ToString(radixMs) + L"ms, order " + (sameOrder ? L"matches\n" : L"DIFFERS\n"));
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "PCH.h"
+
+using namespace SampleFramework11;
+
+// Draw items ordered by a 64-bit key computed once per item. Sort() is an LSD radix sort over
+// 8-bit digits that skips digits every key shares, so it is stable and only pays for the key
+// bits that actually vary. MakeKey() packs state from most to least expensive to change, with
+// quantized depth last so items with the same state draw front to back.
+class RenderQueue
+{
+public:
+	struct Item
+	{
+		uint64 key;
+		uint32 payload;
+	};
+
+	// Bits per field, from the top of the key
+	static const uint32 PermutationBits = 8;
+	static const uint32 MeshBits = 16;
+	static const uint32 MaterialBits = 16;
+	static const uint32 DepthBits = 24;
+
+	// depth01 is the linear view depth mapped to [0, 1], values outside are clamped
+	static uint64 MakeKey(uint32 permutation, uint32 mesh, uint32 material, float depth01);
+
+	// Monotonic float -> uint32 mapping, for keys that are only a depth
+	static uint32 SortableFloatBits(float value);
+
+	void Clear();
+	void Add(uint64 key, uint32 payload);
+	void Sort();
+
+	inline const std::vector<Item> &getItems() const { return _items; }
+	inline uint32 getNumItems() const { return (uint32)_items.size(); }
+
+	// Compares std::sort with OpaqueObjectDepthCompare against computing depth keys once and
+	// radix sorting them, for 1k, 10k and 100k objects
+	static void RunBenchmark();
+
+private:
+	std::vector<Item> _items;
+	std::vector<Item> _scratch;
+};
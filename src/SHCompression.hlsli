@@ -0,0 +1,82 @@
+#ifndef SH_COMPRESSION
+#define SH_COMPRESSION
+
+#include <SH.hlsl>
+
+// 32 byte probe SH, same layout as CompressedSH9Color in SHProbeCompression.h: FP16 DC per
+// channel, and the L1/L2 coefficients as 8-bit snorm relative to their channel's DC times a
+// per-probe FP16 scale. Coefficient i > 0 of channel c is byte (i - 1) * 3 + c.
+struct CompressedSH9Color
+{
+	uint dcRG;
+	uint dcBScale;
+	uint coefficients[6];
+};
+
+CompressedSH9Color CompressSH9Color(in PaddedSH9Color sh)
+{
+	// Ratios against the DC the decoder will see
+	const uint3 dcBits = f32tof16(sh.c[0].xyz);
+	const float3 dc = f16tof32(dcBits);
+	const float3 invDC = float3(dc.x != 0.0f ? 1.0f / dc.x : 0.0f, dc.y != 0.0f ? 1.0f / dc.y : 0.0f,
+								dc.z != 0.0f ? 1.0f / dc.z : 0.0f);
+
+	float3 maxRatio = 0.0f;
+	[unroll]
+	for(uint i = 1; i < 9; ++i)
+		maxRatio = max(maxRatio, abs(sh.c[i].xyz * invDC));
+
+	// Round the scale up so no coefficient clips
+	const float maxScale = max(maxRatio.x, max(maxRatio.y, maxRatio.z));
+	uint scaleBits = f32tof16(maxScale);
+	if(f16tof32(scaleBits) < maxScale)
+		scaleBits += 1;
+	const float scale = f16tof32(scaleBits);
+	const float toSNorm = scale > 0.0f ? 127.0f / scale : 0.0f;
+
+	CompressedSH9Color packed;
+	packed.dcRG = dcBits.x | (dcBits.y << 16);
+	packed.dcBScale = dcBits.z | (scaleBits << 16);
+
+	[unroll]
+	for(uint w = 0; w < 6; ++w)
+		packed.coefficients[w] = 0;
+
+	[unroll]
+	for(uint j = 0; j < 24; ++j)
+	{
+		const uint c = j % 3;
+		const int q = clamp(int(floor(sh.c[1 + j / 3][c] * invDC[c] * toSNorm + 0.5f)), -127, 127);
+		packed.coefficients[j / 4] |= (uint(q) & 0xFF) << ((j % 4) * 8);
+	}
+
+	return packed;
+}
+
+PaddedSH9Color DecompressSH9Color(in CompressedSH9Color packed)
+{
+	const float3 dc = f16tof32(uint3(packed.dcRG, packed.dcRG >> 16, packed.dcBScale));
+	const float3 scale = dc * (f16tof32(packed.dcBScale >> 16) / 127.0f);
+
+	PaddedSH9Color sh;
+	sh.c[0] = float4(dc, 0.0f);
+
+	[unroll]
+	for(uint i = 0; i < 8; ++i)
+	{
+		// sign extend the three bytes of this coefficient
+		int3 q;
+		[unroll]
+		for(uint c = 0; c < 3; ++c)
+		{
+			const uint byteIndex = i * 3 + c;
+			q[c] = asint(packed.coefficients[byteIndex / 4] << (24 - (byteIndex % 4) * 8)) >> 24;
+		}
+
+		sh.c[1 + i] = float4(q * scale, 0.0f);
+	}
+
+	return sh;
+}
+
+#endif
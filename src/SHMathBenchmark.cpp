@@ -0,0 +1,290 @@
+#include "SHMathBenchmark.h"
+
+#include <Graphics\\SH.h>
+#include <Utility.h>
+#include <Timer.h>
+
+#include <random>
+
+static float maxSHDifference(const SH9 &a, const SH9 &b)
+{
+	float maxDiff = 0.0f;
+	for (uint32 i = 0; i < 9; i++)
+		maxDiff = Max(maxDiff, std::abs(a.Coefficients[i] - b.Coefficients[i]));
+	return maxDiff;
+}
+
+static float maxSHDifference(const SH9Color &a, const SH9Color &b)
+{
+	float maxDiff = 0.0f;
+	for (uint32 i = 0; i < 9; i++)
+	{
+		Float3 diff = a.Coefficients[i] - b.Coefficients[i];
+		maxDiff = Max(maxDiff, Max(std::abs(diff.x), Max(std::abs(diff.y), std::abs(diff.z))));
+	}
+	return maxDiff;
+}
+
+static Float3 randomDirection(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> zDist(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> phiDist(0.0f, 2.0f * Pi);
+	const float z = zDist(rng);
+	const float phi = phiDist(rng);
+	const float r = std::sqrt(Max(0.0f, 1.0f - z * z));
+	return Float3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+static Float3x3 randomRotation(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> angleDist(0.0f, 2.0f * Pi);
+	return Quaternion::FromAxisAngle(randomDirection(rng), angleDist(rng)).ToFloat3x3();
+}
+
+static SH9 randomSH9(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	SH9 sh;
+	for (uint32 i = 0; i < 9; i++)
+		sh.Coefficients[i] = dist(rng);
+	return sh;
+}
+
+static float evalSH9(const SH9 &sh, const Float3 &dir)
+{
+	return SH9::Dot(sh, ProjectOntoSH9(dir));
+}
+
+// Projection of the product of two functions by brute force integration over the sphere
+static SH9 projectProductBruteForce(const SH9 &a, const SH9 &b)
+{
+	static const uint32 NumZ = 128;
+	static const uint32 NumPhi = 256;
+	const float weight = 4.0f * Pi / (NumZ * NumPhi);
+
+	double sums[9] = { 0.0 };
+	for (uint32 zi = 0; zi < NumZ; zi++)
+	{
+		const float z = ((zi + 0.5f) / NumZ) * 2.0f - 1.0f;
+		const float r = std::sqrt(1.0f - z * z);
+		for (uint32 phiIdx = 0; phiIdx < NumPhi; phiIdx++)
+		{
+			const float phi = ((phiIdx + 0.5f) / NumPhi) * 2.0f * Pi;
+			const Float3 dir(r * std::cos(phi), r * std::sin(phi), z);
+			const SH9 basis = ProjectOntoSH9(dir);
+			const float product = SH9::Dot(a, basis) * SH9::Dot(b, basis) * weight;
+			for (uint32 i = 0; i < 9; i++)
+				sums[i] += basis.Coefficients[i] * product;
+		}
+	}
+
+	SH9 result;
+	for (uint32 i = 0; i < 9; i++)
+		result.Coefficients[i] = float(sums[i]);
+	return result;
+}
+
+static void checkBatchFunctions(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> colorDist(0.0f, 4.0f);
+	std::vector<Float3> dirs;
+	std::vector<Float3> colors;
+	std::vector<float> weights;
+	std::vector<Float3> results;
+
+	// sizes with and without a scalar tail
+	static const uint32 Counts[] = { 1, 3, 8, 13, 64, 1001 };
+	for (uint32 c = 0; c < _countof(Counts); c++)
+	{
+		const uint32 count = Counts[c];
+		dirs.resize(count);
+		colors.resize(count);
+		weights.resize(count);
+		results.resize(count);
+		for (uint32 i = 0; i < count; i++)
+		{
+			dirs[i] = randomDirection(rng);
+			colors[i] = Float3(colorDist(rng), colorDist(rng), colorDist(rng));
+			weights[i] = colorDist(rng);
+		}
+
+		SH9Color reference;
+		SH9Color referenceWeighted;
+		for (uint32 i = 0; i < count; i++)
+		{
+			reference += ProjectOntoSH9Color(dirs[i], colors[i]);
+			referenceWeighted += ProjectOntoSH9Color(dirs[i], colors[i]) * weights[i];
+		}
+
+		const float tolerance = 1e-5f * count * 16.0f;
+		Assert_(maxSHDifference(reference, ProjectOntoSH9ColorBatch(&dirs[0], &colors[0], nullptr, count)) < tolerance);
+		Assert_(maxSHDifference(referenceWeighted, ProjectOntoSH9ColorBatch(&dirs[0], &colors[0], &weights[0], count)) < tolerance);
+
+		// normalized so the evaluated irradiance stays in the range of the colors
+		const SH9Color average = reference / float(count);
+		EvalSH9CosineBatch(average, &dirs[0], count, &results[0]);
+		for (uint32 i = 0; i < count; i++)
+		{
+			Float3 diff = results[i] - EvalSH9Cosine(dirs[i], average);
+			Assert_(Max(std::abs(diff.x), Max(std::abs(diff.y), std::abs(diff.z))) < 1e-4f);
+		}
+	}
+}
+
+// A rotated projection is the projection of the rotated direction, band 0 doesn't change,
+// rotations compose, and the batch matches the single probe version
+static void checkRotation(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> colorDist(0.0f, 4.0f);
+	for (uint32 iter = 0; iter < 64; iter++)
+	{
+		const Float3x3 r0 = randomRotation(rng);
+		const Float3x3 r1 = randomRotation(rng);
+		const Float3 dir = randomDirection(rng);
+		const Float3 color(colorDist(rng), colorDist(rng), colorDist(rng));
+
+		const SH9Rotation rotation(r0);
+		const SH9Color sh = ProjectOntoSH9Color(dir, color);
+		const SH9Color rotated = rotation.Apply(sh);
+		Assert_(maxSHDifference(rotated, ProjectOntoSH9Color(Float3::Transform(dir, r0), color)) < 1e-4f);
+		Assert_(rotated.Coefficients[0] == sh.Coefficients[0]);
+
+		const SH9 scalarSH = randomSH9(rng);
+		Assert_(maxSHDifference(SH9Rotation(r1).Apply(rotation.Apply(scalarSH)), SH9Rotation(r0 * r1).Apply(scalarSH)) < 1e-4f);
+
+		SH9Color batchRotated;
+		rotation.Apply(&sh, 1, &batchRotated);
+		Assert_(maxSHDifference(rotated, batchRotated) < 1e-5f);
+	}
+}
+
+// The product with a constant 1 is the identity, products commute and match brute force
+static void checkProducts(std::mt19937 &rng)
+{
+	SH9 one;
+	one.Coefficients[0] = 1.0f / 0.282095f;
+	for (uint32 iter = 0; iter < 8; iter++)
+	{
+		const SH9 a = randomSH9(rng);
+		const SH9 b = randomSH9(rng);
+		const SH9 product = MultiplySH9(a, b);
+		Assert_(maxSHDifference(MultiplySH9(one, a), a) < 1e-4f);
+		Assert_(maxSHDifference(product, MultiplySH9(b, a)) < 1e-5f);
+		Assert_(maxSHDifference(product, projectProductBruteForce(a, b)) < 2e-3f);
+
+		SH9Color colorA;
+		for (uint32 i = 0; i < 9; i++)
+			colorA.Coefficients[i] = Float3(a.Coefficients[i], 2.0f * a.Coefficients[i], -a.Coefficients[i]);
+		const SH9Color colorProduct = MultiplySH9(colorA, b);
+		for (uint32 i = 0; i < 9; i++)
+		{
+			Assert_(std::abs(colorProduct.Coefficients[i].x - product.Coefficients[i]) < 1e-4f);
+			Assert_(std::abs(colorProduct.Coefficients[i].y - 2.0f * product.Coefficients[i]) < 2e-4f);
+		}
+
+		// scaling by a constant function scales the function everywhere
+		const Float3 dir = randomDirection(rng);
+		const SH9 scaled = MultiplySH9(one * 3.0f, a);
+		Assert_(std::abs(evalSH9(scaled, dir) - 3.0f * evalSH9(a, dir)) < 1e-3f);
+	}
+}
+
+void SHMathBenchmark::Run()
+{
+	static const uint32 NumIterations = 8;
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> colorDist(0.0f, 4.0f);
+
+	checkBatchFunctions(rng);
+	checkRotation(rng);
+	checkProducts(rng);
+
+	DebugPrint(L"SH9 batch benchmark\n");
+
+	std::vector<Float3> dirs;
+	std::vector<Float3> colors;
+	std::vector<Float3> results;
+	for (uint32 count = 1024; count <= 1024 * 1024; count *= 32)
+	{
+		dirs.resize(count);
+		colors.resize(count);
+		results.resize(count);
+		for (uint32 i = 0; i < count; i++)
+		{
+			dirs[i] = randomDirection(rng);
+			colors[i] = Float3(colorDist(rng), colorDist(rng), colorDist(rng));
+		}
+
+		Timer timer;
+
+		SH9Color scalarSH;
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			scalarSH = SH9Color();
+			for (uint32 i = 0; i < count; i++)
+				scalarSH += ProjectOntoSH9Color(dirs[i], colors[i]);
+		}
+		timer.Update();
+		const double scalarProjectMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		SH9Color batchSH;
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+			batchSH = ProjectOntoSH9ColorBatch(&dirs[0], &colors[0], nullptr, count);
+		timer.Update();
+		const double batchProjectMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+			for (uint32 i = 0; i < count; i++)
+				results[i] = EvalSH9Cosine(dirs[i], batchSH);
+		timer.Update();
+		const double scalarEvalMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+			EvalSH9CosineBatch(batchSH, &dirs[0], count, &results[0]);
+		timer.Update();
+		const double batchEvalMs = timer.DeltaMillisecondsD() / NumIterations;
+
+		DebugPrint(ToString(count) + L" directions: project scalar " + ToString(scalarProjectMs) + L"ms, batch "
+			+ ToString(batchProjectMs) + L"ms, evaluate scalar " + ToString(scalarEvalMs) + L"ms, batch "
+			+ ToString(batchEvalMs) + L"ms, relative projection difference "
+			+ ToString(maxSHDifference(scalarSH, batchSH) / Max(1.0f, scalarSH.Coefficients[0].x)) + L"\n");
+	}
+
+	// Rotating a volume's worth of probes, rebuilding the rotation per probe against building it once
+	static const uint32 NumProbes = 16384;
+	std::vector<SH9Color> probes(NumProbes);
+	std::vector<SH9Color> rotated(NumProbes);
+	for (uint32 p = 0; p < NumProbes; p++)
+		probes[p] = ProjectOntoSH9Color(randomDirection(rng), Float3(colorDist(rng), colorDist(rng), colorDist(rng)));
+	const Float3x3 rotationMatrix = randomRotation(rng);
+
+	Timer timer;
+	timer.Update();
+	for (uint32 iter = 0; iter < NumIterations; iter++)
+		for (uint32 p = 0; p < NumProbes; p++)
+			rotated[p] = RotateSH9(probes[p], rotationMatrix);
+	timer.Update();
+	const double perProbeMs = timer.DeltaMillisecondsD() / NumIterations;
+
+	timer.Update();
+	for (uint32 iter = 0; iter < NumIterations; iter++)
+		SH9Rotation(rotationMatrix).Apply(&probes[0], NumProbes, &rotated[0]);
+	timer.Update();
+	const double batchRotateMs = timer.DeltaMillisecondsD() / NumIterations;
+
+	SH9 visibility = randomSH9(rng);
+	timer.Update();
+	for (uint32 iter = 0; iter < NumIterations; iter++)
+		for (uint32 p = 0; p < NumProbes; p++)
+			rotated[p] = MultiplySH9(probes[p], visibility);
+	timer.Update();
+	const double productMs = timer.DeltaMillisecondsD() / NumIterations;
+
+	DebugPrint(ToString(NumProbes) + L" probes: RotateSH9 per probe " + ToString(perProbeMs) + L"ms, SH9Rotation batch "
+		+ ToString(batchRotateMs) + L"ms, MultiplySH9 " + ToString(productMs) + L"ms\n");
+}
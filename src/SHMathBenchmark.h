@@ -0,0 +1,15 @@
+#pragma once
+#include "PCH.h"
+
+using namespace SampleFramework11;
+
+// The framework's SH9 batch, rotation and product functions. They need the framework and its
+// SSE/AVX paths, so they are checked here rather than in Tests/.
+class SHMathBenchmark
+{
+public:
+	// Asserts that the batch functions match the scalar ones and rotation/products match brute
+	// force projection, then times batch against scalar for 1k to 1M directions and rotating and
+	// multiplying 16k probes
+	static void Run();
+};
@@ -0,0 +1,257 @@
+#include "SHProbeBaker.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Same face orientations as IrradianceVolume::_CubemapCameraStruct
+static const Float3 FaceLookAt[6] =
+{
+	Float3(1.0f, 0.0f, 0.0f), Float3(-1.0f, 0.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f),
+	Float3(0.0f, -1.0f, 0.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 0.0f, -1.0f),
+};
+
+static const Float3 FaceUp[6] =
+{
+	Float3(0.0f, 1.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f), Float3(0.0f, 0.0f, -1.0f),
+	Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 1.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f),
+};
+
+// Cosine kernel the integration convolves with, see ProjectOntoSH in RelightSH.hlsl
+static const float KernelA0 = 3.141593f;
+static const float KernelA1 = 2.095395f;
+static const float KernelA2 = 0.785398f;
+
+static void projectOntoSH9Cosine(const Float3 &n, float sh[9])
+{
+	sh[0] = 0.282095f * KernelA0;
+	sh[1] = 0.488603f * n.y * KernelA1;
+	sh[2] = 0.488603f * n.z * KernelA1;
+	sh[3] = 0.488603f * n.x * KernelA1;
+	sh[4] = 1.092548f * n.x * n.y * KernelA2;
+	sh[5] = 1.092548f * n.y * n.z * KernelA2;
+	sh[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f) * KernelA2;
+	sh[7] = 1.092548f * n.x * n.z * KernelA2;
+	sh[8] = 0.546274f * (n.x * n.x - n.y * n.y) * KernelA2;
+}
+
+// Bilinear sample with wrap addressing, like the Linear sampler
+static Float4 sampleBilinear(const Float4 *map, uint32 size, float u, float v)
+{
+	float x = u * size - 0.5f;
+	float y = v * size - 0.5f;
+	float fx = floorf(x);
+	float fy = floorf(y);
+	float tx = x - fx;
+	float ty = y - fy;
+
+	int32 x0 = (int32)fx;
+	int32 y0 = (int32)fy;
+	auto texel = [&](int32 px, int32 py) -> Float4
+	{
+		uint32 wx = (uint32)(((px % (int32)size) + (int32)size) % (int32)size);
+		uint32 wy = (uint32)(((py % (int32)size) + (int32)size) % (int32)size);
+		return map[wy * size + wx];
+	};
+
+	Float4 top = texel(x0, y0) * Float4(1.0f - tx) + texel(x0 + 1, y0) * Float4(tx);
+	Float4 bottom = texel(x0, y0 + 1) * Float4(1.0f - tx) + texel(x0 + 1, y0 + 1) * Float4(tx);
+	return top * Float4(1.0f - ty) + bottom * Float4(ty);
+}
+
+SHProbeBaker::Inputs::Inputs() : numProbes(0), probePositions(nullptr), cubemapSize(0), albedoAtlas(nullptr),
+	texcoordCubemapSize(0), texcoordAtlas(nullptr), directLightMapSize(0), directLightMap(nullptr),
+	indirectLightMapSize(0), lightMapPositions(nullptr), lightMapNormals(nullptr), skyColor(0.0f),
+	probeLightRadius(0.0f), probeLightIntensity(0.0f), numBounces(1)
+{
+}
+
+SHProbeBaker::SHProbeBaker() : _finalWeight(0.0f)
+{
+}
+
+Float3 SHProbeBaker::EvalSH9Cosine(const Float3 &n, const PaddedSH9Color &sh)
+{
+	float basis[9];
+	projectOntoSH9Cosine(n, basis);
+
+	Float3 result;
+	for (uint32 i = 0; i < 9; i++)
+	{
+		result += sh.sh9[i].To3D() * basis[i];
+	}
+	return result;
+}
+
+void SHProbeBaker::Bake(const Inputs &inputs, std::vector<PaddedSH9Color> &output)
+{
+	Assert_(inputs.texcoordCubemapSize % inputs.cubemapSize == 0);
+	Assert_(inputs.numBounces <= 1 || (inputs.lightMapPositions != nullptr && inputs.lightMapNormals != nullptr));
+
+	// Integration weight, same texel positions as IntegrateCS
+	const uint32 size = inputs.cubemapSize;
+	double weightSum = 0.0;
+	for (uint32 y = 0; y < size; y++)
+	{
+		for (uint32 x = 0; x < size; x++)
+		{
+			const float u = (float(x) / float(size)) * 2.0f - 1.0f;
+			const float v = (float(y) / float(size)) * 2.0f - 1.0f;
+			const float temp = 1.0f + u * u + v * v;
+			weightSum += 4.0f / (sqrtf(temp) * temp);
+		}
+	}
+	_finalWeight = float((4.0 * 3.14159) / (weightSum * 6.0));
+
+	// First bounce, the indirect light map is cleared to (0, 0, 0, 1)
+	_indirectLightMap.clear();
+
+	output.resize(inputs.numProbes);
+	ParallelFor(0, inputs.numProbes, [&](uint32 probe)
+	{
+		relightAndIntegrate(inputs, probe, output[probe]);
+	});
+
+	if (inputs.numBounces > 1)
+	{
+		_probeTree.Build(inputs.probePositions, inputs.numProbes);
+	}
+
+	for (uint32 bounce = 1; bounce < inputs.numBounces; bounce++)
+	{
+		shadeIndirectLightMap(inputs, output);
+
+		ParallelFor(0, inputs.numProbes, [&](uint32 probe)
+		{
+			relightAndIntegrate(inputs, probe, output[probe]);
+		});
+	}
+}
+
+void SHProbeBaker::relightAndIntegrate(const Inputs &inputs, uint32 probe, PaddedSH9Color &output) const
+{
+	static const float SampleOffsets[4][2] = { { -0.5f, -0.5f }, { 0.5f, -0.5f }, { -0.5f, 0.5f }, { 0.5f, 0.5f } };
+
+	const uint32 size = inputs.cubemapSize;
+	const uint32 atlasWidth = 6 * size;
+	const uint32 texcoordSize = inputs.texcoordCubemapSize;
+	const uint32 texcoordAtlasWidth = 6 * texcoordSize;
+	const float texcoordScale = float(texcoordSize / size);
+
+	double sums[9][3] = { { 0.0 } };
+
+	for (uint32 face = 0; face < 6; face++)
+	{
+		const Float3 forward = FaceLookAt[face];
+		const Float3 right = Float3::Normalize(Float3::Cross(FaceUp[face], forward));
+		const Float3 up = Float3::Cross(forward, right);
+
+		for (uint32 y = 0; y < size; y++)
+		{
+			for (uint32 x = 0; x < size; x++)
+			{
+				// RelightCubemap.hlsl, 2x2 box filter over the texcoord atlas
+				const uint32 atlasX = face * size + x;
+				const uint32 atlasY = probe * size + y;
+				const Float3 albedo = inputs.albedoAtlas[atlasY * atlasWidth + atlasX].To3D();
+
+				Float3 radiance;
+				for (uint32 s = 0; s < 4; s++)
+				{
+					uint32 sampleX = (uint32)((atlasX + 0.5f) * texcoordScale + SampleOffsets[s][0]);
+					uint32 sampleY = (uint32)((atlasY + 0.5f) * texcoordScale + SampleOffsets[s][1]);
+					const Float4 &texcoord = inputs.texcoordAtlas[sampleY * texcoordAtlasWidth + sampleX];
+
+					if (texcoord.z > 0.0f)
+					{
+						radiance += inputs.skyColor;
+						continue;
+					}
+
+					Float3 light = sampleBilinear(inputs.directLightMap, inputs.directLightMapSize, texcoord.x, texcoord.y).To3D();
+					if (!_indirectLightMap.empty())
+					{
+						Float4 indirect = sampleBilinear(&_indirectLightMap[0], inputs.indirectLightMapSize, texcoord.x, texcoord.y);
+						if (indirect.w > 0.0f)
+							light += indirect.To3D() / indirect.w;
+					}
+					radiance += albedo * light;
+				}
+				radiance = Float3(Max(radiance.x, 0.0f), Max(radiance.y, 0.0f), Max(radiance.z, 0.0f)) * 0.25f;
+
+				// RelightSH.hlsl IntegrateCS
+				const float u = (x / float(size)) * 2.0f - 1.0f;
+				const float v = -((y / float(size)) * 2.0f - 1.0f);
+				const float temp = 1.0f + u * u + v * v;
+				const float weight = 4.0f / (sqrtf(temp) * temp);
+
+				Float3 dirWS = Float3::Normalize(right * u + up * v + forward);
+				float basis[9];
+				projectOntoSH9Cosine(dirWS, basis);
+
+				const Float3 weighted = radiance * weight;
+				for (uint32 i = 0; i < 9; i++)
+				{
+					sums[i][0] += basis[i] * weighted.x;
+					sums[i][1] += basis[i] * weighted.y;
+					sums[i][2] += basis[i] * weighted.z;
+				}
+			}
+		}
+	}
+
+	for (uint32 i = 0; i < 9; i++)
+	{
+		output.sh9[i] = Float4(float(sums[i][0]) * _finalWeight, float(sums[i][1]) * _finalWeight,
+			float(sums[i][2]) * _finalWeight, 0.0f);
+	}
+}
+
+void SHProbeBaker::shadeIndirectLightMap(const Inputs &inputs, const std::vector<PaddedSH9Color> &probeSH)
+{
+	// IndirectDiffuse.hlsl: every covered texel sums the SH probe lights reaching it
+	const uint32 size = inputs.indirectLightMapSize;
+	_indirectLightMap.assign(size * size, Float4(0.0f, 0.0f, 0.0f, 0.0f));
+
+	ParallelFor(0, size, [&](uint32 y)
+	{
+		std::vector<uint32> probes;
+		for (uint32 x = 0; x < size; x++)
+		{
+			const uint32 texel = y * size + x;
+			if (inputs.lightMapPositions[texel].w <= 0.0f) continue;
+
+			const Float3 posWS = inputs.lightMapPositions[texel].To3D();
+			const Float3 normalWS = Float3::Normalize(inputs.lightMapNormals[texel].To3D());
+
+			probes.clear();
+			_probeTree.FindInRadius(posWS, inputs.probeLightRadius, probes);
+			std::sort(probes.begin(), probes.end()); // fixed summation order
+
+			Float4 lighting(0.0f, 0.0f, 0.0f, 0.0f);
+			for (size_t i = 0; i < probes.size(); i++)
+			{
+				// CalcSHProbeLight
+				Float3 lightDir = inputs.probePositions[probes[i]] - posWS;
+				const float dist = Float3::Length(lightDir);
+				lightDir = dist > 0.0f ? lightDir / dist : Float3(0.0f, 1.0f, 0.0f);
+
+				const float att = 1.0f - Saturate(dist / inputs.probeLightRadius);
+				const float nDotL = Saturate(Float3::Dot(normalWS, lightDir));
+				const float unitIntensity = Saturate(powf(att, 1.5f) * nDotL);
+
+				Float3 shColor;
+				if (nDotL > 0.0f)
+				{
+					Float3 irradiance = EvalSH9Cosine(normalWS, probeSH[probes[i]]);
+					shColor = Float3(Max(irradiance.x, 0.0f), Max(irradiance.y, 0.0f), Max(irradiance.z, 0.0f)) * inputs.probeLightIntensity;
+				}
+
+				lighting += Float4(shColor * (unitIntensity / 3.14159f), unitIntensity);
+			}
+
+			_indirectLightMap[texel] = lighting;
+		}
+	});
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include "CPUMath.h"
+#include "ProbeKDTree.h"
+
+using namespace SampleFramework11;
+
+// Irradiance SH for one probe, laid out like the GPU buffer: coefficient i in sh9[i].xyz
+struct PaddedSH9Color
+{
+	Float4 sh9[9];
+};
+
+// CPU implementation of IrradianceVolume's probe relighting: relight the probe G-buffer atlases
+// with the direct (and indirect) light maps, project every probe onto SH9 with the cosine kernel,
+// and bounce by shading the light map with the probes again. Nothing here touches the device, the
+// inputs are plain arrays, so it runs on machines without a GPU and doubles as a reference for
+// the GPU passes. Texel, sampling and integration conventions follow RelightCubemap.hlsl,
+// IndirectDiffuse.hlsl and RelightSH.hlsl so results compare directly. Probes are baked in
+// parallel, and each probe is summed in a fixed order, so the output is deterministic.
+class SHProbeBaker
+{
+public:
+	// Atlases are laid out like the GPU render targets: 6 faces side by side, one probe per row of
+	// faces, i.e. texel (x, y) of face f of probe p is at [(p * size + y) * 6 * size + f * size + x]
+	struct Inputs
+	{
+		uint32 numProbes;
+		const Float3 *probePositions;
+
+		uint32 cubemapSize;                 // G-buffer face size
+		const Float4 *albedoAtlas;          // rgb albedo
+
+		uint32 texcoordCubemapSize;         // proxy mesh texcoord face size, a multiple of cubemapSize
+		const Float4 *texcoordAtlas;        // xy light map uv, z > 0 where the sky is visible
+
+		uint32 directLightMapSize;
+		const Float4 *directLightMap;       // rgb direct diffuse on the proxy mesh light map
+
+		// Light map G-buffer, only needed for more than one bounce. w > 0 marks covered texels.
+		uint32 indirectLightMapSize;
+		const Float4 *lightMapPositions;    // world space position
+		const Float4 *lightMapNormals;      // world space normal
+
+		Float3 skyColor;
+		float probeLightRadius;             // SHProbeLight radius and intensity for the bounces
+		float probeLightIntensity;
+		uint32 numBounces;
+
+		Inputs();
+	};
+
+	SHProbeBaker();
+
+	void Bake(const Inputs &inputs, std::vector<PaddedSH9Color> &output);
+
+	// Irradiance in direction n, what EvalPaddedSH9Cosine returns on the GPU
+	static Float3 EvalSH9Cosine(const Float3 &n, const PaddedSH9Color &sh);
+
+private:
+	void relightAndIntegrate(const Inputs &inputs, uint32 probe, PaddedSH9Color &output) const;
+	void shadeIndirectLightMap(const Inputs &inputs, const std::vector<PaddedSH9Color> &probeSH);
+
+	float _finalWeight;
+	ProbeKDTree _probeTree;
+	std::vector<Float4> _indirectLightMap;     // rgb sum and weight, like the additive GPU target
+};
@@ -0,0 +1,168 @@
+#include "SHProbeCompression.h"
+
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(CompressedSH9Color) == 32, "CompressedSH9Color must match SHCompression.hlsli");
+
+static const float SNormMax = 127.0f;
+static const uint32 NumErrorDirections = 64;
+
+static inline float channel(const Float4 &v, uint32 c)
+{
+	return (&v.x)[c];
+}
+
+static inline float &channel(Float4 &v, uint32 c)
+{
+	return (&v.x)[c];
+}
+
+// FP16 that decodes to at least value, so the scale never clips a coefficient
+static uint16 halfRoundedUp(float value)
+{
+	uint16 bits = XMConvertFloatToHalf(value);
+	if (XMConvertHalfToFloat(bits) < value) bits++;
+	return bits;
+}
+
+// Fibonacci sphere, evenly spread directions to compare irradiance over
+static const Float3 *errorDirections()
+{
+	static Float3 directions[NumErrorDirections];
+	static bool initialized = false;
+	if (!initialized)
+	{
+		for (uint32 i = 0; i < NumErrorDirections; i++)
+		{
+			float z = 1.0f - (2.0f * i + 1.0f) / NumErrorDirections;
+			float r = std::sqrt(Max(1.0f - z * z, 0.0f));
+			float phi = i * 2.399963f;
+			directions[i] = Float3(r * std::cos(phi), r * std::sin(phi), z);
+		}
+		initialized = true;
+	}
+	return directions;
+}
+
+void SHProbeCompression::Encode(const PaddedSH9Color &sh, CompressedSH9Color &packed)
+{
+	// Ratios use the DC the decoder will see, so FP16 rounding of the DC doesn't add to the error
+	uint16 dcBits[3];
+	float dc[3];
+	for (uint32 c = 0; c < 3; c++)
+	{
+		dcBits[c] = XMConvertFloatToHalf(channel(sh.sh9[0], c));
+		dc[c] = XMConvertHalfToFloat(dcBits[c]);
+	}
+
+	float ratios[24];
+	float maxRatio = 0.0f;
+	for (uint32 i = 0; i < 24; i++)
+	{
+		uint32 c = i % 3;
+		ratios[i] = dc[c] != 0.0f ? channel(sh.sh9[1 + i / 3], c) / dc[c] : 0.0f;
+		maxRatio = Max(maxRatio, std::abs(ratios[i]));
+	}
+
+	uint16 scaleBits = halfRoundedUp(maxRatio);
+	float scale = XMConvertHalfToFloat(scaleBits);
+
+	packed.dcRG = dcBits[0] | (uint32(dcBits[1]) << 16);
+	packed.dcBScale = dcBits[2] | (uint32(scaleBits) << 16);
+	memset(packed.coefficients, 0, sizeof(packed.coefficients));
+
+	const float toSNorm = scale > 0.0f ? SNormMax / scale : 0.0f;
+	for (uint32 i = 0; i < 24; i++)
+	{
+		int32 q = (int32)std::floor(ratios[i] * toSNorm + 0.5f);
+		q = Clamp(q, -127, 127);
+		packed.coefficients[i / 4] |= (uint32(q) & 0xFF) << ((i % 4) * 8);
+	}
+}
+
+void SHProbeCompression::Decode(const CompressedSH9Color &packed, PaddedSH9Color &sh)
+{
+	float dc[3] =
+	{
+		XMConvertHalfToFloat(uint16(packed.dcRG & 0xFFFF)),
+		XMConvertHalfToFloat(uint16(packed.dcRG >> 16)),
+		XMConvertHalfToFloat(uint16(packed.dcBScale & 0xFFFF)),
+	};
+	const float scale = XMConvertHalfToFloat(uint16(packed.dcBScale >> 16)) / SNormMax;
+
+	sh.sh9[0] = Float4(dc[0], dc[1], dc[2], 0.0f);
+	for (uint32 i = 1; i < 9; i++)
+		sh.sh9[i] = Float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+	for (uint32 i = 0; i < 24; i++)
+	{
+		int8 q = int8((packed.coefficients[i / 4] >> ((i % 4) * 8)) & 0xFF);
+		uint32 c = i % 3;
+		channel(sh.sh9[1 + i / 3], c) = q * scale * dc[c];
+	}
+}
+
+void SHProbeCompression::EncodeArray(const PaddedSH9Color *sh, uint32 count, CompressedSH9Color *packed)
+{
+	for (uint32 i = 0; i < count; i++)
+		Encode(sh[i], packed[i]);
+}
+
+void SHProbeCompression::DecodeArray(const CompressedSH9Color *packed, uint32 count, PaddedSH9Color *sh)
+{
+	for (uint32 i = 0; i < count; i++)
+		Decode(packed[i], sh[i]);
+}
+
+SHProbeCompression::ErrorStats SHProbeCompression::MeasureError(const PaddedSH9Color *sh, uint32 count)
+{
+	const Float3 *directions = errorDirections();
+	const float meanIrradianceScale = 0.282095f * 3.141593f;
+
+	ErrorStats stats = { 0.0f, 0.0f, 0.0f, 0.0f };
+	double coefficientErrorSum = 0.0;
+	double irradianceErrorSum = 0.0;
+	uint32 numCoefficients = 0;
+	uint32 numIrradiance = 0;
+
+	for (uint32 p = 0; p < count; p++)
+	{
+		CompressedSH9Color packed;
+		PaddedSH9Color decoded;
+		Encode(sh[p], packed);
+		Decode(packed, decoded);
+
+		for (uint32 c = 0; c < 3; c++)
+		{
+			float dc = std::abs(channel(sh[p].sh9[0], c));
+			if (dc == 0.0f) continue;
+
+			for (uint32 i = 0; i < 9; i++)
+			{
+				float error = std::abs(channel(decoded.sh9[i], c) - channel(sh[p].sh9[i], c)) / dc;
+				stats.maxCoefficientError = Max(stats.maxCoefficientError, error);
+				coefficientErrorSum += error;
+				numCoefficients++;
+			}
+		}
+
+		// black probes have no meaningful relative error
+		Float3 dc = sh[p].sh9[0].To3D();
+		float meanIrradiance = Max(Max(dc.x, dc.y), dc.z) * meanIrradianceScale;
+		if (meanIrradiance <= 0.0f) continue;
+
+		for (uint32 d = 0; d < NumErrorDirections; d++)
+		{
+			Float3 diff = SHProbeBaker::EvalSH9Cosine(directions[d], decoded) - SHProbeBaker::EvalSH9Cosine(directions[d], sh[p]);
+			float error = Max(Max(std::abs(diff.x), std::abs(diff.y)), std::abs(diff.z)) / meanIrradiance;
+			stats.maxIrradianceError = Max(stats.maxIrradianceError, error);
+			irradianceErrorSum += error;
+			numIrradiance++;
+		}
+	}
+
+	stats.meanCoefficientError = numCoefficients > 0 ? float(coefficientErrorSum / numCoefficients) : 0.0f;
+	stats.meanIrradianceError = numIrradiance > 0 ? float(irradianceErrorSum / numIrradiance) : 0.0f;
+	return stats;
+}
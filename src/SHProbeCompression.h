@@ -0,0 +1,40 @@
+#pragma once
+#include "SHProbeBaker.h"
+
+using namespace SampleFramework11;
+
+// 32 byte encoding of a probe's irradiance SH, 4.5x smaller than PaddedSH9Color. The DC term
+// is FP16 per channel. The 8 L1/L2 coefficients are divided by their channel's DC and by one
+// FP16 scale per probe (the largest of those ratios, rounded up) and stored as 8-bit snorm, so
+// precision follows the probe's brightness. Coefficient i > 0 of channel c is byte
+// (i - 1) * 3 + c of coefficients[], lowest byte first. Same layout as SHCompression.hlsli.
+struct CompressedSH9Color
+{
+	uint32 dcRG;            // FP16 DC red | green << 16
+	uint32 dcBScale;        // FP16 DC blue | scale << 16
+	uint32 coefficients[6];
+};
+
+class SHProbeCompression
+{
+public:
+	// Coefficient errors are relative to the probe's DC in the same channel, irradiance errors
+	// are relative to the probe's mean irradiance, over a fixed set of directions
+	struct ErrorStats
+	{
+		float maxCoefficientError;
+		float meanCoefficientError;
+		float maxIrradianceError;
+		float meanIrradianceError;
+	};
+
+	static void Encode(const PaddedSH9Color &sh, CompressedSH9Color &packed);
+	static void Decode(const CompressedSH9Color &packed, PaddedSH9Color &sh);
+
+	static void EncodeArray(const PaddedSH9Color *sh, uint32 count, CompressedSH9Color *packed);
+	static void DecodeArray(const CompressedSH9Color *packed, uint32 count, PaddedSH9Color *sh);
+
+	// Round trips every probe and compares it with the float SH, irradiance through
+	// SHProbeBaker::EvalSH9Cosine like the shading does
+	static ErrorStats MeasureError(const PaddedSH9Color *sh, uint32 count);
+};
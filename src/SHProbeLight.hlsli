@@ -2,6 +2,7 @@
 #define SH_PROBELIGHT
 
 #include "LightCommon.hlsli"
+#include "SHCompression.hlsli"
 
 struct SHProbeLight
 {
@@ -16,6 +17,16 @@ struct SHProbeLight
 
 // TODO: refactor this - this is coupled with the #of t registers in ClusteredDeferred.hlsl
 StructuredBuffer<PaddedSH9Color> shProbeCoefficients : register(t11);
+StructuredBuffer<CompressedSH9Color> compressedSHProbeCoefficients : register(t14);
+
+// Needs the AppSettings constants, include AppSettings.hlsl first
+PaddedSH9Color LoadProbeSH(uint probeIndex)
+{
+	if (CompressSHProbes)
+		return DecompressSH9Color(compressedSHProbeCoefficients[probeIndex]);
+
+	return shProbeCoefficients[probeIndex];
+}
 
 float SHProbeLightFallOff(float radius, float dist)
 {
@@ -41,7 +52,7 @@ float4 CalcSHProbeLight(float3 posWS, float3 normalWS, in SHProbeLight probeLigh
 
 	if (nDotL > 0.0f)
 	{
-		PaddedSH9Color sh9 = shProbeCoefficients[probeLight.probeIndex];
+		PaddedSH9Color sh9 = LoadProbeSH(probeLight.probeIndex);
 		shColor = max(EvalPaddedSH9Cosine(normalWS, sh9), 0.0) * probeLight.intensity;
 	}
 
@@ -76,7 +87,7 @@ float4 CalcSHProbeLight(in Surface surface, in SHProbeLight probeLight, in float
 		float3 fresnel = Fresnel(surface.metallic, h, lightDir);
 		lighting += specular * fresnel*/;
 
-		PaddedSH9Color sh9 = shProbeCoefficients[probeLight.probeIndex];
+		PaddedSH9Color sh9 = LoadProbeSH(probeLight.probeIndex);
 		shColor = max(EvalPaddedSH9Cosine(surface.normalWS, sh9), 0.0) * probeLight.intensity;
 	}
 
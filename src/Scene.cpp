@@ -8,16 +8,11 @@ Scene::Scene()
 	: _sceneCamSaved(1.7778f, 0.785f * 0.75f, 0.01f, 100.0f)
 {
 	_device = NULL;
-	
-	_numStaticOpaqueObjects = 0;
-	_numDynamicOpaqueObjects = 0;
-	_numObjectBases = 0;
-	_numPrevWVPs = 0;
 
 	_sceneScale = 1;
-	_numLights = 0;
-	_numPointLights = 0;
 	_sceneBoundGenerated = false;
+	_staticBVHDirty = false;
+	_dynamicBVHDirty = false;
 
 	_sceneWSAABB_staticObj.Max = XMFLOAT3(0, 0, 0);
 	_sceneWSAABB_staticObj.Min = XMFLOAT3(0, 0, 0);
@@ -47,12 +42,13 @@ void Scene::Update(const Timer& timer)
 {
 	if (_sceneBoundGenerated == false)
 	{
-		genStaticSceneWSAABB();
+		updateStaticBVH();
 		_sceneBoundGenerated = true;
 	}
 	
 	_sceneScript->Update(this, &timer);
 	updateDynamicSceneObjectBounds();
+	updateDynamicBVH();
 }
 
 void Scene::OnSceneChange()
@@ -69,10 +65,11 @@ Model *Scene::addBoxModel()
 {
 	if (!_boxModel)
 	{
-		_models[_numTotalModelsShared++].GenerateBoxScene(_device);
-		ModelPartsBound & data = (_modelsData[_numTotalModelsShared - 1] = ModelPartsBound());
-		ComputeModelBounds(_device, _context, &_models[_numTotalModelsShared - 1], data.BoundingSpheres, data.BoundingBoxes);
-		_boxModel = &_models[_numTotalModelsShared - 1];
+		uint32 index = _models.Add();
+		_models[index].GenerateBoxScene(_device);
+		ModelPartsBound &data = _modelsData[_modelsData.Add()];
+		ComputeModelBounds(_device, _context, &_models[index], data.BoundingSpheres, data.BoundingBoxes);
+		_boxModel = &_models[index];
 	}
 	return _boxModel;
 }
@@ -81,10 +78,11 @@ Model *Scene::addPlaneModel()
 {
 	if (!_planeModel)
 	{
-		_models[_numTotalModelsShared++].GeneratePlaneScene(_device, 1.0, Float3(), Quaternion(), L"", L"Bricks_NML.dds");
-		ModelPartsBound & data = (_modelsData[_numTotalModelsShared - 1] = ModelPartsBound());
-		ComputeModelBounds(_device, _context, &_models[_numTotalModelsShared - 1], data.BoundingSpheres, data.BoundingBoxes);
-		_planeModel = &_models[_numTotalModelsShared - 1];
+		uint32 index = _models.Add();
+		_models[index].GeneratePlaneScene(_device, 1.0, Float3(), Quaternion(), L"", L"Bricks_NML.dds");
+		ModelPartsBound &data = _modelsData[_modelsData.Add()];
+		ComputeModelBounds(_device, _context, &_models[index], data.BoundingSpheres, data.BoundingBoxes);
+		_planeModel = &_models[index];
 	}
 
 	return _planeModel;
@@ -103,59 +101,55 @@ Model *Scene::addModel(const std::wstring &modelPath)
 
 	std::wstring ext = GetFileExtension(modelPath.c_str());
 
+	// Pool elements never move, the cache and scene objects can keep pointing at them
+	uint32 index = _models.Add();
+	Model &model = _models[index];
+
 	// TODO: error handling
 	if (ext == L"meshdata")
 	{
-		_models[_numTotalModelsShared].CreateFromMeshData(_device, fullPath.c_str());
-		ModelPartsBound & data = (_modelsData[_numTotalModelsShared] = ModelPartsBound());
-		ComputeModelBounds(_device, _context, &_models[_numTotalModelsShared], data.BoundingSpheres, data.BoundingBoxes);
-		_numTotalModelsShared++;
+		model.CreateFromMeshData(_device, fullPath.c_str());
 	}
 	else if (ext == L"sdkmesh")
 	{
-		_models[_numTotalModelsShared].CreateFromSDKMeshFile(_device, fullPath.c_str());
-		ModelPartsBound & data = (_modelsData[_numTotalModelsShared] = ModelPartsBound());
-		ComputeModelBounds(_device, _context, &_models[_numTotalModelsShared], data.BoundingSpheres, data.BoundingBoxes);
-		_numTotalModelsShared++;
+		model.CreateFromSDKMeshFile(_device, fullPath.c_str());
 	}
 	else
 	{
-		_models[_numTotalModelsShared].CreateWithAssimp(_device, fullPath.c_str());
-		ModelPartsBound & data = (_modelsData[_numTotalModelsShared] = ModelPartsBound());
-		ComputeModelBounds(_device, _context, &_models[_numTotalModelsShared], data.BoundingSpheres, data.BoundingBoxes);
-		_numTotalModelsShared++;
+		model.CreateWithAssimp(_device, fullPath.c_str());
 	}
 
-	_modelIndices.push_back(_numTotalModelsShared - 1);
-	_modelCache.insert(std::make_pair(fullPath, &_models[_numTotalModelsShared - 1]));
+	ModelPartsBound &data = _modelsData[_modelsData.Add()];
+	ComputeModelBounds(_device, _context, &model, data.BoundingSpheres, data.BoundingBoxes);
+
+	_modelIndices.push_back((int)index);
+	_modelCache.insert(std::make_pair(fullPath, &model));
 
-	return &_models[_numTotalModelsShared - 1];
+	return &model;
 }
 
 void Scene::setProxySceneObject(const std::wstring &modelPath, float scale, const Float3 &pos, const Quaternion &rot)
 {
 	Model *m = addModel(modelPath);
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
+	uint32 baseIndex = _objectBases.Add(createBase(scale, pos, rot));
+	uint32 prevWVPIndex = _prevWVPs.Add(_objectBases[baseIndex]);
 
 	SceneObject &obj = _proxySceneObject;
-	obj.base = &_objectBases[_numObjectBases];
+	obj.base = &_objectBases[baseIndex];
 	obj.model = m;
 	obj.bound = nullptr;
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
+	obj.prevWVP = &_prevWVPs[prevWVPIndex];
+	obj.handle.flags = 0;
+	obj.handle.slot = 0;
 	obj.id = _highestSceneObjId++;
 
-	_numObjectBases++;
-	_numPrevWVPs++;
-
 	_hasProxySceneObject = true;
 }
 
-void Scene::genSceneObjectBounds(uint64 objTypeflag, uint64 sceneObjIndex, uint64 modelIndex)
+void Scene::genSceneObjectBounds(uint64 objTypeflag, uint32 slot, uint64 modelIndex)
 {
 	bool isstatic = (objTypeflag & STATIC_OBJ) > 0;
 	bool isopaque = (objTypeflag & OPAQUE_OBJ) > 0;
-	SceneObject *sceneObj = nullptr;
 	SceneObjectBound *sceneObjBound = nullptr;
 	ModelPartsBound *sceneModelPartsBound = nullptr;
 	BBox *sceneObjBBox = nullptr;
@@ -165,41 +159,48 @@ void Scene::genSceneObjectBounds(uint64 objTypeflag, uint64 sceneObjIndex, uint6
 	{
 		if (isopaque)
 		{
-			sceneObj = &_staticOpaqueObjects[sceneObjIndex];
-			sceneObjBound = &_sceneStaticOpaqueObjectBounds[sceneObjIndex];
-			sceneObjBBox = &_staticOpaqueObjectsBBoxes[sceneObjIndex];
-			sceneObjBSphere = &_staticOpaqueObjectsBSpheres[sceneObjIndex];
-			sceneModelPartsBound = &_sceneStaticOpaqueObjectModelPartsBounds[sceneObjIndex];
+			sceneObjBound = &_sceneStaticOpaqueObjectBounds[_sceneStaticOpaqueObjectBounds.Add()];
+			sceneObjBBox = &_staticOpaqueObjectsBBoxes[_staticOpaqueObjectsBBoxes.Add()];
+			sceneObjBSphere = &_staticOpaqueObjectsBSpheres[_staticOpaqueObjectsBSpheres.Add()];
+			sceneModelPartsBound = &_sceneStaticOpaqueObjectModelPartsBounds[_sceneStaticOpaqueObjectModelPartsBounds.Add()];
 		}
 	}
 	else
 	{	
 		if (isopaque)
 		{
-			sceneObj = &_dynamicOpaqueObjects[sceneObjIndex];
-			sceneObjBound = &_sceneDynamicOpaqueObjectBounds[sceneObjIndex];
-			sceneObjBBox = &_dynamicOpaqueObjectsBBoxes[sceneObjIndex];
-			sceneObjBSphere = &_dynamicOpaqueObjectsBSpheres[sceneObjIndex];
-			sceneModelPartsBound = &_sceneDynamicOpaqueObjectModelPartsBounds[sceneObjIndex];
+			sceneObjBound = &_sceneDynamicOpaqueObjectBounds[_sceneDynamicOpaqueObjectBounds.Add()];
+			sceneObjBBox = &_dynamicOpaqueObjectsBBoxes[_dynamicOpaqueObjectsBBoxes.Add()];
+			sceneObjBSphere = &_dynamicOpaqueObjectsBSpheres[_dynamicOpaqueObjectsBSpheres.Add()];
+			sceneModelPartsBound = &_sceneDynamicOpaqueObjectModelPartsBounds[_sceneDynamicOpaqueObjectModelPartsBounds.Add()];
 		}
 	}
 
+	// every pool of a kind grows together, the new elements sit at the object's slot
+	Assert_(slot + 1 == (isstatic ? _sceneStaticOpaqueObjectBounds.size() : _sceneDynamicOpaqueObjectBounds.size()));
+	SceneObjectHandle handle = { (uint32)objTypeflag, slot };
+	SceneObject *sceneObj = getSceneObject(handle);
+
 	// memcpy(sceneModelPartsBound, &_modelsData[modelIndex], sizeof(ModelPartsBound));
 	sceneModelPartsBound->FrustumTests = { };
 	sceneModelPartsBound->NumSuccessfulTests = 0;
-	sceneModelPartsBound->BoundingBoxes.resize(_modelsData[modelIndex].BoundingBoxes.size());
-	sceneModelPartsBound->BoundingSpheres.resize(_modelsData[modelIndex].BoundingSpheres.size());
-	std::copy(_modelsData[modelIndex].BoundingBoxes.begin(), _modelsData[modelIndex].BoundingBoxes.end(), sceneModelPartsBound->BoundingBoxes.begin());
-	std::copy(_modelsData[modelIndex].BoundingSpheres.begin(), _modelsData[modelIndex].BoundingSpheres.end(), sceneModelPartsBound->BoundingSpheres.begin());
+	sceneModelPartsBound->BoundingBoxes = _modelsData[(uint32)modelIndex].BoundingBoxes;
+	sceneModelPartsBound->BoundingSpheres = _modelsData[(uint32)modelIndex].BoundingSpheres;
 	
 	sceneObjBound->modelPartsBound = sceneModelPartsBound;
 	sceneObjBound->frustumTest = false;
-	sceneObjBound->originalModelPartsBound = &_modelsData[modelIndex];
+	sceneObjBound->originalModelPartsBound = &_modelsData[(uint32)modelIndex];
 	sceneObjBound->bbox = sceneObjBBox;
 	sceneObjBound->bsphere = sceneObjBSphere;
+	sceneObj->bound = sceneObjBound;
 
 	transformSceneObjectModelPartsBounds(sceneObj);
 
+	if (isstatic)
+		_staticBVHDirty = true;
+	else
+		_dynamicBVHDirty = true;
+
 	// TODO: cache merge bounds of the same model
 	BBox bbox = MergeBoundingBoxes(sceneModelPartsBound->BoundingBoxes);
 	BSphere bsphere = MergeBoundingSpheres(sceneModelPartsBound->BoundingSpheres);
@@ -207,177 +208,88 @@ void Scene::genSceneObjectBounds(uint64 objTypeflag, uint64 sceneObjIndex, uint6
 	*sceneObjBSphere = bsphere;
 }
 
-SceneObject *Scene::addDynamicOpaqueBoxObject(float scale, const Float3 &pos, const Quaternion &rot)
+SceneObjectHandle Scene::addSceneObject(uint64 objTypeflag, Model *model, float scale, const Float3 &pos, const Quaternion &rot)
 {
-	Assert_(_numObjectBases < MAX_DYNAMIC_OBJECTS);
-	Assert_(_numTotalModelsShared < MAX_MODELS);
-	Assert_(_numObjectBases < MAX_OBJECT_MATRICES);
-	Assert_(_numPrevWVPs < MAX_OBJECT_MATRICES);
-
-	if (!_boxModel)
-	{
-		addBoxModel();
-		_modelIndices.push_back(_numTotalModelsShared - 1);
-	}
+	Assert_(model != nullptr);
+	Assert_((objTypeflag & OPAQUE_OBJ) != 0); // TODO: transparent
 
-	uint64 modelIndex = getModelIndex(_boxModel);
+	uint64 modelIndex = getModelIndex(model);
 	Assert_(modelIndex != -1);
 
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
-	_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects] = SceneObjectBound();
+	bool isstatic = (objTypeflag & STATIC_OBJ) > 0;
+	std::vector<SceneObject> &objects = isstatic ? _staticOpaqueObjects : _dynamicOpaqueObjects;
+	std::vector<uint32> &indices = isstatic ? _staticOpaqueObjectIndices : _dynamicOpaqueObjectIndices;
+
+	uint32 baseIndex = _objectBases.Add(createBase(scale, pos, rot));
+	uint32 prevWVPIndex = _prevWVPs.Add(_objectBases[baseIndex]);
+
+	uint32 slot = (uint32)objects.size();
+	indices.push_back(slot);
+	objects.push_back(SceneObject());
 
-	SceneObject &obj = _dynamicOpaqueObjects[_numDynamicOpaqueObjects];
-	obj.base = &_objectBases[_numObjectBases];
-	obj.model = _boxModel;
-	obj.bound = &_sceneDynamicOpaqueObjectBounds[_numDynamicOpaqueObjects];
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
+	SceneObject &obj = objects.back();
+	obj.base = &_objectBases[baseIndex];
+	obj.model = model;
+	obj.bound = nullptr;
+	obj.prevWVP = &_prevWVPs[prevWVPIndex];
+	obj.handle.flags = (uint32)objTypeflag;
+	obj.handle.slot = slot;
 	obj.id = _highestSceneObjId++;
 
-	genSceneObjectBounds(DYNAMIC_OBJ | OPAQUE_OBJ, _numDynamicOpaqueObjects, modelIndex);
+	genSceneObjectBounds(objTypeflag, slot, modelIndex);
 
-	_numObjectBases++;
-	_numPrevWVPs++;
-	_numDynamicOpaqueObjects++;
+	return obj.handle;
+}
 
-	return &obj;
+SceneObject *Scene::getSceneObject(SceneObjectHandle handle)
+{
+	if (handle.flags & STATIC_OBJ)
+		return &_staticOpaqueObjects[_staticOpaqueObjectIndices[handle.slot]];
+	else
+		return &_dynamicOpaqueObjects[_dynamicOpaqueObjectIndices[handle.slot]];
 }
 
-SceneObject *Scene::addStaticOpaquePlaneObject(float scale, const Float3 &pos, const Quaternion &rot)
+SceneObjectHandle Scene::addDynamicOpaqueBoxObject(float scale, const Float3 &pos, const Quaternion &rot)
 {
-	Assert_(_numObjectBases < MAX_STATIC_OBJECTS);
-	Assert_(_numTotalModelsShared < MAX_MODELS);
-	Assert_(_numObjectBases < MAX_OBJECT_MATRICES);
-	Assert_(_numPrevWVPs < MAX_OBJECT_MATRICES);
+	if (!_boxModel)
+	{
+		addBoxModel();
+		_modelIndices.push_back((int)_models.size() - 1);
+	}
 
+	return addSceneObject(DYNAMIC_OBJ | OPAQUE_OBJ, _boxModel, scale, pos, rot);
+}
+
+SceneObjectHandle Scene::addStaticOpaquePlaneObject(float scale, const Float3 &pos, const Quaternion &rot)
+{
 	if (!_planeModel)
 	{
 		addPlaneModel();
-		_modelIndices.push_back(_numTotalModelsShared - 1);
+		_modelIndices.push_back((int)_models.size() - 1);
 	}
 
-	uint64 modelIndex = getModelIndex(_planeModel);
-	Assert_(modelIndex != -1);
-
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
-	_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects] = SceneObjectBound();
-
-	SceneObject &obj = _staticOpaqueObjects[_numStaticOpaqueObjects];
-	obj.base = &_objectBases[_numObjectBases];
-	obj.model = _planeModel;
-	obj.bound = &_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects];
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
-	obj.id = _highestSceneObjId++;
-
-
-	genSceneObjectBounds(STATIC_OBJ | OPAQUE_OBJ, _numStaticOpaqueObjects, modelIndex);
-
-	_numObjectBases++;
-	_numPrevWVPs++;
-	_numStaticOpaqueObjects++;
-
-	return &obj;
+	return addSceneObject(STATIC_OBJ | OPAQUE_OBJ, _planeModel, scale, pos, rot);
 }
-SceneObject *Scene::addDynamicOpaquePlaneObject(float scale, const Float3 &pos, const Quaternion &rot)
-{
-	Assert_(_numObjectBases < MAX_DYNAMIC_OBJECTS);
-	Assert_(_numTotalModelsShared < MAX_MODELS);
-	Assert_(_numObjectBases < MAX_OBJECT_MATRICES);
-	Assert_(_numPrevWVPs < MAX_OBJECT_MATRICES);
 
+SceneObjectHandle Scene::addDynamicOpaquePlaneObject(float scale, const Float3 &pos, const Quaternion &rot)
+{
 	if (!_planeModel)
 	{
 		addPlaneModel();
-		_modelIndices.push_back(_numTotalModelsShared - 1);
+		_modelIndices.push_back((int)_models.size() - 1);
 	}
 
-	uint64 modelIndex = getModelIndex(_planeModel);
-	Assert_(modelIndex != -1);
-
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
-	_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects] = SceneObjectBound();
-
-	SceneObject &obj = _dynamicOpaqueObjects[_numDynamicOpaqueObjects];
-	obj.base = &_objectBases[_numObjectBases];
-	obj.model = _planeModel;
-	obj.bound = &_sceneDynamicOpaqueObjectBounds[_numDynamicOpaqueObjects];
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
-	obj.id = _highestSceneObjId++;
-
-	
-	genSceneObjectBounds(DYNAMIC_OBJ | OPAQUE_OBJ, _numDynamicOpaqueObjects, modelIndex);
-
-	_numObjectBases++;
-	_numPrevWVPs++;
-	_numDynamicOpaqueObjects++;
-	
-	return &obj;
+	return addSceneObject(DYNAMIC_OBJ | OPAQUE_OBJ, _planeModel, scale, pos, rot);
 }
 
-SceneObject *Scene::addStaticOpaqueObject(Model *model, float scale, const Float3 &pos, const Quaternion &rot)
+SceneObjectHandle Scene::addStaticOpaqueObject(Model *model, float scale, const Float3 &pos, const Quaternion &rot)
 {
-	Assert_(model != nullptr);
-	Assert_(_numObjectBases < MAX_STATIC_OBJECTS);
-	Assert_(_numTotalModelsShared < MAX_MODELS);
-	Assert_(_numObjectBases < MAX_OBJECT_MATRICES);
-	Assert_(_numPrevWVPs < MAX_OBJECT_MATRICES);
-
-	uint64 modelIndex = getModelIndex(model);
-	Assert_(modelIndex != -1);
-
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
-	_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects] = SceneObjectBound();
-
-	SceneObject &obj = _staticOpaqueObjects[_numStaticOpaqueObjects];
-	obj.base = &_objectBases[_numObjectBases];
-	obj.model = model;
-	obj.bound = &_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects];
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
-	obj.id = _highestSceneObjId++;
-
-	genSceneObjectBounds(STATIC_OBJ | OPAQUE_OBJ, _numStaticOpaqueObjects, modelIndex);
-
-	_numObjectBases++;
-	_numPrevWVPs++;
-	_numStaticOpaqueObjects++;
-
-	genStaticSceneWSAABB();
-
-	return &obj;
+	return addSceneObject(STATIC_OBJ | OPAQUE_OBJ, model, scale, pos, rot);
 }
 
-SceneObject *Scene::addDynamicOpaqueObject(Model *model, float scale, const Float3 &pos, const Quaternion &rot)
+SceneObjectHandle Scene::addDynamicOpaqueObject(Model *model, float scale, const Float3 &pos, const Quaternion &rot)
 {
-	Assert_(model != nullptr);
-	Assert_(_numObjectBases < MAX_DYNAMIC_OBJECTS);
-	Assert_(_numTotalModelsShared < MAX_MODELS);
-	Assert_(_numObjectBases < MAX_OBJECT_MATRICES);
-	Assert_(_numPrevWVPs < MAX_OBJECT_MATRICES);
-
-	uint64 modelIndex = getModelIndex(model);
-	Assert_(modelIndex != -1);
-
-	_objectBases[_numObjectBases] = createBase(scale, pos, rot);
-	_prevWVPs[_numPrevWVPs] = _objectBases[_numObjectBases];
-	_sceneStaticOpaqueObjectBounds[_numStaticOpaqueObjects] = SceneObjectBound();
-
-	SceneObject &obj = _dynamicOpaqueObjects[_numDynamicOpaqueObjects];
-	obj.base = &_objectBases[_numObjectBases];
-	obj.model = model;
-	obj.bound = &_sceneDynamicOpaqueObjectBounds[_numDynamicOpaqueObjects];
-	obj.prevWVP = &_prevWVPs[_numPrevWVPs];
-	obj.id = _highestSceneObjId++;
-
-	genSceneObjectBounds(DYNAMIC_OBJ | OPAQUE_OBJ, _numDynamicOpaqueObjects, modelIndex);
-
-	_numObjectBases++;
-	_numPrevWVPs++;
-	_numDynamicOpaqueObjects++;
-
-	return &obj;
+	return addSceneObject(DYNAMIC_OBJ | OPAQUE_OBJ, model, scale, pos, rot);
 }
 
 Float4x4 Scene::createBase(float scale, const Float3 &pos, const Quaternion &rot)
@@ -392,26 +304,42 @@ Float4x4 Scene::createBase(float scale, const Float3 &pos, const Quaternion &rot
 
 void Scene::sortSceneObjects(const Float4x4 &viewMatrix)
 {
-	// opaque
-	OpaqueObjectDepthCompare opqCmp(viewMatrix);
-	std::sort(_staticOpaqueObjects, _staticOpaqueObjects + _numStaticOpaqueObjects, opqCmp);
-	std::sort(_dynamicOpaqueObjects, _dynamicOpaqueObjects + _numDynamicOpaqueObjects, opqCmp);
+	// opaque, front to back
+	sortSceneObjectsByDepth(viewMatrix, _staticOpaqueObjects, _staticOpaqueObjectIndices);
+	sortSceneObjectsByDepth(viewMatrix, _dynamicOpaqueObjects, _dynamicOpaqueObjectIndices);
 	
 	// TODO: transparent
 }
 
-PointLight *Scene::addPointLight()
+void Scene::sortSceneObjectsByDepth(const Float4x4 &viewMatrix, std::vector<SceneObject> &objects, std::vector<uint32> &indices)
 {
-	if (_numLights >= MAX_SCENE_LIGHTS) return NULL;
-	_pointLights[_numPointLights] = PointLight();
-	_pointLights[_numPointLights].cColor = Float3(0.1f, 0.3f, 0.7f);
-	_pointLights[_numPointLights].cPos = Float3();
-	_pointLights[_numPointLights].cRadius = 1.0f;
+	// One transform per object instead of two per comparison, same order as OpaqueObjectDepthCompare
+	_depthSortQueue.Clear();
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		float depth = Float3::Transform(objects[i].base->Translation(), viewMatrix).z;
+		_depthSortQueue.Add(RenderQueue::SortableFloatBits(depth), (uint32)i);
+	}
+	_depthSortQueue.Sort();
 
-	_numPointLights++;
-	_numLights++;
+	const std::vector<RenderQueue::Item> &items = _depthSortQueue.getItems();
+	_sortScratch.resize(objects.size());
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		_sortScratch[i] = objects[items[i].payload];
+		indices[_sortScratch[i].handle.slot] = (uint32)i;
+	}
+	objects.swap(_sortScratch);
+}
 
-	return &_pointLights[_numPointLights - 1];
+PointLight *Scene::addPointLight()
+{
+	PointLight &light = _pointLights[_pointLights.Add()];
+	light.cColor = Float3(0.1f, 0.3f, 0.7f);
+	light.cPos = Float3();
+	light.cRadius = 1.0f;
+
+	return &light;
 }
 
 uint32 Scene::fillPointLightsUniformGrid(float unitGridSize, float radius, Float3 offset)
@@ -432,7 +360,6 @@ uint32 Scene::fillPointLightsUniformGrid(float unitGridSize, float radius, Float
 			for (uint32 x = 0; x < xnum; x++)
 			{
 				PointLight *pl = addPointLight();
-				if (pl == NULL) return lightNum; // reached maximum
 				pl->cRadius = radius;
 				pl->cColor = Float3((float)x / xnum, (float)y / ynum, (float)z / znum);
 				pl->cPos = Float3((float)x, (float)y, (float)z) * inv_scale + Float3(_sceneWSAABB_staticObj.Min) + offset;
@@ -444,34 +371,175 @@ uint32 Scene::fillPointLightsUniformGrid(float unitGridSize, float radius, Float
 	return lightNum;
 }
 
-void Scene::genStaticSceneWSAABB()
+void Scene::gatherMeshPartBounds(ChunkedPool<ModelPartsBound> &partsBounds, std::vector<BBox> &boxes, std::vector<MeshPartRef> &refs)
+{
+	boxes.clear();
+	refs.clear();
+
+	// slot order, so primitive numbering only changes when objects are added
+	partsBounds.ForEachChunk([&](ModelPartsBound *chunk, uint32 first, uint32 count)
+	{
+		for (uint32 i = 0; i < count; i++)
+		{
+			const std::vector<BBox> &partBoxes = chunk[i].BoundingBoxes;
+			for (size_t part = 0; part < partBoxes.size(); part++)
+			{
+				MeshPartRef ref = { &chunk[i], (uint32)part };
+				boxes.push_back(partBoxes[part]);
+				refs.push_back(ref);
+			}
+		}
+	});
+}
+
+void Scene::gatherMeshPartSpheres(const std::vector<MeshPartRef> &refs, FrustumCuller &culler)
+{
+	if (culler.getNumSpheres() != refs.size())
+	{
+		culler.Resize((uint32)refs.size());
+	}
+
+	for (size_t i = 0; i < refs.size(); i++)
+	{
+		culler.SetSphere((uint32)i, refs[i].partsBound->BoundingSpheres[refs[i].part]);
+	}
+}
+
+void Scene::updateStaticBVH()
+{
+	_staticBVHDirty = false;
+
+	gatherMeshPartBounds(_sceneStaticOpaqueObjectModelPartsBounds, _staticPartBoxes, _staticPartRefs);
+	_staticBVH.Build(_staticPartBoxes.empty() ? nullptr : &_staticPartBoxes[0], (uint32)_staticPartBoxes.size());
+	gatherMeshPartSpheres(_staticPartRefs, _staticPartCuller);
+
+	// the root box is the static scene bound
+	if (!_staticBVH.isEmpty())
+	{
+		_sceneWSAABB_staticObj = _staticBVH.getBounds();
+	}
+}
+
+void Scene::updateDynamicBVH()
+{
+	size_t numPrevParts = _dynamicPartBoxes.size();
+	gatherMeshPartBounds(_sceneDynamicOpaqueObjectModelPartsBounds, _dynamicPartBoxes, _dynamicPartRefs);
+	gatherMeshPartSpheres(_dynamicPartRefs, _dynamicPartCuller);
+	const BBox *boxes = _dynamicPartBoxes.empty() ? nullptr : &_dynamicPartBoxes[0];
+
+	if (_dynamicBVHDirty || numPrevParts != _dynamicPartBoxes.size() || _dynamicBVH.isEmpty())
+	{
+		_dynamicBVH.Build(boxes, (uint32)_dynamicPartBoxes.size());
+	}
+	else
+	{
+		_dynamicBVH.Refit(boxes);
+
+		// objects moved far from where the tree was built
+		if (_dynamicBVH.ComputeCost() > _dynamicBVH.getBuildCost() * 2.0f)
+		{
+			_dynamicBVH.Build(boxes, (uint32)_dynamicPartBoxes.size());
+		}
+	}
+
+	_dynamicBVHDirty = false;
+}
+
+const BVH &Scene::getStaticBVH()
+{
+	if (_staticBVHDirty)
+	{
+		updateStaticBVH();
+	}
+	return _staticBVH;
+}
+
+const BVH &Scene::getDynamicBVH()
+{
+	if (_dynamicBVHDirty)
+	{
+		updateDynamicBVH();
+	}
+	return _dynamicBVH;
+}
+
+void Scene::cullOpaqueMeshParts(const Frustum &frustum, bool ignoreNearZ, std::vector<MeshPartRef> &visibleParts)
+{
+	visibleParts.clear();
+
+	Float4 planes[6];
+	const uint32 numPlanes = GetFrustumPlanes(frustum, ignoreNearZ, planes);
+
+	_visiblePrimitives.clear();
+	getStaticBVH().CullFrustum(planes, numPlanes, _visiblePrimitives);
+	for (size_t i = 0; i < _visiblePrimitives.size(); i++)
+	{
+		visibleParts.push_back(_staticPartRefs[_visiblePrimitives[i]]);
+	}
+
+	_visiblePrimitives.clear();
+	getDynamicBVH().CullFrustum(planes, numPlanes, _visiblePrimitives);
+	for (size_t i = 0; i < _visiblePrimitives.size(); i++)
+	{
+		visibleParts.push_back(_dynamicPartRefs[_visiblePrimitives[i]]);
+	}
+}
+
+void Scene::cullOpaqueMeshPartSpheres(const Frustum &frustum, bool ignoreNearZ, std::vector<MeshPartRef> &visibleParts)
 {
-	if (_numStaticOpaqueObjects == 0) return;
+	visibleParts.clear();
+
+	// the trees and the spheres are gathered together, so a dirty tree means stale spheres
+	if (_staticBVHDirty)
+	{
+		updateStaticBVH();
+	}
+	if (_dynamicBVHDirty)
+	{
+		updateDynamicBVH();
+	}
+
+	FrustumCuller *cullers[2] = { &_staticPartCuller, &_dynamicPartCuller };
+	const std::vector<MeshPartRef> *refs[2] = { &_staticPartRefs, &_dynamicPartRefs };
+	for (int i = 0; i < 2; i++)
+	{
+		cullers[i]->Cull(frustum, ignoreNearZ);
 
-	std::vector<BBox> temp(_numStaticOpaqueObjects);
-	memcpy(&temp[0], _staticOpaqueObjectsBBoxes, sizeof(BBox) * _numStaticOpaqueObjects);
-	_sceneWSAABB_staticObj = MergeBoundingBoxes(temp);
+		const uint32 *visible = cullers[i]->getVisibleIndices();
+		for (uint32 v = 0; v < cullers[i]->getNumVisible(); v++)
+		{
+			visibleParts.push_back((*refs[i])[visible[v]]);
+		}
+	}
+}
+
+uint64 Scene::getPoolMemoryUsage()
+{
+	return _staticOpaqueObjectsBBoxes.getMemoryUsage() + _dynamicOpaqueObjectsBBoxes.getMemoryUsage()
+		+ _staticOpaqueObjectsBSpheres.getMemoryUsage() + _dynamicOpaqueObjectsBSpheres.getMemoryUsage()
+		+ _sceneStaticOpaqueObjectModelPartsBounds.getMemoryUsage() + _sceneDynamicOpaqueObjectModelPartsBounds.getMemoryUsage()
+		+ _sceneStaticOpaqueObjectBounds.getMemoryUsage() + _sceneDynamicOpaqueObjectBounds.getMemoryUsage()
+		+ _objectBases.getMemoryUsage() + _prevWVPs.getMemoryUsage() + _pointLights.getMemoryUsage()
+		+ (_staticOpaqueObjects.capacity() + _dynamicOpaqueObjects.capacity()) * sizeof(SceneObject);
 }
 
 void Scene::updateDynamicSceneObjectBounds()
 {
-	for (uint64 i = 0; i < _numDynamicOpaqueObjects; i++)
+	for (size_t i = 0; i < _dynamicOpaqueObjects.size(); i++)
 	{
 		SceneObject *obj = &_dynamicOpaqueObjects[i];
 
 		transformSceneObjectModelPartsBounds(obj);
 
-		BBox bbox = MergeBoundingBoxes(obj->bound->modelPartsBound->BoundingBoxes);
-		BSphere bsphere = MergeBoundingSpheres(obj->bound->modelPartsBound->BoundingSpheres);
-
-		_dynamicOpaqueObjectsBBoxes[_numDynamicOpaqueObjects] = bbox;
-		_dynamicOpaqueObjectsBSpheres[_numDynamicOpaqueObjects] = bsphere;
+		// write through the object's own bound, the array may be in sorted order
+		*obj->bound->bbox = MergeBoundingBoxes(obj->bound->modelPartsBound->BoundingBoxes);
+		*obj->bound->bsphere = MergeBoundingSpheres(obj->bound->modelPartsBound->BoundingSpheres);
 	}
 }
 
 uint64 Scene::getModelIndex(Model *model)
 {
-	for (uint64 i = 0; i < _numTotalModelsShared; i++)
+	for (uint32 i = 0; i < _models.size(); i++)
 	{
 		if (&_models[i] == model)
 		{
@@ -484,6 +552,10 @@ uint64 Scene::getModelIndex(Model *model)
 
 BBox Scene::getSceneBoundingBox()
 {
+	if (_staticBVHDirty)
+	{
+		updateStaticBVH();
+	}
 	return _sceneWSAABB_staticObj;
 }
 
@@ -509,13 +581,8 @@ void Scene::transformSceneObjectModelPartsBounds(SceneObject *obj)
 
 
 int Scene::_highestSceneObjId = 0;
-int Scene::_numTotalModelsShared = 0;
 Model *Scene::_boxModel = nullptr;
 Model *Scene::_planeModel = nullptr;
-Model Scene::_models[Scene::MAX_MODELS];
-ModelPartsBound Scene::_modelsData[Scene::MAX_MODELS];
-//SceneObject Scene::_staticOpaqueObjects[Scene::MAX_STATIC_OBJECTS];
-//SceneObject Scene::_dynamicOpaqueObjects[Scene::MAX_DYNAMIC_OBJECTS];
-//Float4x4 Scene::_objectBases[Scene::MAX_OBJECT_MATRICES];
-//Float4x4 Scene::_prevWVPs[Scene::MAX_OBJECT_MATRICES];
+ChunkedPool<Model, 64> Scene::_models;
+ChunkedPool<ModelPartsBound, 64> Scene::_modelsData;
 std::unordered_map<std::wstring, Model *> Scene::_modelCache;
@@ -8,6 +8,10 @@
 
 #include "Light.h"
 #include "BoundUtils.h"
+#include "BVH.h"
+#include "FrustumCuller.h"
+#include "ChunkedPool.h"
+#include "RenderQueue.h"
 
 #include "ProbeManager.h"
 //#include "CreateCubemap.h"
@@ -33,12 +37,21 @@ struct SceneObjectBound
 	bool32 frustumTest;
 };
 
+// Stable reference to a scene object. SceneObject pointers move when objects are added or
+// sorted, a handle keeps naming the same object.
+struct SceneObjectHandle
+{
+	uint32 flags;
+	uint32 slot;
+};
+
 struct SceneObject
 {
 	Float4x4 *base;
 	Float4x4 *prevWVP; // this is hack... 
 	Model *model;
 	SceneObjectBound *bound;
+	SceneObjectHandle handle;
 	int id;
 };
 
@@ -72,7 +85,6 @@ struct TransparentObjectDepthCompare
 };
 
 // TODO: implement scene graph - currently flat structure
-// TODO: support instancing
 class SceneScript;
 class Scene
 {
@@ -97,12 +109,13 @@ public:
 	// OR semi-opaque, semi-transparent structure. 
 
 	// TODO: now static object is not optimized for draw calls (no batching)
-	SceneObject *addStaticOpaqueObject(Model *model, float scale=1.0f, const Float3 &pos=Float3(), const Quaternion &rot=Quaternion());
-	SceneObject *addDynamicOpaqueObject(Model *model, float scale= 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
+	// Objects move in memory when others are added or sorted, look them up with getSceneObject.
+	SceneObjectHandle addStaticOpaqueObject(Model *model, float scale=1.0f, const Float3 &pos=Float3(), const Quaternion &rot=Quaternion());
+	SceneObjectHandle addDynamicOpaqueObject(Model *model, float scale= 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
 
-	SceneObject *addDynamicOpaqueBoxObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
-	SceneObject *addDynamicOpaquePlaneObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
-	SceneObject *addStaticOpaquePlaneObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
+	SceneObjectHandle addDynamicOpaqueBoxObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
+	SceneObjectHandle addDynamicOpaquePlaneObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
+	SceneObjectHandle addStaticOpaquePlaneObject(float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
 
 	void setProxySceneObject(const std::wstring &modelPath, float scale = 1.0f, const Float3 &pos = Float3(), const Quaternion &rot = Quaternion());
 	inline SceneObject *getProxySceneObjectPtr() { return &_proxySceneObject; }
@@ -110,8 +123,10 @@ public:
 
 	void sortSceneObjects(const Float4x4 &viewMatrix);
 
-	inline int getNumStaticOpaqueObjects() { return _numStaticOpaqueObjects; }
-	inline int getNumDynamicOpaueObjects() { return _numDynamicOpaqueObjects; }
+	SceneObject *getSceneObject(SceneObjectHandle handle);
+
+	inline int getNumStaticOpaqueObjects() { return (int)_staticOpaqueObjects.size(); }
+	inline int getNumDynamicOpaueObjects() { return (int)_dynamicOpaqueObjects.size(); }
 	inline int getNumModels() { return (int)_modelIndices.size(); }
 	inline Model *getModel(uint64 index) { return &_models[_modelIndices[index]]; }
 	// inline MeshData *getModelData(uint64 index) { return &_modelsData[_modelIndices[index]]; }
@@ -120,11 +135,9 @@ public:
 	inline float getSceneScale() { return _sceneScale; }
 	inline Quaternion getSceneOrientation() { return _sceneOrientation; }
 
-	inline SceneObject *getStaticOpaqueObjectsPtr() { return _staticOpaqueObjects; }
-	inline SceneObject *getDynamicOpaqueObjectsPtr() { return _dynamicOpaqueObjects; }
-
-	inline BBox *getDynamicObjectBBoxPtr() { return _dynamicOpaqueObjectsBBoxes; }
-	inline BBox *getStaticObjectBBoxPtr() { return _staticOpaqueObjectsBBoxes; }
+	// Contiguous, in draw order
+	inline SceneObject *getStaticOpaqueObjectsPtr() { return _staticOpaqueObjects.empty() ? nullptr : &_staticOpaqueObjects[0]; }
+	inline SceneObject *getDynamicOpaqueObjectsPtr() { return _dynamicOpaqueObjects.empty() ? nullptr : &_dynamicOpaqueObjects[0]; }
 
 	inline FirstPersonCamera *getSceneCameraSavedPtr() { return &_sceneCamSaved; }
 	inline FirstPersonCamera *getGlobalCameraPtr() { return _globalCam; }
@@ -132,18 +145,36 @@ public:
 	// Lights
 	PointLight *addPointLight();
 	uint32 fillPointLightsUniformGrid(float unitGridSize, float radius, Float3 offset=Float3());
-	inline PointLight *getPointLightPtr() { return _pointLights; }
-	inline int getNumPointLights() { return _numPointLights; }
+	inline PointLight *getPointLight(uint32 index) { return &_pointLights[index]; }
+	inline const ChunkedPool<PointLight> &getPointLights() { return _pointLights; }
+	inline int getNumPointLights() { return (int)_pointLights.size(); }
 	BBox getSceneBoundingBox();
 
-	inline ProbeManager *Scene::getProbeManagerPtr() { return &_probeManager; }
+	// Mesh part behind a BVH primitive index
+	struct MeshPartRef
+	{
+		ModelPartsBound *partsBound;
+		uint32 part;
+	};
+
+	// Hierarchies over the world space boxes of all opaque mesh parts, one for static and one for
+	// dynamic objects. Primitive i of a tree is part getXXXPartRefs()[i]; parts are numbered in the
+	// order objects were added, which sorting does not change.
+	const BVH &getStaticBVH();
+	const BVH &getDynamicBVH();
+	inline const std::vector<MeshPartRef> &getStaticPartRefs() { return _staticPartRefs; }
+	inline const std::vector<MeshPartRef> &getDynamicPartRefs() { return _dynamicPartRefs; }
 
-	// Caution: too large will stack overflow
-	static const int MAX_STATIC_OBJECTS = 32;
-	static const int MAX_DYNAMIC_OBJECTS = 128;
-	static const int MAX_MODELS = 64;
-	static const int MAX_OBJECT_MATRICES = MAX_STATIC_OBJECTS + MAX_DYNAMIC_OBJECTS;
-	static const int MAX_SCENE_LIGHTS = 1024;
+	// Opaque mesh parts not outside the frustum, static parts first
+	void cullOpaqueMeshParts(const Frustum &frustum, bool ignoreNearZ, std::vector<MeshPartRef> &visibleParts);
+
+	// Same, tested with the part spheres in batches instead of walking the trees
+	void cullOpaqueMeshPartSpheres(const Frustum &frustum, bool ignoreNearZ, std::vector<MeshPartRef> &visibleParts);
+
+	// Bytes held by the object, bound, matrix and light pools
+	uint64 getPoolMemoryUsage();
+
+	inline ProbeManager *Scene::getProbeManagerPtr() { return &_probeManager; }
 
 	enum SceneObjectFlag
 	{
@@ -155,10 +186,15 @@ public:
 
 	
 private:
-	void genSceneObjectBounds(uint64 objTypeflag, uint64 sceneObjIndex, uint64 modelIndex);
-	void genStaticSceneWSAABB();
+	SceneObjectHandle addSceneObject(uint64 objTypeflag, Model *model, float scale, const Float3 &pos, const Quaternion &rot);
+	void genSceneObjectBounds(uint64 objTypeflag, uint32 slot, uint64 modelIndex);
+	void updateStaticBVH();
+	void updateDynamicBVH();
+	void gatherMeshPartBounds(ChunkedPool<ModelPartsBound> &partsBounds, std::vector<BBox> &boxes, std::vector<MeshPartRef> &refs);
+	void gatherMeshPartSpheres(const std::vector<MeshPartRef> &refs, FrustumCuller &culler);
 	void updateDynamicSceneObjectBounds();
 	void transformSceneObjectModelPartsBounds(SceneObject *obj);
+	void sortSceneObjectsByDepth(const Float4x4 &viewMatrix, std::vector<SceneObject> &objects, std::vector<uint32> &indices);
 
 	Float4x4 createBase(float scale, const Float3 &pos, const Quaternion &rot);
 	uint64 getModelIndex(Model *model);
@@ -172,13 +208,6 @@ private:
 	Float3 _sceneTranslation;
 	float _sceneScale;
 
-	int _numStaticOpaqueObjects;
-	int _numDynamicOpaqueObjects;
-	int _numObjectBases;
-	int _numPrevWVPs;
-	int _numLights;
-	int _numPointLights;
-
 	bool _sceneBoundGenerated;
 
 	// TODO: refactor so that a controlled set of scene api is exposed
@@ -186,28 +215,54 @@ private:
 
 	bool32 _hasProxySceneObject;
 	SceneObject _proxySceneObject;
-	SceneObject _staticOpaqueObjects[MAX_STATIC_OBJECTS];
-	SceneObject _dynamicOpaqueObjects[MAX_DYNAMIC_OBJECTS];
 
-	BBox _staticOpaqueObjectsBBoxes[MAX_STATIC_OBJECTS];
-	BBox _dynamicOpaqueObjectsBBoxes[MAX_DYNAMIC_OBJECTS];
+	// Objects are small and sorted every frame, so they live in plain arrays. Everything they
+	// point to lives in pools indexed by the object's slot and never moves.
+	std::vector<SceneObject> _staticOpaqueObjects;
+	std::vector<SceneObject> _dynamicOpaqueObjects;
+
+	// slot -> position in the object array, refreshed after sorting
+	std::vector<uint32> _staticOpaqueObjectIndices;
+	std::vector<uint32> _dynamicOpaqueObjectIndices;
+	RenderQueue _depthSortQueue;
+	std::vector<SceneObject> _sortScratch;
+
+	ChunkedPool<BBox> _staticOpaqueObjectsBBoxes;
+	ChunkedPool<BBox> _dynamicOpaqueObjectsBBoxes;
 	
 	// Mainly used for frustum culling
-	BSphere _staticOpaqueObjectsBSpheres[MAX_STATIC_OBJECTS];
-	BSphere _dynamicOpaqueObjectsBSpheres[MAX_DYNAMIC_OBJECTS];
+	ChunkedPool<BSphere> _staticOpaqueObjectsBSpheres;
+	ChunkedPool<BSphere> _dynamicOpaqueObjectsBSpheres;
 
-	ModelPartsBound _sceneStaticOpaqueObjectModelPartsBounds[MAX_STATIC_OBJECTS];
-	ModelPartsBound _sceneDynamicOpaqueObjectModelPartsBounds[MAX_DYNAMIC_OBJECTS];
-	SceneObjectBound _sceneStaticOpaqueObjectBounds[MAX_STATIC_OBJECTS];
-	SceneObjectBound _sceneDynamicOpaqueObjectBounds[MAX_DYNAMIC_OBJECTS];
+	ChunkedPool<ModelPartsBound> _sceneStaticOpaqueObjectModelPartsBounds;
+	ChunkedPool<ModelPartsBound> _sceneDynamicOpaqueObjectModelPartsBounds;
+	ChunkedPool<SceneObjectBound> _sceneStaticOpaqueObjectBounds;
+	ChunkedPool<SceneObjectBound> _sceneDynamicOpaqueObjectBounds;
 	
 
 	BBox _sceneWSAABB_staticObj;
 
-	Float4x4 _objectBases[MAX_OBJECT_MATRICES];
-	Float4x4 _prevWVPs[MAX_OBJECT_MATRICES];
+	// Static tree is rebuilt when static objects are added. The dynamic one is refitted every
+	// update and rebuilt when objects are added or refitting made it much worse than a fresh build.
+	BVH _staticBVH;
+	BVH _dynamicBVH;
+	std::vector<BBox> _staticPartBoxes;
+	std::vector<BBox> _dynamicPartBoxes;
+	std::vector<MeshPartRef> _staticPartRefs;
+	std::vector<MeshPartRef> _dynamicPartRefs;
+	std::vector<uint32> _visiblePrimitives;
+	bool _staticBVHDirty;
+	bool _dynamicBVHDirty;
+
+	// Part spheres in primitive order for the batched culler, kept across frames. Static ones are
+	// gathered with the static tree, only the dynamic ones are rewritten every update.
+	FrustumCuller _staticPartCuller;
+	FrustumCuller _dynamicPartCuller;
+
+	ChunkedPool<Float4x4> _objectBases;
+	ChunkedPool<Float4x4> _prevWVPs;
 
-	PointLight _pointLights[MAX_SCENE_LIGHTS];
+	ChunkedPool<PointLight> _pointLights;
 
 	SceneScript *_sceneScript;
 
@@ -222,10 +277,9 @@ private:
 
 	// TODO: justify the usefulness of object id
 	static int _highestSceneObjId;
-	static int _numTotalModelsShared;
 
-	static Model _models[MAX_MODELS];
-	static ModelPartsBound _modelsData[MAX_MODELS];
+	static ChunkedPool<Model, 64> _models;
+	static ChunkedPool<ModelPartsBound, 64> _modelsData;
 
 	static Model *_boxModel;
 	static Model *_planeModel;
@@ -0,0 +1,129 @@
+#include "TestFramework.h"
+
+#include <InstanceBatcher.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// Synthetic keys, the model pointers are only compared and never dereferenced
+static InstanceBatcher::BatchKey randomBatchKey(std::mt19937 &rng, uint32 numModels)
+{
+	InstanceBatcher::BatchKey key;
+	key.model = reinterpret_cast<const SampleFramework11::Model *>((uintptr_t)(rng() % numModels + 1) * 64);
+	key.permutation = rng() % 4;
+	key.mesh = rng() % 3;
+	key.part = rng() % 2;
+	key.probeIndex = rng() % 4;
+	return key;
+}
+
+// Every item exactly once, in a batch with its own key, in add order inside the batch, and
+// batches in the order of their first item
+TEST_CASE(InstanceBatcher_Grouping)
+{
+	std::mt19937 rng(1337);
+	std::vector<InstanceBatcher::BatchKey> keys;
+	std::vector<uint32> instanceSeen;
+	InstanceBatcher batcher;
+
+	for (uint32 round = 0; round < 64; round++)
+	{
+		const uint32 numItems = rng() % 2048;
+		keys.resize(numItems);
+		batcher.Clear();
+
+		for (uint32 i = 0; i < numItems; i++)
+		{
+			keys[i] = randomBatchKey(rng, 1 + round % 8);
+			batcher.AddItem(keys[i], i);
+		}
+		batcher.Build();
+
+		instanceSeen.assign(numItems, 0);
+		uint32 expectedFirst = 0;
+		uint32 prevFirstItem = 0;
+		const std::vector<InstanceBatcher::Batch> &batches = batcher.getBatches();
+		const std::vector<uint32> &instances = batcher.getInstances();
+
+		for (size_t b = 0; b < batches.size(); b++)
+		{
+			const InstanceBatcher::Batch &batch = batches[b];
+			CHECK(batch.firstInstance == expectedFirst);
+			CHECK(batch.numInstances > 0);
+			expectedFirst += batch.numInstances;
+
+			uint32 firstItem = instances[batch.firstInstance];
+			CHECK(b == 0 || firstItem > prevFirstItem);
+			prevFirstItem = firstItem;
+
+			for (uint32 i = batch.firstInstance; i < batch.firstInstance + batch.numInstances; i++)
+			{
+				uint32 item = instances[i];
+				CHECK(item < numItems && instanceSeen[item]++ == 0);
+				CHECK(item < numItems && keys[item] == batch.key);
+				CHECK(i == batch.firstInstance || item > instances[i - 1]);
+			}
+		}
+
+		CHECK(expectedFirst == numItems);
+		CHECK(batcher.getNumDrawCallsSaved() == numItems - (uint32)batches.size());
+	}
+}
+
+// Clear() keeps nothing but capacity
+TEST_CASE(InstanceBatcher_Reuse)
+{
+	std::mt19937 rng(7);
+	InstanceBatcher batcher;
+	InstanceBatcher::BatchKey key = randomBatchKey(rng, 1);
+
+	batcher.AddItem(key, 5);
+	batcher.AddItem(key, 6);
+	batcher.Build();
+	CHECK(batcher.getBatches().size() == 1);
+	CHECK(batcher.getNumDrawCallsSaved() == 1);
+
+	batcher.Clear();
+	batcher.AddItem(key, 9);
+	batcher.Build();
+	CHECK(batcher.getBatches().size() == 1);
+	CHECK(batcher.getBatches().size() == 1 && batcher.getBatches()[0].numInstances == 1);
+	CHECK(batcher.getInstances().size() == 1 && batcher.getInstances()[0] == 9);
+}
+
+// AddItem + Build for 1k to 100k items over a few dozen distinct meshes, like a scene full of props
+BENCHMARK(InstanceBatcher_Build)
+{
+	static const uint32 NumIterations = 16;
+
+	std::mt19937 rng(1337);
+	std::vector<InstanceBatcher::BatchKey> keys;
+	InstanceBatcher batcher;
+
+	for (uint32 numItems = 1000; numItems <= 100000; numItems *= 10)
+	{
+		keys.resize(numItems);
+		for (uint32 i = 0; i < numItems; i++)
+		{
+			keys[i] = randomBatchKey(rng, 16);
+		}
+
+		Tests::Stopwatch timer;
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+		{
+			batcher.Clear();
+			for (uint32 i = 0; i < numItems; i++)
+			{
+				batcher.AddItem(keys[i], i);
+			}
+			batcher.Build();
+		}
+		timer.Update();
+		double buildMs = timer.getDeltaMs() / NumIterations;
+
+		printf("%u items: %fms, %fM items/s, %u batches, %u draw calls saved\n", numItems, buildMs,
+			numItems / std::max(buildMs, 0.001) / 1000.0, (uint32)batcher.getBatches().size(), batcher.getNumDrawCallsSaved());
+	}
+}
@@ -0,0 +1,193 @@
+#include "TestFramework.h"
+
+#include <ProbeBlender.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+// Probes scattered over a level sized area with boxes from room to corridor size
+static void randomProbes(std::mt19937 &rng, uint32 numProbes, float areaSize, std::vector<Float3> &positions,
+	std::vector<Float3> &boxSizes)
+{
+	std::uniform_real_distribution<float> posDist(-areaSize, areaSize);
+	std::uniform_real_distribution<float> sizeDist(1.0f, 12.0f);
+
+	positions.resize(numProbes);
+	boxSizes.resize(numProbes);
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		positions[i] = Float3(posDist(rng), posDist(rng) * 0.25f, posDist(rng));
+		boxSizes[i] = Float3(sizeDist(rng), sizeDist(rng), sizeDist(rng));
+	}
+}
+
+// What ComputeBlend promises, by testing every probe: the most influential probes first, ties
+// to the smaller box and then the lower index, the nearest probe when no box contains pos
+static void blendBruteForce(const std::vector<Float3> &positions, const std::vector<Float3> &boxSizes, float fadeFraction,
+	const ProbeKDTree &tree, const Float3 &pos, ProbeBlender::BlendResult &result)
+{
+	struct Candidate
+	{
+		uint32 probeIndex;
+		float influence;
+		float volume;
+	};
+
+	std::vector<Candidate> all;
+	for (uint32 i = 0; i < positions.size(); i++)
+	{
+		const Float3 &size = boxSizes[i];
+		Candidate candidate = { i, ProbeBlender::ComputeInfluence(pos, positions[i], size, fadeFraction),
+			std::abs(size.x) * std::abs(size.y) * std::abs(size.z) };
+		if (candidate.influence > 0.0f)
+			all.push_back(candidate);
+	}
+
+	std::sort(all.begin(), all.end(), [](const Candidate &a, const Candidate &b)
+	{
+		if (a.influence != b.influence) return a.influence > b.influence;
+		if (a.volume != b.volume) return a.volume < b.volume;
+		return a.probeIndex < b.probeIndex;
+	});
+
+	if (all.empty())
+	{
+		result.count = 1;
+		result.probeIndices[0] = tree.FindNearest(pos);
+		result.weights[0] = 1.0f;
+		return;
+	}
+
+	result.count = Min((uint32)all.size(), ProbeBlender::MaxBlendProbes);
+	float weightSum = 0.0f;
+	for (uint32 i = 0; i < result.count; i++)
+		weightSum += all[i].influence;
+	for (uint32 i = 0; i < result.count; i++)
+	{
+		result.probeIndices[i] = all[i].probeIndex;
+		result.weights[i] = all[i].influence / weightSum;
+	}
+}
+
+// Fading in from a face of the box never decreases the influence, full at the center, none
+// outside. Negative box sizes only count by their extent.
+TEST_CASE(ProbeBlender_Influence)
+{
+	const Float3 probePos(1.0f, 2.0f, 3.0f);
+	const Float3 boxSize(2.0f, -4.0f, 1.0f);
+	float prevInfluence = 0.0f;
+	for (uint32 step = 0; step <= 64; step++)
+	{
+		float t = step / 64.0f;
+		float influence = ProbeBlender::ComputeInfluence(probePos + Float3(2.5f * (1.0f - t), 0.0f, 0.0f), probePos, boxSize, 0.25f);
+		CHECK(influence >= prevInfluence && influence >= 0.0f && influence <= 1.0f);
+		prevInfluence = influence;
+	}
+	CHECK(ProbeBlender::ComputeInfluence(probePos, probePos, boxSize, 0.25f) == 1.0f);
+	CHECK(ProbeBlender::ComputeInfluence(probePos + Float3(0.0f, 3.9f, 0.0f), probePos, boxSize, 0.0f) == 1.0f);
+	CHECK(ProbeBlender::ComputeInfluence(probePos + Float3(0.0f, 4.5f, 0.0f), probePos, boxSize, 0.25f) == 0.0f);
+}
+
+// The BVH candidates give the same probes, order and weights as testing every probe, weights are
+// sorted and normalized, and single and batched blends agree
+TEST_CASE(ProbeBlender_MatchesBruteForce)
+{
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(-1.0f, 1.0f);
+	std::vector<Float3> positions;
+	std::vector<Float3> boxSizes;
+	std::vector<Float3> queries(256);
+	std::vector<ProbeBlender::BlendResult> batch(queries.size());
+	ProbeBlender blender;
+	ProbeKDTree tree;
+
+	for (uint32 round = 0; round < 32; round++)
+	{
+		const uint32 numProbes = 1 + rng() % 256;
+		const float fadeFraction = (round % 5) * 0.25f;
+		randomProbes(rng, numProbes, 30.0f, positions, boxSizes);
+		tree.Build(&positions[0], numProbes);
+		blender.Build(&positions[0], &boxSizes[0], numProbes, fadeFraction);
+		CHECK(blender.getNumProbes() == numProbes);
+
+		for (size_t q = 0; q < queries.size(); q++)
+			queries[q] = Float3(unitDist(rng) * 35.0f, unitDist(rng) * 10.0f, unitDist(rng) * 35.0f);
+		blender.ComputeBlendBatch(&queries[0], (uint32)queries.size(), tree, &batch[0]);
+
+		for (size_t q = 0; q < queries.size(); q++)
+		{
+			ProbeBlender::BlendResult result;
+			ProbeBlender::BlendResult reference;
+			blender.ComputeBlend(queries[q], tree, result);
+			blendBruteForce(positions, boxSizes, fadeFraction, tree, queries[q], reference);
+
+			CHECK(result.count == reference.count && result.count >= 1 && result.count <= ProbeBlender::MaxBlendProbes);
+			CHECK(batch[q].count == result.count);
+			float weightSum = 0.0f;
+			for (uint32 i = 0; i < result.count && i < reference.count; i++)
+			{
+				CHECK(result.probeIndices[i] == reference.probeIndices[i]);
+				CHECK(std::abs(result.weights[i] - reference.weights[i]) < 1e-6f);
+				CHECK(i == 0 || result.weights[i] <= result.weights[i - 1]);
+				CHECK(batch[q].probeIndices[i] == result.probeIndices[i] && batch[q].weights[i] == result.weights[i]);
+				weightSum += result.weights[i];
+			}
+			CHECK(std::abs(weightSum - 1.0f) < 1e-5f);
+		}
+	}
+}
+
+// Testing every probe against the BVH candidates, 100 to 5000 probes and 10k objects
+BENCHMARK(ProbeBlender_Blend)
+{
+	static const uint32 NumObjects = 10000;
+	static const uint32 NumProbeCounts = 3;
+	static const uint32 ProbeCounts[NumProbeCounts] = { 100, 1000, 5000 };
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(-1.0f, 1.0f);
+	std::vector<Float3> positions;
+	std::vector<Float3> boxSizes;
+	std::vector<Float3> objects(NumObjects);
+	std::vector<ProbeBlender::BlendResult> results(NumObjects);
+	ProbeBlender blender;
+	ProbeKDTree tree;
+
+	for (uint32 c = 0; c < NumProbeCounts; c++)
+	{
+		const uint32 numProbes = ProbeCounts[c];
+
+		// keep the probe density roughly constant as the count grows
+		float areaSize = 10.0f * std::sqrt((float)numProbes);
+		randomProbes(rng, numProbes, areaSize, positions, boxSizes);
+		for (uint32 i = 0; i < NumObjects; i++)
+			objects[i] = Float3(unitDist(rng) * areaSize, unitDist(rng) * areaSize * 0.25f, unitDist(rng) * areaSize);
+
+		Tests::Stopwatch timer;
+		timer.Update();
+		tree.Build(&positions[0], numProbes);
+		blender.Build(&positions[0], &boxSizes[0], numProbes, 0.2f);
+		timer.Update();
+		double buildMs = timer.getDeltaMs();
+
+		timer.Update();
+		for (uint32 i = 0; i < NumObjects; i++)
+			blendBruteForce(positions, boxSizes, 0.2f, tree, objects[i], results[i]);
+		timer.Update();
+		double bruteForceMs = timer.getDeltaMs();
+
+		timer.Update();
+		blender.ComputeBlendBatch(&objects[0], NumObjects, tree, &results[0]);
+		timer.Update();
+		double batchMs = timer.getDeltaMs();
+
+		uint32 numBlended = 0;
+		for (uint32 i = 0; i < NumObjects; i++)
+			numBlended += results[i].count > 1 ? 1 : 0;
+
+		printf("%u probes: build %fms, every probe %fms, batched %fms, %u objects blend several probes\n",
+			numProbes, buildMs, bruteForceMs, batchMs, numBlended);
+	}
+}
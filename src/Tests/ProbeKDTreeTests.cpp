@@ -0,0 +1,176 @@
+#include "TestFramework.h"
+
+#include <ProbeKDTree.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <random>
+
+static float distanceSq(const Float3 &a, const Float3 &b)
+{
+	Float3 d = a - b;
+	return Float3::Dot(d, d);
+}
+
+// What ProbeManager::CalNN used to do, on packed positions: ties go to the higher index
+static uint32 linearNearest(const std::vector<Float3> &probes, const Float3 &pos)
+{
+	float minDis = FLT_MAX;
+	uint32 nearest = ProbeKDTree::InvalidIndex;
+	for (uint32 i = 0; i < probes.size(); i++)
+	{
+		float distance = std::sqrt(distanceSq(probes[i], pos));
+		if (minDis >= distance)
+		{
+			nearest = i;
+			minDis = distance;
+		}
+	}
+	return nearest;
+}
+
+static void randomPoints(std::mt19937 &rng, uint32 count, std::vector<Float3> &points)
+{
+	std::uniform_real_distribution<float> posDist(-100.0f, 100.0f);
+	points.resize(count);
+	for (uint32 i = 0; i < count; i++)
+		points[i] = Float3(posDist(rng), posDist(rng), posDist(rng));
+}
+
+// Nearest and batched nearest pick what the linear search picks, also on a grid full of ties
+TEST_CASE(ProbeKDTree_Nearest)
+{
+	std::mt19937 rng(1337);
+	std::vector<Float3> probes;
+	std::vector<Float3> queries;
+	std::vector<uint32> batch;
+	ProbeKDTree tree;
+
+	CHECK(tree.FindNearest(Float3(0.0f)) == ProbeKDTree::InvalidIndex);
+
+	static const uint32 ProbeCounts[] = { 1, 7, 12, 100, 1000 };
+	for (uint32 c = 0; c < 5; c++)
+	{
+		randomPoints(rng, ProbeCounts[c], probes);
+		randomPoints(rng, 2000, queries);
+		tree.Build(&probes[0], (uint32)probes.size());
+		CHECK(tree.getNumPoints() == probes.size());
+
+		batch.resize(queries.size());
+		tree.FindNearestBatch(&queries[0], (uint32)queries.size(), &batch[0]);
+		for (size_t i = 0; i < queries.size(); i++)
+		{
+			uint32 expected = linearNearest(probes, queries[i]);
+			CHECK(tree.FindNearest(queries[i]) == expected);
+			CHECK(batch[i] == expected);
+		}
+	}
+
+	probes.clear();
+	for (uint32 z = 0; z < 8; z++)
+		for (uint32 y = 0; y < 8; y++)
+			for (uint32 x = 0; x < 8; x++)
+				probes.push_back(Float3(float(x), float(y), float(z)));
+	tree.Build(&probes[0], (uint32)probes.size());
+	for (uint32 i = 0; i < 1000; i++)
+	{
+		Float3 pos(float(rng() % 17) * 0.5f - 0.5f, float(rng() % 17) * 0.5f - 0.5f, float(rng() % 17) * 0.5f - 0.5f);
+		CHECK(tree.FindNearest(pos) == linearNearest(probes, pos));
+	}
+}
+
+// K nearest come nearest first with the brute force distances, radius queries find exactly the
+// points inside
+TEST_CASE(ProbeKDTree_KNearestAndRadius)
+{
+	std::mt19937 rng(7);
+	std::vector<Float3> probes;
+	std::vector<Float3> queries;
+	std::vector<uint32> found;
+	ProbeKDTree tree;
+
+	randomPoints(rng, 500, probes);
+	randomPoints(rng, 500, queries);
+	tree.Build(&probes[0], (uint32)probes.size());
+
+	std::vector<float> sorted(probes.size());
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		const Float3 &pos = queries[q];
+		for (size_t i = 0; i < probes.size(); i++)
+			sorted[i] = distanceSq(probes[i], pos);
+		std::sort(sorted.begin(), sorted.end());
+
+		uint32 indices[ProbeKDTree::MaxKNearest];
+		float distances[ProbeKDTree::MaxKNearest];
+		const uint32 k = 1 + (uint32)q % ProbeKDTree::MaxKNearest;
+		CHECK(tree.FindKNearest(pos, k, indices, distances) == k);
+		for (uint32 i = 0; i < k; i++)
+		{
+			CHECK(distances[i] == sorted[i]);
+			CHECK(distanceSq(probes[indices[i]], pos) == distances[i]);
+		}
+
+		const float radius = 10.0f + float(q % 40);
+		found.clear();
+		tree.FindInRadius(pos, radius, found);
+		uint32 expected = 0;
+		for (size_t i = 0; i < probes.size(); i++)
+			expected += distanceSq(probes[i], pos) <= radius * radius ? 1 : 0;
+		CHECK(found.size() == expected);
+		for (size_t i = 0; i < found.size(); i++)
+			CHECK(distanceSq(probes[found[i]], pos) <= radius * radius);
+	}
+}
+
+// The linear search against the tree for 12 to 10k probes, 10k queries each
+BENCHMARK(ProbeKDTree_Lookup)
+{
+	static const uint32 NumQueries = 10000;
+	static const uint32 NumProbeCounts = 4;
+	static const uint32 ProbeCounts[NumProbeCounts] = { 12, 100, 1000, 10000 };
+
+	std::mt19937 rng(1337);
+	std::vector<Float3> queries;
+	randomPoints(rng, NumQueries, queries);
+
+	std::vector<Float3> probes;
+	std::vector<uint32> linearResult(NumQueries);
+	std::vector<uint32> treeResult(NumQueries);
+	std::vector<uint32> batchResult(NumQueries);
+	ProbeKDTree tree;
+
+	for (uint32 c = 0; c < NumProbeCounts; c++)
+	{
+		const uint32 numProbes = ProbeCounts[c];
+		randomPoints(rng, numProbes, probes);
+
+		Tests::Stopwatch timer;
+
+		timer.Update();
+		for (uint32 i = 0; i < NumQueries; i++)
+			linearResult[i] = linearNearest(probes, queries[i]);
+		timer.Update();
+		double linearMs = timer.getDeltaMs();
+
+		timer.Update();
+		tree.Build(&probes[0], numProbes);
+		timer.Update();
+		double buildMs = timer.getDeltaMs();
+
+		timer.Update();
+		for (uint32 i = 0; i < NumQueries; i++)
+			treeResult[i] = tree.FindNearest(queries[i]);
+		timer.Update();
+		double treeMs = timer.getDeltaMs();
+
+		timer.Update();
+		tree.FindNearestBatch(&queries[0], NumQueries, &batchResult[0]);
+		timer.Update();
+		double batchMs = timer.getDeltaMs();
+
+		CHECK(linearResult == treeResult && linearResult == batchResult);
+		printf("%u probes: linear %fms, build %fms, tree %fms, batched %fms\n", numProbes, linearMs, buildMs, treeMs, batchMs);
+	}
+}
@@ -0,0 +1,246 @@
+#include "TestFramework.h"
+
+#include <ProbePlacement.h>
+#include <ProbeKDTree.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Closed box as 12 triangles with flat per face normals, pointing out of the box or into it
+static void addBox(const Float3 &boxMin, const Float3 &boxMax, bool normalsInward,
+	std::vector<Float3> &vertices, std::vector<Float3> &normals, std::vector<uint32> &indices)
+{
+	for (uint32 axis = 0; axis < 3; axis++)
+	{
+		for (uint32 side = 0; side < 2; side++)
+		{
+			Float3 normal;
+			float sign = side == 0 ? -1.0f : 1.0f;
+			if (axis == 0) normal.x = sign;
+			else if (axis == 1) normal.y = sign;
+			else normal.z = sign;
+			if (normalsInward) normal = -normal;
+
+			const uint32 u = (axis + 1) % 3;
+			const uint32 v = (axis + 2) % 3;
+			const uint32 base = (uint32)vertices.size();
+			for (uint32 corner = 0; corner < 4; corner++)
+			{
+				float coords[3];
+				coords[axis] = side == 0 ? boxMin[axis] : boxMax[axis];
+				coords[u] = (corner & 1) ? boxMax[u] : boxMin[u];
+				coords[v] = (corner & 2) ? boxMax[v] : boxMin[v];
+				vertices.push_back(Float3(coords[0], coords[1], coords[2]));
+				normals.push_back(normal);
+			}
+
+			const uint32 quad[6] = { 0, 1, 2, 2, 1, 3 };
+			for (uint32 i = 0; i < 6; i++)
+				indices.push_back(base + quad[i]);
+		}
+	}
+}
+
+static bool insideBounds(const Float3 &pos, const BBox &bounds)
+{
+	return pos.x > bounds.Min.x && pos.y > bounds.Min.y && pos.z > bounds.Min.z
+		&& pos.x < bounds.Max.x && pos.y < bounds.Max.y && pos.z < bounds.Max.z;
+}
+
+// A 16x8x16 room with a solid 4x4 pillar through its middle
+struct PillarRoom
+{
+	std::vector<Float3> vertices;
+	std::vector<Float3> normals;
+	std::vector<uint32> indices;
+	Float3 pillarMin;
+	Float3 pillarMax;
+	BBox bounds;
+	ProbePlacement::Settings settings;
+
+	PillarRoom() : pillarMin(6.0f, 0.0f, 6.0f), pillarMax(10.0f, 8.0f, 10.0f)
+	{
+		const Float3 roomMin(0.0f, 0.0f, 0.0f);
+		const Float3 roomMax(16.0f, 8.0f, 16.0f);
+		addBox(roomMin, roomMax, true, vertices, normals, indices);
+		addBox(pillarMin, pillarMax, false, vertices, normals, indices);
+		bounds = MakeBBox(roomMin, roomMax);
+
+		settings.unitsBetweenProbes = 1.0f;
+		settings.maxEmptySpacing = 4.0f;
+		settings.maxProbes = 100000;
+	}
+
+	uint32 numTriangles() const { return (uint32)indices.size() / 3; }
+
+	void Place(std::vector<Float3> &positions, ProbePlacement::Stats *stats = nullptr) const
+	{
+		ProbePlacement::PlaceAdaptive(bounds, &vertices[0], &normals[0], &indices[0], numTriangles(), settings,
+			positions, stats);
+	}
+
+	bool inPillar(const Float3 &p, float margin) const
+	{
+		return p.x > pillarMin.x - margin && p.x < pillarMax.x + margin && p.z > pillarMin.z - margin && p.z < pillarMax.z + margin;
+	}
+};
+
+// Every axis uses its own spacing and no probe touches the bounds
+TEST_CASE(ProbePlacement_Grid)
+{
+	std::vector<Float3> positions;
+	const BBox bounds = MakeBBox(Float3(-5.0f, 0.0f, 2.0f), Float3(5.0f, 4.0f, 8.0f));
+	ProbePlacement::PlaceGrid(bounds, 1.0f, positions);
+
+	CHECK(positions.size() == 10 * 4 * 6);
+	for (size_t i = 0; i < positions.size(); i++)
+		CHECK(insideBounds(positions[i], bounds));
+	CHECK(std::abs((positions[10].y - positions[0].y) - 4.0f / 5.0f) < 1e-4f);
+	CHECK(std::abs((positions[40].z - positions[0].z) - 6.0f / 7.0f) < 1e-4f);
+}
+
+// No probe inside the pillar, and points next to the surfaces always have a probe within one
+// finest cell
+TEST_CASE(ProbePlacement_AdaptiveCoverage)
+{
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+	std::vector<Float3> positions;
+	PillarRoom room;
+
+	ProbePlacement::Stats stats;
+	room.Place(positions, &stats);
+	CHECK(!positions.empty() && stats.numRejectedInside > 0);
+	for (size_t i = 0; i < positions.size(); i++)
+		CHECK(insideBounds(positions[i], room.bounds) && !room.inPillar(positions[i], 0.0f));
+
+	ProbeKDTree tree;
+	tree.Build(&positions[0], (uint32)positions.size());
+	for (uint32 i = 0; i < 256; i++)
+	{
+		Float3 p(0.25f + unitDist(rng) * 15.5f, 0.25f, 0.25f + unitDist(rng) * 15.5f);
+		if (room.inPillar(p, 0.25f))
+			continue;
+		uint32 nearest = tree.FindNearest(p);
+		CHECK(Float3::Distance(p, positions[nearest]) <= stats.finestSpacing * 1.7321f);
+	}
+}
+
+// Fewer probes than the grid at the same spacing, the same probes every time, and the probe
+// budget is respected by coarsening
+TEST_CASE(ProbePlacement_AdaptiveBudgetAndDeterminism)
+{
+	std::vector<Float3> positions;
+	std::vector<Float3> reference;
+	PillarRoom room;
+
+	room.Place(positions);
+	ProbePlacement::PlaceGrid(room.bounds, room.settings.unitsBetweenProbes, reference);
+	CHECK(positions.size() < reference.size());
+
+	room.Place(reference);
+	CHECK(reference.size() == positions.size());
+	CHECK(memcmp(&reference[0], &positions[0], sizeof(Float3) * positions.size()) == 0);
+
+	room.settings.maxProbes = 64;
+	room.Place(reference);
+	CHECK(!reference.empty() && reference.size() <= 64);
+}
+
+// The looked up probe is never further than one cell diagonal from the true nearest probe, and
+// gathering finds every probe within the radius
+TEST_CASE(ProbePlacement_IndirectionGrid)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+	std::vector<Float3> positions;
+	std::vector<uint32> gathered;
+	PillarRoom room;
+
+	ProbePlacement::IndirectionGrid grid;
+	ProbePlacement::BuildIndirectionGrid(room.bounds, 1.0f, nullptr, 0, grid);
+	CHECK(grid.Lookup(Float3(1.0f)) == ProbeKDTree::InvalidIndex);
+	grid.GatherProbes(Float3(1.0f), 100.0f, gathered);
+	CHECK(gathered.empty());
+
+	room.Place(positions);
+	ProbeKDTree tree;
+	tree.Build(&positions[0], (uint32)positions.size());
+	ProbePlacement::BuildIndirectionGrid(room.bounds, 1.0f, &positions[0], (uint32)positions.size(), grid);
+	CHECK(grid.dims[0] == 16 && grid.dims[1] == 8 && grid.dims[2] == 16);
+	CHECK(grid.cellProbes.size() == positions.size());
+
+	const float cellDiagonal = Float3::Length(grid.cellSize);
+	for (uint32 i = 0; i < 1024; i++)
+	{
+		// also outside the bounds, where lookups and gathers clamp to the border cells
+		Float3 p(unitDist(rng) * 18.0f - 1.0f, unitDist(rng) * 10.0f - 1.0f, unitDist(rng) * 18.0f - 1.0f);
+		uint32 lookedUp = grid.Lookup(p);
+		uint32 nearest = tree.FindNearest(p);
+		CHECK(lookedUp < positions.size());
+		if (p.x >= 0.0f && p.y >= 0.0f && p.z >= 0.0f && p.x <= 16.0f && p.y <= 8.0f && p.z <= 16.0f)
+			CHECK(Float3::Distance(p, positions[lookedUp]) <= Float3::Distance(p, positions[nearest]) + cellDiagonal + 1e-4f);
+
+		const float radius = unitDist(rng) * 4.0f;
+		gathered.clear();
+		grid.GatherProbes(p, radius, gathered);
+		std::sort(gathered.begin(), gathered.end());
+		CHECK(std::adjacent_find(gathered.begin(), gathered.end()) == gathered.end());
+		for (uint32 probe = 0; probe < positions.size(); probe++)
+		{
+			if (Float3::Distance(p, positions[probe]) <= radius)
+				CHECK(std::binary_search(gathered.begin(), gathered.end(), probe));
+		}
+	}
+}
+
+// A Sponza sized hall, two floors of arcades around an open atrium with rows of solid columns:
+// grid against adaptive probe counts and placement time
+BENCHMARK(ProbePlacement_Hall)
+{
+	std::vector<Float3> vertices;
+	std::vector<Float3> normals;
+	std::vector<uint32> indices;
+	const Float3 hallMin(-30.0f, 0.0f, -13.0f);
+	const Float3 hallMax(30.0f, 25.0f, 13.0f);
+	addBox(hallMin, hallMax, true, vertices, normals, indices);
+	for (uint32 floor = 0; floor < 2; floor++)
+	{
+		const float floorY = floor * 8.0f;
+		addBox(Float3(-28.0f, floorY + 7.5f, -12.0f), Float3(28.0f, floorY + 8.0f, -6.0f), false, vertices, normals, indices);
+		addBox(Float3(-28.0f, floorY + 7.5f, 6.0f), Float3(28.0f, floorY + 8.0f, 12.0f), false, vertices, normals, indices);
+		for (int32 column = -6; column <= 6; column++)
+		{
+			const float x = column * 4.0f;
+			addBox(Float3(x - 0.5f, floorY, -6.5f), Float3(x + 0.5f, floorY + 7.5f, -5.5f), false, vertices, normals, indices);
+			addBox(Float3(x - 0.5f, floorY, 5.5f), Float3(x + 0.5f, floorY + 7.5f, 6.5f), false, vertices, normals, indices);
+		}
+	}
+	const BBox hallBounds = MakeBBox(hallMin, hallMax);
+	const uint32 numTriangles = (uint32)indices.size() / 3;
+
+	printf("%u triangles\n", numTriangles);
+
+	std::vector<Float3> positions;
+	for (float spacing = 2.0f; spacing >= 0.5f; spacing *= 0.5f)
+	{
+		ProbePlacement::PlaceGrid(hallBounds, spacing, positions);
+		uint32 numGridProbes = (uint32)positions.size();
+
+		ProbePlacement::Settings settings;
+		settings.unitsBetweenProbes = spacing;
+		settings.maxProbes = UINT_MAX;
+		ProbePlacement::Stats stats;
+
+		Tests::Stopwatch timer;
+		timer.Update();
+		ProbePlacement::PlaceAdaptive(hallBounds, &vertices[0], &normals[0], &indices[0], numTriangles, settings, positions, &stats);
+		timer.Update();
+
+		printf("spacing %f: grid %u probes, adaptive %u probes (%u inside geometry dropped, %u leaves) in %fms\n",
+			spacing, numGridProbes, (uint32)positions.size(), stats.numRejectedInside, stats.numLeaves, timer.getDeltaMs());
+	}
+}
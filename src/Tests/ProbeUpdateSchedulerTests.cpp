@@ -0,0 +1,207 @@
+#include "TestFramework.h"
+
+#include <ProbeUpdateScheduler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+static const uint32 NumProbes = 200;
+static const uint32 Budget = 16;
+
+// Probes scattered over a flat volume, all with the same radius, and the indirection grid the
+// scheduler gathers them from
+static void randomProbePositions(std::mt19937 &rng, uint32 numProbes, float extent, std::vector<Float3> &positions,
+	std::vector<float> &radii, ProbePlacement::IndirectionGrid &grid)
+{
+	std::uniform_real_distribution<float> posDist(-extent, extent);
+	positions.resize(numProbes);
+	radii.resize(numProbes);
+	for (uint32 i = 0; i < numProbes; i++)
+	{
+		positions[i] = Float3(posDist(rng), posDist(rng) * 0.25f, posDist(rng));
+		radii[i] = 2.0f;
+	}
+
+	const BBox bounds = MakeBBox(Float3(-extent, -extent * 0.25f, -extent), Float3(extent, extent * 0.25f, extent));
+	ProbePlacement::BuildIndirectionGrid(bounds, 2.0f, &positions[0], numProbes, grid);
+}
+
+static bool contains(const std::vector<uint32> &list, uint32 probe)
+{
+	return std::binary_search(list.begin(), list.end(), probe);
+}
+
+// Every probe in the first list, then exactly the budget, sorted and unique
+TEST_CASE(ProbeUpdateScheduler_FirstUpdateAndBudget)
+{
+	std::mt19937 rng(1337);
+	std::vector<Float3> positions;
+	std::vector<float> radii;
+	ProbePlacement::IndirectionGrid grid;
+	std::vector<uint32> list;
+	ProbeUpdateScheduler scheduler;
+
+	randomProbePositions(rng, NumProbes, 20.0f, positions, radii, grid);
+	scheduler.Reset(&positions[0], &radii[0], NumProbes, &grid, false);
+	CHECK(scheduler.Schedule(Float3(), Budget, list) == NumProbes);
+	for (uint32 frame = 0; frame < 64; frame++)
+	{
+		CHECK(scheduler.Schedule(Float3(), Budget, list) == Budget);
+		for (size_t i = 1; i < list.size(); i++)
+			CHECK(list[i - 1] < list[i]);
+	}
+
+	// probes from the cache start out with results, only the budget is updated
+	scheduler.Reset(&positions[0], &radii[0], NumProbes, &grid, true);
+	CHECK(scheduler.Schedule(Float3(), Budget, list) == Budget);
+}
+
+// With a fixed camera every probe comes back within a bounded number of frames, the distance
+// bonus only lets near probes cut in line
+TEST_CASE(ProbeUpdateScheduler_NoStarvation)
+{
+	std::mt19937 rng(1337);
+	std::vector<Float3> positions;
+	std::vector<float> radii;
+	ProbePlacement::IndirectionGrid grid;
+	std::vector<uint32> list;
+	std::vector<uint32> updateCounts(NumProbes, 0);
+	ProbeUpdateScheduler scheduler;
+
+	randomProbePositions(rng, NumProbes, 20.0f, positions, radii, grid);
+	scheduler.Reset(&positions[0], &radii[0], NumProbes, &grid, false);
+	scheduler.Schedule(Float3(), Budget, list);
+
+	const uint32 numFrames = 4 * NumProbes / Budget;
+	for (uint32 frame = 0; frame < numFrames; frame++)
+	{
+		scheduler.Schedule(Float3(), Budget, list);
+		for (size_t i = 0; i < list.size(); i++)
+			updateCounts[list[i]]++;
+	}
+	for (uint32 i = 0; i < NumProbes; i++)
+		CHECK(updateCounts[i] > 0);
+	CHECK(scheduler.getStats().maxStaleness <= numFrames);
+}
+
+// A light change reaches exactly the probes whose radius it overlaps on the next frame, even far
+// from the camera. Moved lights notify where they were and where they are, and invalidating
+// everything is worked through at the budget.
+TEST_CASE(ProbeUpdateScheduler_LightChanges)
+{
+	std::mt19937 rng(1337);
+	std::vector<Float3> positions;
+	std::vector<float> radii;
+	ProbePlacement::IndirectionGrid grid;
+	std::vector<uint32> list;
+	ProbeUpdateScheduler scheduler;
+	const Float3 farCamera(100.0f, 0.0f, 100.0f);
+
+	randomProbePositions(rng, NumProbes, 20.0f, positions, radii, grid);
+	scheduler.Reset(&positions[0], &radii[0], NumProbes, &grid, true);
+	scheduler.Schedule(farCamera, NumProbes, list);
+	CHECK(scheduler.getStats().numPending == 0);
+
+	const Float3 lightPos = positions[17] + Float3(0.5f, 0.0f, 0.0f);
+	const float lightRadius = 3.0f;
+	uint32 numReached = 0;
+	for (uint32 i = 0; i < NumProbes; i++)
+		numReached += Float3::Distance(lightPos, positions[i]) <= lightRadius + radii[i] ? 1 : 0;
+	scheduler.NotifyLightChanged(lightPos, lightRadius);
+	CHECK(scheduler.getStats().numProbes == NumProbes);
+
+	// a budget large enough for all of them, they outrank every probe that only got stale
+	scheduler.Schedule(farCamera, numReached, list);
+	for (uint32 i = 0; i < NumProbes; i++)
+		CHECK(contains(list, i) == (Float3::Distance(lightPos, positions[i]) <= lightRadius + radii[i]));
+	CHECK(scheduler.getStats().numPending == 0);
+
+	PointLight light;
+	light.cPos = positions[42];
+	light.cRadius = 0.5f;
+	light.cColor = Float3(1.0f, 1.0f, 1.0f);
+	light.padding = 0;
+	scheduler.UpdateLights(&light, 1);
+	scheduler.Schedule(farCamera, Budget, list);
+	CHECK(contains(list, 42));
+
+	light.cPos = positions[43];
+	scheduler.UpdateLights(&light, 1);
+	scheduler.Schedule(farCamera, Budget, list);
+	CHECK(contains(list, 42) && contains(list, 43));
+
+	// unchanged lights don't notify anything
+	scheduler.Schedule(farCamera, NumProbes, list);
+	scheduler.UpdateLights(&light, 1);
+	CHECK(scheduler.Schedule(farCamera, Budget, list) == Budget && scheduler.getStats().numPending == 0);
+
+	scheduler.InvalidateAll();
+	scheduler.Schedule(Float3(), Budget, list);
+	CHECK(scheduler.getStats().numPending == NumProbes - Budget);
+}
+
+// Same inputs, same lists
+TEST_CASE(ProbeUpdateScheduler_Determinism)
+{
+	std::mt19937 rng(1337);
+	std::vector<Float3> positions;
+	std::vector<float> radii;
+	ProbePlacement::IndirectionGrid grid;
+	std::vector<uint32> list;
+	std::vector<uint32> referenceList;
+	ProbeUpdateScheduler scheduler;
+	ProbeUpdateScheduler reference;
+
+	randomProbePositions(rng, NumProbes, 20.0f, positions, radii, grid);
+	scheduler.Reset(&positions[0], &radii[0], NumProbes, &grid, true);
+	reference.Reset(&positions[0], &radii[0], NumProbes, &grid, true);
+	for (uint32 frame = 0; frame < 32; frame++)
+	{
+		Float3 cameraPos(frame * 1.0f, 0.0f, 0.0f);
+		scheduler.Schedule(cameraPos, Budget, list);
+		reference.Schedule(cameraPos, Budget, referenceList);
+		CHECK(list == referenceList);
+	}
+}
+
+// Scheduling 512 to 16k probes at budgets of 16 to 256, camera circling the volume
+BENCHMARK(ProbeUpdateScheduler_Schedule)
+{
+	static const uint32 NumFrames = 256;
+
+	std::mt19937 rng(1337);
+	std::vector<Float3> positions;
+	std::vector<float> radii;
+	ProbePlacement::IndirectionGrid grid;
+	std::vector<uint32> list;
+	ProbeUpdateScheduler scheduler;
+
+	for (uint32 numProbes = 512; numProbes <= 16384; numProbes *= 4)
+	{
+		randomProbePositions(rng, numProbes, 40.0f, positions, radii, grid);
+
+		for (uint32 budget = 16; budget <= 256; budget *= 4)
+		{
+			scheduler.Reset(&positions[0], &radii[0], numProbes, &grid, true);
+
+			uint32 maxStaleness = 0;
+			double meanStaleness = 0.0;
+
+			Tests::Stopwatch timer;
+			timer.Update();
+			for (uint32 frame = 0; frame < NumFrames; frame++)
+			{
+				float angle = frame * (2.0f * Pi / NumFrames);
+				scheduler.Schedule(Float3(std::cos(angle) * 30.0f, 2.0f, std::sin(angle) * 30.0f), budget, list);
+				maxStaleness = Max(maxStaleness, scheduler.getStats().maxStaleness);
+				meanStaleness += scheduler.getStats().meanStaleness;
+			}
+			timer.Update();
+
+			printf("%u probes, budget %u: %fms per frame, staleness max %u mean %f frames\n", numProbes, budget,
+				timer.getDeltaMs() / NumFrames, maxStaleness, meanStaleness / NumFrames);
+		}
+	}
+}
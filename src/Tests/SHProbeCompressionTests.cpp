@@ -0,0 +1,195 @@
+#include "TestFramework.h"
+
+#include <SHProbeCompression.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+static const float SNormMax = 127.0f;
+
+static float channel(const Float4 &v, uint32 c)
+{
+	return (&v.x)[c];
+}
+
+// The SH9 basis in the framework's coefficient order (ProjectOntoSH9)
+static void projectOntoSH9(const Float3 &dir, float basis[9])
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * dir.y;
+	basis[2] = 0.488603f * dir.z;
+	basis[3] = 0.488603f * dir.x;
+	basis[4] = 1.092548f * dir.x * dir.y;
+	basis[5] = 1.092548f * dir.y * dir.z;
+	basis[6] = 0.315392f * (3.0f * dir.z * dir.z - 1.0f);
+	basis[7] = 1.092548f * dir.x * dir.z;
+	basis[8] = 0.546274f * (dir.x * dir.x - dir.y * dir.y);
+}
+
+// A few strong lights over a dim environment, convolved with the cosine kernel like the
+// integration in RelightSH.hlsl. Sometimes a channel is black, e.g. a pure red room.
+static void randomProbeSH(std::mt19937 &rng, PaddedSH9Color &sh)
+{
+	static const float Kernel[9] = { 3.141593f, 2.095395f, 2.095395f, 2.095395f, 0.785398f, 0.785398f, 0.785398f, 0.785398f, 0.785398f };
+
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+
+	auto randomDirection = [&]() -> Float3
+	{
+		Float3 dir;
+		do
+		{
+			dir = Float3(signedUnit(rng), signedUnit(rng), signedUnit(rng));
+		} while (Float3::Length(dir) < 0.01f || Float3::Length(dir) > 1.0f);
+		return Float3::Normalize(dir);
+	};
+
+	float channelMask[3] = { 1.0f, 1.0f, 1.0f };
+	if (rng() % 8 == 0) channelMask[rng() % 3] = 0.0f;
+
+	Float3 radiance[9];
+	const uint32 numStrong = 1 + rng() % 4;
+	const float brightness = std::pow(10.0f, signedUnit(rng) * 2.0f);
+	for (uint32 i = 0; i < 32; i++)
+	{
+		float intensity = (i < numStrong ? 4.0f : 0.1f) * brightness;
+		Float3 color = Float3(unit(rng) * channelMask[0], unit(rng) * channelMask[1], unit(rng) * channelMask[2]) * intensity;
+		float basis[9];
+		projectOntoSH9(randomDirection(), basis);
+		for (uint32 b = 0; b < 9; b++)
+			radiance[b] += color * basis[b];
+	}
+
+	for (uint32 i = 0; i < 9; i++)
+		sh.sh9[i] = Float4(radiance[i] * Kernel[i], 0.0f);
+}
+
+// The stand-in conversions round like DirectXMath: exact for halves, to nearest even between
+// them, denormals, infinity and zero kept
+TEST_CASE(SHProbeCompression_HalfConversion)
+{
+	CHECK(XMConvertFloatToHalf(1.0f) == 0x3C00);
+	CHECK(XMConvertFloatToHalf(-2.0f) == 0xC000);
+	CHECK(XMConvertFloatToHalf(65504.0f) == 0x7BFF);
+	CHECK(XMConvertFloatToHalf(1e6f) == 0x7C00);
+	CHECK(XMConvertFloatToHalf(0.0f) == 0);
+	CHECK(XMConvertFloatToHalf(1.0f + 1.0f / 2048.0f) == 0x3C00);
+	CHECK(XMConvertFloatToHalf(1.0f + 3.0f / 2048.0f) == 0x3C02);
+	CHECK(XMConvertHalfToFloat(0x0001) == std::ldexp(1.0f, -24));
+	CHECK(XMConvertHalfToFloat(0x7C00) == INFINITY);
+
+	for (uint32 bits = 0; bits < 0x7C00; bits++)
+	{
+		CHECK(XMConvertFloatToHalf(XMConvertHalfToFloat(uint16(bits))) == bits);
+		CHECK(XMConvertFloatToHalf(-XMConvertHalfToFloat(uint16(bits))) == (bits | 0x8000));
+	}
+}
+
+// Every coefficient within half a quantization step of its probe's scale, the DC within FP16
+// rounding
+TEST_CASE(SHProbeCompression_QuantizationBounds)
+{
+	std::mt19937 rng(1337);
+	std::vector<PaddedSH9Color> probes(2048);
+	for (size_t p = 0; p < probes.size(); p++)
+		randomProbeSH(rng, probes[p]);
+
+	for (size_t p = 0; p < probes.size(); p++)
+	{
+		CompressedSH9Color packed;
+		PaddedSH9Color decoded;
+		SHProbeCompression::Encode(probes[p], packed);
+		SHProbeCompression::Decode(packed, decoded);
+
+		const float scale = XMConvertHalfToFloat(uint16(packed.dcBScale >> 16));
+		for (uint32 c = 0; c < 3; c++)
+		{
+			float dc = channel(probes[p].sh9[0], c);
+			CHECK(std::abs(channel(decoded.sh9[0], c) - dc) <= std::abs(dc) * (1.0f / 2048.0f));
+
+			float step = scale * std::abs(channel(decoded.sh9[0], c)) / (2.0f * SNormMax);
+			for (uint32 i = 1; i < 9; i++)
+				CHECK(std::abs(channel(decoded.sh9[i], c) - channel(probes[p].sh9[i], c)) <= step * 1.001f + 1e-7f);
+		}
+	}
+
+	// irradiance through the shading path stays within a few percent of the probe's mean
+	SHProbeCompression::ErrorStats stats = SHProbeCompression::MeasureError(&probes[0], (uint32)probes.size());
+	CHECK(stats.maxIrradianceError < 0.03f && stats.meanIrradianceError < 0.005f);
+}
+
+// Black decodes to black, a DC only probe has no higher bands, and the array versions match
+TEST_CASE(SHProbeCompression_ExactCases)
+{
+	PaddedSH9Color black;
+	CompressedSH9Color packed;
+	PaddedSH9Color decoded;
+	SHProbeCompression::Encode(black, packed);
+	SHProbeCompression::Decode(packed, decoded);
+	CHECK(memcmp(&black, &decoded, sizeof(black)) == 0);
+
+	PaddedSH9Color uniform = black;
+	uniform.sh9[0] = Float4(0.5f, 0.25f, 2.0f, 0.0f);
+	SHProbeCompression::Encode(uniform, packed);
+	SHProbeCompression::Decode(packed, decoded);
+	CHECK(memcmp(&uniform, &decoded, sizeof(uniform)) == 0);
+
+	std::mt19937 rng(7);
+	std::vector<PaddedSH9Color> probes(64);
+	std::vector<CompressedSH9Color> packedArray(probes.size());
+	std::vector<PaddedSH9Color> decodedArray(probes.size());
+	for (size_t p = 0; p < probes.size(); p++)
+		randomProbeSH(rng, probes[p]);
+	SHProbeCompression::EncodeArray(&probes[0], (uint32)probes.size(), &packedArray[0]);
+	SHProbeCompression::DecodeArray(&packedArray[0], (uint32)probes.size(), &decodedArray[0]);
+	for (size_t p = 0; p < probes.size(); p++)
+	{
+		SHProbeCompression::Encode(probes[p], packed);
+		SHProbeCompression::Decode(packed, decoded);
+		CHECK(memcmp(&packed, &packedArray[p], sizeof(packed)) == 0);
+		CHECK(memcmp(&decoded, &decodedArray[p], sizeof(decoded)) == 0);
+	}
+}
+
+// Encoding and decoding 512 to 32k probes, with the error against the float SH
+BENCHMARK(SHProbeCompression_EncodeDecode)
+{
+	static const uint32 NumIterations = 16;
+
+	std::mt19937 rng(1337);
+	std::vector<PaddedSH9Color> probes;
+	std::vector<PaddedSH9Color> decoded;
+	std::vector<CompressedSH9Color> packed;
+
+	for (uint32 numProbes = 512; numProbes <= 32768; numProbes *= 8)
+	{
+		probes.resize(numProbes);
+		decoded.resize(numProbes);
+		packed.resize(numProbes);
+		for (uint32 i = 0; i < numProbes; i++)
+			randomProbeSH(rng, probes[i]);
+
+		Tests::Stopwatch timer;
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+			SHProbeCompression::EncodeArray(&probes[0], numProbes, &packed[0]);
+		timer.Update();
+		double encodeMs = timer.getDeltaMs() / NumIterations;
+
+		timer.Update();
+		for (uint32 iter = 0; iter < NumIterations; iter++)
+			SHProbeCompression::DecodeArray(&packed[0], numProbes, &decoded[0]);
+		timer.Update();
+		double decodeMs = timer.getDeltaMs() / NumIterations;
+
+		SHProbeCompression::ErrorStats stats = SHProbeCompression::MeasureError(&probes[0], numProbes);
+
+		printf("%u probes: %uKB -> %uKB, encode %fms, decode %fms, coefficient error max %f%% mean %f%%, "
+			"irradiance error max %f%% mean %f%%\n", numProbes, uint32(sizeof(PaddedSH9Color) * numProbes / 1024),
+			uint32(sizeof(CompressedSH9Color) * numProbes / 1024), encodeMs, decodeMs, stats.maxCoefficientError * 100.0f,
+			stats.meanCoefficientError * 100.0f, stats.maxIrradianceError * 100.0f, stats.meanIrradianceError * 100.0f);
+	}
+}
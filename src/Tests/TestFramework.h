@@ -0,0 +1,66 @@
+#pragma once
+#include <CPUTypes.h>
+
+#include <chrono>
+#include <vector>
+
+// Tests and benchmarks of the device-free modules. TEST_CASE and BENCHMARK register a function
+// under a name, CHECK reports a failed expression with its location and carries on. The runner
+// (TestMain.cpp) runs every test whose name starts with its argument and returns non-zero when
+// a check failed; benchmarks only run with --benchmark and print their timings.
+namespace Tests
+{
+	typedef void (*TestFunction)();
+
+	struct Registration
+	{
+		const char *name;
+		TestFunction function;
+		bool benchmark;
+	};
+
+	std::vector<Registration> &getRegistry();
+
+	struct Registrar
+	{
+		Registrar(const char *name, TestFunction function, bool benchmark)
+		{
+			Registration registration = { name, function, benchmark };
+			getRegistry().push_back(registration);
+		}
+	};
+
+	void ReportFailure(const char *file, int line, const char *expression);
+
+	// Milliseconds between Update() calls
+	class Stopwatch
+	{
+	public:
+		Stopwatch() : _last(std::chrono::high_resolution_clock::now()), _deltaMs(0.0) {}
+
+		void Update()
+		{
+			std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+			_deltaMs = std::chrono::duration<double, std::milli>(now - _last).count();
+			_last = now;
+		}
+
+		inline double getDeltaMs() const { return _deltaMs; }
+
+	private:
+		std::chrono::high_resolution_clock::time_point _last;
+		double _deltaMs;
+	};
+}
+
+#define TEST_CASE(name) \
+	static void name(); \
+	static Tests::Registrar name##Registrar(#name, name, false); \
+	static void name()
+
+#define BENCHMARK(name) \
+	static void name(); \
+	static Tests::Registrar name##Registrar(#name, name, true); \
+	static void name()
+
+#define CHECK(expression) ((expression) ? (void)0 : Tests::ReportFailure(__FILE__, __LINE__, #expression))
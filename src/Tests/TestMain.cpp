@@ -0,0 +1,67 @@
+#include "TestFramework.h"
+
+#include <cstdio>
+#include <cstring>
+
+static uint32 numFailures = 0;
+
+std::vector<Tests::Registration> &Tests::getRegistry()
+{
+	static std::vector<Registration> registry;
+	return registry;
+}
+
+void Tests::ReportFailure(const char *file, int line, const char *expression)
+{
+	printf("%s(%d): CHECK(%s) failed\n", file, line, expression);
+	numFailures++;
+}
+
+// Realtime_GI_Tests [--benchmark] [name prefix]
+int main(int argc, char **argv)
+{
+	bool benchmark = false;
+	const char *prefix = "";
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--benchmark") == 0)
+			benchmark = true;
+		else
+			prefix = argv[i];
+	}
+
+	uint32 numRun = 0;
+	uint32 numFailed = 0;
+	const std::vector<Tests::Registration> &registry = Tests::getRegistry();
+	for (size_t i = 0; i < registry.size(); i++)
+	{
+		if (registry[i].benchmark != benchmark || strncmp(registry[i].name, prefix, strlen(prefix)) != 0)
+			continue;
+
+		printf("[ RUN  ] %s\n", registry[i].name);
+		fflush(stdout);
+
+		uint32 failuresBefore = numFailures;
+		registry[i].function();
+		numRun++;
+
+		if (numFailures != failuresBefore)
+		{
+			numFailed++;
+			printf("[ FAIL ] %s\n", registry[i].name);
+		}
+		else
+		{
+			printf("[  OK  ] %s\n", registry[i].name);
+		}
+	}
+
+	if (numRun == 0)
+	{
+		printf("No %s matches \"%s\"\n", benchmark ? "benchmark" : "test", prefix);
+		return 1;
+	}
+
+	printf("%u of %u passed\n", numRun - numFailed, numRun);
+	return numFailed == 0 ? 0 : 1;
+}
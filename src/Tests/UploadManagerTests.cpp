@@ -0,0 +1,185 @@
+#include "TestFramework.h"
+
+#include <UploadManager.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Compares the rebuilt contents of every buffer with the sources, a shrunk buffer leaves a tail behind
+static bool contentsMatch(const RecordingUploadBackend &backend, const std::vector<std::vector<uint8>> &sources)
+{
+	for (uint32 b = 0; b < (uint32)sources.size(); b++)
+	{
+		const std::vector<uint8> &contents = backend.getContents(b);
+		if (contents.size() < sources[b].size()) return false;
+		if (!sources[b].empty() && memcmp(&contents[0], &sources[b][0], sources[b].size()) != 0) return false;
+	}
+	return true;
+}
+
+// Sparse random changes, sometimes none, sometimes a resize, rebuilt through the recording backend
+TEST_CASE(UploadManager_SparseUpdates)
+{
+	std::mt19937 rng(1337);
+
+	RecordingUploadBackend backend;
+	UploadManager manager;
+	manager.Initialize(&backend, 64);
+
+	static const uint32 Granularity[3] = { 32, 4, 256 };
+	std::vector<std::vector<uint8>> sources(3);
+	for (uint32 b = 0; b < 3; b++)
+	{
+		sources[b].assign(Granularity[b] * (64 + rng() % 64), 0);
+		manager.AddBuffer((uint32)sources[b].size(), Granularity[b]);
+	}
+
+	for (uint32 frame = 0; frame < 256; frame++)
+	{
+		backend.ClearUploads();
+		uint64 expectedWritten = 0;
+
+		for (uint32 b = 0; b < 3; b++)
+		{
+			std::vector<uint8> &source = sources[b];
+			if (rng() % 32 == 0)
+			{
+				source.resize(Granularity[b] * (32 + rng() % 128), uint8(rng()));
+				manager.ResizeBuffer(b, (uint32)source.size());
+			}
+
+			const uint32 numChanges = rng() % 4 == 0 ? 0 : rng() % 16;
+			for (uint32 i = 0; i < numChanges; i++)
+				source[rng() % source.size()] ^= uint8(1 + rng() % 255);
+
+			manager.Write(b, 0, &source[0], (uint32)source.size());
+			expectedWritten += source.size();
+		}
+		manager.Flush();
+
+		CHECK(contentsMatch(backend, sources));
+		CHECK(manager.getFrameStats().bytesWritten == expectedWritten);
+
+		// Uploads are whole granularity blocks, don't overlap and are no more than the dirty bytes plus merged gaps
+		const std::vector<RecordingUploadBackend::Upload> &uploads = backend.getUploads();
+		CHECK(uploads.size() == manager.getFrameStats().numUploads);
+		for (size_t i = 0; i < uploads.size(); i++)
+		{
+			const uint32 granularity = Granularity[uploads[i].buffer];
+			CHECK(uploads[i].offset % granularity == 0 && uploads[i].size % granularity == 0);
+			CHECK(i == 0 || uploads[i].buffer != uploads[i - 1].buffer
+				|| uploads[i].offset > uploads[i - 1].offset + uploads[i - 1].size + 64);
+		}
+	}
+
+	// Nothing changed, nothing uploaded
+	backend.ClearUploads();
+	for (uint32 b = 0; b < 3; b++)
+		manager.Write(b, 0, &sources[b][0], (uint32)sources[b].size());
+	manager.Flush();
+	CHECK(backend.getUploads().empty());
+	CHECK(manager.getFrameStats().bytesUploaded == 0);
+}
+
+// Two changes closer than the merge gap go up as one range, farther apart as two
+TEST_CASE(UploadManager_MergeGap)
+{
+	RecordingUploadBackend backend;
+	UploadManager manager;
+	manager.Initialize(&backend, 64);
+
+	std::vector<uint8> source(1024, 0);
+	uint32 buffer = manager.AddBuffer((uint32)source.size(), 16);
+	manager.Flush();
+
+	source[0] = 1;
+	source[16 + 64] = 1;
+	backend.ClearUploads();
+	manager.Write(buffer, 0, &source[0], (uint32)source.size());
+	manager.Flush();
+	CHECK(backend.getUploads().size() == 1);
+	CHECK(backend.getUploads().size() == 1 && backend.getUploads()[0].size == 96);
+
+	source[512] = 2;
+	source[512 + 16 + 80] = 2;
+	backend.ClearUploads();
+	manager.Write(buffer, 0, &source[0], (uint32)source.size());
+	manager.Flush();
+	CHECK(backend.getUploads().size() == 2);
+	CHECK(manager.getFrameStats().bytesUploaded == 32);
+
+	// partial writes only look at their own range
+	uint8 value = 3;
+	backend.ClearUploads();
+	manager.Write(buffer, 256, &value, 1);
+	manager.Flush();
+	CHECK(backend.getUploads().size() == 1);
+	CHECK(backend.getUploads().size() == 1 && backend.getUploads()[0].offset == 256 && backend.getUploads()[0].size == 1);
+	CHECK(manager.getFrameStats().bytesWritten == 1);
+}
+
+// Bytes and time per frame of partial uploads against copying everything, for 1k to 100k lights
+BENCHMARK(UploadManager_Lights)
+{
+	static const uint32 NumFrames = 64;
+	static const uint32 LightSize = 32;
+
+	std::mt19937 rng(1337);
+	std::vector<uint8> lights;
+	std::vector<uint8> mapped;
+
+	for (uint32 numLights = 1000; numLights <= 100000; numLights *= 10)
+	{
+		for (uint32 movingPercent = 1; movingPercent <= 100; movingPercent *= 10)
+		{
+			lights.assign(numLights * LightSize, 0);
+			mapped.resize(lights.size());
+
+			RecordingUploadBackend backend;
+			UploadManager manager;
+			manager.Initialize(&backend);
+			uint32 buffer = manager.AddBuffer((uint32)lights.size(), LightSize);
+			manager.Flush();
+
+			uint64 bytesUploaded = 0;
+			uint32 numUploads = 0;
+			double fullMs = 0.0;
+			double partialMs = 0.0;
+			Tests::Stopwatch timer;
+
+			for (uint32 frame = 0; frame < NumFrames; frame++)
+			{
+				// the moving lights are scattered, like lights animated by different scripts
+				const uint32 numMoving = std::max(numLights * movingPercent / 100, 1u);
+				for (uint32 i = 0; i < numMoving; i++)
+				{
+					uint32 light = movingPercent == 100 ? i : rng() % numLights;
+					float *position = reinterpret_cast<float *>(&lights[light * LightSize]);
+					position[0] += 0.01f;
+				}
+
+				// what a WRITE_DISCARD map + memcpy of everything costs on the CPU side
+				timer.Update();
+				memcpy(&mapped[0], &lights[0], lights.size());
+				timer.Update();
+				fullMs += timer.getDeltaMs();
+
+				backend.ClearUploads();
+				timer.Update();
+				manager.Write(buffer, 0, &lights[0], (uint32)lights.size());
+				manager.Flush();
+				timer.Update();
+				partialMs += timer.getDeltaMs();
+
+				bytesUploaded += manager.getFrameStats().bytesUploaded;
+				numUploads += manager.getFrameStats().numUploads;
+			}
+
+			printf("%u lights, %u%% moving: full %uKB %fms, partial %lluKB in %u ranges %fms per frame\n",
+				numLights, movingPercent, (uint32)(lights.size() / 1024), fullMs / NumFrames,
+				(unsigned long long)(bytesUploaded / NumFrames / 1024), numUploads / NumFrames, partialMs / NumFrames);
+		}
+	}
+}
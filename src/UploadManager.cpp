@@ -0,0 +1,155 @@
+#include "UploadManager.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+void RecordingUploadBackend::UploadRange(uint32 buffer, uint32 offset, const void *data, uint32 size)
+{
+	Upload upload = { buffer, offset, size };
+	_uploads.push_back(upload);
+
+	if (buffer >= _contents.size())
+		_contents.resize(buffer + 1);
+	std::vector<uint8> &contents = _contents[buffer];
+	if (offset + size > contents.size())
+		contents.resize(offset + size);
+	memcpy(&contents[offset], data, size);
+}
+
+const std::vector<uint8> &RecordingUploadBackend::getContents(uint32 buffer) const
+{
+	static const std::vector<uint8> empty;
+	return buffer < _contents.size() ? _contents[buffer] : empty;
+}
+
+UploadManager::UploadManager() : _backend(nullptr), _mergeGap(DefaultMergeGap)
+{
+	memset(&_pendingStats, 0, sizeof(_pendingStats));
+	memset(&_frameStats, 0, sizeof(_frameStats));
+}
+
+void UploadManager::Initialize(UploadBackend *backend, uint32 mergeGap)
+{
+	_backend = backend;
+	_mergeGap = mergeGap;
+	_buffers.clear();
+
+	memset(&_pendingStats, 0, sizeof(_pendingStats));
+	memset(&_frameStats, 0, sizeof(_frameStats));
+}
+
+uint32 UploadManager::AddBuffer(uint32 size, uint32 granularity)
+{
+	assert(granularity > 0);
+
+	BufferState state;
+	state.granularity = granularity;
+	_buffers.push_back(state);
+
+	uint32 buffer = (uint32)_buffers.size() - 1;
+	ResizeBuffer(buffer, size);
+	return buffer;
+}
+
+void UploadManager::ResizeBuffer(uint32 buffer, uint32 size)
+{
+	_buffers[buffer].contents.resize(size, 0);
+	Invalidate(buffer);
+}
+
+void UploadManager::Invalidate(uint32 buffer)
+{
+	BufferState &state = _buffers[buffer];
+	state.dirty.clear();
+	addDirtyRange(state, 0, (uint32)state.contents.size());
+	_pendingStats.bytesDirty += state.contents.size();
+}
+
+void UploadManager::addDirtyRange(BufferState &state, uint32 begin, uint32 end)
+{
+	if (begin >= end) return;
+
+	// writes usually walk forward, extend the last range instead of adding one
+	if (!state.dirty.empty() && state.dirty.back().end >= begin && state.dirty.back().begin <= begin)
+	{
+		state.dirty.back().end = std::max(state.dirty.back().end, end);
+		return;
+	}
+
+	Range range = { begin, end };
+	state.dirty.push_back(range);
+}
+
+void UploadManager::Write(uint32 buffer, uint32 offset, const void *data, uint32 size)
+{
+	BufferState &state = _buffers[buffer];
+	assert(offset % state.granularity == 0 && offset + size <= state.contents.size());
+
+	_pendingStats.bytesWritten += size;
+
+	const uint8 *src = reinterpret_cast<const uint8 *>(data) - offset;
+	uint8 *contents = state.contents.empty() ? nullptr : &state.contents[0];
+	const uint32 end = offset + size;
+	const uint32 granularity = state.granularity;
+
+	uint32 pos = offset;
+	while (pos < end)
+	{
+		uint32 blockEnd = std::min(pos + granularity, end);
+		if (memcmp(contents + pos, src + pos, blockEnd - pos) == 0)
+		{
+			pos = blockEnd;
+			continue;
+		}
+
+		// run of changed blocks
+		uint32 runBegin = pos;
+		do
+		{
+			memcpy(contents + pos, src + pos, blockEnd - pos);
+			pos = blockEnd;
+			blockEnd = std::min(pos + granularity, end);
+		} while (pos < end && memcmp(contents + pos, src + pos, blockEnd - pos) != 0);
+
+		addDirtyRange(state, runBegin, pos);
+		_pendingStats.bytesDirty += pos - runBegin;
+	}
+}
+
+void UploadManager::Flush()
+{
+	for (uint32 b = 0; b < (uint32)_buffers.size(); b++)
+	{
+		BufferState &state = _buffers[b];
+		if (state.dirty.empty()) continue;
+
+		_pendingStats.numDirtyRanges += (uint32)state.dirty.size();
+
+		// Sort, then merge overlapping ranges and ranges separated by less than the merge gap
+		std::sort(state.dirty.begin(), state.dirty.end(), [](const Range &a, const Range &b) { return a.begin < b.begin; });
+		_merged.clear();
+		_merged.push_back(state.dirty[0]);
+		for (size_t i = 1; i < state.dirty.size(); i++)
+		{
+			Range &last = _merged.back();
+			if (state.dirty[i].begin <= last.end + _mergeGap)
+				last.end = std::max(last.end, state.dirty[i].end);
+			else
+				_merged.push_back(state.dirty[i]);
+		}
+		state.dirty.clear();
+
+		for (size_t i = 0; i < _merged.size(); i++)
+		{
+			const uint32 size = _merged[i].end - _merged[i].begin;
+			_backend->UploadRange(b, _merged[i].begin, &state.contents[_merged[i].begin], size);
+
+			_pendingStats.bytesUploaded += size;
+			_pendingStats.numUploads++;
+		}
+	}
+
+	_frameStats = _pendingStats;
+	memset(&_pendingStats, 0, sizeof(_pendingStats));
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include "CPUTypes.h"
+
+// Receives the coalesced ranges of UploadManager::Flush(). data points into the manager's CPU copy
+// of the buffer and is only guaranteed until the next Write() or ResizeBuffer(); the backends here
+// copy it right away. One that records for later, e.g. into D3D12 upload heaps, stages it itself.
+class UploadBackend
+{
+public:
+	virtual ~UploadBackend() {}
+	virtual void UploadRange(uint32 buffer, uint32 offset, const void *data, uint32 size) = 0;
+};
+
+// Rebuilds every buffer from the upload stream and records the stream itself. No device, so the
+// diffing and coalescing can be checked and timed anywhere.
+class RecordingUploadBackend : public UploadBackend
+{
+public:
+	struct Upload
+	{
+		uint32 buffer;
+		uint32 offset;
+		uint32 size;
+	};
+
+	virtual void UploadRange(uint32 buffer, uint32 offset, const void *data, uint32 size) override;
+
+	// Forgets the recorded stream, the rebuilt contents stay
+	void ClearUploads() { _uploads.clear(); }
+
+	inline const std::vector<Upload> &getUploads() const { return _uploads; }
+	const std::vector<uint8> &getContents(uint32 buffer) const;
+
+private:
+	std::vector<Upload> _uploads;
+	std::vector<std::vector<uint8>> _contents;
+};
+
+// Partial uploads for buffers that are rewritten every frame but mostly unchanged. Write() diffs
+// the new contents against a CPU copy of what was last uploaded, at the buffer's granularity, and
+// keeps the changed spans; Flush() sorts and merges them per buffer (spans closer than the merge
+// gap go as one) and hands them to the backend straight from the CPU copy, so nothing is copied
+// twice on the way.
+class UploadManager
+{
+public:
+	static const uint32 DefaultMergeGap = 256;
+
+	// Counters of the last Flush()
+	struct FrameStats
+	{
+		uint64 bytesWritten;        // passed to Write()
+		uint64 bytesDirty;          // different from the last upload
+		uint64 bytesUploaded;       // sent to the backend, dirty bytes plus merged gaps
+		uint32 numDirtyRanges;
+		uint32 numUploads;
+	};
+
+	UploadManager();
+
+	void Initialize(UploadBackend *backend, uint32 mergeGap = DefaultMergeGap);
+
+	// granularity is the unit compared and uploaded, e.g. one element or one texture row. The
+	// whole buffer goes up with the next Flush().
+	uint32 AddBuffer(uint32 size, uint32 granularity);
+
+	// For a recreated GPU resource: new size, and everything is sent again
+	void ResizeBuffer(uint32 buffer, uint32 size);
+	void Invalidate(uint32 buffer);
+
+	// offset has to be a multiple of the buffer's granularity
+	void Write(uint32 buffer, uint32 offset, const void *data, uint32 size);
+
+	void Flush();
+
+	inline const FrameStats &getFrameStats() const { return _frameStats; }
+	inline uint32 getBufferSize(uint32 buffer) const { return (uint32)_buffers[buffer].contents.size(); }
+
+private:
+	struct Range
+	{
+		uint32 begin;
+		uint32 end;
+	};
+
+	struct BufferState
+	{
+		std::vector<uint8> contents;    // as of the last Write(), what the GPU has after Flush()
+		std::vector<Range> dirty;
+		uint32 granularity;
+	};
+
+	void addDirtyRange(BufferState &state, uint32 begin, uint32 end);
+
+	UploadBackend *_backend;
+	uint32 _mergeGap;
+	std::vector<BufferState> _buffers;
+	std::vector<Range> _merged;
+
+	FrameStats _pendingStats;
+	FrameStats _frameStats;
+};